@@ -28,6 +28,7 @@
 #include "rapidjson_wrapper.hpp"
 #include "thread_group.hpp"
 #include "utils/image_utils.hpp"
+#include "cpu_trace.hpp"
 //#include "ocean.hpp"
 #include <float.h>
 #include <stdexcept>
@@ -147,6 +148,8 @@ void SceneViewerApplication::read_config(const std::string &path)
 		config.show_ui = doc["showUi"].GetBool();
 	if (doc.HasMember("forwardDepthPrepass"))
 		config.forward_depth_prepass = doc["forwardDepthPrepass"].GetBool();
+	if (doc.HasMember("occlusionCulling"))
+		config.occlusion_culling = doc["occlusionCulling"].GetBool();
 	if (doc.HasMember("deferredClusteredStencilCulling"))
 		config.deferred_clustered_stencil_culling = doc["deferredClusteredStencilCulling"].GetBool();
 
@@ -596,7 +599,14 @@ void SceneViewerApplication::render_main_pass(CommandBuffer &cmd, const mat4 &pr
 	auto &scene = scene_loader.get_scene();
 	context.set_camera(jitter.get_jitter_matrix() * proj, view);
 	visible.clear();
-	scene.gather_visible_opaque_renderables(context.get_visibility_frustum(), visible);
+
+	if (config.occlusion_culling)
+	{
+		scene.rasterize_occluders(occlusion_culler, context, Global::thread_group());
+		scene.gather_visible_opaque_renderables(context.get_visibility_frustum(), visible, &occlusion_culler);
+	}
+	else
+		scene.gather_visible_opaque_renderables(context.get_visibility_frustum(), visible);
 	scene.gather_visible_render_pass_sinks(context.get_render_parameters().camera_position, visible);
 
 	if (config.renderer_type == RendererType::GeneralForward)
@@ -882,6 +892,9 @@ void SceneViewerApplication::add_shadow_pass(Device &, const std::string &tag, D
 		up_pass.set_need_render_pass(
 		    [this, type]() { return type == DepthPassType::Main ? need_shadow_map_update : true; });
 
+		down_pass.set_parallel_recording(true);
+		up_pass.set_parallel_recording(true);
+
 		down_pass.set_build_render_pass([&](CommandBuffer &cmd) {
 			auto &input = graph.get_physical_texture_resource(down_pass_res);
 			vec2 inv_size(1.0f / input.get_image().get_create_info().width,
@@ -907,6 +920,9 @@ void SceneViewerApplication::add_shadow_pass(Device &, const std::string &tag, D
 		shadowpass.set_depth_stencil_output(tagcat("shadow", tag), shadowmap);
 	}
 
+	// The cascades only touch their own ShadowCascade and the lighting transform they own,
+	// which nothing reads until the lighting pass, so they can be recorded concurrently.
+	shadowpass.set_parallel_recording(true);
 	shadowpass.set_build_render_pass([this, type](CommandBuffer &cmd) {
 		if (type == DepthPassType::Main)
 			render_shadow_map_far(cmd);
@@ -1036,7 +1052,8 @@ void SceneViewerApplication::update_shadow_scene_aabb()
 void SceneViewerApplication::update_shadow_map()
 {
 	auto &scene = scene_loader.get_scene();
-	depth_visible.clear();
+	auto &cascade = far_cascade;
+	cascade.visible.clear();
 
 	mat4 view = mat4_cast(look_at(-selected_directional->direction, vec3(0.0f, 1.0f, 0.0f)));
 
@@ -1046,24 +1063,25 @@ void SceneViewerApplication::update_shadow_map()
 
 	// Standard scale/bias.
 	lighting.shadow.far_transform = translate(vec3(0.5f, 0.5f, 0.0f)) * scale(vec3(0.5f, 0.5f, 1.0f)) * proj * view;
-	depth_context.set_camera(proj, view);
+	cascade.context.set_camera(proj, view);
 
-	depth_renderer.set_mesh_renderer_options(config.directional_light_shadows_vsm ? Renderer::SHADOW_VSM_BIT : 0);
-	depth_renderer.begin();
-	scene.gather_visible_static_shadow_renderables(depth_context.get_visibility_frustum(), depth_visible);
-	depth_renderer.push_depth_renderables(depth_context, depth_visible);
+	cascade.renderer.set_mesh_renderer_options(config.directional_light_shadows_vsm ? Renderer::SHADOW_VSM_BIT : 0);
+	cascade.renderer.begin();
+	scene.gather_visible_static_shadow_renderables(cascade.context.get_visibility_frustum(), cascade.visible);
+	cascade.renderer.push_depth_renderables(cascade.context, cascade.visible);
 }
 
 void SceneViewerApplication::render_shadow_map_far(CommandBuffer &cmd)
 {
 	update_shadow_map();
-	depth_renderer.flush(cmd, depth_context, Renderer::DEPTH_BIAS_BIT);
+	far_cascade.renderer.flush(cmd, far_cascade.context, Renderer::DEPTH_BIAS_BIT);
 }
 
 void SceneViewerApplication::render_shadow_map_near(CommandBuffer &cmd)
 {
 	auto &scene = scene_loader.get_scene();
-	depth_visible.clear();
+	auto &cascade = near_cascade;
+	cascade.visible.clear();
 	mat4 view = mat4_cast(look_at(-selected_directional->direction, vec3(0.0f, 1.0f, 0.0f)));
 	AABB ortho_range_depth = shadow_scene_aabb.transform(view); // Just need this to determine Zmin/Zmax.
 
@@ -1084,16 +1102,17 @@ void SceneViewerApplication::render_shadow_map_near(CommandBuffer &cmd)
 
 	mat4 proj = ortho(ortho_range);
 	lighting.shadow.near_transform = translate(vec3(0.5f, 0.5f, 0.0f)) * scale(vec3(0.5f, 0.5f, 1.0f)) * proj * view;
-	depth_context.set_camera(proj, view);
-	depth_renderer.set_mesh_renderer_options(config.directional_light_shadows_vsm ? Renderer::SHADOW_VSM_BIT : 0);
-	depth_renderer.begin();
-	scene.gather_visible_dynamic_shadow_renderables(depth_context.get_visibility_frustum(), depth_visible);
-	depth_renderer.push_depth_renderables(depth_context, depth_visible);
-	depth_renderer.flush(cmd, depth_context, Renderer::DEPTH_BIAS_BIT);
+	cascade.context.set_camera(proj, view);
+	cascade.renderer.set_mesh_renderer_options(config.directional_light_shadows_vsm ? Renderer::SHADOW_VSM_BIT : 0);
+	cascade.renderer.begin();
+	scene.gather_visible_dynamic_shadow_renderables(cascade.context.get_visibility_frustum(), cascade.visible);
+	cascade.renderer.push_depth_renderables(cascade.context, cascade.visible);
+	cascade.renderer.flush(cmd, cascade.context, Renderer::DEPTH_BIAS_BIT);
 }
 
 void SceneViewerApplication::update_scene(double frame_time, double elapsed_time)
 {
+	GRANITE_CPU_TRACE_ZONE("SceneViewerApplication::update_scene");
 	last_frame_times[last_frame_index++ & FrameWindowSizeMask] = float(frame_time);
 	auto &scene = scene_loader.get_scene();
 
@@ -1160,11 +1179,23 @@ void SceneViewerApplication::render_ui(CommandBuffer &cmd)
 	flat_renderer.render_text(Global::ui_manager()->get_font(UI::FontSize::Large), latency_text,
 	                          offset + vec3(0.0f, 60.0f, 0.0f), size - vec2(0.0f, 60.0f), color, alignment, 1.0f);
 
+	if (config.occlusion_culling)
+	{
+		auto &stats = occlusion_culler.get_statistics();
+		char occlusion_text[128];
+		sprintf(occlusion_text, "Occlusion: %u / %u culled, %u tris, %.3f ms raster, %.3f ms test",
+		        stats.culled, stats.tested, stats.occluder_triangles,
+		        1e-6 * double(stats.rasterize_nsecs), 1e-6 * double(stats.test_nsecs));
+		flat_renderer.render_text(Global::ui_manager()->get_font(UI::FontSize::Large), occlusion_text,
+		                          offset + vec3(0.0f, 80.0f, 0.0f), size - vec2(0.0f, 80.0f), color, alignment, 1.0f);
+	}
+
 	flat_renderer.flush(cmd, vec3(0.0f), vec3(cmd.get_viewport().width, cmd.get_viewport().height, 1.0f));
 }
 
 void SceneViewerApplication::render_scene()
 {
+	GRANITE_CPU_TRACE_ZONE("SceneViewerApplication::render_scene");
 	auto &wsi = get_wsi();
 	auto &device = wsi.get_device();
 	auto &scene = scene_loader.get_scene();
@@ -36,6 +36,7 @@
 #include "lights/clusterer.hpp"
 #include "lights/volumetric_fog.hpp"
 #include "lights/deferred_lights.hpp"
+#include "occlusion_culler.hpp"
 #include "camera_export.hpp"
 #include "post/aa.hpp"
 #include "post/temporal.hpp"
@@ -56,7 +57,6 @@ protected:
 	void render_scene();
 
 	RenderContext context;
-	RenderContext depth_context;
 	Renderer forward_renderer;
 	Renderer deferred_renderer;
 	Renderer depth_renderer;
@@ -64,7 +64,16 @@ protected:
 	LightingParameters lighting;
 	FPSCamera cam;
 	VisibilityList visible;
-	VisibilityList depth_visible;
+
+	// The shadow cascades are recorded in parallel, so each needs its own renderer state.
+	struct ShadowCascade
+	{
+		RenderContext context;
+		Renderer renderer { RendererType::DepthOnly };
+		VisibilityList visible;
+	};
+	ShadowCascade far_cascade;
+	ShadowCascade near_cascade;
 	SceneLoader scene_loader;
 	std::unique_ptr<AnimationSystem> animation_system;
 
@@ -142,6 +151,7 @@ private:
 		bool hdr_bloom = true;
 		bool hdr_bloom_dynamic_exposure = true;
 		bool forward_depth_prepass = false;
+		bool occlusion_culling = false;
 		bool deferred_clustered_stencil_culling = true;
 		bool rt_fp16 = false;
 		bool timestamps = false;
@@ -164,6 +174,8 @@ private:
 	TemporalJitter jitter;
 	void capture_environment_probe();
 
+	OcclusionCuller occlusion_culler;
+
 	RenderTextureResource *ssao_output = nullptr;
 	RenderTextureResource *shadow_near = nullptr;
 	RenderTextureResource *shadow_main = nullptr;
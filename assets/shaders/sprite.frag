@@ -100,7 +100,11 @@ void main()
         #endif
     #endif
 
-    #if defined(VARIANT_BIT_4) && VARIANT_BIT_4
+    #if defined(VARIANT_BIT_6) && VARIANT_BIT_6
+        // Distance field with the edge at 0.5, antialiased over roughly one pixel at any scale.
+        mediump float edge_width = max(fwidth(color.r), 1.0 / 255.0);
+        color = vec4(1.0, 1.0, 1.0, smoothstep(0.5 - edge_width, 0.5 + edge_width, color.r));
+    #elif defined(VARIANT_BIT_4) && VARIANT_BIT_4
         color = vec4(1.0, 1.0, 1.0, color.r);
     #endif
 
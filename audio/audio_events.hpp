@@ -68,6 +68,32 @@ private:
 	unsigned index;
 };
 
+// Sent from the mixer thread when a stream could not supply enough audio in time.
+// The missing frames are played back as silence.
+class StreamUnderrunEvent : public Event
+{
+public:
+	GRANITE_EVENT_TYPE_DECL(StreamUnderrunEvent)
+	explicit StreamUnderrunEvent(StreamID id_, unsigned missing_frames_)
+		: Event(get_type_id()), id(id_), missing_frames(missing_frames_)
+	{
+	}
+
+	StreamID get_stream_id() const
+	{
+		return id;
+	}
+
+	unsigned get_missing_frames() const
+	{
+		return missing_frames;
+	}
+
+private:
+	StreamID id;
+	unsigned missing_frames;
+};
+
 class AudioStreamPerformanceEvent : public Event
 {
 public:
@@ -25,8 +25,20 @@
 #include "audio_events.hpp"
 #include "timer.hpp"
 #include "logging.hpp"
+#include "bitops.hpp"
+#include "dsp/dsp.hpp"
 #include <string.h>
 #include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 using namespace std;
 
@@ -45,12 +57,42 @@ void MixerStream::install_message_queue(StreamID id, Util::LockFreeMessageQueue
 	message_queue = queue;
 }
 
+size_t MixerStream::skip_samples(float *const *scratch, size_t num_frames) noexcept
+{
+	float gains[Backend::MaxAudioChannels] = {};
+	return accumulate_samples(scratch, gains, num_frames);
+}
+
 void Mixer::set_backend_parameters(float sample_rate_, unsigned channels_, size_t max_num_samples_)
 {
 	max_num_samples = max_num_samples_;
 	sample_rate = sample_rate_;
 	num_channels = channels_;
 	inv_sample_rate = 1.0 / sample_rate;
+
+	unsigned count = num_buses.load(memory_order_relaxed);
+	for (unsigned i = 0; i < count; i++)
+	{
+		init_bus_buffers(buses[i]);
+		for (auto *effect : buses[i].effects)
+			effect->setup(sample_rate, num_channels, max_num_samples);
+	}
+}
+
+void Mixer::init_bus_buffers(Bus &bus)
+{
+	for (auto &buffer : bus.buffer)
+		buffer.clear();
+	for (auto &buffer : bus.skip_buffer)
+		buffer.clear();
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		bus.buffer[c].resize(max_num_samples);
+		bus.skip_buffer[c].resize(max_num_samples);
+		bus.channels[c] = bus.buffer[c].data();
+		bus.skip_channels[c] = bus.skip_buffer[c].data();
+	}
 }
 
 void Mixer::on_backend_start()
@@ -103,7 +145,32 @@ Mixer::Mixer()
 		gain = f32_to_u32(1.0f);
 	for (auto &active : active_channel_mask)
 		active = 0;
+	for (auto &virt : stream_virtual)
+		virt = false;
+	for (auto &priority : stream_priority)
+		priority = 0;
 	latency = 0;
+	max_rendered_streams = DefaultMaxRenderedStreams;
+	virtualization_threshold = f32_to_u32(0.0f);
+	num_virtual_streams = 0;
+	voice_candidates.resize(MaxSources);
+
+	for (auto &bus : stream_bus)
+		bus = MasterBus;
+	for (auto &bus : buses)
+	{
+		bus.gain_linear = f32_to_u32(1.0f);
+		bus.pending_generation = 0;
+		bus.claimed_generation = 0;
+		bus.done_generation = 0;
+	}
+	buses[MasterBus].voices.resize(MaxSources);
+	buses[MasterBus].events.reset(new Util::LockFreeMessageQueue);
+	num_buses = 1;
+	mix_deadline = f32_to_u32(0.75f);
+	num_missed_bus_deadlines = 0;
+	work_generation = 0;
+	num_mix_threads = 0;
 }
 
 void Mixer::on_backend_stop()
@@ -114,10 +181,14 @@ void Mixer::on_backend_stop()
 
 Mixer::~Mixer()
 {
+	set_num_mix_threads(0);
 	on_backend_stop();
 	for (auto *stream : mixer_streams)
 		if (stream)
 			stream->dispose();
+	for (auto &bus : buses)
+		for (auto *effect : bus.effects)
+			effect->dispose();
 }
 
 unsigned Mixer::get_stream_index(StreamID id)
@@ -196,14 +267,168 @@ void Mixer::update_stream_play_cursor(unsigned index, double new_latency) noexce
 		stream_adjusted_play_cursors_usec[index].store(t_usec, memory_order_release);
 }
 
+float Mixer::compute_stream_gains(unsigned index, float *gains) const noexcept
+{
+	float gain = u32_to_f32(gain_linear[index].load(memory_order_relaxed));
+	float pan = u32_to_f32(panning[index].load(memory_order_relaxed));
+
+	if (num_channels != 2)
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			gains[c] = gain;
+		return gain;
+	}
+	else
+	{
+		gains[0] = gain * saturate(1.0f - pan);
+		gains[1] = gain * saturate(1.0f + pan);
+		return std::max(gains[0], gains[1]);
+	}
+}
+
+bool Mixer::is_bus_in_flight(const Bus &bus) const noexcept
+{
+	return bus.claimed_generation.load(memory_order_acquire) != bus.done_generation.load(memory_order_acquire);
+}
+
+bool Mixer::is_slot_in_flight(unsigned index) const noexcept
+{
+	return is_bus_in_flight(buses[stream_bus[index].load(memory_order_relaxed)]);
+}
+
+void Mixer::mix_bus(Bus &bus, uint64_t generation) noexcept
+{
+	float gains[Backend::MaxAudioChannels];
+	size_t num_frames = bus.num_frames;
+
+	for (unsigned c = 0; c < num_channels; c++)
+		memset(bus.channels[c], 0, num_frames * sizeof(float));
+
+	for (unsigned i = 0; i < bus.num_voices; i++)
+	{
+		auto &voice = bus.voices[i];
+		unsigned index = voice.index;
+
+#ifdef AUDIO_MIXER_DEBUG
+		auto start_time = Util::get_current_time_nsecs();
+#endif
+
+		if (voice.render)
+		{
+			compute_stream_gains(index, gains);
+			voice.got = mixer_streams[index]->accumulate_samples(bus.channels, gains, num_frames);
+		}
+		else
+			voice.got = mixer_streams[index]->skip_samples(bus.skip_channels, num_frames);
+
+#ifdef AUDIO_MIXER_DEBUG
+		auto end_time = Util::get_current_time_nsecs();
+		voice.mix_time = 1e-9 * (end_time - start_time);
+#endif
+
+		stream_virtual[index].store(!voice.render, memory_order_relaxed);
+		stream_raw_play_cursors[index] += voice.got;
+		update_stream_play_cursor(index, bus.latency);
+		voice.stopped = voice.got < num_frames;
+	}
+
+	for (auto *effect : bus.effects)
+		effect->process(bus.channels, num_frames);
+
+	bus.done_generation.store(generation, memory_order_release);
+}
+
+void Mixer::run_bus_jobs(uint64_t generation) noexcept
+{
+	unsigned count = num_buses.load(memory_order_acquire);
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &bus = buses[i];
+		if (bus.pending_generation.load(memory_order_acquire) != generation)
+			continue;
+
+		// Generations only increase, so a stale worker can never claim a bus for a period which has already ended.
+		uint64_t claimed = bus.claimed_generation.load(memory_order_acquire);
+		if (claimed < generation &&
+		    bus.claimed_generation.compare_exchange_strong(claimed, generation, memory_order_acq_rel))
+		{
+			mix_bus(bus, generation);
+		}
+	}
+}
+
+// Hands the payloads over as-is, and gives the bus queue a payload of the same size back,
+// so neither queue has to allocate in steady state.
+void Mixer::forward_bus_events(Bus &bus) noexcept
+{
+	while (bus.events->available_read_messages())
+	{
+		auto payload = bus.events->read_message();
+		bus.events->recycle_payload(message_queue.allocate_write_payload(payload.get_capacity()));
+		message_queue.push_written_payload(std::move(payload));
+	}
+}
+
+// Only the mixer thread can post to the message queue, so bookkeeping for stopped streams happens here.
+void Mixer::collect_bus(Bus &bus, float *const *channels, bool sum) noexcept
+{
+	forward_bus_events(bus);
+
+	if (sum)
+	{
+		float gain = u32_to_f32(bus.gain_linear.load(memory_order_relaxed));
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], bus.channels[c], gain, bus.num_frames);
+	}
+
+	for (unsigned i = 0; i < bus.num_voices; i++)
+	{
+		auto &voice = bus.voices[i];
+
+#ifdef AUDIO_MIXER_DEBUG
+		emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[voice.index]->get_stream_id(),
+		                                                          voice.mix_time, voice.got);
+#endif
+
+		if (voice.stopped)
+		{
+			active_channel_mask[voice.index / 32].fetch_and(~(1u << (voice.index & 31)), memory_order_release);
+			emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, voice.index);
+		}
+	}
+
+	bus.num_voices = 0;
+	bus.collected_generation = bus.done_generation.load(memory_order_relaxed);
+}
+
 void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 {
+	auto start_time = Util::get_current_time_nsecs();
+
 	for (unsigned c = 0; c < num_channels; c++)
 		memset(channels[c], 0, num_frames * sizeof(float));
 	float gains[Backend::MaxAudioChannels];
 
 	auto current_latency = double(latency.load(memory_order_acquire)) * 1e-6;
+	unsigned max_rendered = max_rendered_streams.load(memory_order_relaxed);
+	float threshold = u32_to_f32(virtualization_threshold.load(memory_order_relaxed));
+	uint64_t generation = ++mix_generation;
+
+	// Buses which missed their deadline earlier are still owned by a worker, leave them alone.
+	// Once the worker is done, the results are discarded, but stopped streams must still be dealt with.
+	unsigned bus_count = num_buses.load(memory_order_acquire);
+	bool bus_in_flight[MaxBuses];
+	for (unsigned i = 0; i < bus_count; i++)
+	{
+		auto &bus = buses[i];
+		bus_in_flight[i] = is_bus_in_flight(bus);
+		if (!bus_in_flight[i] && bus.collected_generation != bus.done_generation.load(memory_order_acquire))
+			collect_bus(bus, channels, false);
+	}
 
+	// Gather all playing streams, ranked by priority first, then audibility.
+	// Audibility is never negative, so the float bit pattern sorts correctly as an integer.
+	unsigned num_candidates = 0;
 	constexpr unsigned iter = MaxSources / 32;
 	for (unsigned i = 0; i < iter; i++)
 	{
@@ -211,51 +436,96 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 		if (!active_mask)
 			continue;
 
-		uint32_t dead_mask = 0;
-
 		Util::for_each_bit(active_mask, [&](unsigned bit) {
 			unsigned index = bit + 32 * i;
 			if (!stream_playing[index].load(memory_order_acquire))
 				return;
+			if (bus_in_flight[stream_bus[index].load(memory_order_relaxed)])
+				return;
 
-			float gain = u32_to_f32(gain_linear[index].load(memory_order_relaxed));
-			float pan = u32_to_f32(panning[index].load(memory_order_relaxed));
+			auto &candidate = voice_candidates[num_candidates++];
+			candidate.audibility = compute_stream_gains(index, gains);
+			candidate.key = (uint64_t(stream_priority[index].load(memory_order_relaxed)) << 32) |
+			                f32_to_u32(candidate.audibility);
+			candidate.index = index;
+		});
+	}
 
-			if (num_channels != 2)
-			{
-				for (unsigned c = 0; c < num_channels; c++)
-					gains[c] = gain;
-			}
-			else
-			{
-				gains[0] = gain * saturate(1.0f - pan);
-				gains[1] = gain * saturate(1.0f + pan);
-			}
+	// Partial sort is O(n) and does not allocate, so it's safe to use in the mixer thread.
+	if (num_candidates > max_rendered)
+	{
+		std::nth_element(voice_candidates.begin(), voice_candidates.begin() + max_rendered,
+		                 voice_candidates.begin() + num_candidates,
+		                 [](const VoiceCandidate &a, const VoiceCandidate &b) {
+			                 return a.key > b.key;
+		                 });
+	}
 
-#ifdef AUDIO_MIXER_DEBUG
-			auto start_time = Util::get_current_time_nsecs();
-#endif
+	unsigned virtual_count = 0;
+	for (unsigned i = 0; i < num_candidates; i++)
+	{
+		auto &candidate = voice_candidates[i];
+		bool render = i < max_rendered && candidate.audibility > threshold;
+		if (!render)
+			virtual_count++;
+
+		auto &bus = buses[stream_bus[candidate.index].load(memory_order_relaxed)];
+		auto &voice = bus.voices[bus.num_voices++];
+		voice.index = candidate.index;
+		voice.render = render;
+		voice.stopped = false;
+		voice.mix_time = 0.0;
+		voice.got = 0;
+	}
+	num_virtual_streams.store(virtual_count, memory_order_relaxed);
 
-			size_t got = mixer_streams[index]->accumulate_samples(channels, gains, num_frames);
+	// Kick the buses which have work to do.
+	bool has_work = false;
+	for (unsigned i = 0; i < bus_count; i++)
+	{
+		auto &bus = buses[i];
+		if (bus_in_flight[i] || (!bus.num_voices && bus.effects.empty()))
+			continue;
 
-#ifdef AUDIO_MIXER_DEBUG
-			auto end_time = Util::get_current_time_nsecs();
-			emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[index]->get_stream_id(),
-			                                                          1e-9 * (end_time - start_time), got);
+		bus.num_frames = num_frames;
+		bus.latency = current_latency;
+		bus.pending_generation.store(generation, memory_order_release);
+		has_work = true;
+	}
 
-#endif
+	if (has_work)
+	{
+		if (num_mix_threads.load(memory_order_relaxed))
+		{
+			// Notify without holding the lock so the mixer thread can never block here.
+			work_generation.store(generation, memory_order_release);
+			mix_thread_cond.notify_all();
+		}
+
+		// Whatever the workers have not picked up, we do ourselves.
+		run_bus_jobs(generation);
+
+		auto period_nsecs = int64_t(1e9 * double(num_frames) * inv_sample_rate);
+		auto deadline = start_time + int64_t(u32_to_f32(mix_deadline.load(memory_order_relaxed)) * float(period_nsecs));
 
-			stream_raw_play_cursors[index] += got;
-			update_stream_play_cursor(index, current_latency);
+		for (unsigned i = 0; i < bus_count; i++)
+		{
+			auto &bus = buses[i];
+			if (bus.pending_generation.load(memory_order_relaxed) != generation)
+				continue;
 
-			if (got < num_frames)
+			bool done;
+			while (!(done = bus.done_generation.load(memory_order_acquire) == generation) &&
+			       Util::get_current_time_nsecs() < deadline)
 			{
-				dead_mask |= 1u << bit;
-				emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, bit + 32 * i);
+				std::this_thread::yield();
 			}
-		});
 
-		active_channel_mask[i].fetch_and(~dead_mask, memory_order_release);
+			if (done)
+				collect_bus(bus, channels, true);
+			else
+				num_missed_bus_deadlines.fetch_add(1, memory_order_relaxed);
+		}
 	}
 
 #ifdef AUDIO_MIXER_DEBUG
@@ -269,11 +539,18 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 }
 
 StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
-                                 float initial_gain_db, float initial_panning)
+                                 float initial_gain_db, float initial_panning,
+                                 BusID bus)
 {
 	if (!stream)
 		return StreamID(-1);
 
+	if (bus >= num_buses.load(memory_order_acquire))
+	{
+		LOGE("Mixer bus %u does not exist.\n", bus);
+		return StreamID(-1);
+	}
+
 	// Cannot deal with this yet.
 	if (stream->get_num_channels() != num_channels)
 	{
@@ -289,10 +566,18 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 	// The only important non-locking code is the audio thread, which can only use atomics.
 	NON_CRITICAL_THREAD_LOCK();
 
+	// Next-fit, continue searching where the last allocation left off.
+	// Recently killed slots are not reused immediately, and allocation stays cheap with many live streams.
 	constexpr unsigned iter = MaxSources / 32;
-	for (unsigned i = 0; i < iter; i++)
+	for (unsigned j = 0; j < iter; j++)
 	{
+		unsigned i = (allocation_search_offset + j) % iter;
 		uint32_t vacant_mask = ~active_channel_mask[i].load(memory_order_acquire);
+
+		// A worker might still be mixing a recently killed stream.
+		while (vacant_mask && is_slot_in_flight(i * 32 + trailing_zeroes(vacant_mask)))
+			vacant_mask &= ~(1u << trailing_zeroes(vacant_mask));
+
 		if (!vacant_mask)
 			continue;
 
@@ -301,7 +586,7 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 
 		MixerStream *old_stream = mixer_streams[index];
 		StreamID id = generate_stream_id(index);
-		stream->install_message_queue(id, &message_queue);
+		stream->install_message_queue(id, buses[bus].events.get());
 
 		stream->setup(sample_rate, num_channels, max_num_samples);
 
@@ -320,9 +605,13 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 		gain_linear[index].store(f32_to_u32(std::pow(10.0f, initial_gain_db / 20.0f)), memory_order_relaxed);
 		panning[index].store(f32_to_u32(initial_panning), memory_order_relaxed);
 		stream_playing[index].store(start_playing, memory_order_relaxed);
+		stream_virtual[index].store(false, memory_order_relaxed);
+		stream_priority[index].store(0, memory_order_relaxed);
+		stream_bus[index].store(bus, memory_order_relaxed);
 
 		// Kick mixer thread.
 		active_channel_mask[i].fetch_or(1u << subindex, memory_order_release);
+		allocation_search_offset = i;
 
 		if (old_stream)
 			old_stream->dispose();
@@ -330,7 +619,8 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 		return id;
 	}
 
-	return unsigned(-1);
+	LOGE("Exhausted all %u mixer stream slots.\n", unsigned(MaxSources));
+	return StreamID(-1);
 }
 
 void Mixer::dispose_dead_streams()
@@ -341,6 +631,9 @@ void Mixer::dispose_dead_streams()
 	{
 		uint32_t dead_mask = ~active_channel_mask[i].load(memory_order_acquire);
 		Util::for_each_bit(dead_mask, [&](unsigned bit) {
+			if (is_slot_in_flight(bit + 32 * i))
+				return;
+
 			MixerStream *old_stream = mixer_streams[bit + 32 * i];
 			if (old_stream)
 				old_stream->dispose();
@@ -387,5 +680,148 @@ void Mixer::set_stream_mixer_parameters(StreamID id, float new_gain_db, float ne
 	gain_linear[index].store(f32_to_u32(std::pow(10.0f, new_gain_db / 20.0f)), memory_order_release);
 	panning[index].store(f32_to_u32(new_panning), memory_order_release);
 }
+
+void Mixer::set_stream_priority(StreamID id, unsigned priority)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id))
+		return;
+
+	unsigned index = get_stream_index(id);
+	stream_priority[index].store(priority, memory_order_release);
+}
+
+void Mixer::set_max_rendered_streams(unsigned max_streams)
+{
+	max_rendered_streams.store(max_streams, memory_order_release);
+}
+
+void Mixer::set_virtualization_threshold_db(float threshold_db)
+{
+	virtualization_threshold.store(f32_to_u32(std::pow(10.0f, threshold_db / 20.0f)), memory_order_release);
+}
+
+bool Mixer::is_stream_virtual(StreamID id)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id))
+		return false;
+
+	unsigned index = get_stream_index(id);
+	return stream_virtual[index].load(memory_order_relaxed);
+}
+
+unsigned Mixer::get_num_virtual_streams() const
+{
+	return num_virtual_streams.load(memory_order_relaxed);
+}
+BusID Mixer::create_bus(float gain_db, MixerEffect *const *effects, unsigned num_effects)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	unsigned index = num_buses.load(memory_order_relaxed);
+	if (index >= MaxBuses)
+	{
+		LOGE("Exhausted all %u mixer buses.\n", unsigned(MaxBuses));
+		for (unsigned i = 0; i < num_effects; i++)
+			effects[i]->dispose();
+		return BusID(-1);
+	}
+
+	auto &bus = buses[index];
+	bus.gain_linear.store(f32_to_u32(std::pow(10.0f, gain_db / 20.0f)), memory_order_relaxed);
+	bus.effects.assign(effects, effects + num_effects);
+	bus.voices.resize(MaxSources);
+	bus.events.reset(new Util::LockFreeMessageQueue);
+
+	// If the backend is not up yet, this happens in set_backend_parameters() instead.
+	if (num_channels)
+	{
+		init_bus_buffers(bus);
+		for (auto *effect : bus.effects)
+			effect->setup(sample_rate, num_channels, max_num_samples);
+	}
+
+	// Kick mixer thread.
+	num_buses.store(index + 1, memory_order_release);
+	return index;
+}
+
+void Mixer::set_bus_gain(BusID bus, float gain_db)
+{
+	if (bus >= num_buses.load(memory_order_acquire))
+		return;
+	buses[bus].gain_linear.store(f32_to_u32(std::pow(10.0f, gain_db / 20.0f)), memory_order_release);
+}
+
+static void set_realtime_thread_priority()
+{
+#if defined(_WIN32)
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__linux__) || defined(__APPLE__)
+	// Will usually fail without the appropriate privileges, in which case we stay at normal priority.
+	sched_param param = {};
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+		LOGI("Could not set real-time priority for mix thread.\n");
+#endif
+}
+
+void Mixer::mix_thread_main()
+{
+	set_realtime_thread_priority();
+	uint64_t seen_generation = 0;
+
+	for (;;)
+	{
+		{
+			unique_lock<mutex> holder{mix_thread_lock};
+			// The mixer thread notifies without taking the lock, so we might miss a wakeup.
+			// That only means the mixer thread ends up doing the work itself, so just poll as a fallback.
+			mix_thread_cond.wait_for(holder, chrono::milliseconds(1), [&]() {
+				return mix_threads_quit || work_generation.load(memory_order_acquire) != seen_generation;
+			});
+
+			if (mix_threads_quit)
+				break;
+		}
+
+		uint64_t generation = work_generation.load(memory_order_acquire);
+		if (generation == seen_generation)
+			continue;
+
+		seen_generation = generation;
+		run_bus_jobs(generation);
+	}
+}
+
+void Mixer::set_num_mix_threads(unsigned num_threads)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	num_mix_threads.store(0, memory_order_relaxed);
+
+	{
+		lock_guard<mutex> holder{mix_thread_lock};
+		mix_threads_quit = true;
+	}
+	mix_thread_cond.notify_all();
+	for (auto &thread : mix_threads)
+		thread.join();
+	mix_threads.clear();
+
+	mix_threads_quit = false;
+	for (unsigned i = 0; i < num_threads; i++)
+		mix_threads.emplace_back(&Mixer::mix_thread_main, this);
+	num_mix_threads.store(num_threads, memory_order_relaxed);
+}
+
+void Mixer::set_mix_deadline(float fraction_of_period)
+{
+	mix_deadline.store(f32_to_u32(fraction_of_period), memory_order_relaxed);
+}
+
+uint64_t Mixer::get_num_missed_bus_deadlines() const
+{
+	return num_missed_bus_deadlines.load(memory_order_relaxed);
+}
 }
 }
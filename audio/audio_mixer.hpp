@@ -26,6 +26,9 @@
 #include "message_queue.hpp"
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <thread>
 #include <vector>
 
 namespace Granite
@@ -33,6 +36,7 @@ namespace Granite
 namespace Audio
 {
 using StreamID = uint64_t;
+using BusID = unsigned;
 
 class MixerStream
 {
@@ -58,6 +62,12 @@ public:
 	// Must increment.
 	virtual size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept = 0;
 
+	// Called instead of accumulate_samples() while the stream is virtualized.
+	// Must advance the stream exactly like accumulate_samples() would, so playback can resume seamlessly.
+	// scratch holds get_num_channels() buffers with room for num_frames which can be freely clobbered.
+	// The default implementation mixes into scratch, streams which can skip ahead cheaply should override this.
+	virtual size_t skip_samples(float * const *scratch, size_t num_frames) noexcept;
+
 	virtual unsigned get_num_channels() const = 0;
 	virtual float get_sample_rate() const = 0;
 
@@ -67,6 +77,7 @@ public:
 	}
 
 protected:
+	// Belongs to the bus the stream is mixed in. Events are forwarded to the mixer's queue once the bus is done.
 	Util::LockFreeMessageQueue &get_message_queue()
 	{
 		return *message_queue;
@@ -77,6 +88,28 @@ private:
 	Util::LockFreeMessageQueue *message_queue = nullptr;
 };
 
+// Processes the output of a submix bus in-place.
+class MixerEffect
+{
+public:
+	virtual ~MixerEffect() = default;
+
+	virtual void dispose()
+	{
+		delete this;
+	}
+
+	virtual void setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames)
+	{
+		(void)mixer_output_rate;
+		(void)mixer_channels;
+		(void)max_num_frames;
+	}
+
+	// Might be called from one of the mix worker threads.
+	virtual void process(float * const *channels, size_t num_frames) noexcept = 0;
+};
+
 class Mixer : public BackendCallback
 {
 public:
@@ -89,8 +122,10 @@ public:
 	// Atomically adds a mixer stream. Might also dispose and replace an old stream.
 	// Can only be called from a non-critical thread.
 	// Returns StreamID(-1) if a mixer stream slot cannot be found.
+	// The stream is mixed into the given bus for its entire lifetime.
 	StreamID add_mixer_stream(MixerStream *stream, bool start_playing = true,
-	                          float initial_gain_db = 0.0f, float initial_panning = 0.0f);
+	                          float initial_gain_db = 0.0f, float initial_panning = 0.0f,
+	                          BusID bus = MasterBus);
 	void kill_stream(StreamID id);
 
 	// Garbage collection. Should be called regularly from a non-critical thread.
@@ -100,6 +135,40 @@ public:
 	// Panning is -1 (left), 0 (center), 1 (right).
 	void set_stream_mixer_parameters(StreamID id, float new_gain_db, float new_panning);
 
+	// Streams with higher priority are always rendered before streams with lower priority.
+	// Within the same priority, streams are ranked by how audible they are based on gain and panning.
+	void set_stream_priority(StreamID id, unsigned priority);
+
+	// Only the top max_streams playing streams are mixed, the rest become virtual.
+	// Virtual streams only advance their play cursor, so the cost of the mixer thread is bounded
+	// no matter how many streams are playing.
+	void set_max_rendered_streams(unsigned max_streams);
+
+	// Streams which are quieter than this are virtualized even if there is room to render them.
+	void set_virtualization_threshold_db(float threshold_db);
+
+	// Returns true if the stream was virtualized in the last mixed period.
+	bool is_stream_virtual(StreamID id);
+	unsigned get_num_virtual_streams() const;
+
+	// Submix buses. Each bus mixes its streams into a separate buffer, runs its effect chain in order,
+	// then gets summed into the output with the bus gain applied.
+	// Independent buses can be mixed in parallel by the mix worker threads.
+	// The master bus always exists. Buses live as long as the mixer.
+	// Ownership of the effects is transferred to the mixer.
+	// Can only be called from a non-critical thread.
+	// Returns BusID(-1) if no more buses can be created.
+	enum { MasterBus = 0, MaxBuses = 16 };
+	BusID create_bus(float gain_db = 0.0f, MixerEffect * const *effects = nullptr, unsigned num_effects = 0);
+	void set_bus_gain(BusID bus, float gain_db);
+
+	// Spawns worker threads which mix buses in parallel with the backend thread.
+	// The backend thread waits for the workers until a fraction of the period has passed.
+	// A bus which is not done by then is dropped from the output, and is not mixed again until its worker is done with it.
+	void set_num_mix_threads(unsigned num_threads);
+	void set_mix_deadline(float fraction_of_period);
+	uint64_t get_num_missed_bus_deadlines() const;
+
 	// Returns latency-adjusted play cursor in seconds from add_mixer_stream.
 	// The play cursor monotonically increases.
 	// Returns a negative number if the stream no longer exists.
@@ -120,7 +189,7 @@ public:
 	Util::LockFreeMessageQueue &get_message_queue();
 
 private:
-	enum { MaxSources = 128 };
+	enum { MaxSources = 4096, DefaultMaxRenderedStreams = 128 };
 	std::atomic<uint32_t> active_channel_mask[MaxSources / 32];
 	MixerStream *mixer_streams[MaxSources] = {};
 
@@ -129,12 +198,77 @@ private:
 	std::atomic<uint32_t> gain_linear[MaxSources];
 	std::atomic<uint32_t> latency;
 	std::atomic<bool> stream_playing[MaxSources];
+	std::atomic<bool> stream_virtual[MaxSources];
+	std::atomic<uint32_t> stream_priority[MaxSources];
+
+	std::atomic<uint32_t> max_rendered_streams;
+	std::atomic<uint32_t> virtualization_threshold;
+	std::atomic<uint32_t> num_virtual_streams;
+
+	std::atomic<uint32_t> stream_bus[MaxSources];
+
+	// Only touched by the mixer thread.
+	struct VoiceCandidate
+	{
+		uint64_t key;
+		float audibility;
+		unsigned index;
+	};
+	std::vector<VoiceCandidate> voice_candidates;
+	uint64_t mix_generation = 0;
+
+	struct BusVoice
+	{
+		unsigned index;
+		bool render;
+		bool stopped;
+		double mix_time;
+		size_t got;
+	};
+
+	struct Bus
+	{
+		std::atomic<uint32_t> gain_linear;
+		std::vector<MixerEffect *> effects;
+		std::vector<float> buffer[Backend::MaxAudioChannels];
+		std::vector<float> skip_buffer[Backend::MaxAudioChannels];
+		float *channels[Backend::MaxAudioChannels] = {};
+		float *skip_channels[Backend::MaxAudioChannels] = {};
+
+		// Only written by the mixer thread while no worker owns the bus.
+		std::vector<BusVoice> voices;
+		unsigned num_voices = 0;
+		size_t num_frames = 0;
+		double latency = 0.0;
+		uint64_t collected_generation = 0;
+
+		// Streams post their events here since they might run on a mix worker.
+		// The mixer thread forwards them to the shared message queue when it collects the bus.
+		std::unique_ptr<Util::LockFreeMessageQueue> events;
+
+		// A worker owns the bus from claiming it until it is done.
+		std::atomic<uint64_t> pending_generation;
+		std::atomic<uint64_t> claimed_generation;
+		std::atomic<uint64_t> done_generation;
+	};
+	Bus buses[MaxBuses];
+	std::atomic<uint32_t> num_buses;
+	std::atomic<uint32_t> mix_deadline;
+	std::atomic<uint64_t> num_missed_bus_deadlines;
+
+	std::vector<std::thread> mix_threads;
+	std::mutex mix_thread_lock;
+	std::condition_variable mix_thread_cond;
+	std::atomic<uint64_t> work_generation;
+	std::atomic<uint32_t> num_mix_threads;
+	bool mix_threads_quit = false;
 
 	uint64_t stream_raw_play_cursors[MaxSources];
 	std::atomic<uint64_t> stream_adjusted_play_cursors_usec[MaxSources];
 
 	uint64_t stream_generation[MaxSources] = {};
 	std::mutex non_critical_lock;
+	unsigned allocation_search_offset = 0;
 
 	size_t max_num_samples = 0;
 	unsigned num_channels = 0;
@@ -153,6 +287,16 @@ private:
 	bool is_active = false;
 
 	void update_stream_play_cursor(unsigned index, double new_latency) noexcept;
+	float compute_stream_gains(unsigned index, float *gains) const noexcept;
+
+	void init_bus_buffers(Bus &bus);
+	bool is_bus_in_flight(const Bus &bus) const noexcept;
+	bool is_slot_in_flight(unsigned index) const noexcept;
+	void run_bus_jobs(uint64_t generation) noexcept;
+	void mix_bus(Bus &bus, uint64_t generation) noexcept;
+	void collect_bus(Bus &bus, float * const *channels, bool sum) noexcept;
+	void forward_bus_events(Bus &bus) noexcept;
+	void mix_thread_main();
 
 	Util::LockFreeMessageQueue message_queue;
 };
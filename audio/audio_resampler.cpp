@@ -45,12 +45,10 @@ void ResampledStream::setup(float output_rate, unsigned channels, size_t num_fra
 	max_num_frames = num_frames;
 	sample_rate = output_rate;
 
-	for (auto &re : resamplers)
-		re.reset();
-	for (unsigned i = 0; i < channels; i++)
-		resamplers[i].reset(new DSP::SincResampler(output_rate, source->get_sample_rate(), DSP::SincResampler::Quality::Medium));
+	resampler.reset(new DSP::SincResampler(output_rate, source->get_sample_rate(),
+	                                       DSP::SincResampler::Quality::Medium, channels));
 
-	size_t maximum_input = resamplers[0]->get_maximum_input_for_output_frames(max_num_frames);
+	size_t maximum_input = resampler->get_maximum_input_for_output_frames(max_num_frames);
 	for (auto &buffer : input_buffer)
 		buffer.clear();
 	for (unsigned i = 0; i < channels; i++)
@@ -61,7 +59,7 @@ void ResampledStream::setup(float output_rate, unsigned channels, size_t num_fra
 
 size_t ResampledStream::accumulate_samples(float *const *channels, const float *gain, size_t num_frames) noexcept
 {
-	size_t need_samples = resamplers[0]->get_current_input_for_output_frames(num_frames);
+	size_t need_samples = resampler->get_current_input_for_output_frames(num_frames);
 	float *output_channels[Backend::MaxAudioChannels];
 	for (unsigned c = 0; c < num_channels; c++)
 	{
@@ -71,13 +69,33 @@ size_t ResampledStream::accumulate_samples(float *const *channels, const float *
 
 	size_t source_input = source->accumulate_samples(output_channels, gain, need_samples);
 
+	size_t output = resampler->process_and_accumulate(channels, output_channels, num_frames);
+	(void)output;
+	assert(output == need_samples);
+
+	return source_input ? num_frames : 0;
+}
+
+size_t ResampledStream::skip_samples(float *const *, size_t num_frames) noexcept
+{
+	// The source is still rendered so the filter history is correct when the stream becomes audible again,
+	// but the expensive part, the filtering itself, is skipped.
+	size_t need_samples = resampler->get_current_input_for_output_frames(num_frames);
+	float *output_channels[Backend::MaxAudioChannels];
+	float unity_gains[Backend::MaxAudioChannels];
 	for (unsigned c = 0; c < num_channels; c++)
 	{
-		size_t output = resamplers[c]->process_and_accumulate(channels[c], output_channels[c], num_frames);
-		(void)output;
-		assert(output == need_samples);
+		output_channels[c] = input_buffer[c].data();
+		memset(output_channels[c], 0, need_samples * sizeof(float));
+		unity_gains[c] = 1.0f;
 	}
 
+	size_t source_input = source->accumulate_samples(output_channels, unity_gains, need_samples);
+
+	size_t output = resampler->skip(output_channels, num_frames);
+	(void)output;
+	assert(output == need_samples);
+
 	return source_input ? num_frames : 0;
 }
 
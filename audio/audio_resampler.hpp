@@ -38,6 +38,7 @@ public:
 
 	void setup(float output_rate, unsigned channels, size_t frames) override;
 	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
@@ -56,7 +57,7 @@ private:
 	size_t max_num_frames = 0;
 
 	std::vector<float> input_buffer[Backend::MaxAudioChannels];
-	std::unique_ptr<DSP::SincResampler> resamplers[Backend::MaxAudioChannels];
+	std::unique_ptr<DSP::SincResampler> resampler;
 };
 }
 }
@@ -152,6 +152,50 @@ static inline void accumulate_channel_nogain(float * __restrict output, const fl
 #endif
 }
 
+static inline void accumulate_channel_i16(float * __restrict output, const int16_t * __restrict input, float gain, size_t count) noexcept
+{
+	gain *= 1.0f / float(0x8000);
+#ifdef __ARM_NEON
+	size_t rounded_count = count & ~3;
+	for (size_t i = 0; i < rounded_count; i += 4)
+	{
+		float32x4_t acc = vld1q_f32(output);
+		float32x4_t in = vcvtq_f32_s32(vmovl_s16(vld1_s16(input)));
+		acc = vmlaq_n_f32(acc, in, gain);
+		vst1q_f32(output, acc);
+
+		output += 4;
+		input += 4;
+	}
+
+	size_t overflow_count = count & 3;
+	for (size_t i = 0; i < overflow_count; i++)
+		output[i] += float(input[i]) * gain;
+#elif defined(__SSE2__)
+	size_t rounded_count = count & ~3;
+	__m128 gain_splat = _mm_set1_ps(gain);
+	for (size_t i = 0; i < rounded_count; i += 4)
+	{
+		__m128 acc = _mm_loadu_ps(output);
+		__m128i in16 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(input));
+		// Sign-extend by placing the 16-bit value in the upper half and shifting down.
+		__m128 in = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), in16), 16));
+		acc = _mm_add_ps(acc, _mm_mul_ps(in, gain_splat));
+		_mm_storeu_ps(output, acc);
+
+		output += 4;
+		input += 4;
+	}
+
+	size_t overflow_count = count & 3;
+	for (size_t i = 0; i < overflow_count; i++)
+		output[i] += float(input[i]) * gain;
+#else
+	for (size_t i = 0; i < count; i++)
+		output[i] += float(input[i]) * gain;
+#endif
+}
+
 static inline void convert_to_mono(float * __restrict output,
                                    const float * __restrict const *input,
                                    unsigned num_channels,
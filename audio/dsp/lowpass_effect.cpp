@@ -0,0 +1,102 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lowpass_effect.hpp"
+#include <cmath>
+
+#ifndef PI
+#define PI 3.14159265359
+#endif
+
+namespace Granite
+{
+namespace Audio
+{
+namespace DSP
+{
+// Biquad in transposed direct form II, with coefficients from the RBJ audio EQ cookbook.
+struct LowpassEffect : MixerEffect
+{
+	LowpassEffect(float cutoff_freq_, float q_)
+		: cutoff_freq(cutoff_freq_), q(q_)
+	{
+	}
+
+	void setup(float mixer_output_rate, unsigned mixer_channels, size_t) override
+	{
+		num_channels = mixer_channels;
+
+		// Keep the cutoff below Nyquist, or the filter becomes unstable.
+		double freq = std::fmin(double(cutoff_freq), 0.45 * mixer_output_rate);
+		double w0 = 2.0 * PI * freq / mixer_output_rate;
+		double alpha = std::sin(w0) / (2.0 * q);
+		double cos_w0 = std::cos(w0);
+		double inv_a0 = 1.0 / (1.0 + alpha);
+
+		b0 = float(0.5 * (1.0 - cos_w0) * inv_a0);
+		b1 = float((1.0 - cos_w0) * inv_a0);
+		b2 = b0;
+		a1 = float(-2.0 * cos_w0 * inv_a0);
+		a2 = float((1.0 - alpha) * inv_a0);
+
+		for (auto &s : state)
+			s[0] = s[1] = 0.0f;
+	}
+
+	void process(float *const *channels, size_t num_frames) noexcept override
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			float *samples = channels[c];
+			float z0 = state[c][0];
+			float z1 = state[c][1];
+
+			for (size_t i = 0; i < num_frames; i++)
+			{
+				float x = samples[i];
+				float y = b0 * x + z0;
+				z0 = b1 * x - a1 * y + z1;
+				z1 = b2 * x - a2 * y;
+				samples[i] = y;
+			}
+
+			state[c][0] = z0;
+			state[c][1] = z1;
+		}
+	}
+
+	float cutoff_freq;
+	float q;
+	float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+	float state[Backend::MaxAudioChannels][2] = {};
+	unsigned num_channels = 0;
+};
+
+MixerEffect *create_lowpass_effect(float cutoff_freq, float q)
+{
+	if (cutoff_freq <= 0.0f || q <= 0.0f)
+		return nullptr;
+	return new LowpassEffect(cutoff_freq, q);
+}
+}
+}
+}
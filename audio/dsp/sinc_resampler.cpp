@@ -95,6 +95,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 
 #ifndef PI
 #define PI 3.14159265359
@@ -147,9 +148,14 @@ void SincResampler::init_table_kaiser(double cutoff, unsigned phase_count, unsig
 		float delta = (val - phase_table[phase * stride * num_taps + j]);
 		phase_table[(phase * stride + 1) * num_taps + j] = delta;
 	}
+
+	// History is stored oldest first, so reverse the taps to be able to walk both arrays forwards.
+	for (unsigned row = 0; row < phase_count * stride; row++)
+		std::reverse(phase_table + row * num_taps, phase_table + (row + 1) * num_taps);
 }
 
-SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
+SincResampler::SincResampler(float out_rate, float in_rate, Quality quality, unsigned num_channels_)
+	: num_channels(num_channels_)
 {
 	double cutoff;
 	unsigned sidelobes;
@@ -198,19 +204,20 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 		taps = unsigned(ceil(taps / bandwidth_mod));
 	}
 
-	/* Be SIMD-friendly. */
-	taps = (taps + 3) & ~3;
+	/* Be SIMD-friendly, 8 taps fit in one AVX register. */
+	taps = (taps + 7) & ~7;
 
 	unsigned phase_elems = ((1u << phase_bits) * taps);
 	phase_elems = phase_elems * 2;
-	unsigned elems = phase_elems + 2 * taps;
+	history_stride = (taps + BlockInputFrames + 31) & ~31;
+	size_t elems = phase_elems + history_stride * num_channels;
 
 	main_buffer = static_cast<float *>(Util::memalign_calloc(128, sizeof(float) * elems));
 	if (!main_buffer)
 		throw std::bad_alloc();
 
 	phase_table = main_buffer;
-	window_buffer = main_buffer + phase_elems;
+	history_buffer = main_buffer + phase_elems;
 
 	init_table_kaiser(cutoff, 1u << phase_bits, taps, kaiser_beta);
 
@@ -240,83 +247,261 @@ size_t SincResampler::get_current_input_for_output_frames(size_t out_frames) con
 	return size_t(start_time);
 }
 
-size_t SincResampler::process_and_accumulate(float *output, const float *input, size_t out_frames) noexcept
+// Plans as many output frames as we can fit in one block, and advances time past them.
+size_t SincResampler::plan_block(size_t out_frames, size_t &consumed) noexcept
 {
-	uint32_t ratio = fixed_ratio;
+	// Worst case number of input frames consumed for one output frame.
+	unsigned max_step = (fixed_ratio + phases - 1) / phases;
+	out_frames = std::min<size_t>(out_frames, BlockOutputFrames);
 
-	size_t consumed_frames = 0;
-	while (out_frames)
+	size_t planned = 0;
+	consumed = 0;
+	while (planned < out_frames && consumed + max_step <= BlockInputFrames)
 	{
-		// Pump out samples.
-		while (out_frames && time < phases)
+		frame_input_offsets[planned] = unsigned(consumed);
+		frame_phase_offsets[planned] = (time >> subphase_bits) * taps * 2;
+		frame_deltas[planned] = float(time & subphase_mask) * subphase_mod;
+		planned++;
+
+		time += fixed_ratio;
+		while (time >= phases)
 		{
-			const float *buffer = window_buffer + ptr;
-			unsigned num_taps = taps;
-			unsigned phase = time >> subphase_bits;
+			consumed++;
+			time -= phases;
+		}
+	}
+
+	return planned;
+}
+
+#if defined(__AVX__)
+static inline __m256 fma_ps(__m256 c, __m256 a, __m256 b)
+{
+#ifdef __FMA__
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// Horizontally adds eight vectors at once, element i holds the sum of v[i].
+static inline __m256 reduce8(const __m256 *v)
+{
+	__m256 s01 = _mm256_hadd_ps(v[0], v[1]);
+	__m256 s23 = _mm256_hadd_ps(v[2], v[3]);
+	__m256 s45 = _mm256_hadd_ps(v[4], v[5]);
+	__m256 s67 = _mm256_hadd_ps(v[6], v[7]);
+	__m256 s0123 = _mm256_hadd_ps(s01, s23);
+	__m256 s4567 = _mm256_hadd_ps(s45, s67);
+	__m256 lo = _mm256_permute2f128_ps(s0123, s4567, 0x20);
+	__m256 hi = _mm256_permute2f128_ps(s0123, s4567, 0x31);
+	return _mm256_add_ps(lo, hi);
+}
 
-			const float *sample_phase_table = phase_table + phase * num_taps * 2;
-			const float *delta_table = sample_phase_table + num_taps;
+#define FILTER_LANES 8
+#elif defined(__SSE3__) || defined(__ARM_NEON)
+#define FILTER_LANES 4
+#else
+#define FILTER_LANES 1
+#endif
 
-#ifdef __SSE__
-			__m128 sum = _mm_setzero_ps();
-			__m128 delta = _mm_set1_ps(float(time & subphase_mask) * subphase_mod);
-			for (unsigned i = 0; i < num_taps; i += 4)
+// Filters Frames output frames per iteration.
+// Each chunk of interpolated filter taps is shared by all channels, and the horizontal adds for every
+// frame and channel in the group are done together.
+template <unsigned Channels>
+static void filter_block_impl(float * const *outputs, size_t output_offset, const float *history, size_t history_stride,
+                              const float *phase_table, unsigned taps,
+                              const unsigned *input_offsets, const unsigned *phase_offsets, const float *deltas,
+                              size_t out_frames) noexcept
+{
+	constexpr unsigned Frames = Channels < FILTER_LANES ? FILTER_LANES / Channels : 1;
+
+	for (size_t base = 0; base < out_frames; base += Frames)
+	{
+		// Keep the loop bounds constant so the accumulators stay in registers.
+		// Frames past the end just duplicate the last frame, and are ignored.
+		const float *coeffs[Frames];
+		const float *windows[Frames];
+		float frame_deltas[Frames];
+		for (unsigned f = 0; f < Frames; f++)
+		{
+			size_t frame = std::min<size_t>(base + f, out_frames - 1);
+			coeffs[f] = phase_table + phase_offsets[frame];
+			windows[f] = history + input_offsets[frame];
+			frame_deltas[f] = deltas[frame];
+		}
+
+#if defined(__AVX__)
+		__m256 acc[FILTER_LANES];
+		__m256 delta_splat[Frames];
+		for (auto &a : acc)
+			a = _mm256_setzero_ps();
+		for (unsigned f = 0; f < Frames; f++)
+			delta_splat[f] = _mm256_set1_ps(frame_deltas[f]);
+
+		for (unsigned i = 0; i < taps; i += 8)
+		{
+			for (unsigned f = 0; f < Frames; f++)
 			{
-				__m128 buf = _mm_loadu_ps(buffer + i);
-				__m128 deltas = _mm_load_ps(delta_table + i);
-				__m128 _sinc  = _mm_add_ps(_mm_load_ps(sample_phase_table + i), _mm_mul_ps(deltas, delta));
-				sum = _mm_add_ps(sum, _mm_mul_ps(buf, _sinc));
+				__m256 sinc = fma_ps(_mm256_load_ps(coeffs[f] + i), _mm256_load_ps(coeffs[f] + taps + i),
+				                     delta_splat[f]);
+				for (unsigned c = 0; c < Channels; c++)
+				{
+					acc[f * Channels + c] = fma_ps(acc[f * Channels + c],
+					                               _mm256_loadu_ps(windows[f] + c * history_stride + i), sinc);
+				}
 			}
+		}
 
-			// Horizontal add.
-			sum = _mm_add_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 2, 3)), sum);
-			sum = _mm_add_ss(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)), sum);
-			_mm_store_ss(output, _mm_add_ss(_mm_load_ss(output), sum));
-#elif defined(__ARM_NEON)
-			float delta = float(time & subphase_mask) * subphase_mod;
-			float32x4_t sum = vdupq_n_f32(0.0f);
-			for (unsigned i = 0; i < taps; i += 4)
+		alignas(32) float sums[FILTER_LANES];
+		_mm256_store_ps(sums, reduce8(acc));
+#elif defined(__SSE3__)
+		__m128 acc[FILTER_LANES];
+		__m128 delta_splat[Frames];
+		for (auto &a : acc)
+			a = _mm_setzero_ps();
+		for (unsigned f = 0; f < Frames; f++)
+			delta_splat[f] = _mm_set1_ps(frame_deltas[f]);
+
+		for (unsigned i = 0; i < taps; i += 4)
+		{
+			for (unsigned f = 0; f < Frames; f++)
 			{
-				float32x4_t phases = vld1q_f32(phase_table + i);
-				float32x4_t deltas = vld1q_f32(delta_table + i);
-				float32x4_t buf = vld1q_f32(buffer + i);
-				float32x4_t _sinc = vmlaq_n_f32(phases, deltas, delta);
-				sum = vmlaq_f32(sum, buf, _sinc);
+				__m128 sinc = _mm_add_ps(_mm_load_ps(coeffs[f] + i),
+				                         _mm_mul_ps(_mm_load_ps(coeffs[f] + taps + i), delta_splat[f]));
+				for (unsigned c = 0; c < Channels; c++)
+				{
+					acc[f * Channels + c] = _mm_add_ps(acc[f * Channels + c],
+					                                   _mm_mul_ps(_mm_loadu_ps(windows[f] + c * history_stride + i), sinc));
+				}
 			}
+		}
 
-			float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
-			float32x2_t res = vpadd_f32(half, half);
-			float32x2_t o = vld1_dup_f32(output);
-			res = vadd_f32(o, res);
-			vst1_lane_f32(output, res, 0);
-#else
-			float delta = float(time & subphase_mask) * subphase_mod;
-			float sum = 0.0f;
-			for (unsigned i = 0; i < taps; i++)
+		alignas(16) float sums[FILTER_LANES];
+		__m128 s01 = _mm_hadd_ps(acc[0], acc[1]);
+		__m128 s23 = _mm_hadd_ps(acc[2], acc[3]);
+		_mm_store_ps(sums, _mm_hadd_ps(s01, s23));
+#elif defined(__ARM_NEON)
+		float32x4_t acc[FILTER_LANES];
+		for (auto &a : acc)
+			a = vdupq_n_f32(0.0f);
+
+		for (unsigned i = 0; i < taps; i += 4)
+		{
+			for (unsigned f = 0; f < Frames; f++)
 			{
-				float sinc_val = phase_table[i] + delta_table[i] * delta;
-				sum += buffer[i] * sinc_val;
+				float32x4_t sinc = vmlaq_n_f32(vld1q_f32(coeffs[f] + i), vld1q_f32(coeffs[f] + taps + i), frame_deltas[f]);
+				for (unsigned c = 0; c < Channels; c++)
+				{
+					acc[f * Channels + c] = vmlaq_f32(acc[f * Channels + c],
+					                                  vld1q_f32(windows[f] + c * history_stride + i), sinc);
+				}
 			}
-			*output += sum;
+		}
+
+		float sums[FILTER_LANES];
+		for (unsigned l = 0; l < FILTER_LANES; l++)
+		{
+			float32x2_t half = vadd_f32(vget_low_f32(acc[l]), vget_high_f32(acc[l]));
+			sums[l] = vget_lane_f32(vpadd_f32(half, half), 0);
+		}
+#else
+		(void)history_stride;
+		float sums[FILTER_LANES] = {};
+		for (unsigned i = 0; i < taps; i++)
+		{
+			float sinc = coeffs[0][i] + coeffs[0][taps + i] * frame_deltas[0];
+			sums[0] += windows[0][i] * sinc;
+		}
 #endif
 
-			output++;
-			out_frames--;
-			time += ratio;
+		for (unsigned f = 0; f < Frames && base + f < out_frames; f++)
+			for (unsigned c = 0; c < Channels; c++)
+				outputs[c][output_offset + base + f] += sums[f * Channels + c];
+	}
+}
+
+void SincResampler::filter_block(float * const *outputs, size_t output_offset, size_t out_frames) const noexcept
+{
+#define FILTER_BLOCK(channels) \
+	filter_block_impl<channels>(outputs, output_offset, history_buffer, history_stride, phase_table, taps, \
+	                            frame_input_offsets, frame_phase_offsets, frame_deltas, out_frames)
+
+	switch (num_channels)
+	{
+	case 1: FILTER_BLOCK(1); break;
+#if FILTER_LANES >= 4
+	case 2: FILTER_BLOCK(2); break;
+	case 3: FILTER_BLOCK(3); break;
+	case 4: FILTER_BLOCK(4); break;
+#endif
+#if FILTER_LANES >= 8
+	case 5: FILTER_BLOCK(5); break;
+	case 6: FILTER_BLOCK(6); break;
+	case 7: FILTER_BLOCK(7); break;
+	case 8: FILTER_BLOCK(8); break;
+#endif
+	default:
+		// Wider than a vector, filter one channel at a time.
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			filter_block_impl<1>(outputs + c, output_offset, history_buffer + c * history_stride, history_stride,
+			                     phase_table, taps, frame_input_offsets, frame_phase_offsets, frame_deltas,
+			                     out_frames);
 		}
+		break;
+	}
+#undef FILTER_BLOCK
+}
 
-		// Drain inputs.
-		while (time >= phases)
+size_t SincResampler::process_and_accumulate(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept
+{
+	size_t consumed_frames = 0;
+	size_t produced_frames = 0;
+
+	while (produced_frames < out_frames)
+	{
+		size_t block_consumed;
+		size_t block_frames = plan_block(out_frames - produced_frames, block_consumed);
+
+		for (unsigned c = 0; c < num_channels; c++)
 		{
-			/* Push in reverse to make filter more obvious. */
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			window_buffer[ptr + taps] = input[consumed_frames];
-			window_buffer[ptr] = input[consumed_frames];
-			consumed_frames++;
-			time -= phases;
+			float *history = history_buffer + c * history_stride;
+			memcpy(history + taps, inputs[c] + consumed_frames, block_consumed * sizeof(float));
+		}
+
+		filter_block(outputs, produced_frames, block_frames);
+
+		// Slide the history window forward.
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			float *history = history_buffer + c * history_stride;
+			memmove(history, history + block_consumed, taps * sizeof(float));
+		}
+
+		produced_frames += block_frames;
+		consumed_frames += block_consumed;
+	}
+
+	return consumed_frames;
+}
+
+size_t SincResampler::skip(const float * const *inputs, size_t out_frames) noexcept
+{
+	uint64_t end_time = uint64_t(time) + uint64_t(fixed_ratio) * out_frames;
+	auto consumed_frames = size_t(end_time >> (phase_bits + subphase_bits));
+	time = uint32_t(end_time & (phases - 1));
+
+	// Only the last taps input frames matter for the filter history.
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		float *history = history_buffer + c * history_stride;
+		if (consumed_frames >= taps)
+			memcpy(history, inputs[c] + consumed_frames - taps, taps * sizeof(float));
+		else
+		{
+			memmove(history, history + consumed_frames, (taps - consumed_frames) * sizeof(float));
+			memcpy(history + taps - consumed_frames, inputs[c], consumed_frames * sizeof(float));
 		}
 	}
 
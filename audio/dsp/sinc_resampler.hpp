@@ -33,6 +33,7 @@ namespace Audio
 namespace DSP
 {
 
+// All channels of a stream are resampled in one pass, so they share the phase interpolation.
 class SincResampler
 {
 public:
@@ -42,9 +43,20 @@ public:
 		Medium,
 		High
 	};
-	SincResampler(float out_rate, float in_rate, Quality quality);
+	SincResampler(float out_rate, float in_rate, Quality quality, unsigned num_channels = 1);
 	~SincResampler();
-	size_t process_and_accumulate(float *outputs, const float *inputs, size_t out_frames) noexcept;
+
+	size_t process_and_accumulate(float * const *outputs, const float * const *inputs, size_t out_frames) noexcept;
+
+	// Consumes input exactly like process_and_accumulate() without filtering anything.
+	// The filter history is kept intact, so processing can resume seamlessly afterwards.
+	size_t skip(const float * const *inputs, size_t out_frames) noexcept;
+
+	// Mono convenience.
+	size_t process_and_accumulate(float *output, const float *input, size_t out_frames) noexcept
+	{
+		return process_and_accumulate(&output, &input, out_frames);
+	}
 
 	void operator=(const SincResampler &) = delete;
 	SincResampler(const SincResampler &) = delete;
@@ -52,12 +64,19 @@ public:
 	size_t get_maximum_input_for_output_frames(size_t out_frames) const noexcept;
 	size_t get_current_input_for_output_frames(size_t out_frames) const noexcept;
 
+	unsigned get_num_channels() const
+	{
+		return num_channels;
+	}
+
 private:
+	enum { BlockInputFrames = 512, BlockOutputFrames = 256 };
+
 	unsigned phase_bits = 0;
 	unsigned subphase_bits = 0;
 	unsigned subphase_mask = 0;
 	unsigned taps = 0;
-	unsigned ptr = 0;
+	unsigned num_channels = 0;
 	uint32_t time = 0;
 	uint32_t fixed_ratio = 0;
 	uint32_t phases = 0;
@@ -65,9 +84,20 @@ private:
 
 	float *main_buffer = nullptr;
 	float *phase_table = nullptr;
-	float *window_buffer = nullptr;
+
+	// Per channel, the last taps input frames, followed by room for one block of input.
+	// Keeping history linear lets us compute several output frames at once.
+	float *history_buffer = nullptr;
+	size_t history_stride = 0;
+
+	// Input offset into the block, phase table offset and interpolation factor for each output frame in a block.
+	unsigned frame_input_offsets[BlockOutputFrames];
+	unsigned frame_phase_offsets[BlockOutputFrames];
+	float frame_deltas[BlockOutputFrames];
 
 	void init_table_kaiser(double cutoff, unsigned phase_count, unsigned num_taps, double beta);
+	size_t plan_block(size_t out_frames, size_t &consumed) noexcept;
+	void filter_block(float * const *outputs, size_t output_offset, size_t out_frames) const noexcept;
 };
 
 }
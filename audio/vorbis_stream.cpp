@@ -25,8 +25,17 @@
 #include "dsp/dsp.hpp"
 #include "stb_vorbis.h"
 #include "logging.hpp"
+#include "audio_events.hpp"
+#include "message_queue.hpp"
+#include "lru_cache.hpp"
+#include "intrusive.hpp"
+#include "hash.hpp"
 #include <string.h>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 using namespace std;
 
@@ -74,29 +83,283 @@ struct VorbisStream : MixerStream
 	float *mix_channels[Backend::MaxAudioChannels] = {};
 };
 
+struct DecodedVorbisBuffer : Util::ThreadSafeIntrusivePtrEnabled<DecodedVorbisBuffer>
+{
+	bool decode(const string &path, DecodedSampleFormat format);
+	uint64_t get_size() const;
+
+	std::vector<float> samples_f32[Backend::MaxAudioChannels];
+	std::vector<int16_t> samples_i16[Backend::MaxAudioChannels];
+	size_t num_frames = 0;
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+	DecodedSampleFormat format = DecodedSampleFormat::F32;
+};
+using DecodedVorbisBufferHandle = Util::IntrusivePtr<DecodedVorbisBuffer>;
+
+// The buffer is immutable once decoded, so streams only need their own cursor.
 struct DecodedVorbisStream : MixerStream
 {
-	bool init(const string &path);
+	explicit DecodedVorbisStream(DecodedVorbisBufferHandle buffer_)
+		: buffer(std::move(buffer_))
+	{
+	}
 
 	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
-		return sample_rate;
+		return buffer->sample_rate;
 	}
 
 	unsigned get_num_channels() const override
 	{
-		return num_channels;
+		return buffer->num_channels;
 	}
 
-	std::vector<float> decoded_audio[Backend::MaxAudioChannels];
+	DecodedVorbisBufferHandle buffer;
 	size_t offset = 0;
-	float sample_rate = 0.0f;
-	unsigned num_channels = 0;
 	bool looping = false;
 };
 
+class DecodedVorbisCache
+{
+public:
+	DecodedVorbisCache()
+	{
+		cache.set_total_cost(DefaultBudget);
+	}
+
+	DecodedVorbisBufferHandle request(const string &path, DecodedSampleFormat format);
+	void set_budget(uint64_t bytes);
+	void clear();
+
+private:
+	enum : uint64_t { DefaultBudget = 64 * 1024 * 1024 };
+	std::mutex lock;
+	Util::LRUCache<DecodedVorbisBufferHandle> cache;
+};
+
+static DecodedVorbisCache &get_decoded_vorbis_cache()
+{
+	static DecodedVorbisCache cache;
+	return cache;
+}
+
+struct DecodeAheadVorbisStream : VorbisStream
+{
+	~DecodeAheadVorbisStream();
+
+	void setup(float mixer_output_rate, unsigned mixer_channels, size_t num_frames) override;
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_samples(float * const *scratch, size_t num_frames) noexcept override;
+
+	// Called from the decode worker thread.
+	void decode_ahead();
+
+	enum { DecodeChunkFrames = 1024, DecodeAheadFrames = 16 * 1024 };
+
+	Util::LockFreeRingBuffer<float> rings[Backend::MaxAudioChannels];
+	std::vector<float> decode_buffer[Backend::MaxAudioChannels];
+	float *decode_channels[Backend::MaxAudioChannels] = {};
+	std::atomic_bool eof{false};
+	bool registered = false;
+};
+
+// Decodes every decode-ahead stream on a single background thread.
+// The thread only lives as long as there are decode-ahead streams.
+class VorbisDecodeWorker
+{
+public:
+	static void register_stream(DecodeAheadVorbisStream *stream);
+	static void unregister_stream(DecodeAheadVorbisStream *stream);
+
+private:
+	VorbisDecodeWorker();
+	~VorbisDecodeWorker();
+	void thread_main();
+
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<DecodeAheadVorbisStream *> streams;
+	bool dead = false;
+
+	static std::mutex global_lock;
+	static VorbisDecodeWorker *global_worker;
+};
+
+std::mutex VorbisDecodeWorker::global_lock;
+VorbisDecodeWorker *VorbisDecodeWorker::global_worker;
+
+VorbisDecodeWorker::VorbisDecodeWorker()
+{
+	thread = std::thread(&VorbisDecodeWorker::thread_main, this);
+}
+
+VorbisDecodeWorker::~VorbisDecodeWorker()
+{
+	{
+		lock_guard<mutex> holder{lock};
+		dead = true;
+		cond.notify_one();
+	}
+
+	if (thread.joinable())
+		thread.join();
+}
+
+void VorbisDecodeWorker::register_stream(DecodeAheadVorbisStream *stream)
+{
+	lock_guard<mutex> holder{global_lock};
+	if (!global_worker)
+		global_worker = new VorbisDecodeWorker;
+
+	lock_guard<mutex> worker_holder{global_worker->lock};
+	global_worker->streams.push_back(stream);
+	global_worker->cond.notify_one();
+}
+
+void VorbisDecodeWorker::unregister_stream(DecodeAheadVorbisStream *stream)
+{
+	lock_guard<mutex> holder{global_lock};
+	if (!global_worker)
+		return;
+
+	bool empty;
+	{
+		// Once we hold the lock, the worker cannot be in the middle of decoding this stream.
+		lock_guard<mutex> worker_holder{global_worker->lock};
+		auto &list = global_worker->streams;
+		list.erase(remove(begin(list), end(list), stream), end(list));
+		empty = list.empty();
+	}
+
+	if (empty)
+	{
+		delete global_worker;
+		global_worker = nullptr;
+	}
+}
+
+void VorbisDecodeWorker::thread_main()
+{
+	unique_lock<mutex> holder{lock};
+	while (!dead)
+	{
+		for (auto *stream : streams)
+			stream->decode_ahead();
+
+		// The ring buffers hold several mixer periods of audio, so polling is fine.
+		cond.wait_for(holder, chrono::milliseconds(2));
+	}
+}
+
+DecodeAheadVorbisStream::~DecodeAheadVorbisStream()
+{
+	if (registered)
+		VorbisDecodeWorker::unregister_stream(this);
+}
+
+void DecodeAheadVorbisStream::setup(float mixer_output_rate, unsigned mixer_channels, size_t num_frames)
+{
+	// Might be called again if the stream is wrapped in a resampler, start over from scratch.
+	if (registered)
+	{
+		VorbisDecodeWorker::unregister_stream(this);
+		registered = false;
+	}
+
+	VorbisStream::setup(mixer_output_rate, mixer_channels, num_frames);
+
+	size_t ring_frames = std::max<size_t>(DecodeAheadFrames, 4 * num_frames);
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		rings[c].reset(ring_frames);
+		decode_buffer[c].resize(DecodeChunkFrames);
+		decode_channels[c] = decode_buffer[c].data();
+	}
+
+	stb_vorbis_seek_start(file);
+	eof.store(false, memory_order_relaxed);
+
+	// Prefill so playback can start immediately.
+	decode_ahead();
+
+	VorbisDecodeWorker::register_stream(this);
+	registered = true;
+}
+
+void DecodeAheadVorbisStream::decode_ahead()
+{
+	if (eof.load(memory_order_relaxed))
+		return;
+
+	bool decoded_since_seek = true;
+
+	// Channels are written in order, and read in order, so the last channel has the least space available.
+	while (rings[num_channels - 1].write_avail() >= DecodeChunkFrames)
+	{
+		int ret = stb_vorbis_get_samples_float(file, int(num_channels), decode_channels, DecodeChunkFrames);
+		if (ret < 0 || (ret == 0 && (!looping || !decoded_since_seek)))
+		{
+			eof.store(true, memory_order_release);
+			return;
+		}
+		else if (ret == 0)
+		{
+			stb_vorbis_seek_start(file);
+			decoded_since_seek = false;
+			continue;
+		}
+
+		for (unsigned c = 0; c < num_channels; c++)
+			rings[c].write_and_move(decode_channels[c], size_t(ret));
+		decoded_since_seek = true;
+	}
+}
+
+size_t DecodeAheadVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
+{
+	// Check for EOF before checking available samples, so we cannot miss the last samples.
+	bool at_end = eof.load(memory_order_acquire);
+	size_t to_read = std::min(rings[num_channels - 1].read_avail(), num_frames);
+
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		rings[c].read_and_move(mix_channels[c], to_read);
+		DSP::accumulate_channel(channels[c], mix_channels[c], gains[c], to_read);
+	}
+
+	if (to_read < num_frames)
+	{
+		if (at_end)
+			return to_read;
+
+		// Keep the stream alive and play silence until the decoder catches up.
+		emplace_audio_event_on_queue<StreamUnderrunEvent>(get_message_queue(), get_stream_id(),
+		                                                 unsigned(num_frames - to_read));
+	}
+
+	return num_frames;
+}
+
+size_t DecodeAheadVorbisStream::skip_samples(float *const *, size_t num_frames) noexcept
+{
+	bool at_end = eof.load(memory_order_acquire);
+	size_t to_read = std::min(rings[num_channels - 1].read_avail(), num_frames);
+
+	for (unsigned c = 0; c < num_channels; c++)
+		rings[c].read_and_move(mix_channels[c], to_read);
+
+	// Underruns are inaudible while virtualized, no need to report them.
+	if (to_read < num_frames && at_end)
+		return to_read;
+	else
+		return num_frames;
+}
+
 bool VorbisStream::init(const string &path)
 {
 	filesystem_file = Global::filesystem()->open(path, FileMode::ReadOnly);
@@ -125,7 +388,7 @@ bool VorbisStream::init(const string &path)
 	return true;
 }
 
-bool DecodedVorbisStream::init(const string &path)
+bool DecodedVorbisBuffer::decode(const string &path, DecodedSampleFormat format_)
 {
 	auto filesystem_file = Global::filesystem()->open(path, FileMode::ReadOnly);
 	if (!filesystem_file)
@@ -150,6 +413,17 @@ bool DecodedVorbisStream::init(const string &path)
 	auto info = stb_vorbis_get_info(file);
 	sample_rate = info.sample_rate;
 	num_channels = unsigned(info.channels);
+	format = format_;
+
+	// Avoids reallocating while decoding.
+	size_t expected_frames = stb_vorbis_stream_length_in_samples(file);
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		if (format == DecodedSampleFormat::I16)
+			samples_i16[c].reserve(expected_frames);
+		else
+			samples_f32[c].reserve(expected_frames);
+	}
 
 	float block[Backend::MaxAudioChannels][256];
 	float *mix_channels[Backend::MaxAudioChannels];
@@ -158,30 +432,94 @@ bool DecodedVorbisStream::init(const string &path)
 
 	int ret;
 	while ((ret = stb_vorbis_get_samples_float(file, int(num_channels), mix_channels, 256)) > 0)
+	{
 		for (unsigned c = 0; c < num_channels; c++)
-			decoded_audio[c].insert(end(decoded_audio[c]), mix_channels[c], mix_channels[c] + ret);
-
-	if (ret < 0)
-		goto error;
+		{
+			if (format == DecodedSampleFormat::I16)
+			{
+				for (int i = 0; i < ret; i++)
+					samples_i16[c].push_back(DSP::f32_to_i16(mix_channels[c][i]));
+			}
+			else
+				samples_f32[c].insert(end(samples_f32[c]), mix_channels[c], mix_channels[c] + ret);
+		}
+		num_frames += size_t(ret);
+	}
 
 	stb_vorbis_close(file);
-	return true;
+	return ret == 0;
+}
 
-error:
-	stb_vorbis_close(file);
-	return false;
+uint64_t DecodedVorbisBuffer::get_size() const
+{
+	size_t sample_size = format == DecodedSampleFormat::I16 ? sizeof(int16_t) : sizeof(float);
+	return uint64_t(num_frames) * num_channels * sample_size;
+}
+
+DecodedVorbisBufferHandle DecodedVorbisCache::request(const string &path, DecodedSampleFormat format)
+{
+	Util::Hasher h;
+	h.string(path);
+	h.u32(uint32_t(format));
+	auto cookie = h.get();
+
+	{
+		lock_guard<mutex> holder{lock};
+		auto *entry = cache.find_and_mark_as_recent(cookie);
+		if (entry)
+			return *entry;
+	}
+
+	// Decode outside the lock, so unrelated streams can be created in parallel.
+	DecodedVorbisBufferHandle buffer(new DecodedVorbisBuffer);
+	if (!buffer->decode(path, format))
+		return {};
+
+	lock_guard<mutex> holder{lock};
+	auto *entry = cache.find_and_mark_as_recent(cookie);
+	if (entry)
+		return *entry;
+
+	*cache.allocate(cookie, buffer->get_size()) = buffer;
+	cache.prune();
+	return buffer;
+}
+
+void DecodedVorbisCache::set_budget(uint64_t bytes)
+{
+	lock_guard<mutex> holder{lock};
+	cache.set_total_cost(bytes);
+	cache.prune();
+}
+
+void DecodedVorbisCache::clear()
+{
+	lock_guard<mutex> holder{lock};
+	uint64_t budget = cache.get_total_cost_limit();
+	cache.set_total_cost(0);
+	cache.prune();
+	cache.set_total_cost(budget);
 }
 
 size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
 {
-	size_t to_write = std::min(decoded_audio[0].size() - offset, num_frames);
+	size_t to_write = std::min(buffer->num_frames - offset, num_frames);
+	unsigned num_channels = buffer->num_channels;
 
-	for (unsigned c = 0; c < num_channels; c++)
-		DSP::accumulate_channel(channels[c], decoded_audio[c].data() + offset, gains[c], to_write);
+	if (buffer->format == DecodedSampleFormat::I16)
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel_i16(channels[c], buffer->samples_i16[c].data() + offset, gains[c], to_write);
+	}
+	else
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], buffer->samples_f32[c].data() + offset, gains[c], to_write);
+	}
 
 	offset += to_write;
 
-	if (offset >= decoded_audio[0].size())
+	if (offset >= buffer->num_frames)
 	{
 		if (looping)
 			offset = 0;
@@ -202,6 +540,27 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 		return to_write;
 }
 
+size_t DecodedVorbisStream::skip_samples(float *const *, size_t num_frames) noexcept
+{
+	size_t skipped = 0;
+	while (skipped < num_frames)
+	{
+		size_t to_skip = std::min(buffer->num_frames - offset, num_frames - skipped);
+		offset += to_skip;
+		skipped += to_skip;
+
+		if (offset >= buffer->num_frames)
+		{
+			if (looping && buffer->num_frames)
+				offset = 0;
+			else
+				break;
+		}
+	}
+
+	return skipped;
+}
+
 size_t VorbisStream::accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept
 {
 	auto actual_frames = stb_vorbis_get_samples_float(file, num_channels, mix_channels, int(num_frames));
@@ -242,9 +601,9 @@ MixerStream *create_vorbis_stream(const string &path, bool looping)
 	return vorbis;
 }
 
-MixerStream *create_decoded_vorbis_stream(const string &path, bool looping)
+MixerStream *create_decode_ahead_vorbis_stream(const string &path, bool looping)
 {
-	auto vorbis = new DecodedVorbisStream;
+	auto vorbis = new DecodeAheadVorbisStream;
 	if (!vorbis->init(path))
 	{
 		vorbis->dispose();
@@ -254,5 +613,26 @@ MixerStream *create_decoded_vorbis_stream(const string &path, bool looping)
 	vorbis->looping = looping;
 	return vorbis;
 }
+
+MixerStream *create_decoded_vorbis_stream(const string &path, bool looping, DecodedSampleFormat format)
+{
+	auto buffer = get_decoded_vorbis_cache().request(path, format);
+	if (!buffer)
+		return nullptr;
+
+	auto vorbis = new DecodedVorbisStream(std::move(buffer));
+	vorbis->looping = looping;
+	return vorbis;
+}
+
+void set_decoded_vorbis_cache_budget(uint64_t bytes)
+{
+	get_decoded_vorbis_cache().set_budget(bytes);
+}
+
+void clear_decoded_vorbis_cache()
+{
+	get_decoded_vorbis_cache().clear();
+}
 }
 }
\ No newline at end of file
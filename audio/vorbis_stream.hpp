@@ -24,12 +24,29 @@
 
 #include "audio_mixer.hpp"
 #include <string>
+#include <stdint.h>
 
 namespace Granite
 {
 namespace Audio
 {
 MixerStream *create_vorbis_stream(const std::string &path, bool looping = false);
-MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping = false);
+enum class DecodedSampleFormat
+{
+	F32,
+	// Halves memory footprint at the cost of converting while mixing.
+	I16
+};
+
+// Decoded PCM data is shared between all streams created from the same path and format.
+// Recently used decodes are kept around in a cache, so triggering the same sound again does not decode it again.
+MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping = false,
+                                          DecodedSampleFormat format = DecodedSampleFormat::F32);
+void set_decoded_vorbis_cache_budget(uint64_t bytes);
+void clear_decoded_vorbis_cache();
+
+// Decoding happens ahead of time on a background thread, so the mixer thread only copies samples.
+// If the decoder falls behind, silence is played and a StreamUnderrunEvent is posted to the mixer message queue.
+MixerStream *create_decode_ahead_vorbis_stream(const std::string &path, bool looping = false);
 }
 }
@@ -28,11 +28,27 @@
 #include "string_helpers.hpp"
 
 #include "spirv-tools/libspirv.hpp"
+#include "hash.hpp"
+
+#ifndef GRANITE_SHADER_COMPILER_REVISION
+#define GRANITE_SHADER_COMPILER_REVISION "unknown"
+#endif
 
 using namespace std;
 
 namespace Granite
 {
+uint64_t GLSLCompiler::get_compiler_version_hash()
+{
+	Util::Hasher h;
+	unsigned version = 0, revision = 0;
+	shaderc_get_spv_version(&version, &revision);
+	h.u32(version);
+	h.u32(revision);
+	h.string(GRANITE_SHADER_COMPILER_REVISION);
+	h.u32(GRANITE_COMPILER_OPTIMIZE);
+	return h.get();
+}
 
 Stage GLSLCompiler::stage_from_path(const std::string &path)
 {
@@ -166,6 +182,11 @@ bool GLSLCompiler::preprocess()
 }
 
 vector<uint32_t> GLSLCompiler::compile(const vector<pair<string, int>> *defines)
+{
+	return compile(error_message, defines);
+}
+
+vector<uint32_t> GLSLCompiler::compile(string &error_string, const vector<pair<string, int>> *defines) const
 {
 	shaderc::Compiler compiler;
 	shaderc::CompileOptions options;
@@ -233,10 +254,10 @@ vector<uint32_t> GLSLCompiler::compile(const vector<pair<string, int>> *defines)
 	}
 	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(preprocessed_source, kind, source_path.c_str(), options);
 
-	error_message.clear();
+	error_string.clear();
 	if (result.GetCompilationStatus() != shaderc_compilation_status_success)
 	{
-		error_message = result.GetErrorMessage();
+		error_string = result.GetErrorMessage();
 		return {};
 	}
 
@@ -244,8 +265,8 @@ vector<uint32_t> GLSLCompiler::compile(const vector<pair<string, int>> *defines)
 
 	spvtools::SpirvTools core(target == Target::Vulkan11 ? SPV_ENV_VULKAN_1_1 : SPV_ENV_VULKAN_1_0);
 
-	core.SetMessageConsumer([this](spv_message_level_t, const char *, const spv_position_t&, const char *message) {
-		error_message = message;
+	core.SetMessageConsumer([&error_string](spv_message_level_t, const char *, const spv_position_t&, const char *message) {
+		error_string = message;
 	});
 
 	spvtools::ValidatorOptions opts;
@@ -73,6 +73,9 @@ public:
 
 	std::vector<uint32_t> compile(const std::vector<std::pair<std::string, int>> *defines = nullptr);
 
+	// Can be called concurrently from multiple threads once the source is preprocessed.
+	std::vector<uint32_t> compile(std::string &error_string, const std::vector<std::pair<std::string, int>> *defines = nullptr) const;
+
 	const std::unordered_set<std::string> &get_dependencies() const
 	{
 		return dependencies;
@@ -100,6 +103,41 @@ public:
 		strip = strip_;
 	}
 
+	// Everything which affects the output of compile() other than defines.
+	const std::string &get_preprocessed_source() const
+	{
+		return preprocessed_source;
+	}
+
+	Target get_target() const
+	{
+		return target;
+	}
+
+	Stage get_stage() const
+	{
+		return stage;
+	}
+
+	Optimization get_optimization() const
+	{
+		return optimization;
+	}
+
+	bool get_strip() const
+	{
+		return strip;
+	}
+
+	const std::string &get_source_path() const
+	{
+		return source_path;
+	}
+
+	// Identifies the compiler build, i.e. the shaderc, glslang and SPIRV-Tools revisions,
+	// and whether it was built with GRANITE_COMPILER_OPTIMIZE.
+	static uint64_t get_compiler_version_hash();
+
 private:
 	std::string source;
 	std::string source_path;
@@ -91,7 +91,7 @@ private:
 };
 
 using ComponentNode = Util::IntrusivePODWrapper<ComponentBase *>;
-using ComponentHashMap = Util::IntrusiveHashMapHolder<ComponentNode>;
+using ComponentHashMap = Util::IntrusiveHashMapGroupedHolder<ComponentNode>;
 using ComponentGroupHashMap = Util::IntrusiveHashMap<ComponentSet>;
 
 struct ComponentIDMapping
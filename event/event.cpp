@@ -21,7 +21,9 @@
  */
 
 #include "event.hpp"
+#include "aligned_alloc.hpp"
 #include <algorithm>
+#include <thread>
 #include <assert.h>
 
 using namespace std;
@@ -29,6 +31,116 @@ using namespace std;
 namespace Granite
 {
 
+EventManager::EventArena::EventArena()
+{
+	writers.store(0, memory_order_relaxed);
+	head.store(nullptr, memory_order_relaxed);
+	current.store(allocate_block(BlockSize), memory_order_relaxed);
+}
+
+EventManager::EventArena::~EventArena()
+{
+	// Events which were enqueued too late to be dispatched.
+	for (auto *queued = take_all(); queued; queued = queued->next)
+		queued->event->~Event();
+
+	for (auto *block : blocks)
+	{
+		Util::memalign_free(block->data);
+		delete block;
+	}
+}
+
+EventManager::EventArena::Block *EventManager::EventArena::allocate_block(size_t size)
+{
+	auto *block = new Block;
+	block->data = static_cast<uint8_t *>(Util::memalign_alloc(64, size));
+	block->size = size;
+	block->offset.store(0, memory_order_relaxed);
+	blocks.push_back(block);
+	return block;
+}
+
+void *EventManager::EventArena::allocate(size_t size)
+{
+	size = (size + EventArenaAlignment - 1) & ~size_t(EventArenaAlignment - 1);
+
+	for (;;)
+	{
+		auto *block = current.load(memory_order_acquire);
+		size_t offset = block->offset.fetch_add(size, memory_order_relaxed);
+		if (offset + size <= block->size)
+			return block->data + offset;
+
+		// Slow path, move on to the next block, which is usually recycled from an earlier frame.
+		lock_guard<mutex> holder{lock};
+		if (current.load(memory_order_relaxed) != block)
+			continue;
+
+		Block *next_block = nullptr;
+		while (++current_index < blocks.size())
+		{
+			if (blocks[current_index]->size >= size)
+			{
+				next_block = blocks[current_index];
+				break;
+			}
+		}
+
+		if (!next_block)
+		{
+			next_block = allocate_block(max<size_t>(BlockSize, size));
+			current_index = blocks.size() - 1;
+		}
+
+		current.store(next_block, memory_order_release);
+	}
+}
+
+void EventManager::EventArena::push(QueuedEvent *queued)
+{
+	auto *old_head = head.load(memory_order_relaxed);
+	do
+	{
+		queued->next = old_head;
+	} while (!head.compare_exchange_weak(old_head, queued, memory_order_release, memory_order_relaxed));
+}
+
+EventManager::QueuedEvent *EventManager::EventArena::take_all()
+{
+	return head.exchange(nullptr, memory_order_acquire);
+}
+
+void EventManager::EventArena::reset()
+{
+	// Only called when there are no writers.
+	for (auto *block : blocks)
+		block->offset.store(0, memory_order_relaxed);
+	current_index = 0;
+	current.store(blocks.front(), memory_order_relaxed);
+}
+
+EventManager::EventManager()
+{
+	active_arena.store(0, memory_order_relaxed);
+}
+
+EventManager::EventArena &EventManager::begin_enqueue()
+{
+	for (;;)
+	{
+		uint32_t index = active_arena.load(memory_order_seq_cst);
+		auto &arena = arenas[index];
+		arena.writers.fetch_add(1, memory_order_seq_cst);
+
+		// If dispatch() flipped the arenas in the meantime, it might not have observed our writer count.
+		if (active_arena.load(memory_order_seq_cst) == index)
+			return arena;
+
+		arena.writers.fetch_sub(1, memory_order_release);
+	}
+}
+
 EventManager::~EventManager()
 {
 	dispatch();
@@ -47,20 +159,53 @@ EventManager::~EventManager()
 
 void EventManager::dispatch()
 {
-	for (auto &event_type : events)
+	// Flip arenas so new events, including ones enqueued by the handlers we are about to call,
+	// go to the next dispatch. Wait for writers which are still in the middle of enqueueing into the old arena.
+	uint32_t index = active_arena.load(memory_order_relaxed);
+	auto &arena = arenas[index];
+	active_arena.store(index ^ 1, memory_order_seq_cst);
+	while (arena.writers.load(memory_order_seq_cst) != 0)
+		this_thread::yield();
+
+	// The list is in LIFO order, restore enqueue order.
+	for (auto *queued = arena.take_all(); queued; queued = queued->next)
+		dispatch_list.push_back(queued);
+	reverse(begin(dispatch_list), end(dispatch_list));
+
+	// Only visit event types which actually have events pending.
+	for (auto *queued : dispatch_list)
 	{
-		auto &handlers = event_type.handlers;
-		auto &queued_events = event_type.queued_events;
+		auto &event_type = events[queued->type];
+		if (!event_type.dirty)
+		{
+			event_type.dirty = true;
+			dirty_types.push_back(&event_type);
+		}
+		event_type.queued_events.push_back(queued->event);
+	}
+
+	for (auto *event_type : dirty_types)
+	{
+		auto &handlers = event_type->handlers;
+		auto &queued_events = event_type->queued_events;
 		auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) {
-			for (auto &event : queued_events)
+			for (auto *event : queued_events)
 				if (!handler.mem_fn(handler.handler, *event))
 					return true;
 			return false;
 		});
 
 		handlers.erase(itr, end(handlers));
+
+		for (auto *event : queued_events)
+			event->~Event();
 		queued_events.clear();
+		event_type->dirty = false;
 	}
+
+	dirty_types.clear();
+	dispatch_list.clear();
+	arena.reset();
 }
 
 void EventManager::dispatch_event(std::vector<Handler> &handlers, const Event &e)
@@ -26,6 +26,9 @@
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <atomic>
+#include <mutex>
+#include <new>
 #include "global_managers.hpp"
 #include "compile_time_hash.hpp"
 #include "intrusive_hash_map.hpp"
@@ -107,15 +110,25 @@ private:
 
 class EventManager
 {
+	struct QueuedEvent;
+	class EventArena;
+
 public:
+	EventManager();
+
+	// Thread-safe, can be called from any thread, including from event handlers.
+	// Events are dispatched on the next call to dispatch(). Memory for the event is recycled after it is dispatched.
 	template<typename T, typename... P>
 	void enqueue(P&&... p)
 	{
+		static_assert(alignof(T) <= EventArenaAlignment, "Event type is overaligned.");
 		static constexpr auto type = T::get_type_id();
-		auto &l = events[type];
 
-		auto ptr = std::unique_ptr<Event>(new T(std::forward<P>(p)...));
-		l.queued_events.emplace_back(std::move(ptr));
+		EnqueueScope scope(*this);
+		auto *queued = static_cast<QueuedEvent *>(scope.arena->allocate(sizeof(QueuedEvent) + sizeof(T)));
+		queued->event = new (queued + 1) T(std::forward<P>(p)...);
+		queued->type = type;
+		scope.arena->push(queued);
 	}
 
 	template<typename T, typename... P>
@@ -156,6 +169,7 @@ public:
 		dispatch_event(l.handlers, e);
 	}
 
+	// Must be called from the thread which owns the event manager.
 	void dispatch();
 
 	template<typename T, typename EventType, bool (T::*mem_fn)(const EventType &)>
@@ -234,11 +248,12 @@ private:
 
 	struct EventTypeData : Util::IntrusiveHashMapEnabled<EventTypeData>
 	{
-		std::vector<std::unique_ptr<Event>> queued_events;
+		std::vector<Event *> queued_events;
 		std::vector<Handler> handlers;
 		std::vector<Handler> recursive_handlers;
 		bool enqueueing = false;
 		bool dispatching = false;
+		bool dirty = false;
 
 		void flush_recursive_handlers();
 	};
@@ -268,5 +283,70 @@ private:
 	Util::IntrusiveHashMap<EventTypeData> events;
 	Util::IntrusiveHashMap<LatchEventTypeData> latched_events;
 	uint64_t cookie_counter = 0;
+
+	enum { EventArenaAlignment = 16 };
+
+	struct alignas(EventArenaAlignment) QueuedEvent
+	{
+		QueuedEvent *next;
+		Event *event;
+		EventType type;
+	};
+
+	// Bump allocator with a lock-free list of the events allocated from it.
+	// Blocks are kept around after reset(), so steady state enqueueing never hits the heap.
+	class EventArena
+	{
+	public:
+		EventArena();
+		~EventArena();
+
+		void *allocate(size_t size);
+		void push(QueuedEvent *queued);
+		QueuedEvent *take_all();
+		void reset();
+
+		std::atomic<uint32_t> writers;
+
+	private:
+		struct Block
+		{
+			uint8_t *data;
+			size_t size;
+			std::atomic<size_t> offset;
+		};
+		enum { BlockSize = 64 * 1024 };
+
+		std::atomic<QueuedEvent *> head;
+		std::atomic<Block *> current;
+		std::vector<Block *> blocks;
+		size_t current_index = 0;
+		std::mutex lock;
+
+		Block *allocate_block(size_t size);
+	};
+
+	// Producers enqueue into one arena while the other is being dispatched and recycled.
+	EventArena arenas[2];
+	std::atomic<uint32_t> active_arena;
+	std::vector<EventTypeData *> dirty_types;
+	std::vector<QueuedEvent *> dispatch_list;
+
+	EventArena &begin_enqueue();
+
+	struct EnqueueScope
+	{
+		explicit EnqueueScope(EventManager &manager)
+			: arena(&manager.begin_enqueue())
+		{
+		}
+
+		~EnqueueScope()
+		{
+			arena->writers.fetch_sub(1, std::memory_order_release);
+		}
+
+		EventArena *arena;
+	};
 };
 }
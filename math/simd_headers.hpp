@@ -31,6 +31,9 @@
 #if !defined(__SSE__)
 #define __SSE__ 1
 #endif
+#if !defined(__SSE2__) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define __SSE2__ 1
+#endif
 #if defined(_INCLUDED_IMM) && !defined(__AVX__)
 #define __AVX__ 1
 #endif
@@ -39,6 +42,8 @@
 #include <immintrin.h>
 #elif defined(__SSE3__)
 #include <pmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
 #elif defined(__SSE__)
 #include <xmmintrin.h>
 #elif defined(__ARM_NEON)
@@ -21,11 +21,243 @@
  */
 
 #include "animation_system.hpp"
+#include "simd_headers.hpp"
+#include "small_vector.hpp"
+#include <algorithm>
+#include <string.h>
 
 using namespace std;
 
 namespace Granite
 {
+void AnimationPose::resize(unsigned count)
+{
+	size_t padded = (count + JointsPerStep - 1) & ~(JointsPerStep - 1);
+	for (unsigned c = 0; c < 4; c++)
+		rotation[c].resize(padded, c == 3 ? 1.0f : 0.0f);
+	for (auto &t : translation)
+		t.resize(padded, 0.0f);
+	for (auto &s : scale)
+		s.resize(padded, 1.0f);
+	num_joints = count;
+}
+
+unsigned AnimationPose::get_num_joints() const
+{
+	return num_joints;
+}
+
+void AnimationPose::set_identity()
+{
+	for (unsigned c = 0; c < 4; c++)
+		fill(begin(rotation[c]), end(rotation[c]), c == 3 ? 1.0f : 0.0f);
+	for (auto &t : translation)
+		fill(begin(t), end(t), 0.0f);
+	for (auto &s : scale)
+		fill(begin(s), end(s), 1.0f);
+}
+
+vec4 AnimationPose::get_rotation(unsigned joint) const
+{
+	return vec4(rotation[0][joint], rotation[1][joint], rotation[2][joint], rotation[3][joint]);
+}
+
+vec3 AnimationPose::get_translation(unsigned joint) const
+{
+	return vec3(translation[0][joint], translation[1][joint], translation[2][joint]);
+}
+
+vec3 AnimationPose::get_scale(unsigned joint) const
+{
+	return vec3(scale[0][joint], scale[1][joint], scale[2][joint]);
+}
+
+void AnimationPose::set_rotation(unsigned joint, const vec4 &q)
+{
+	for (unsigned c = 0; c < 4; c++)
+		rotation[c][joint] = q[c];
+}
+
+void AnimationPose::set_translation(unsigned joint, const vec3 &t)
+{
+	for (unsigned c = 0; c < 3; c++)
+		translation[c][joint] = t[c];
+}
+
+void AnimationPose::set_scale(unsigned joint, const vec3 &s)
+{
+	for (unsigned c = 0; c < 3; c++)
+		scale[c][joint] = s[c];
+}
+
+void AnimationPose::load(const Transform *const *transforms, unsigned count)
+{
+	resize(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		set_rotation(i, transforms[i]->rotation.as_vec4());
+		set_translation(i, transforms[i]->translation);
+		set_scale(i, transforms[i]->scale);
+	}
+}
+
+void AnimationPose::store(Transform *const *transforms, unsigned count) const
+{
+	count = muglm::min(count, get_num_joints());
+	for (unsigned i = 0; i < count; i++)
+	{
+		transforms[i]->rotation = quat(get_rotation(i));
+		transforms[i]->translation = get_translation(i);
+		transforms[i]->scale = get_scale(i);
+	}
+}
+
+// The kernels below work on four joints at a time, one joint per lane.
+#if defined(__SSE__)
+using JointLanes = __m128;
+static inline JointLanes lanes_load(const float *v) { return _mm_loadu_ps(v); }
+static inline void lanes_store(float *v, JointLanes x) { _mm_storeu_ps(v, x); }
+static inline JointLanes lanes_splat(float v) { return _mm_set1_ps(v); }
+static inline JointLanes lanes_add(JointLanes a, JointLanes b) { return _mm_add_ps(a, b); }
+static inline JointLanes lanes_sub(JointLanes a, JointLanes b) { return _mm_sub_ps(a, b); }
+static inline JointLanes lanes_mul(JointLanes a, JointLanes b) { return _mm_mul_ps(a, b); }
+static inline JointLanes lanes_div(JointLanes a, JointLanes b) { return _mm_div_ps(a, b); }
+static inline JointLanes lanes_sqrt(JointLanes a) { return _mm_sqrt_ps(a); }
+// Flips the sign of v in the lanes where s is negative.
+static inline JointLanes lanes_flip_sign(JointLanes v, JointLanes s)
+{
+	return _mm_xor_ps(v, _mm_and_ps(s, _mm_set1_ps(-0.0f)));
+}
+#else
+struct JointLanes
+{
+	float v[AnimationPose::JointsPerStep];
+};
+
+template <typename Op>
+static inline JointLanes lanes_op(JointLanes a, JointLanes b, const Op &op)
+{
+	JointLanes res;
+	for (unsigned i = 0; i < AnimationPose::JointsPerStep; i++)
+		res.v[i] = op(a.v[i], b.v[i]);
+	return res;
+}
+
+static inline JointLanes lanes_load(const float *v) { JointLanes res; memcpy(res.v, v, sizeof(res.v)); return res; }
+static inline void lanes_store(float *v, JointLanes x) { memcpy(v, x.v, sizeof(x.v)); }
+static inline JointLanes lanes_splat(float v) { return { { v, v, v, v } }; }
+static inline JointLanes lanes_add(JointLanes a, JointLanes b) { return lanes_op(a, b, [](float x, float y) { return x + y; }); }
+static inline JointLanes lanes_sub(JointLanes a, JointLanes b) { return lanes_op(a, b, [](float x, float y) { return x - y; }); }
+static inline JointLanes lanes_mul(JointLanes a, JointLanes b) { return lanes_op(a, b, [](float x, float y) { return x * y; }); }
+static inline JointLanes lanes_div(JointLanes a, JointLanes b) { return lanes_op(a, b, [](float x, float y) { return x / y; }); }
+static inline JointLanes lanes_sqrt(JointLanes a) { return lanes_op(a, a, [](float x, float) { return muglm::sqrt(x); }); }
+static inline JointLanes lanes_flip_sign(JointLanes v, JointLanes s)
+{
+	return lanes_op(v, s, [](float x, float y) { return y < 0.0f ? -x : x; });
+}
+#endif
+
+static inline JointLanes lanes_mix(JointLanes a, JointLanes b, JointLanes w)
+{
+	return lanes_add(a, lanes_mul(lanes_sub(b, a), w));
+}
+
+static inline void lanes_normalize4(JointLanes q[4])
+{
+	JointLanes len2 = lanes_mul(q[0], q[0]);
+	for (unsigned c = 1; c < 4; c++)
+		len2 = lanes_add(len2, lanes_mul(q[c], q[c]));
+	JointLanes len = lanes_sqrt(len2);
+	for (unsigned c = 0; c < 4; c++)
+		q[c] = lanes_div(q[c], len);
+}
+
+// out = mix(a, b, weight) for every joint. out may alias a.
+static void blend_poses(AnimationPose &out, const AnimationPose &a, const AnimationPose &b, float weight)
+{
+	unsigned count = muglm::min(a.get_num_joints(), b.get_num_joints());
+	out.resize(count);
+
+	const JointLanes w = lanes_splat(weight);
+	for (size_t i = 0; i < count; i += AnimationPose::JointsPerStep)
+	{
+		JointLanes ar[4], br[4];
+		for (unsigned c = 0; c < 4; c++)
+		{
+			ar[c] = lanes_load(a.rotation[c].data() + i);
+			br[c] = lanes_load(b.rotation[c].data() + i);
+		}
+
+		// Blend in the same hemisphere.
+		JointLanes d = lanes_mul(ar[0], br[0]);
+		for (unsigned c = 1; c < 4; c++)
+			d = lanes_add(d, lanes_mul(ar[c], br[c]));
+
+		for (unsigned c = 0; c < 4; c++)
+			ar[c] = lanes_mix(ar[c], lanes_flip_sign(br[c], d), w);
+		lanes_normalize4(ar);
+
+		for (unsigned c = 0; c < 4; c++)
+			lanes_store(out.rotation[c].data() + i, ar[c]);
+
+		for (unsigned c = 0; c < 3; c++)
+		{
+			lanes_store(out.translation[c].data() + i,
+			            lanes_mix(lanes_load(a.translation[c].data() + i), lanes_load(b.translation[c].data() + i), w));
+			lanes_store(out.scale[c].data() + i,
+			            lanes_mix(lanes_load(a.scale[c].data() + i), lanes_load(b.scale[c].data() + i), w));
+		}
+	}
+}
+
+// Applies a weighted additive pose (relative to identity) on top of base.
+static void add_pose(AnimationPose &base, const AnimationPose &delta, float weight)
+{
+	unsigned count = muglm::min(base.get_num_joints(), delta.get_num_joints());
+
+	const JointLanes w = lanes_splat(weight);
+	const JointLanes zero = lanes_splat(0.0f);
+	const JointLanes one = lanes_splat(1.0f);
+	for (size_t i = 0; i < count; i += AnimationPose::JointsPerStep)
+	{
+		// Scale the delta rotation from identity in the hemisphere where w is positive.
+		JointLanes dr[4];
+		JointLanes dw = lanes_load(delta.rotation[3].data() + i);
+		for (unsigned c = 0; c < 4; c++)
+			dr[c] = lanes_mix(c == 3 ? one : zero, lanes_flip_sign(lanes_load(delta.rotation[c].data() + i), dw), w);
+		lanes_normalize4(dr);
+
+		JointLanes p[4];
+		for (unsigned c = 0; c < 4; c++)
+			p[c] = lanes_load(base.rotation[c].data() + i);
+
+		// base * delta.
+		JointLanes rx = lanes_sub(lanes_add(lanes_add(lanes_mul(p[3], dr[0]), lanes_mul(p[0], dr[3])),
+		                                    lanes_mul(p[1], dr[2])), lanes_mul(p[2], dr[1]));
+		JointLanes ry = lanes_sub(lanes_add(lanes_add(lanes_mul(p[3], dr[1]), lanes_mul(p[1], dr[3])),
+		                                    lanes_mul(p[2], dr[0])), lanes_mul(p[0], dr[2]));
+		JointLanes rz = lanes_sub(lanes_add(lanes_add(lanes_mul(p[3], dr[2]), lanes_mul(p[2], dr[3])),
+		                                    lanes_mul(p[0], dr[1])), lanes_mul(p[1], dr[0]));
+		JointLanes rw = lanes_sub(lanes_sub(lanes_sub(lanes_mul(p[3], dr[3]), lanes_mul(p[0], dr[0])),
+		                                    lanes_mul(p[1], dr[1])), lanes_mul(p[2], dr[2]));
+		lanes_store(base.rotation[0].data() + i, rx);
+		lanes_store(base.rotation[1].data() + i, ry);
+		lanes_store(base.rotation[2].data() + i, rz);
+		lanes_store(base.rotation[3].data() + i, rw);
+
+		for (unsigned c = 0; c < 3; c++)
+		{
+			JointLanes t = lanes_add(lanes_load(base.translation[c].data() + i),
+			                         lanes_mul(lanes_load(delta.translation[c].data() + i), w));
+			lanes_store(base.translation[c].data() + i, t);
+
+			JointLanes s = lanes_mul(lanes_load(base.scale[c].data() + i),
+			                         lanes_mix(one, lanes_load(delta.scale[c].data() + i), w));
+			lanes_store(base.scale[c].data() + i, s);
+		}
+	}
+}
+
 template <typename T, typename Sampler>
 static void resample_channel(T *resampled, size_t count, const SceneFormats::AnimationChannel &channel, const Sampler &sampler, float inv_frame_rate)
 {
@@ -91,16 +323,23 @@ uint32_t AnimationUnrolled::get_multi_node_index(unsigned channel) const
 	return multi_node_indices[channel];
 }
 
+void AnimationUnrolled::compute_sample_range(float offset_time, int &lo, int &hi, float &l) const
+{
+	float sample = offset_time * frame_rate;
+	float low_sample = muglm::floor(sample);
+	lo = clamp(int(low_sample), 0, int(num_samples) - 1);
+	hi = muglm::min(lo + 1, int(num_samples) - 1);
+	l = sample - low_sample;
+}
+
 void AnimationUnrolled::animate(Transform *const *transforms, unsigned num_transforms, float offset_time) const
 {
 	if (num_transforms != get_num_channels())
 		throw std::logic_error("Incorrect number of transforms.");
 
-	float sample = offset_time * frame_rate;
-	float low_sample = muglm::floor(sample);
-	int lo = clamp(int(low_sample), 0, int(num_samples) - 1);
-	int hi = muglm::min(lo + 1, int(num_samples) - 1);
-	float l = sample - low_sample;
+	int lo, hi;
+	float l;
+	compute_sample_range(offset_time, lo, hi, l);
 
 	for (unsigned i = 0; i < num_transforms; i++)
 	{
@@ -109,6 +348,70 @@ void AnimationUnrolled::animate(Transform *const *transforms, unsigned num_trans
 	}
 }
 
+void AnimationUnrolled::sample(AnimationPose &pose, float offset_time) const
+{
+	if (pose.get_num_joints() != get_num_channels())
+		throw std::logic_error("Incorrect number of joints in pose.");
+
+	int lo, hi;
+	float l;
+	compute_sample_range(offset_time, lo, hi, l);
+
+	unsigned count = get_num_channels();
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto mask = channel_mask[i];
+		if (mask & ROTATION_BIT)
+			pose.set_rotation(i, normalize(mix(key_frames_rotation[i][lo].as_vec4(), key_frames_rotation[i][hi].as_vec4(), l)));
+		if (mask & TRANSLATION_BIT)
+			pose.set_translation(i, mix(key_frames_translation[i][lo], key_frames_translation[i][hi], l));
+		if (mask & SCALE_BIT)
+			pose.set_scale(i, mix(key_frames_scale[i][lo], key_frames_scale[i][hi], l));
+	}
+}
+
+void AnimationUnrolled::make_additive()
+{
+	if (additive)
+		return;
+
+	unsigned count = get_num_channels();
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto mask = channel_mask[i];
+		if ((mask & ROTATION_BIT) && !key_frames_rotation[i].empty())
+		{
+			quat inv_ref = conjugate(key_frames_rotation[i].front());
+			for (auto &r : key_frames_rotation[i])
+				r = normalize(inv_ref * r);
+		}
+
+		if ((mask & TRANSLATION_BIT) && !key_frames_translation[i].empty())
+		{
+			vec3 ref = key_frames_translation[i].front();
+			for (auto &t : key_frames_translation[i])
+				t = t - ref;
+		}
+
+		if ((mask & SCALE_BIT) && !key_frames_scale[i].empty())
+		{
+			vec3 ref = key_frames_scale[i].front();
+			vec3 inv_ref = vec3(ref.x != 0.0f ? 1.0f / ref.x : 1.0f,
+			                    ref.y != 0.0f ? 1.0f / ref.y : 1.0f,
+			                    ref.z != 0.0f ? 1.0f / ref.z : 1.0f);
+			for (auto &s : key_frames_scale[i])
+				s = s * inv_ref;
+		}
+	}
+
+	additive = true;
+}
+
+bool AnimationUnrolled::is_additive() const
+{
+	return additive;
+}
+
 void AnimationUnrolled::animate_single(Transform &t, unsigned channel, int lo, int hi, float l) const
 {
 	// The animations should be sampled at such a high rate that doing slerp for rotation is irrelevant.
@@ -195,6 +498,178 @@ AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, f
 	}
 }
 
+AnimationBlendTree::NodeIndex AnimationBlendTree::allocate_node()
+{
+	if (!vacant_nodes.empty())
+	{
+		auto index = vacant_nodes.back();
+		vacant_nodes.pop_back();
+		return index;
+	}
+
+	auto index = NodeIndex(nodes.size());
+	nodes.emplace_back();
+	return index;
+}
+
+AnimationBlendTree::NodeIndex AnimationBlendTree::add_clip(AnimationID id, float speed, double start_time, bool repeat)
+{
+	auto index = allocate_node();
+	auto &node = nodes[index];
+	node.type = Type::Clip;
+	node.animation = id;
+	node.speed = speed;
+	node.start_time = start_time;
+	node.repeat = repeat;
+	if (root == InvalidNode)
+		root = index;
+	return index;
+}
+
+AnimationBlendTree::NodeIndex AnimationBlendTree::add_blend(NodeIndex a, NodeIndex b, float weight)
+{
+	auto index = allocate_node();
+	auto &node = nodes[index];
+	node.type = Type::Blend;
+	node.children[0] = a;
+	node.children[1] = b;
+	node.weight = weight;
+	node.target_weight = weight;
+	if (root == a || root == b)
+		root = index;
+	return index;
+}
+
+AnimationBlendTree::NodeIndex AnimationBlendTree::add_additive(NodeIndex base, NodeIndex layer, float weight)
+{
+	auto index = allocate_node();
+	auto &node = nodes[index];
+	node.type = Type::Additive;
+	node.children[0] = base;
+	node.children[1] = layer;
+	node.weight = weight;
+	node.target_weight = weight;
+	if (root == base || root == layer)
+		root = index;
+	return index;
+}
+
+void AnimationBlendTree::set_root(NodeIndex node)
+{
+	root = node;
+}
+
+AnimationBlendTree::NodeIndex AnimationBlendTree::get_root() const
+{
+	return root;
+}
+
+void AnimationBlendTree::set_weight(NodeIndex node, float weight)
+{
+	if (node >= nodes.size())
+		return;
+	nodes[node].weight = weight;
+	nodes[node].target_weight = weight;
+	nodes[node].fade_rate = 0.0f;
+}
+
+float AnimationBlendTree::get_weight(NodeIndex node) const
+{
+	return node < nodes.size() ? nodes[node].weight : 0.0f;
+}
+
+void AnimationBlendTree::fade_weight(NodeIndex node, float target_weight, float duration)
+{
+	if (node >= nodes.size())
+		return;
+
+	if (duration <= 0.0f)
+	{
+		set_weight(node, target_weight);
+		return;
+	}
+
+	auto &n = nodes[node];
+	n.target_weight = target_weight;
+	n.fade_rate = (target_weight - n.weight) / duration;
+}
+
+void AnimationBlendTree::set_speed(NodeIndex node, float speed)
+{
+	if (node < nodes.size())
+		nodes[node].speed = speed;
+}
+
+void AnimationBlendTree::free_subtree(NodeIndex node)
+{
+	if (node >= nodes.size())
+		return;
+
+	for (auto child : nodes[node].children)
+		free_subtree(child);
+
+	nodes[node] = {};
+	vacant_nodes.push_back(node);
+}
+
+void AnimationBlendTree::replace_references(NodeIndex from, NodeIndex to)
+{
+	if (root == from)
+		root = to;
+
+	for (auto &node : nodes)
+		for (auto &child : node.children)
+			if (child == from)
+				child = to;
+}
+
+void AnimationBlendTree::remove_subtree(NodeIndex node)
+{
+	if (node >= nodes.size())
+		return;
+	replace_references(node, InvalidNode);
+	free_subtree(node);
+}
+
+void AnimationBlendTree::update_fades(float frame_time)
+{
+	Util::SmallVector<NodeIndex> completed;
+
+	for (auto &node : nodes)
+	{
+		if (node.fade_rate == 0.0f)
+			continue;
+
+		node.weight += node.fade_rate * frame_time;
+		if ((node.fade_rate > 0.0f && node.weight >= node.target_weight) ||
+		    (node.fade_rate < 0.0f && node.weight <= node.target_weight))
+		{
+			node.weight = node.target_weight;
+			node.fade_rate = 0.0f;
+			if (node.collapse_on_fade_complete)
+				completed.push_back(NodeIndex(&node - nodes.data()));
+		}
+	}
+
+	// A completed cross-fade only needs to keep the side it faded to.
+	for (auto index : completed)
+	{
+		// Might have been freed already as part of another collapsed subtree.
+		auto &node = nodes[index];
+		if (!node.collapse_on_fade_complete)
+			continue;
+
+		unsigned keep_child = node.weight >= 0.5f ? 1 : 0;
+		auto keep = node.children[keep_child];
+		auto drop = node.children[1 - keep_child];
+		node.children[0] = InvalidNode;
+		node.children[1] = InvalidNode;
+		replace_references(index, keep);
+		free_subtree(drop);
+		free_subtree(index);
+	}
+}
+
 AnimationID AnimationSystem::get_animation_id_from_name(const string &name) const
 {
 	Util::Hasher hasher;
@@ -217,6 +692,15 @@ AnimationID AnimationSystem::register_animation(const std::string &name, Animati
 	return id;
 }
 
+AnimationID AnimationSystem::register_additive_animation(const std::string &name,
+                                                         const SceneFormats::Animation &animation,
+                                                         float key_frame_rate)
+{
+	AnimationUnrolled unrolled(animation, key_frame_rate);
+	unrolled.make_additive();
+	return register_animation(name, move(unrolled));
+}
+
 bool AnimationSystem::animation_is_running(AnimationStateID id) const
 {
 	return animation_state_pool.maybe_get(id) != nullptr;
@@ -240,30 +724,30 @@ AnimationID AnimationSystem::register_animation(const std::string &name,
 	return register_animation(name, AnimationUnrolled(animation, key_frame_rate));
 }
 
-AnimationStateID AnimationSystem::start_animation(Scene::Node &node, Granite::AnimationID animation_id,
-                                                  double start_time)
+void AnimationSystem::register_state(AnimationStateID id)
 {
-	auto *animation = animation_pool.maybe_get(animation_id);
-	if (!animation)
-	{
-		LOGE("Animation does not exist!\n");
-		return 0;
-	}
+	auto *state = &animation_state_pool.get(id);
+	state->id = id;
+	// Stagger LOD updates so that animations with reduced update rate do not all evaluate on the same frame.
+	state->lod_phase = phase_counter++;
+	active_animation.insert_front(state);
+}
 
-	AnimationStateID id;
-	if (animation->is_skinned())
+AnimationStateID AnimationSystem::create_state(Scene::Node &node, const AnimationUnrolled &animation, double start_time)
+{
+	if (animation.is_skinned())
 	{
-		if (node.get_skin().skin.empty() || node.get_skin().skin_compat != animation->get_skin_compat())
+		if (node.get_skin().skin.empty() || node.get_skin().skin_compat != animation.get_skin_compat())
 		{
 			LOGE("Skin is not compatible with animation.\n");
 			return 0;
 		}
 
-		id = animation_state_pool.emplace(*animation, &node, start_time);
+		return animation_state_pool.emplace(&animation, &node, start_time);
 	}
 	else
 	{
-		if (animation->get_num_channels() != 1)
+		if (animation.get_num_channels() != 1)
 		{
 			LOGE("Animation has more than one channel of animation.\n");
 			return 0;
@@ -271,12 +755,26 @@ AnimationStateID AnimationSystem::start_animation(Scene::Node &node, Granite::An
 
 		std::vector<Transform *> target_transforms = { &node.transform };
 		std::vector<Scene::Node *> nodes = { &node };
-		id = animation_state_pool.emplace(*animation, move(target_transforms), move(nodes), start_time);
+		return animation_state_pool.emplace(&animation, move(target_transforms), move(nodes), start_time);
 	}
+}
 
-	auto *state = &animation_state_pool.get(id);
-	state->id = id;
-	active_animation.insert_front(state);
+AnimationStateID AnimationSystem::start_animation(Scene::Node &node, Granite::AnimationID animation_id,
+                                                  double start_time)
+{
+	auto *animation = animation_pool.maybe_get(animation_id);
+	if (!animation)
+	{
+		LOGE("Animation does not exist!\n");
+		return 0;
+	}
+
+	auto id = create_state(node, *animation, start_time);
+	if (id == 0)
+		return 0;
+
+	animation_state_pool.get(id).animation_id = animation_id;
+	register_state(id);
 	return id;
 }
 
@@ -352,17 +850,10 @@ void AnimationSystem::set_fixed_pose_multi(Scene::NodeHandle *nodes, unsigned nu
 	animation->animate(target_transforms.data(), target_transforms.size(), offset);
 }
 
-AnimationStateID AnimationSystem::start_animation_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
-                                                        AnimationID animation_id, double start_time)
+AnimationStateID AnimationSystem::create_state_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
+                                                     const AnimationUnrolled &animation, double start_time)
 {
-	auto *animation = animation_pool.maybe_get(animation_id);
-	if (!animation)
-	{
-		LOGE("Animation does not exist!\n");
-		return 0;
-	}
-
-	if (animation->is_skinned())
+	if (animation.is_skinned())
 	{
 		LOGE("Cannot use start_animation_multi with skinned animations.\n");
 		return 0;
@@ -370,12 +861,12 @@ AnimationStateID AnimationSystem::start_animation_multi(Scene::NodeHandle *nodes
 
 	std::vector<Transform *> target_transforms;
 	std::vector<Scene::Node *> target_nodes;
-	target_transforms.reserve(animation->get_num_channels());
-	target_nodes.reserve(animation->get_num_channels());
+	target_transforms.reserve(animation.get_num_channels());
+	target_nodes.reserve(animation.get_num_channels());
 
-	for (unsigned channel = 0; channel < animation->get_num_channels(); channel++)
+	for (unsigned channel = 0; channel < animation.get_num_channels(); channel++)
 	{
-		unsigned index = animation->get_multi_node_index(channel);
+		unsigned index = animation.get_multi_node_index(channel);
 		if (index >= num_nodes)
 		{
 			LOGE("Node index %u is out of range of provided nodes (%u).\n", index, num_nodes);
@@ -386,13 +877,233 @@ AnimationStateID AnimationSystem::start_animation_multi(Scene::NodeHandle *nodes
 		target_nodes.push_back(nodes[index].get());
 	}
 
-	auto id = animation_state_pool.emplace(*animation, move(target_transforms), move(target_nodes), start_time);
-	auto *state = &animation_state_pool.get(id);
-	state->id = id;
-	active_animation.insert_front(state);
+	return animation_state_pool.emplace(&animation, move(target_transforms), move(target_nodes), start_time);
+}
+
+AnimationStateID AnimationSystem::start_animation_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
+                                                        AnimationID animation_id, double start_time)
+{
+	auto *animation = animation_pool.maybe_get(animation_id);
+	if (!animation)
+	{
+		LOGE("Animation does not exist!\n");
+		return 0;
+	}
+
+	auto id = create_state_multi(nodes, num_nodes, *animation, start_time);
+	if (id == 0)
+		return 0;
+
+	animation_state_pool.get(id).animation_id = animation_id;
+	register_state(id);
 	return id;
 }
 
+const AnimationUnrolled *AnimationSystem::find_reference_animation(const AnimationBlendTree &tree,
+                                                                   AnimationBlendTree::NodeIndex index) const
+{
+	if (index >= tree.nodes.size())
+		return nullptr;
+
+	auto &node = tree.nodes[index];
+	if (node.type == AnimationBlendTree::Type::Clip)
+	{
+		auto *animation = animation_pool.maybe_get(node.animation);
+		return animation && !animation->is_additive() ? animation : nullptr;
+	}
+
+	for (auto child : node.children)
+		if (auto *animation = find_reference_animation(tree, child))
+			return animation;
+	return nullptr;
+}
+
+bool AnimationSystem::animation_is_compatible(const AnimationUnrolled &animation, const AnimationState &state) const
+{
+	if (state.skinned_node)
+	{
+		return animation.is_skinned() &&
+		       animation.get_skin_compat() == state.skinned_node->get_skin().skin_compat;
+	}
+
+	if (animation.is_skinned() || animation.get_num_channels() != state.channel_transforms.size())
+		return false;
+
+	for (unsigned channel = 0; channel < animation.get_num_channels(); channel++)
+		if (animation.get_multi_node_index(channel) != state.animation->get_multi_node_index(channel))
+			return false;
+
+	return true;
+}
+
+bool AnimationSystem::validate_blend_node(const AnimationBlendTree &tree, AnimationBlendTree::NodeIndex index,
+                                          const AnimationState &state) const
+{
+	if (index == AnimationBlendTree::InvalidNode)
+		return true;
+	if (index >= tree.nodes.size())
+		return false;
+
+	auto &node = tree.nodes[index];
+	if (node.type == AnimationBlendTree::Type::Clip)
+	{
+		auto *animation = animation_pool.maybe_get(node.animation);
+		if (!animation)
+		{
+			LOGE("Animation does not exist!\n");
+			return false;
+		}
+
+		if (!animation_is_compatible(*animation, state))
+		{
+			LOGE("Animation in blend tree is not compatible with target.\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	return validate_blend_node(tree, node.children[0], state) &&
+	       validate_blend_node(tree, node.children[1], state);
+}
+
+AnimationStateID AnimationSystem::attach_blend_tree(AnimationStateID id, AnimationBlendTree tree)
+{
+	auto &state = animation_state_pool.get(id);
+	if (!validate_blend_node(tree, tree.get_root(), state))
+	{
+		animation_state_pool.remove(id);
+		return 0;
+	}
+
+	state.blend_tree.reset(new AnimationBlendTree(move(tree)));
+
+	Transform * const *transforms;
+	unsigned count;
+	get_target_transforms(state, transforms, count);
+	state.rest_pose.load(transforms, count);
+
+	register_state(id);
+	return id;
+}
+
+AnimationStateID AnimationSystem::start_blend_tree(Scene::Node &node, AnimationBlendTree tree, double start_time)
+{
+	auto *reference = find_reference_animation(tree, tree.get_root());
+	if (!reference)
+	{
+		LOGE("Blend tree does not contain any valid animation.\n");
+		return 0;
+	}
+
+	auto id = create_state(node, *reference, start_time);
+	if (id == 0)
+		return 0;
+	return attach_blend_tree(id, move(tree));
+}
+
+AnimationStateID AnimationSystem::start_blend_tree_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
+                                                         AnimationBlendTree tree, double start_time)
+{
+	auto *reference = find_reference_animation(tree, tree.get_root());
+	if (!reference)
+	{
+		LOGE("Blend tree does not contain any valid animation.\n");
+		return 0;
+	}
+
+	auto id = create_state_multi(nodes, num_nodes, *reference, start_time);
+	if (id == 0)
+		return 0;
+	return attach_blend_tree(id, move(tree));
+}
+
+AnimationBlendTree *AnimationSystem::get_blend_tree(AnimationStateID id)
+{
+	auto *state = animation_state_pool.maybe_get(id);
+	return state ? state->blend_tree.get() : nullptr;
+}
+
+bool AnimationSystem::cross_fade(AnimationStateID id, AnimationID to, float duration, float speed)
+{
+	auto *state = animation_state_pool.maybe_get(id);
+	if (!state)
+		return false;
+
+	auto *animation = animation_pool.maybe_get(to);
+	if (!animation)
+	{
+		LOGE("Animation does not exist!\n");
+		return false;
+	}
+
+	if (animation->is_additive() || !animation_is_compatible(*animation, *state))
+	{
+		LOGE("Cannot cross-fade to incompatible animation.\n");
+		return false;
+	}
+
+	if (!state->blend_tree)
+	{
+		state->blend_tree.reset(new AnimationBlendTree);
+		state->blend_tree->add_clip(state->animation_id, 1.0f, 0.0, state->repeating);
+
+		Transform * const *transforms;
+		unsigned count;
+		get_target_transforms(*state, transforms, count);
+		state->rest_pose.load(transforms, count);
+	}
+
+	auto &tree = *state->blend_tree;
+	auto old_root = tree.get_root();
+	auto clip = tree.add_clip(to, speed, state->current_time, state->repeating);
+
+	if (old_root == AnimationBlendTree::InvalidNode || duration <= 0.0f)
+	{
+		tree.remove_subtree(old_root);
+		tree.set_root(clip);
+	}
+	else
+	{
+		auto blend = tree.add_blend(old_root, clip, 0.0f);
+		tree.nodes[blend].collapse_on_fade_complete = true;
+		tree.fade_weight(blend, 1.0f, duration);
+		tree.set_root(blend);
+	}
+
+	return true;
+}
+
+void AnimationSystem::set_update_rate_divider(AnimationStateID id, unsigned divider)
+{
+	auto *state = animation_state_pool.maybe_get(id);
+	if (!state)
+		return;
+
+	state->lod_automatic = divider == 0;
+	if (divider >= 8)
+		state->lod_divider = 8;
+	else if (divider >= 4)
+		state->lod_divider = 4;
+	else if (divider >= 2)
+		state->lod_divider = 2;
+	else
+		state->lod_divider = 1;
+}
+
+void AnimationSystem::set_visible(AnimationStateID id, bool visible)
+{
+	auto *state = animation_state_pool.maybe_get(id);
+	if (state)
+		state->visible = visible;
+}
+
+void AnimationSystem::set_lod_reference(const vec3 &position, float full_rate_distance)
+{
+	lod_reference = position;
+	lod_full_rate_distance = full_rate_distance;
+}
+
 void AnimationSystem::set_completion_callback(AnimationStateID id, function<void()> cb)
 {
 	auto *state = animation_state_pool.maybe_get(id);
@@ -414,57 +1125,279 @@ void AnimationSystem::set_relative_timing(Granite::AnimationStateID id, bool ena
 		state->relative_timing = enable;
 }
 
+void AnimationSystem::get_target_transforms(AnimationState &state, Transform * const *&transforms, unsigned &count) const
+{
+	if (state.skinned_node)
+	{
+		auto &skin = state.skinned_node->get_skin().skin;
+		transforms = skin.data();
+		count = unsigned(skin.size());
+	}
+	else
+	{
+		transforms = state.channel_transforms.data();
+		count = unsigned(state.channel_transforms.size());
+	}
+}
+
+void AnimationSystem::invalidate_target_nodes(AnimationState &state) const
+{
+	if (state.skinned_node)
+		state.skinned_node->invalidate_cached_transform();
+	else
+		for (auto *node : state.channel_nodes)
+			node->invalidate_cached_transform();
+}
+
+unsigned AnimationSystem::compute_update_divider(const AnimationState &state) const
+{
+	if (!state.lod_automatic)
+		return state.lod_divider;
+	if (!state.visible)
+		return 8;
+	if (lod_full_rate_distance <= 0.0f)
+		return 1;
+
+	const Scene::Node *node = state.skinned_node;
+	if (!node && !state.channel_nodes.empty())
+		node = state.channel_nodes.front();
+	if (!node)
+		return 1;
+
+	float dist = distance(node->cached_transform.world_transform[3].xyz(), lod_reference);
+	unsigned divider = 1;
+	float threshold = lod_full_rate_distance;
+	while (divider < 8 && dist > threshold)
+	{
+		divider <<= 1;
+		threshold *= 2.0f;
+	}
+	return divider;
+}
+
+bool AnimationSystem::blend_node_is_complete(const AnimationBlendTree &tree, AnimationBlendTree::NodeIndex index,
+                                             double time) const
+{
+	if (index >= tree.nodes.size())
+		return false;
+
+	auto &node = tree.nodes[index];
+	switch (node.type)
+	{
+	case AnimationBlendTree::Type::Clip:
+	{
+		if (node.repeat)
+			return false;
+		auto *animation = animation_pool.maybe_get(node.animation);
+		return !animation || (time - node.start_time) * double(node.speed) >= double(animation->get_length());
+	}
+
+	case AnimationBlendTree::Type::Blend:
+		// While fading, both sides are still visible.
+		if (node.fade_rate == 0.0f && node.weight <= 0.0f)
+			return blend_node_is_complete(tree, node.children[0], time);
+		else if (node.fade_rate == 0.0f && node.weight >= 1.0f)
+			return blend_node_is_complete(tree, node.children[1], time);
+		else
+			return blend_node_is_complete(tree, node.children[0], time) &&
+			       blend_node_is_complete(tree, node.children[1], time);
+
+	case AnimationBlendTree::Type::Additive:
+		// Layers decorate the base, they do not keep the tree alive on their own.
+		return blend_node_is_complete(tree, node.children[0], time);
+	}
+
+	return false;
+}
+
+void AnimationSystem::evaluate_blend_node(const AnimationState &state, AnimationBlendTree::NodeIndex index,
+                                          unsigned depth, double time)
+{
+	auto &tree = *state.blend_tree;
+	if (index >= tree.nodes.size())
+	{
+		pose_scratch[depth] = state.rest_pose;
+		return;
+	}
+
+	auto &node = tree.nodes[index];
+	float weight = clamp(node.weight, 0.0f, 1.0f);
+
+	switch (node.type)
+	{
+	case AnimationBlendTree::Type::Clip:
+	{
+		auto &pose = pose_scratch[depth];
+		auto *animation = animation_pool.maybe_get(node.animation);
+		if (animation && animation->is_additive())
+		{
+			pose.resize(state.rest_pose.get_num_joints());
+			pose.set_identity();
+		}
+		else
+			pose = state.rest_pose;
+
+		if (animation && animation->get_num_channels() == pose.get_num_joints())
+		{
+			float length = animation->get_length();
+			float offset = float((time - node.start_time) * double(node.speed));
+			if (length <= 0.0f)
+				offset = 0.0f;
+			else if (node.repeat)
+				offset = mod(offset, length);
+			else
+				offset = clamp(offset, 0.0f, length);
+			animation->sample(pose, offset);
+		}
+		break;
+	}
+
+	case AnimationBlendTree::Type::Blend:
+		if (weight <= 0.0f)
+			evaluate_blend_node(state, node.children[0], depth, time);
+		else if (weight >= 1.0f)
+			evaluate_blend_node(state, node.children[1], depth, time);
+		else
+		{
+			evaluate_blend_node(state, node.children[0], depth, time);
+			evaluate_blend_node(state, node.children[1], depth + 1, time);
+			blend_poses(pose_scratch[depth], pose_scratch[depth], pose_scratch[depth + 1], weight);
+		}
+		break;
+
+	case AnimationBlendTree::Type::Additive:
+		evaluate_blend_node(state, node.children[0], depth, time);
+		if (weight > 0.0f)
+		{
+			evaluate_blend_node(state, node.children[1], depth + 1, time);
+			add_pose(pose_scratch[depth], pose_scratch[depth + 1], weight);
+		}
+		break;
+	}
+}
+
+void AnimationSystem::evaluate_state(AnimationState &state, AnimationPose *pose, double time)
+{
+	Transform * const *transforms;
+	unsigned count;
+	get_target_transforms(state, transforms, count);
+
+	if (state.blend_tree)
+	{
+		// Depth of the tree can never exceed the number of nodes.
+		if (pose_scratch.size() < state.blend_tree->nodes.size() + 1)
+			pose_scratch.resize(state.blend_tree->nodes.size() + 1);
+
+		evaluate_blend_node(state, state.blend_tree->get_root(), 0, time);
+		if (pose)
+			swap(*pose, pose_scratch[0]);
+		else
+			pose_scratch[0].store(transforms, count);
+	}
+	else
+		state.animation->animate(transforms, count, float(time));
+}
+
 void AnimationSystem::animate(double frame_time, double elapsed_time)
 {
+	frame_counter++;
+	if (pose_scratch.empty())
+		pose_scratch.resize(1);
+
 	auto itr = active_animation.begin();
 	while (itr != active_animation.end())
 	{
+		auto &state = *itr;
 		bool complete = false;
 
-		float offset;
-		if (itr->relative_timing)
+		double time;
+		if (state.relative_timing)
 		{
-			itr->start_time += frame_time;
-			offset = float(itr->start_time);
+			state.start_time += frame_time;
+			time = state.start_time;
 		}
 		else
 		{
-			offset = float(elapsed_time - itr->start_time);
+			time = elapsed_time - state.start_time;
 		}
+		state.current_time = time;
 
-		if (!itr->repeating && offset >= itr->animation.get_length())
-			complete = true;
+		if (state.blend_tree)
+		{
+			state.blend_tree->update_fades(float(frame_time));
+			complete = blend_node_is_complete(*state.blend_tree, state.blend_tree->get_root(), time);
+		}
+		else
+		{
+			float offset = float(time);
 
-		if (itr->repeating)
-			offset = mod(offset, itr->animation.get_length());
+			if (!state.repeating && offset >= state.animation->get_length())
+				complete = true;
+
+			if (state.repeating)
+				offset = mod(offset, state.animation->get_length());
+
+			time = offset;
+		}
 
-		if (itr->animation.is_skinned())
+		unsigned divider = compute_update_divider(state);
+		if (divider != state.lod_current_divider)
 		{
-			auto *node = itr->skinned_node;
-			itr->animation.animate(node->get_skin().skin.data(), node->get_skin().skin.size(), offset);
-			node->invalidate_cached_transform();
+			state.lod_current_divider = divider;
+			state.lod_poses_valid = false;
+		}
+
+		unsigned cycle = (frame_counter + state.lod_phase) & (divider - 1);
+
+		if (divider > 1 && state.blend_tree && state.visible && !complete)
+		{
+			if (cycle == 0 || !state.lod_poses_valid)
+			{
+				// Evaluate ahead to the next update, and interpolate towards it until then.
+				unsigned interval = divider - cycle;
+				if (state.lod_poses_valid)
+					swap(state.lod_poses[0], state.lod_poses[1]);
+				else
+					evaluate_state(state, &state.lod_poses[0], time);
+				evaluate_state(state, &state.lod_poses[1], time + double(interval) * frame_time);
+				state.lod_start_frame = frame_counter;
+				state.lod_interval = interval;
+				state.lod_poses_valid = true;
+			}
+
+			Transform * const *transforms;
+			unsigned count;
+			get_target_transforms(state, transforms, count);
+
+			float l = muglm::min(float(frame_counter - state.lod_start_frame) / float(state.lod_interval), 1.0f);
+			blend_poses(pose_scratch[0], state.lod_poses[0], state.lod_poses[1], l);
+			pose_scratch[0].store(transforms, count);
+			invalidate_target_nodes(state);
 		}
 		else
 		{
-			itr->animation.animate(itr->channel_transforms.data(), itr->channel_transforms.size(), offset);
-			for (auto *node : itr->channel_nodes)
-				node->invalidate_cached_transform();
+			state.lod_poses_valid = false;
+			if (cycle == 0 || complete)
+			{
+				evaluate_state(state, nullptr, time);
+				invalidate_target_nodes(state);
+			}
 		}
 
 		if (complete)
 		{
-			auto *state = itr.get();
+			auto *s = itr.get();
 			itr = active_animation.erase(itr);
-			if (state->cb)
-				state->cb();
-			animation_state_pool.remove(state->id);
+			if (s->cb)
+				s->cb();
+			animation_state_pool.remove(s->id);
 		}
 		else
 			++itr;
 	}
 }
 
-AnimationSystem::AnimationState::AnimationState(const AnimationUnrolled &anim,
+AnimationSystem::AnimationState::AnimationState(const AnimationUnrolled *anim,
                                                 std::vector<Transform *> channel_transforms_,
                                                 std::vector<Scene::Node *> channel_nodes_,
                                                 double start_time_)
@@ -475,10 +1408,10 @@ AnimationSystem::AnimationState::AnimationState(const AnimationUnrolled &anim,
 {
 }
 
-AnimationSystem::AnimationState::AnimationState(const Granite::AnimationUnrolled &anim, Granite::Scene::Node *node,
+AnimationSystem::AnimationState::AnimationState(const Granite::AnimationUnrolled *anim, Granite::Scene::Node *node,
                                                 double start_time_)
 		: skinned_node(node), animation(anim), start_time(start_time_)
 {
 }
 
-}
\ No newline at end of file
+}
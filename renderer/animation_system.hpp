@@ -28,15 +28,50 @@
 #include "intrusive_hash_map.hpp"
 #include "intrusive_list.hpp"
 #include <vector>
+#include <memory>
 
 namespace Granite
 {
+// Joint data in SoA form, with one array per component, so blending processes four joints per SIMD step.
+// Arrays are padded to a multiple of four joints with valid transforms, so kernels need no tail handling.
+struct AnimationPose
+{
+	enum { JointsPerStep = 4 };
+
+	void resize(unsigned count);
+	void set_identity();
+	void load(const Transform * const *transforms, unsigned count);
+	void store(Transform * const *transforms, unsigned count) const;
+	unsigned get_num_joints() const;
+
+	vec4 get_rotation(unsigned joint) const;
+	vec3 get_translation(unsigned joint) const;
+	vec3 get_scale(unsigned joint) const;
+	void set_rotation(unsigned joint, const vec4 &q);
+	void set_translation(unsigned joint, const vec3 &t);
+	void set_scale(unsigned joint, const vec3 &s);
+
+	// Quaternions as x, y, z, w.
+	std::vector<float> rotation[4];
+	std::vector<float> translation[3];
+	std::vector<float> scale[3];
+	unsigned num_joints = 0;
+};
+
 class AnimationUnrolled : public Util::IntrusiveHashMapEnabled<AnimationUnrolled>
 {
 public:
 	AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate);
 	void animate(Transform * const *transforms, unsigned num_transforms, float offset_time) const;
 
+	// Only writes channels which are animated. Other joints in the pose are left untouched.
+	void sample(AnimationPose &pose, float offset_time) const;
+
+	// Rebases all key frames to be relative to the first key frame.
+	// Additive animations are only meaningful as layers in an AnimationBlendTree.
+	void make_additive();
+	bool is_additive() const;
+
 	unsigned get_num_channels() const;
 
 	bool is_skinned() const;
@@ -67,7 +102,9 @@ private:
 
 	Util::Hash skin_compat = 0;
 	bool skinning = false;
+	bool additive = false;
 
+	void compute_sample_range(float offset_time, int &lo, int &hi, float &l) const;
 	void reserve_num_clips(unsigned count);
 	unsigned find_or_allocate_index(uint32_t node_index);
 
@@ -77,6 +114,66 @@ private:
 using AnimationID = Util::GenerationalHandleID;
 using AnimationStateID = Util::GenerationalHandleID;
 
+// Blends between the pose of the animation clips in the tree.
+// Clips loop unless added with repeat = false, in which case they hold their last frame.
+// The tree completes once every clip which contributes to it has played to the end without repeating.
+class AnimationBlendTree
+{
+public:
+	using NodeIndex = unsigned;
+	enum { InvalidNode = ~0u };
+
+	NodeIndex add_clip(AnimationID id, float speed = 1.0f, double start_time = 0.0, bool repeat = true);
+	// weight = 0 -> a, weight = 1 -> b.
+	NodeIndex add_blend(NodeIndex a, NodeIndex b, float weight);
+	// Layer must be a clip registered with AnimationSystem::register_additive_animation().
+	NodeIndex add_additive(NodeIndex base, NodeIndex layer, float weight);
+
+	void set_root(NodeIndex node);
+	NodeIndex get_root() const;
+
+	void set_weight(NodeIndex node, float weight);
+	float get_weight(NodeIndex node) const;
+	void fade_weight(NodeIndex node, float target_weight, float duration);
+	void set_speed(NodeIndex node, float speed);
+
+	// Removes a node and every node below it.
+	void remove_subtree(NodeIndex node);
+
+private:
+	friend class AnimationSystem;
+
+	enum class Type : uint8_t
+	{
+		Clip,
+		Blend,
+		Additive
+	};
+
+	struct Node
+	{
+		Type type = Type::Clip;
+		bool collapse_on_fade_complete = false;
+		bool repeat = true;
+		AnimationID animation = 0;
+		NodeIndex children[2] = { InvalidNode, InvalidNode };
+		float weight = 0.0f;
+		float target_weight = 0.0f;
+		float fade_rate = 0.0f;
+		float speed = 1.0f;
+		double start_time = 0.0;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<NodeIndex> vacant_nodes;
+	NodeIndex root = InvalidNode;
+
+	NodeIndex allocate_node();
+	void free_subtree(NodeIndex node);
+	void replace_references(NodeIndex from, NodeIndex to);
+	void update_fades(float frame_time);
+};
+
 class AnimationSystem
 {
 public:
@@ -86,6 +183,7 @@ public:
 
 	AnimationID register_animation(const std::string &name, const SceneFormats::Animation &animation, float key_frame_rate = 60.0f);
 	AnimationID register_animation(const std::string &name, AnimationUnrolled animation);
+	AnimationID register_additive_animation(const std::string &name, const SceneFormats::Animation &animation, float key_frame_rate = 60.0f);
 	AnimationID get_animation_id_from_name(const std::string &name) const;
 
 	AnimationStateID start_animation(Scene::Node &node, AnimationID id, double start_time);
@@ -98,15 +196,39 @@ public:
 
 	void set_completion_callback(AnimationStateID id, std::function<void ()> cb);
 
+	// Blend trees. All clips in the tree must be compatible with the node(s),
+	// i.e. same skin for skinned animations, same channel layout for multi-node animations.
+	// Clip start times in the tree are relative to the start time of the state.
+	AnimationStateID start_blend_tree(Scene::Node &node, AnimationBlendTree tree, double start_time);
+	AnimationStateID start_blend_tree_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
+	                                        AnimationBlendTree tree, double start_time);
+	AnimationBlendTree *get_blend_tree(AnimationStateID id);
+
+	// Fades from whatever the state is currently playing to a new animation.
+	// Plain animation states are converted to blend trees.
+	// The new clip follows set_repeating() for the state, so a non-repeating state still completes,
+	// and calls its completion callback, once the new clip has played to the end.
+	bool cross_fade(AnimationStateID id, AnimationID to, float duration, float speed = 1.0f);
+
+	// Update-rate LOD. Animations are evaluated every 1, 2, 4 or 8 frames.
+	// Blend trees which are visible interpolate between evaluated poses on the frames in-between,
+	// which is much cheaper than evaluating every clip in the tree.
+	// Plain clips and invisible animations hold their pose, since sampling a single clip costs as much as interpolation.
+	// divider = 0 selects the rate automatically based on visibility and distance to the LOD reference.
+	void set_update_rate_divider(AnimationStateID id, unsigned divider);
+	void set_visible(AnimationStateID id, bool visible);
+	// Within full_rate_distance, animations update every frame. Rate halves for every doubling of distance.
+	void set_lod_reference(const vec3 &position, float full_rate_distance);
+
 private:
 	struct AnimationState : Util::IntrusiveListEnabled<AnimationState>
 	{
-		AnimationState(const AnimationUnrolled &anim,
+		AnimationState(const AnimationUnrolled *anim,
 		               std::vector<Transform *> channel_transforms_,
 		               std::vector<Scene::Node *> channel_nodes_,
 		               double start_time_);
 
-		AnimationState(const AnimationUnrolled &anim,
+		AnimationState(const AnimationUnrolled *anim,
 		               Scene::Node *node,
 		               double start_time_);
 
@@ -114,14 +236,50 @@ private:
 		AnimationStateID id = 0;
 		std::vector<Transform *> channel_transforms;
 		std::vector<Scene::Node *> channel_nodes;
-		const AnimationUnrolled &animation;
+		// For blend trees, this is the animation which defines the channel layout.
+		const AnimationUnrolled *animation;
+		AnimationID animation_id = 0;
 		double start_time = 0.0;
+		double current_time = 0.0;
 		bool repeating = false;
 		bool relative_timing = false;
 
+		std::unique_ptr<AnimationBlendTree> blend_tree;
+		AnimationPose rest_pose;
+		AnimationPose lod_poses[2];
+		unsigned lod_divider = 1;
+		unsigned lod_phase = 0;
+		unsigned lod_current_divider = 1;
+		unsigned lod_start_frame = 0;
+		unsigned lod_interval = 1;
+		bool lod_automatic = false;
+		bool lod_poses_valid = false;
+		bool visible = true;
+
 		std::function<void ()> cb;
 	};
 
+	void get_target_transforms(AnimationState &state, Transform * const *&transforms, unsigned &count) const;
+	void invalidate_target_nodes(AnimationState &state) const;
+	unsigned compute_update_divider(const AnimationState &state) const;
+	void evaluate_state(AnimationState &state, AnimationPose *pose, double time);
+	void evaluate_blend_node(const AnimationState &state, AnimationBlendTree::NodeIndex index, unsigned depth, double time);
+	bool blend_node_is_complete(const AnimationBlendTree &tree, AnimationBlendTree::NodeIndex index, double time) const;
+	bool animation_is_compatible(const AnimationUnrolled &animation, const AnimationState &state) const;
+	AnimationStateID create_state(Scene::Node &node, const AnimationUnrolled &animation, double start_time);
+	AnimationStateID create_state_multi(Scene::NodeHandle *nodes, unsigned num_nodes,
+	                                    const AnimationUnrolled &animation, double start_time);
+	AnimationStateID attach_blend_tree(AnimationStateID id, AnimationBlendTree tree);
+	void register_state(AnimationStateID id);
+	const AnimationUnrolled *find_reference_animation(const AnimationBlendTree &tree, AnimationBlendTree::NodeIndex index) const;
+	bool validate_blend_node(const AnimationBlendTree &tree, AnimationBlendTree::NodeIndex index, const AnimationState &state) const;
+
+	std::vector<AnimationPose> pose_scratch;
+	vec3 lod_reference = vec3(0.0f);
+	float lod_full_rate_distance = 0.0f;
+	unsigned frame_counter = 0;
+	unsigned phase_counter = 0;
+
 	Util::GenerationalHandlePool<AnimationUnrolled> animation_pool;
 	Util::IntrusiveHashMap<Util::IntrusivePODWrapper<AnimationID>> animation_map;
 	Util::GenerationalHandlePool<AnimationState> animation_state_pool;
@@ -22,6 +22,12 @@
 
 #include "cpu_rasterizer.hpp"
 #include "simd.hpp"
+#include "simd_headers.hpp"
+#include "thread_group.hpp"
+#include "bitops.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace Granite
 {
@@ -58,6 +64,7 @@ struct TriangleSetup
 	vec3 dy;
 	vec2 lo;
 	vec2 hi;
+	float max_z;
 };
 
 static float cross_2d(const vec2 &a, const vec2 &b)
@@ -97,6 +104,7 @@ static bool setup_triangle(TriangleSetup &setup, const Triangle &tri, CullMode c
 	vec2 hi = max(max(tri.vertices[0].xy(), tri.vertices[1].xy()), tri.vertices[2].xy());
 	setup.lo = lo;
 	setup.hi = hi;
+	setup.max_z = muglm::max(muglm::max(tri.vertices[0].z, tri.vertices[1].z), tri.vertices[2].z);
 
 	return true;
 }
@@ -352,8 +360,260 @@ void rasterize_conservative_triangles(std::vector<uvec2> &coverage,
 
 void transform_vertices(vec4 *clip_position, const vec4 *positions, unsigned num_positions, const mat4 &mvp)
 {
+#if defined(__SSE__)
+	// Same as SIMD::mul, but the matrix is only loaded once.
+	__m128 col0 = _mm_loadu_ps(mvp[0].data);
+	__m128 col1 = _mm_loadu_ps(mvp[1].data);
+	__m128 col2 = _mm_loadu_ps(mvp[2].data);
+	__m128 col3 = _mm_loadu_ps(mvp[3].data);
+
+	for (unsigned i = 0; i < num_positions; i++)
+	{
+		__m128 p = _mm_loadu_ps(positions[i].data);
+		__m128 res = _mm_mul_ps(col0, _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)));
+		res = _mm_add_ps(res, _mm_mul_ps(col1, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))));
+		res = _mm_add_ps(res, _mm_mul_ps(col2, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+		res = _mm_add_ps(res, _mm_mul_ps(col3, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3))));
+		_mm_storeu_ps(clip_position[i].data, res);
+	}
+#else
 	for (unsigned i = 0; i < num_positions; i++)
 		SIMD::mul(clip_position[i], mvp, positions[i]);
+#endif
+}
+
+void CoverageMask::reset(uvec2 resolution_)
+{
+	resolution = resolution_;
+	words_per_row = (resolution.x + 31) / 32;
+	bits.clear();
+	bits.resize(words_per_row * resolution.y);
+}
+
+// Returns a bit for each of the 8 pixels starting at x which is inside all three edges.
+static inline uint32_t evaluate_edges_8(const vec3 &row, const vec3 &step_x, float x)
+{
+#if defined(__AVX__)
+	__m256 lanes = _mm256_add_ps(_mm256_set1_ps(x), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+	__m256 e0 = _mm256_add_ps(_mm256_set1_ps(row.x), _mm256_mul_ps(_mm256_set1_ps(step_x.x), lanes));
+	__m256 e1 = _mm256_add_ps(_mm256_set1_ps(row.y), _mm256_mul_ps(_mm256_set1_ps(step_x.y), lanes));
+	__m256 e2 = _mm256_add_ps(_mm256_set1_ps(row.z), _mm256_mul_ps(_mm256_set1_ps(step_x.z), lanes));
+	__m256 zero = _mm256_setzero_ps();
+	__m256 inside = _mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GT_OQ), _mm256_cmp_ps(e1, zero, _CMP_GT_OQ));
+	inside = _mm256_and_ps(inside, _mm256_cmp_ps(e2, zero, _CMP_GT_OQ));
+	return uint32_t(_mm256_movemask_ps(inside));
+#elif defined(__SSE__)
+	__m128 lanes_lo = _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+	__m128 lanes_hi = _mm_add_ps(lanes_lo, _mm_set1_ps(4.0f));
+	__m128 zero = _mm_setzero_ps();
+
+#define EVALUATE_EDGE(comp) \
+	__m128 row_##comp = _mm_set1_ps(row.comp); \
+	__m128 slope_##comp = _mm_set1_ps(step_x.comp); \
+	__m128 lo_##comp = _mm_cmpgt_ps(_mm_add_ps(row_##comp, _mm_mul_ps(slope_##comp, lanes_lo)), zero); \
+	__m128 hi_##comp = _mm_cmpgt_ps(_mm_add_ps(row_##comp, _mm_mul_ps(slope_##comp, lanes_hi)), zero)
+	EVALUATE_EDGE(x);
+	EVALUATE_EDGE(y);
+	EVALUATE_EDGE(z);
+#undef EVALUATE_EDGE
+
+	__m128 inside_lo = _mm_and_ps(_mm_and_ps(lo_x, lo_y), lo_z);
+	__m128 inside_hi = _mm_and_ps(_mm_and_ps(hi_x, hi_y), hi_z);
+	return uint32_t(_mm_movemask_ps(inside_lo)) | (uint32_t(_mm_movemask_ps(inside_hi)) << 4);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const float lane_offsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	static const uint32_t lane_bits[4] = { 1, 2, 4, 8 };
+	float32x4_t lanes_lo = vaddq_f32(vdupq_n_f32(x), vld1q_f32(lane_offsets));
+	float32x4_t lanes_hi = vaddq_f32(lanes_lo, vdupq_n_f32(4.0f));
+	float32x4_t zero = vdupq_n_f32(0.0f);
+
+#define EVALUATE_EDGE(comp) \
+	float32x4_t row_##comp = vdupq_n_f32(row.comp); \
+	uint32x4_t lo_##comp = vcgtq_f32(vmlaq_n_f32(row_##comp, lanes_lo, step_x.comp), zero); \
+	uint32x4_t hi_##comp = vcgtq_f32(vmlaq_n_f32(row_##comp, lanes_hi, step_x.comp), zero)
+	EVALUATE_EDGE(x);
+	EVALUATE_EDGE(y);
+	EVALUATE_EDGE(z);
+#undef EVALUATE_EDGE
+
+	uint32x4_t bits = vld1q_u32(lane_bits);
+	uint32x4_t inside_lo = vandq_u32(vandq_u32(vandq_u32(lo_x, lo_y), lo_z), bits);
+	uint32x4_t inside_hi = vandq_u32(vandq_u32(vandq_u32(hi_x, hi_y), hi_z), bits);
+	return vaddvq_u32(inside_lo) | (vaddvq_u32(inside_hi) << 4);
+#else
+	uint32_t mask = 0;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		vec3 e = row + step_x * (x + float(i));
+		if (all(greaterThan(e, vec3(0.0f))))
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+// Conservative edges are biased by this many float epsilons of the edge function magnitude,
+// scaled by the square root of the accumulation length in the scalar path.
+static constexpr float ConservativeEdgeBiasScale = 4.0f;
+static constexpr float ConservativeEdgeBiasSteps = 16.0f;
+
+void BinnedRasterizer::begin(uvec2 resolution_)
+{
+	resolution = resolution_;
+	num_tiles = uvec2((resolution.x + TileWidth - 1) / TileWidth, (resolution.y + TileHeight - 1) / TileHeight);
+	triangles.clear();
+	bins.resize(num_tiles.x * num_tiles.y);
+	for (auto &bin : bins)
+		bin.clear();
+}
+
+void BinnedRasterizer::add_triangles(const vec4 *clip_positions, const unsigned *indices, unsigned num_indices,
+                                     CullMode cull, CoverageMode mode)
+{
+	vec2 fresolution = vec2(resolution);
+	vec2 inv_resolution = 1.0f / fresolution;
+
+	TriangleSetup setups[4];
+	for (unsigned index = 0; index < num_indices; index += 3)
+	{
+		unsigned count = setup_clipped_triangles(setups,
+		                                         clip_positions[indices[index + 0]],
+		                                         clip_positions[indices[index + 1]],
+		                                         clip_positions[indices[index + 2]], cull);
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			auto &setup = setups[i];
+			BinnedTriangle tri;
+			tri.lo = max(ivec2(setup.lo * fresolution), ivec2(0));
+			tri.hi = min(ivec2(setup.hi * fresolution), ivec2(resolution) - 1);
+			if (tri.lo.x > tri.hi.x || tri.lo.y > tri.hi.y)
+				continue;
+
+			// Edge functions relative to pixel (0, 0).
+			// Evaluating at the most inside corner of a pixel gives conservative coverage like the scalar path.
+			tri.step_x = setup.dx * inv_resolution.x;
+			tri.step_y = setup.dy * inv_resolution.y;
+			tri.origin = setup.base;
+			if (mode == CoverageMode::Conservative)
+			{
+				tri.origin += select(vec3(0.0f), tri.step_x, greaterThan(setup.dx, vec3(0.0f)));
+				tri.origin += select(vec3(0.0f), tri.step_y, greaterThan(setup.dy, vec3(0.0f)));
+
+				// The scalar path accumulates its edge functions across the bounding box, which rounds differently.
+				// Bias the edges outwards by the expected rounding error, with margin,
+				// so coverage is a superset of what the scalar path produces.
+				vec3 magnitude = abs(tri.origin) +
+				                 abs(tri.step_x) * float(tri.hi.x + 1) +
+				                 abs(tri.step_y) * float(tri.hi.y + 1);
+				float walk = float(tri.hi.x - tri.lo.x + tri.hi.y - tri.lo.y);
+				float steps = ConservativeEdgeBiasScale * std::sqrt(walk) + ConservativeEdgeBiasSteps;
+				tri.origin += (std::numeric_limits<float>::epsilon() * steps) * magnitude;
+			}
+			else
+				tri.origin += 0.5f * (tri.step_x + tri.step_y);
+			tri.depth = setup.max_z;
+
+			auto triangle_index = uint32_t(triangles.size());
+			triangles.push_back(tri);
+
+			unsigned tile_lo_x = unsigned(tri.lo.x) / TileWidth;
+			unsigned tile_hi_x = unsigned(tri.hi.x) / TileWidth;
+			unsigned tile_lo_y = unsigned(tri.lo.y) / TileHeight;
+			unsigned tile_hi_y = unsigned(tri.hi.y) / TileHeight;
+			for (unsigned y = tile_lo_y; y <= tile_hi_y; y++)
+				for (unsigned x = tile_lo_x; x <= tile_hi_x; x++)
+					bins[y * num_tiles.x + x].push_back(triangle_index);
+		}
+	}
+}
+
+template <typename Op>
+void BinnedRasterizer::for_each_tile_row(unsigned tile_x, unsigned tile_y, const Op &op) const
+{
+	int base_x = int(tile_x * TileWidth);
+	int base_y = int(tile_y * TileHeight);
+	int end_x = base_x + TileWidth - 1;
+	int end_y = base_y + TileHeight - 1;
+
+	for (auto triangle_index : bins[tile_y * num_tiles.x + tile_x])
+	{
+		auto &tri = triangles[triangle_index];
+		int lo_x = std::max(tri.lo.x, base_x) - base_x;
+		int hi_x = std::min(tri.hi.x, end_x) - base_x;
+		int lo_y = std::max(tri.lo.y, base_y);
+		int hi_y = std::min(tri.hi.y, end_y);
+
+		uint32_t column_mask = (~0u << lo_x) & (~0u >> (31 - hi_x));
+		int first_group = lo_x >> 3;
+		int last_group = hi_x >> 3;
+
+		for (int y = lo_y; y <= hi_y; y++)
+		{
+			vec3 row = tri.origin + tri.step_y * float(y);
+			uint32_t word = 0;
+			for (int group = first_group; group <= last_group; group++)
+				word |= evaluate_edges_8(row, tri.step_x, float(base_x + 8 * group)) << (8 * group);
+			word &= column_mask;
+			if (word)
+				op(tri, unsigned(y), word);
+		}
+	}
+}
+
+template <typename Op>
+void BinnedRasterizer::for_each_tile(ThreadGroup *group, const Op &op) const
+{
+	const auto rasterize_tile_row = [this, &op](unsigned tile_y) {
+		for (unsigned tile_x = 0; tile_x < num_tiles.x; tile_x++)
+			op(tile_x, tile_y);
+	};
+
+	if (!group || num_tiles.y <= 1)
+	{
+		for (unsigned tile_y = 0; tile_y < num_tiles.y; tile_y++)
+			rasterize_tile_row(tile_y);
+		return;
+	}
+
+	// Tile rows cover disjoint rows of the output, so they can be written concurrently.
+	auto task = group->create_task();
+	for (unsigned tile_y = 0; tile_y < num_tiles.y; tile_y++)
+	{
+		task->enqueue_task([&rasterize_tile_row, tile_y]() {
+			rasterize_tile_row(tile_y);
+		});
+	}
+	task->flush();
+	task->wait();
+}
+
+void BinnedRasterizer::rasterize(CoverageMask &mask, ThreadGroup *group) const
+{
+	if (triangles.empty())
+		return;
+
+	for_each_tile(group, [this, &mask](unsigned tile_x, unsigned tile_y) {
+		for_each_tile_row(tile_x, tile_y, [&mask, tile_x](const BinnedTriangle &, unsigned y, uint32_t word) {
+			mask.get_row(y)[tile_x] |= word;
+		});
+	});
+}
+
+void BinnedRasterizer::rasterize_depth(float *depth, ThreadGroup *group) const
+{
+	if (triangles.empty())
+		return;
+
+	unsigned width = resolution.x;
+	for_each_tile(group, [this, depth, width](unsigned tile_x, unsigned tile_y) {
+		for_each_tile_row(tile_x, tile_y, [depth, width, tile_x](const BinnedTriangle &tri, unsigned y, uint32_t word) {
+			float *row = depth + y * width + tile_x * TileWidth;
+			Util::for_each_bit(word, [&](uint32_t bit) {
+				row[bit] = muglm::min(row[bit], tri.depth);
+			});
+		});
+	});
 }
 }
 }
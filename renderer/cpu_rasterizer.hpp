@@ -23,10 +23,13 @@
 #pragma once
 
 #include <vector>
+#include <stdint.h>
 #include "math.hpp"
 
 namespace Granite
 {
+class ThreadGroup;
+
 namespace Rasterizer
 {
 enum class CullMode
@@ -36,11 +39,94 @@ enum class CullMode
 	Both
 };
 
+enum class CoverageMode
+{
+	// Every pixel the triangle touches.
+	Conservative,
+	// Pixels whose center is inside the triangle, so adjacent triangles leave no gaps.
+	Center
+};
+
 void rasterize_conservative_triangles(std::vector<uvec2> &coverage,
                                       const vec4 *clip_positions,
                                       const unsigned *indices, unsigned num_indices,
                                       uvec2 resolution, CullMode cull);
 
 void transform_vertices(vec4 *clip_position, const vec4 *positions, unsigned num_positions, const mat4 &mvp);
+
+// One bit per pixel. Each row is padded to a multiple of 32 pixels, so every row starts on a new word.
+struct CoverageMask
+{
+	uvec2 resolution = uvec2(0u);
+	unsigned words_per_row = 0;
+	std::vector<uint32_t> bits;
+
+	void reset(uvec2 resolution);
+
+	bool test(unsigned x, unsigned y) const
+	{
+		return (bits[y * words_per_row + (x >> 5)] & (1u << (x & 31))) != 0;
+	}
+
+	uint32_t *get_row(unsigned y)
+	{
+		return bits.data() + y * words_per_row;
+	}
+
+	const uint32_t *get_row(unsigned y) const
+	{
+		return bits.data() + y * words_per_row;
+	}
+};
+
+// Conservative rasterizer which bins triangles into tiles before rasterizing them.
+// A tile is TileWidth x TileHeight pixels, and a row within a tile is exactly one word in the coverage mask.
+// Tiles can therefore be rasterized concurrently, and edge functions are evaluated for 8 pixels at a time.
+// Coverage matches rasterize_conservative_triangles(), up to rounding of the edge functions.
+class BinnedRasterizer
+{
+public:
+	enum { TileWidth = 32, TileHeight = 8 };
+
+	// Clears the previous set of triangles.
+	void begin(uvec2 resolution);
+	void add_triangles(const vec4 *clip_positions, const unsigned *indices, unsigned num_indices,
+	                   CullMode cull, CoverageMode mode = CoverageMode::Conservative);
+
+	// Coverage is ORed into mask, which must have been reset to the same resolution.
+	// If group is non-null, rows of tiles are rasterized in parallel.
+	void rasterize(CoverageMask &mask, ThreadGroup *group = nullptr) const;
+
+	// Depth is a tightly packed resolution.x * resolution.y buffer.
+	// Covered pixels take the minimum of the current depth and the farthest depth of the triangle,
+	// so the result never lies closer than the actual triangles.
+	void rasterize_depth(float *depth, ThreadGroup *group = nullptr) const;
+
+	unsigned get_num_triangles() const
+	{
+		return unsigned(triangles.size());
+	}
+
+private:
+	struct BinnedTriangle
+	{
+		vec3 origin;
+		vec3 step_x;
+		vec3 step_y;
+		ivec2 lo;
+		ivec2 hi;
+		float depth;
+	};
+
+	uvec2 resolution = uvec2(0u);
+	uvec2 num_tiles = uvec2(0u);
+	std::vector<BinnedTriangle> triangles;
+	std::vector<std::vector<uint32_t>> bins;
+
+	template <typename Op>
+	void for_each_tile(ThreadGroup *group, const Op &op) const;
+	template <typename Op>
+	void for_each_tile_row(unsigned tile_x, unsigned tile_y, const Op &op) const;
+};
 }
 }
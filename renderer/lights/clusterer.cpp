@@ -1074,12 +1074,11 @@ void LightClusterer::refresh(RenderContext &context_)
 		refresh_legacy(context_);
 }
 
+static_assert(LightClusterer::MaxLights <= ClustererCPULights::MaxLights, "Too many lights for CPU clustering.");
+
 uvec2 LightClusterer::cluster_lights_cpu(int x, int y, int z, const CPUGlobalAccelState &state,
                                          const CPULocalAccelState &local_state, float scale, uvec2 pre_mask)
 {
-	uint32_t spot_mask = 0;
-	uint32_t point_mask = 0;
-
 	vec3 view_space = vec3(2.0f, 2.0f, 0.5f) *
 	                  (vec3(x, y, z) + vec3(0.5f * scale)) *
 	                  state.inv_res +
@@ -1088,45 +1087,8 @@ uvec2 LightClusterer::cluster_lights_cpu(int x, int y, int z, const CPUGlobalAcc
 	vec3 cube_center = (state.inverse_cluster_transform * vec4(view_space, 1.0f)).xyz();
 	float cube_radius = local_state.cube_radius * scale;
 
-	while (pre_mask.x)
-	{
-		unsigned i = trailing_zeroes(pre_mask.x);
-		pre_mask.x &= ~(1u << i);
-
-		// Sphere/cone culling from https://bartwronski.com/2017/04/13/cull-that-cone/.
-		vec3 V = cube_center - state.spot_position[i];
-		float V_sq = dot(V, V);
-		float V1_len  = dot(V, state.spot_direction[i]);
-
-		if (V1_len > cube_radius + state.spot_size[i])
-			continue;
-		if (-V1_len > cube_radius)
-			continue;
-
-		float V2_len = sqrtf(std::max(V_sq - V1_len * V1_len, 0.0f));
-		float distance_closest_point = state.spot_angle_cos[i] * V2_len - state.spot_angle_sin[i] * V1_len;
-
-		if (distance_closest_point > cube_radius)
-			continue;
-
-		spot_mask |= 1u << i;
-	}
-
-	while (pre_mask.y)
-	{
-		unsigned i = trailing_zeroes(pre_mask.y);
-		pre_mask.y &= ~(1u << i);
-
-		vec3 cube_center_dist = cube_center - state.point_position[i];
-		float radial_dist_sqr = dot(cube_center_dist, cube_center_dist);
-
-		float cutoff = state.point_size[i] + cube_radius;
-		cutoff *= cutoff;
-		bool radial_inside = radial_dist_sqr <= cutoff;
-		if (radial_inside)
-			point_mask |= 1u << i;
-	}
-
+	uint32_t spot_mask = cluster_spot_lights_cpu(state.lights, cube_center, cube_radius, pre_mask.x);
+	uint32_t point_mask = cluster_point_lights_cpu(state.lights, cube_center, cube_radius, pre_mask.y);
 	return uvec2(spot_mask, point_mask);
 }
 
@@ -1286,241 +1248,6 @@ void LightClusterer::update_bindless_range_buffer_cpu(Vulkan::CommandBuffer &cmd
 	memcpy(ranges, bindless.light_index_range.data(), resolution_z * sizeof(ivec2));
 }
 
-static vec2 project_sphere_flat(float view_xy, float view_z, float radius)
-{
-	// Goal here is to deal with the intersection problem in 2D.
-	// Camera forms a cone with the sphere.
-	// We want to intersect that cone with the near plane.
-	// To do that we find minimum and maximum angles in 2D, rotate the direction vector,
-	// and project down to plane.
-
-	float len = length(vec2(view_xy, view_z));
-	float sin_xy = radius / len;
-
-	if (sin_xy < 0.999f)
-	{
-		// Find half-angles for the cone, and turn it into a 2x2 rotation matrix.
-		float cos_xy = muglm::sqrt(1.0f - sin_xy * sin_xy);
-
-		// Rotate half-angles in each direction.
-		vec2 rot_lo = mat2(vec2(cos_xy, +sin_xy), vec2(-sin_xy, cos_xy)) * vec2(view_xy, view_z);
-		vec2 rot_hi = mat2(vec2(cos_xy, -sin_xy), vec2(+sin_xy, cos_xy)) * vec2(view_xy, view_z);
-
-		// Clip to some sensible ranges.
-		if (rot_lo.y <= 0.0f)
-		{
-			rot_lo.x = -1.0f;
-			rot_lo.y = 0.0f;
-		}
-
-		if (rot_hi.y <= 0.0f)
-		{
-			rot_hi.x = +1.0f;
-			rot_hi.y = 0.0f;
-		}
-
-		return vec2(rot_lo.x / rot_lo.y, rot_hi.x / rot_hi.y);
-	}
-	else
-		return vec2(-std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
-}
-
-struct ProjectedResult
-{
-	vec4 ranges;
-	vec4 transformed_ranges;
-	mat2 clip_transform;
-	bool ellipsis;
-};
-
-static ProjectedResult project_sphere(const RenderContext &context,
-                                      const vec3 &pos, float radius)
-{
-	ProjectedResult result;
-	vec3 view = (context.get_render_parameters().view * vec4(pos, 1.0f)).xyz();
-
-	// Work in projection space.
-	view.y = -view.y;
-	view.z = -view.z;
-
-	result.ranges = vec4(project_sphere_flat(view.x, view.z, radius),
-	                     project_sphere_flat(view.y, view.z, radius));
-
-	// Need to rotate view space on the Z-axis so the ellipsis will
-	// have its major axes orthogonal with X/Y.
-	float xy_length = length(vec2(view.x, view.y));
-
-	if (xy_length < 0.0001f)
-	{
-		result.clip_transform = mat2(1.0f);
-	}
-	else
-	{
-		float inv_xy_length = 1.0f / muglm::max(xy_length, 0.0000001f);
-		result.clip_transform = mat2(vec2(view.x, -view.y) * inv_xy_length,
-		                             vec2(view.y, view.x) * inv_xy_length);
-	}
-
-	vec2 transformed_xy = result.clip_transform * vec2(view.x, view.y);
-
-	result.transformed_ranges = vec4(project_sphere_flat(transformed_xy.x, view.z, radius),
-	                                 project_sphere_flat(transformed_xy.y, view.z, radius));
-
-	result.ellipsis =
-			result.transformed_ranges.x > -std::numeric_limits<float>::infinity() &&
-			result.transformed_ranges.y < std::numeric_limits<float>::infinity() &&
-			result.transformed_ranges.z > -std::numeric_limits<float>::infinity() &&
-			result.transformed_ranges.w < std::numeric_limits<float>::infinity();
-
-	return result;
-}
-
-void LightClusterer::update_bindless_mask_buffer_spot(uint32_t *masks, unsigned index)
-{
-	vector<uvec2> coverage;
-
-	Rasterizer::CullMode cull;
-	vec2 range = spot_light_z_range(*context, bindless.transforms.model[index]);
-	if (range.x <= context->get_render_parameters().z_near && range.y >= context->get_render_parameters().z_far)
-		cull = Rasterizer::CullMode::Both;
-	else if (range.x <= context->get_render_parameters().z_near)
-		cull = Rasterizer::CullMode::Back;
-	else
-		cull = Rasterizer::CullMode::Front;
-
-	if (cull != Rasterizer::CullMode::Both)
-	{
-		auto mvp = context->get_render_parameters().view_projection * bindless.transforms.model[index];
-		const vec4 spot_points[5] = {
-				vec4(0.0f, 0.0f, 0.0f, 1.0f),
-				vec4(+1.0f, +1.0f, -1.0f, 1.0f),
-				vec4(-1.0f, +1.0f, -1.0f, 1.0f),
-				vec4(-1.0f, -1.0f, -1.0f, 1.0f),
-				vec4(+1.0f, -1.0f, -1.0f, 1.0f),
-		};
-		vec4 clip[5];
-		Rasterizer::transform_vertices(clip, spot_points, 5, mvp);
-		coverage.clear();
-
-		static const unsigned indices[6 * 3] = {
-				0, 1, 2,
-				0, 2, 3,
-				0, 3, 4,
-				0, 4, 1,
-				2, 1, 3,
-				4, 3, 1,
-		};
-
-		Rasterizer::rasterize_conservative_triangles(coverage, clip,
-		                                             indices, sizeof(indices) / sizeof(indices[0]),
-		                                             uvec2(resolution_x, resolution_y),
-		                                             cull);
-
-		for (auto &cov : coverage)
-		{
-			unsigned linear_coord = cov.y * resolution_x + cov.x;
-			auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-			tile_list[index >> 5] |= 1u << (index & 31);
-		}
-	}
-	else
-	{
-		for (unsigned y = 0; y < resolution_y; y++)
-		{
-			for (unsigned x = 0; x < resolution_x; x++)
-			{
-				unsigned linear_coord = y * resolution_x + x;
-				auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-				tile_list[index >> 5] |= 1u << (index & 31);
-			}
-		}
-	}
-}
-
-void LightClusterer::update_bindless_mask_buffer_point(uint32_t *masks, unsigned index)
-{
-	vec2 inv_resolution = 1.0f / vec2(resolution_x, resolution_y);
-	vec2 clip_scale = vec2(context->get_render_parameters().inv_projection[0][0],
-	                       -context->get_render_parameters().inv_projection[1][1]);
-
-	auto &pos = bindless.transforms.lights[index].position;
-	float radius = 1.0f / bindless.transforms.lights[index].inv_radius;
-
-	auto projection = project_sphere(*context, pos, radius);
-	auto &ranges = projection.ranges;
-	auto &transformed_ranges = projection.transformed_ranges;
-	auto &clip_transform = projection.clip_transform;
-	auto &ellipsis = projection.ellipsis;
-
-	// Compute screen-space BB for projected sphere.
-	ranges = ranges *
-	         vec4(context->get_render_parameters().projection[0][0],
-	              context->get_render_parameters().projection[0][0],
-	              -context->get_render_parameters().projection[1][1],
-	              -context->get_render_parameters().projection[1][1]) *
-	         0.5f + 0.5f;
-
-	ranges *= vec4(resolution_x, resolution_x, resolution_y, resolution_y);
-	ranges = clamp(ranges, vec4(0.0f), vec4(resolution_x, resolution_x - 1,
-	                                        resolution_y, resolution_y - 1));
-
-	uvec4 uranges(ranges);
-
-	if (ellipsis)
-	{
-		vec2 intersection_center = 0.5f * (transformed_ranges.xz() + transformed_ranges.yw());
-		vec2 intersection_radius = transformed_ranges.yw() - intersection_center;
-
-		vec2 inv_intersection_radius = 1.0f / intersection_radius;
-
-		for (unsigned y = uranges.z; y <= uranges.w; y++)
-		{
-			for (unsigned x = uranges.x; x <= uranges.y; x++)
-			{
-				vec2 clip_lo = 2.0f * vec2(x, y) * inv_resolution - 1.0f;
-				vec2 clip_hi = clip_lo + 2.0f * inv_resolution;
-				clip_lo *= clip_scale;
-				clip_hi *= clip_scale;
-
-				vec2 dist_00 = clip_transform * vec2(clip_lo.x, clip_lo.y) - intersection_center;
-				vec2 dist_01 = clip_transform * vec2(clip_lo.x, clip_hi.y) - intersection_center;
-				vec2 dist_10 = clip_transform * vec2(clip_hi.x, clip_lo.y) - intersection_center;
-				vec2 dist_11 = clip_transform * vec2(clip_hi.x, clip_hi.y) - intersection_center;
-
-				dist_00 *= inv_intersection_radius;
-				dist_01 *= inv_intersection_radius;
-				dist_10 *= inv_intersection_radius;
-				dist_11 *= inv_intersection_radius;
-
-				float max_diag = muglm::max(distance(dist_00, dist_11), distance(dist_01, dist_10));
-				float min_sq_dist = (1.0f + max_diag) * (1.0f + max_diag);
-
-				if (dot(dist_00, dist_00) < min_sq_dist &&
-				    dot(dist_01, dist_01) < min_sq_dist &&
-				    dot(dist_10, dist_10) < min_sq_dist &&
-				    dot(dist_11, dist_11) < min_sq_dist)
-				{
-					unsigned linear_coord = y * resolution_x + x;
-					auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-					tile_list[index >> 5] |= 1u << (index & 31);
-				}
-			}
-		}
-	}
-	else
-	{
-		for (unsigned y = uranges.z; y <= uranges.w; y++)
-		{
-			for (unsigned x = uranges.x; x <= uranges.y; x++)
-			{
-				unsigned linear_coord = y * resolution_x + x;
-				auto *tile_list = masks + linear_coord * bindless.parameters.num_lights_32;
-				tile_list[index >> 5] |= 1u << (index & 31);
-			}
-		}
-	}
-}
-
 void LightClusterer::update_bindless_mask_buffer_cpu(Vulkan::CommandBuffer &cmd)
 {
 	if (bindless.parameters.num_lights == 0)
@@ -1530,13 +1257,14 @@ void LightClusterer::update_bindless_mask_buffer_cpu(Vulkan::CommandBuffer &cmd)
 	auto *masks = static_cast<uint32_t *>(cmd.update_buffer(*bindless.bitmask_buffer, 0, size));
 	memset(masks, 0, size);
 
-	for (unsigned i = 0; i < bindless.count; i++)
-	{
-		if (bindless_light_is_point(i))
-			update_bindless_mask_buffer_point(masks, i);
-		else
-			update_bindless_mask_buffer_spot(masks, i);
-	}
+	ClustererBindlessBinning binning;
+	binning.context = context;
+	binning.transforms = &bindless.transforms;
+	binning.count = bindless.count;
+	binning.num_lights_32 = bindless.parameters.num_lights_32;
+	binning.resolution_x = resolution_x;
+	binning.resolution_y = resolution_y;
+	bin_bindless_lights(binning, masks, Global::thread_group());
 }
 
 void LightClusterer::update_bindless_mask_buffer_gpu(Vulkan::CommandBuffer &cmd)
@@ -1719,17 +1447,13 @@ void LightClusterer::build_cluster_cpu(Vulkan::CommandBuffer &cmd, Vulkan::Image
 
 	for (unsigned i = 0; i < legacy.spots.count; i++)
 	{
-		state.spot_position[i] = legacy.spots.lights[i].position;
-		state.spot_direction[i] = legacy.spots.lights[i].direction;
-		state.spot_size[i] = 1.0f / legacy.spots.lights[i].inv_radius;
-		state.spot_angle_cos[i] = cosf(legacy.spots.handles[i]->get_xy_range());
-		state.spot_angle_sin[i] = sinf(legacy.spots.handles[i]->get_xy_range());
+		state.lights.set_spot(i, legacy.spots.lights[i].position, legacy.spots.lights[i].direction,
+		                      1.0f / legacy.spots.lights[i].inv_radius, legacy.spots.handles[i]->get_xy_range());
 	}
 
 	for (unsigned i = 0; i < legacy.points.count; i++)
 	{
-		state.point_position[i] = legacy.points.lights[i].position;
-		state.point_size[i] = 1.0f / legacy.points.lights[i].inv_radius;
+		state.lights.set_point(i, legacy.points.lights[i].position, 1.0f / legacy.points.lights[i].inv_radius);
 	}
 
 	for (unsigned slice = 0; slice < ClusterHierarchies + 1; slice++)
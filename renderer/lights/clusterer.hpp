@@ -28,6 +28,7 @@
 #include "shader_manager.hpp"
 #include "renderer.hpp"
 #include "lru_cache.hpp"
+#include "clusterer_cpu.hpp"
 
 namespace Granite
 {
@@ -172,13 +173,7 @@ private:
 	struct CPUGlobalAccelState
 	{
 		mat4 inverse_cluster_transform;
-		vec3 spot_position[MaxLights];
-		vec3 spot_direction[MaxLights];
-		float spot_size[MaxLights];
-		float spot_angle_sin[MaxLights];
-		float spot_angle_cos[MaxLights];
-		vec3 point_position[MaxLights];
-		float point_size[MaxLights];
+		ClustererCPULights lights;
 
 		vec3 inv_res;
 		float radius;
@@ -238,8 +233,6 @@ private:
 	void update_bindless_range_buffer_gpu(Vulkan::CommandBuffer &cmd);
 	void update_bindless_mask_buffer_cpu(Vulkan::CommandBuffer &cmd);
 	void update_bindless_mask_buffer_gpu(Vulkan::CommandBuffer &cmd);
-	void update_bindless_mask_buffer_spot(uint32_t *masks, unsigned index);
-	void update_bindless_mask_buffer_point(uint32_t *masks, unsigned index);
 	void begin_bindless_barriers(Vulkan::CommandBuffer &cmd);
 	void end_bindless_barriers(Vulkan::CommandBuffer &cmd);
 	void render_bindless_spot(Vulkan::CommandBuffer &cmd, unsigned index);
@@ -0,0 +1,553 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "clusterer_cpu.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "simd_headers.hpp"
+#include "bitops.hpp"
+#include "render_context.hpp"
+#include "lights.hpp"
+#include "thread_group.hpp"
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+namespace Granite
+{
+void ClustererCPULights::set_spot(unsigned index, const vec3 &position, const vec3 &direction, float size, float xy_range)
+{
+	spot_position_x[index] = position.x;
+	spot_position_y[index] = position.y;
+	spot_position_z[index] = position.z;
+	spot_direction_x[index] = direction.x;
+	spot_direction_y[index] = direction.y;
+	spot_direction_z[index] = direction.z;
+	spot_size[index] = size;
+	spot_angle_sin[index] = sinf(xy_range);
+	spot_angle_cos[index] = cosf(xy_range);
+}
+
+void ClustererCPULights::set_point(unsigned index, const vec3 &position, float size)
+{
+	point_position_x[index] = position.x;
+	point_position_y[index] = position.y;
+	point_position_z[index] = position.z;
+	point_size[index] = size;
+}
+
+uint32_t cluster_spot_lights_cpu_scalar(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask)
+{
+	uint32_t mask = 0;
+	while (pre_mask)
+	{
+		unsigned i = trailing_zeroes(pre_mask);
+		pre_mask &= ~(1u << i);
+
+		// Sphere/cone culling from https://bartwronski.com/2017/04/13/cull-that-cone/.
+		vec3 V = center - vec3(lights.spot_position_x[i], lights.spot_position_y[i], lights.spot_position_z[i]);
+		float V_sq = dot(V, V);
+		float V1_len = dot(V, vec3(lights.spot_direction_x[i], lights.spot_direction_y[i], lights.spot_direction_z[i]));
+
+		if (V1_len > radius + lights.spot_size[i])
+			continue;
+		if (-V1_len > radius)
+			continue;
+
+		float V2_len = sqrtf(std::max(V_sq - V1_len * V1_len, 0.0f));
+		float distance_closest_point = lights.spot_angle_cos[i] * V2_len - lights.spot_angle_sin[i] * V1_len;
+
+		if (distance_closest_point > radius)
+			continue;
+
+		mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+uint32_t cluster_point_lights_cpu_scalar(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask)
+{
+	uint32_t mask = 0;
+	while (pre_mask)
+	{
+		unsigned i = trailing_zeroes(pre_mask);
+		pre_mask &= ~(1u << i);
+
+		vec3 dist = center - vec3(lights.point_position_x[i], lights.point_position_y[i], lights.point_position_z[i]);
+		float cutoff = lights.point_size[i] + radius;
+		if (dot(dist, dist) <= cutoff * cutoff)
+			mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+#if defined(__AVX__)
+// Each call tests 8 lights starting at base, and returns one bit per light.
+static inline uint32_t spot_lights_mask(const ClustererCPULights &lights, unsigned base,
+                                        __m256 cx, __m256 cy, __m256 cz, __m256 radius)
+{
+	__m256 vx = _mm256_sub_ps(cx, _mm256_load_ps(lights.spot_position_x + base));
+	__m256 vy = _mm256_sub_ps(cy, _mm256_load_ps(lights.spot_position_y + base));
+	__m256 vz = _mm256_sub_ps(cz, _mm256_load_ps(lights.spot_position_z + base));
+
+	__m256 v_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+	__m256 v1_len = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(vx, _mm256_load_ps(lights.spot_direction_x + base)),
+			_mm256_mul_ps(vy, _mm256_load_ps(lights.spot_direction_y + base))),
+			_mm256_mul_ps(vz, _mm256_load_ps(lights.spot_direction_z + base)));
+
+	__m256 reject = _mm256_cmp_ps(v1_len, _mm256_add_ps(radius, _mm256_load_ps(lights.spot_size + base)), _CMP_GT_OQ);
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(_mm256_sub_ps(_mm256_setzero_ps(), v1_len), radius, _CMP_GT_OQ));
+
+	__m256 v2_len = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(v_sq, _mm256_mul_ps(v1_len, v1_len)), _mm256_setzero_ps()));
+	__m256 distance_closest_point = _mm256_sub_ps(
+			_mm256_mul_ps(_mm256_load_ps(lights.spot_angle_cos + base), v2_len),
+			_mm256_mul_ps(_mm256_load_ps(lights.spot_angle_sin + base), v1_len));
+	reject = _mm256_or_ps(reject, _mm256_cmp_ps(distance_closest_point, radius, _CMP_GT_OQ));
+
+	return uint32_t(_mm256_movemask_ps(reject)) ^ 0xffu;
+}
+
+static inline uint32_t point_lights_mask(const ClustererCPULights &lights, unsigned base,
+                                         __m256 cx, __m256 cy, __m256 cz, __m256 radius)
+{
+	__m256 vx = _mm256_sub_ps(cx, _mm256_load_ps(lights.point_position_x + base));
+	__m256 vy = _mm256_sub_ps(cy, _mm256_load_ps(lights.point_position_y + base));
+	__m256 vz = _mm256_sub_ps(cz, _mm256_load_ps(lights.point_position_z + base));
+	__m256 dist_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+	__m256 cutoff = _mm256_add_ps(radius, _mm256_load_ps(lights.point_size + base));
+	__m256 accept = _mm256_cmp_ps(dist_sq, _mm256_mul_ps(cutoff, cutoff), _CMP_LE_OQ);
+	return uint32_t(_mm256_movemask_ps(accept));
+}
+
+#define SIMD_LIGHTS_PER_ITERATION 8
+#define SIMD_SETUP() \
+	__m256 cx = _mm256_set1_ps(center.x); \
+	__m256 cy = _mm256_set1_ps(center.y); \
+	__m256 cz = _mm256_set1_ps(center.z); \
+	__m256 r = _mm256_set1_ps(radius)
+#elif defined(__SSE__)
+// Each call tests 4 lights starting at base, and returns one bit per light.
+static inline uint32_t spot_lights_mask(const ClustererCPULights &lights, unsigned base,
+                                        __m128 cx, __m128 cy, __m128 cz, __m128 radius)
+{
+	__m128 vx = _mm_sub_ps(cx, _mm_load_ps(lights.spot_position_x + base));
+	__m128 vy = _mm_sub_ps(cy, _mm_load_ps(lights.spot_position_y + base));
+	__m128 vz = _mm_sub_ps(cz, _mm_load_ps(lights.spot_position_z + base));
+
+	__m128 v_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+	__m128 v1_len = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(vx, _mm_load_ps(lights.spot_direction_x + base)),
+			_mm_mul_ps(vy, _mm_load_ps(lights.spot_direction_y + base))),
+			_mm_mul_ps(vz, _mm_load_ps(lights.spot_direction_z + base)));
+
+	__m128 reject = _mm_cmpgt_ps(v1_len, _mm_add_ps(radius, _mm_load_ps(lights.spot_size + base)));
+	reject = _mm_or_ps(reject, _mm_cmpgt_ps(_mm_sub_ps(_mm_setzero_ps(), v1_len), radius));
+
+	__m128 v2_len = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(v_sq, _mm_mul_ps(v1_len, v1_len)), _mm_setzero_ps()));
+	__m128 distance_closest_point = _mm_sub_ps(
+			_mm_mul_ps(_mm_load_ps(lights.spot_angle_cos + base), v2_len),
+			_mm_mul_ps(_mm_load_ps(lights.spot_angle_sin + base), v1_len));
+	reject = _mm_or_ps(reject, _mm_cmpgt_ps(distance_closest_point, radius));
+
+	return uint32_t(_mm_movemask_ps(reject)) ^ 0xfu;
+}
+
+static inline uint32_t point_lights_mask(const ClustererCPULights &lights, unsigned base,
+                                         __m128 cx, __m128 cy, __m128 cz, __m128 radius)
+{
+	__m128 vx = _mm_sub_ps(cx, _mm_load_ps(lights.point_position_x + base));
+	__m128 vy = _mm_sub_ps(cy, _mm_load_ps(lights.point_position_y + base));
+	__m128 vz = _mm_sub_ps(cz, _mm_load_ps(lights.point_position_z + base));
+	__m128 dist_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+	__m128 cutoff = _mm_add_ps(radius, _mm_load_ps(lights.point_size + base));
+	__m128 accept = _mm_cmple_ps(dist_sq, _mm_mul_ps(cutoff, cutoff));
+	return uint32_t(_mm_movemask_ps(accept));
+}
+
+#define SIMD_LIGHTS_PER_ITERATION 4
+#define SIMD_SETUP() \
+	__m128 cx = _mm_set1_ps(center.x); \
+	__m128 cy = _mm_set1_ps(center.y); \
+	__m128 cz = _mm_set1_ps(center.z); \
+	__m128 r = _mm_set1_ps(radius)
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static inline uint32_t movemask(uint32x4_t v)
+{
+	static const uint32_t bits[4] = { 1, 2, 4, 8 };
+	return vaddvq_u32(vandq_u32(v, vld1q_u32(bits)));
+}
+
+// Each call tests 4 lights starting at base, and returns one bit per light.
+static inline uint32_t spot_lights_mask(const ClustererCPULights &lights, unsigned base,
+                                        float32x4_t cx, float32x4_t cy, float32x4_t cz, float32x4_t radius)
+{
+	float32x4_t vx = vsubq_f32(cx, vld1q_f32(lights.spot_position_x + base));
+	float32x4_t vy = vsubq_f32(cy, vld1q_f32(lights.spot_position_y + base));
+	float32x4_t vz = vsubq_f32(cz, vld1q_f32(lights.spot_position_z + base));
+
+	float32x4_t v_sq = vmlaq_f32(vmlaq_f32(vmulq_f32(vx, vx), vy, vy), vz, vz);
+	float32x4_t v1_len = vmulq_f32(vx, vld1q_f32(lights.spot_direction_x + base));
+	v1_len = vmlaq_f32(v1_len, vy, vld1q_f32(lights.spot_direction_y + base));
+	v1_len = vmlaq_f32(v1_len, vz, vld1q_f32(lights.spot_direction_z + base));
+
+	uint32x4_t reject = vcgtq_f32(v1_len, vaddq_f32(radius, vld1q_f32(lights.spot_size + base)));
+	reject = vorrq_u32(reject, vcgtq_f32(vnegq_f32(v1_len), radius));
+
+	float32x4_t v2_len = vsqrtq_f32(vmaxq_f32(vmlsq_f32(v_sq, v1_len, v1_len), vdupq_n_f32(0.0f)));
+	float32x4_t distance_closest_point = vmlsq_f32(vmulq_f32(vld1q_f32(lights.spot_angle_cos + base), v2_len),
+	                                               vld1q_f32(lights.spot_angle_sin + base), v1_len);
+	reject = vorrq_u32(reject, vcgtq_f32(distance_closest_point, radius));
+
+	return movemask(reject) ^ 0xfu;
+}
+
+static inline uint32_t point_lights_mask(const ClustererCPULights &lights, unsigned base,
+                                         float32x4_t cx, float32x4_t cy, float32x4_t cz, float32x4_t radius)
+{
+	float32x4_t vx = vsubq_f32(cx, vld1q_f32(lights.point_position_x + base));
+	float32x4_t vy = vsubq_f32(cy, vld1q_f32(lights.point_position_y + base));
+	float32x4_t vz = vsubq_f32(cz, vld1q_f32(lights.point_position_z + base));
+	float32x4_t dist_sq = vmlaq_f32(vmlaq_f32(vmulq_f32(vx, vx), vy, vy), vz, vz);
+	float32x4_t cutoff = vaddq_f32(radius, vld1q_f32(lights.point_size + base));
+	return movemask(vcleq_f32(dist_sq, vmulq_f32(cutoff, cutoff)));
+}
+
+#define SIMD_LIGHTS_PER_ITERATION 4
+#define SIMD_SETUP() \
+	float32x4_t cx = vdupq_n_f32(center.x); \
+	float32x4_t cy = vdupq_n_f32(center.y); \
+	float32x4_t cz = vdupq_n_f32(center.z); \
+	float32x4_t r = vdupq_n_f32(radius)
+#endif
+
+#ifdef SIMD_LIGHTS_PER_ITERATION
+static_assert(ClustererCPULights::MaxLights % SIMD_LIGHTS_PER_ITERATION == 0, "MaxLights must be a multiple of vector width.");
+static const uint32_t simd_group_mask = (1u << SIMD_LIGHTS_PER_ITERATION) - 1u;
+
+uint32_t cluster_spot_lights_cpu(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask)
+{
+	SIMD_SETUP();
+	uint32_t mask = 0;
+	for (unsigned base = 0; base < ClustererCPULights::MaxLights && (pre_mask >> base) != 0; base += SIMD_LIGHTS_PER_ITERATION)
+		if ((pre_mask >> base) & simd_group_mask)
+			mask |= spot_lights_mask(lights, base, cx, cy, cz, r) << base;
+	return mask & pre_mask;
+}
+
+uint32_t cluster_point_lights_cpu(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask)
+{
+	SIMD_SETUP();
+	uint32_t mask = 0;
+	for (unsigned base = 0; base < ClustererCPULights::MaxLights && (pre_mask >> base) != 0; base += SIMD_LIGHTS_PER_ITERATION)
+		if ((pre_mask >> base) & simd_group_mask)
+			mask |= point_lights_mask(lights, base, cx, cy, cz, r) << base;
+	return mask & pre_mask;
+}
+#else
+uint32_t cluster_spot_lights_cpu(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask)
+{
+	return cluster_spot_lights_cpu_scalar(lights, center, radius, pre_mask);
+}
+
+uint32_t cluster_point_lights_cpu(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask)
+{
+	return cluster_point_lights_cpu_scalar(lights, center, radius, pre_mask);
+}
+#endif
+
+static vec2 project_sphere_flat(float view_xy, float view_z, float radius)
+{
+	// Goal here is to deal with the intersection problem in 2D.
+	// Camera forms a cone with the sphere.
+	// We want to intersect that cone with the near plane.
+	// To do that we find minimum and maximum angles in 2D, rotate the direction vector,
+	// and project down to plane.
+
+	float len = length(vec2(view_xy, view_z));
+	float sin_xy = radius / len;
+
+	if (sin_xy < 0.999f)
+	{
+		// Find half-angles for the cone, and turn it into a 2x2 rotation matrix.
+		float cos_xy = muglm::sqrt(1.0f - sin_xy * sin_xy);
+
+		// Rotate half-angles in each direction.
+		vec2 rot_lo = mat2(vec2(cos_xy, +sin_xy), vec2(-sin_xy, cos_xy)) * vec2(view_xy, view_z);
+		vec2 rot_hi = mat2(vec2(cos_xy, -sin_xy), vec2(+sin_xy, cos_xy)) * vec2(view_xy, view_z);
+
+		// Clip to some sensible ranges.
+		if (rot_lo.y <= 0.0f)
+		{
+			rot_lo.x = -1.0f;
+			rot_lo.y = 0.0f;
+		}
+
+		if (rot_hi.y <= 0.0f)
+		{
+			rot_hi.x = +1.0f;
+			rot_hi.y = 0.0f;
+		}
+
+		return vec2(rot_lo.x / rot_lo.y, rot_hi.x / rot_hi.y);
+	}
+	else
+		return vec2(-std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
+}
+
+struct ProjectedResult
+{
+	vec4 ranges;
+	vec4 transformed_ranges;
+	mat2 clip_transform;
+	bool ellipsis;
+};
+
+static ProjectedResult project_sphere(const RenderContext &context,
+                                      const vec3 &pos, float radius)
+{
+	ProjectedResult result;
+	vec3 view = (context.get_render_parameters().view * vec4(pos, 1.0f)).xyz();
+
+	// Work in projection space.
+	view.y = -view.y;
+	view.z = -view.z;
+
+	result.ranges = vec4(project_sphere_flat(view.x, view.z, radius),
+	                     project_sphere_flat(view.y, view.z, radius));
+
+	// Need to rotate view space on the Z-axis so the ellipsis will
+	// have its major axes orthogonal with X/Y.
+	float xy_length = length(vec2(view.x, view.y));
+
+	if (xy_length < 0.0001f)
+	{
+		result.clip_transform = mat2(1.0f);
+	}
+	else
+	{
+		float inv_xy_length = 1.0f / muglm::max(xy_length, 0.0000001f);
+		result.clip_transform = mat2(vec2(view.x, -view.y) * inv_xy_length,
+		                             vec2(view.y, view.x) * inv_xy_length);
+	}
+
+	vec2 transformed_xy = result.clip_transform * vec2(view.x, view.y);
+
+	result.transformed_ranges = vec4(project_sphere_flat(transformed_xy.x, view.z, radius),
+	                                 project_sphere_flat(transformed_xy.y, view.z, radius));
+
+	result.ellipsis =
+			result.transformed_ranges.x > -std::numeric_limits<float>::infinity() &&
+			result.transformed_ranges.y < std::numeric_limits<float>::infinity() &&
+			result.transformed_ranges.z > -std::numeric_limits<float>::infinity() &&
+			result.transformed_ranges.w < std::numeric_limits<float>::infinity();
+
+	return result;
+}
+
+void bin_bindless_spot_light(const ClustererBindlessBinning &binning, uint32_t *masks, unsigned index,
+                             Rasterizer::BinnedRasterizer &rasterizer, Rasterizer::CoverageMask &coverage)
+{
+	Rasterizer::CullMode cull;
+	vec2 range = spot_light_z_range(*binning.context, binning.transforms->model[index]);
+	if (range.x <= binning.context->get_render_parameters().z_near && range.y >= binning.context->get_render_parameters().z_far)
+		cull = Rasterizer::CullMode::Both;
+	else if (range.x <= binning.context->get_render_parameters().z_near)
+		cull = Rasterizer::CullMode::Back;
+	else
+		cull = Rasterizer::CullMode::Front;
+
+	if (cull != Rasterizer::CullMode::Both)
+	{
+		auto mvp = binning.context->get_render_parameters().view_projection * binning.transforms->model[index];
+		const vec4 spot_points[5] = {
+				vec4(0.0f, 0.0f, 0.0f, 1.0f),
+				vec4(+1.0f, +1.0f, -1.0f, 1.0f),
+				vec4(-1.0f, +1.0f, -1.0f, 1.0f),
+				vec4(-1.0f, -1.0f, -1.0f, 1.0f),
+				vec4(+1.0f, -1.0f, -1.0f, 1.0f),
+		};
+		vec4 clip[5];
+		Rasterizer::transform_vertices(clip, spot_points, 5, mvp);
+
+		static const unsigned indices[6 * 3] = {
+				0, 1, 2,
+				0, 2, 3,
+				0, 3, 4,
+				0, 4, 1,
+				2, 1, 3,
+				4, 3, 1,
+		};
+
+		uvec2 resolution(binning.resolution_x, binning.resolution_y);
+		coverage.reset(resolution);
+		rasterizer.begin(resolution);
+		rasterizer.add_triangles(clip, indices, sizeof(indices) / sizeof(indices[0]), cull);
+		rasterizer.rasterize(coverage);
+
+		for (unsigned y = 0; y < binning.resolution_y; y++)
+		{
+			auto *row = coverage.get_row(y);
+			for (unsigned word = 0; word < coverage.words_per_row; word++)
+			{
+				Util::for_each_bit(row[word], [&](uint32_t bit) {
+					unsigned linear_coord = y * binning.resolution_x + word * 32 + bit;
+					auto *tile_list = masks + linear_coord * binning.num_lights_32;
+					tile_list[index >> 5] |= 1u << (index & 31);
+				});
+			}
+		}
+	}
+	else
+	{
+		for (unsigned y = 0; y < binning.resolution_y; y++)
+		{
+			for (unsigned x = 0; x < binning.resolution_x; x++)
+			{
+				unsigned linear_coord = y * binning.resolution_x + x;
+				auto *tile_list = masks + linear_coord * binning.num_lights_32;
+				tile_list[index >> 5] |= 1u << (index & 31);
+			}
+		}
+	}
+}
+
+void bin_bindless_point_light(const ClustererBindlessBinning &binning, uint32_t *masks, unsigned index)
+{
+	vec2 inv_resolution = 1.0f / vec2(binning.resolution_x, binning.resolution_y);
+	vec2 clip_scale = vec2(binning.context->get_render_parameters().inv_projection[0][0],
+	                       -binning.context->get_render_parameters().inv_projection[1][1]);
+
+	auto &pos = binning.transforms->lights[index].position;
+	float radius = 1.0f / binning.transforms->lights[index].inv_radius;
+
+	auto projection = project_sphere(*binning.context, pos, radius);
+	auto &ranges = projection.ranges;
+	auto &transformed_ranges = projection.transformed_ranges;
+	auto &clip_transform = projection.clip_transform;
+	auto &ellipsis = projection.ellipsis;
+
+	// Compute screen-space BB for projected sphere.
+	ranges = ranges *
+	         vec4(binning.context->get_render_parameters().projection[0][0],
+	              binning.context->get_render_parameters().projection[0][0],
+	              -binning.context->get_render_parameters().projection[1][1],
+	              -binning.context->get_render_parameters().projection[1][1]) *
+	         0.5f + 0.5f;
+
+	ranges *= vec4(binning.resolution_x, binning.resolution_x, binning.resolution_y, binning.resolution_y);
+	ranges = clamp(ranges, vec4(0.0f), vec4(binning.resolution_x, binning.resolution_x - 1,
+	                                        binning.resolution_y, binning.resolution_y - 1));
+
+	uvec4 uranges(ranges);
+
+	if (ellipsis)
+	{
+		vec2 intersection_center = 0.5f * (transformed_ranges.xz() + transformed_ranges.yw());
+		vec2 intersection_radius = transformed_ranges.yw() - intersection_center;
+
+		vec2 inv_intersection_radius = 1.0f / intersection_radius;
+
+		for (unsigned y = uranges.z; y <= uranges.w; y++)
+		{
+			for (unsigned x = uranges.x; x <= uranges.y; x++)
+			{
+				vec2 clip_lo = 2.0f * vec2(x, y) * inv_resolution - 1.0f;
+				vec2 clip_hi = clip_lo + 2.0f * inv_resolution;
+				clip_lo *= clip_scale;
+				clip_hi *= clip_scale;
+
+				vec2 dist_00 = clip_transform * vec2(clip_lo.x, clip_lo.y) - intersection_center;
+				vec2 dist_01 = clip_transform * vec2(clip_lo.x, clip_hi.y) - intersection_center;
+				vec2 dist_10 = clip_transform * vec2(clip_hi.x, clip_lo.y) - intersection_center;
+				vec2 dist_11 = clip_transform * vec2(clip_hi.x, clip_hi.y) - intersection_center;
+
+				dist_00 *= inv_intersection_radius;
+				dist_01 *= inv_intersection_radius;
+				dist_10 *= inv_intersection_radius;
+				dist_11 *= inv_intersection_radius;
+
+				float max_diag = muglm::max(distance(dist_00, dist_11), distance(dist_01, dist_10));
+				float min_sq_dist = (1.0f + max_diag) * (1.0f + max_diag);
+
+				if (dot(dist_00, dist_00) < min_sq_dist &&
+				    dot(dist_01, dist_01) < min_sq_dist &&
+				    dot(dist_10, dist_10) < min_sq_dist &&
+				    dot(dist_11, dist_11) < min_sq_dist)
+				{
+					unsigned linear_coord = y * binning.resolution_x + x;
+					auto *tile_list = masks + linear_coord * binning.num_lights_32;
+					tile_list[index >> 5] |= 1u << (index & 31);
+				}
+			}
+		}
+	}
+	else
+	{
+		for (unsigned y = uranges.z; y <= uranges.w; y++)
+		{
+			for (unsigned x = uranges.x; x <= uranges.y; x++)
+			{
+				unsigned linear_coord = y * binning.resolution_x + x;
+				auto *tile_list = masks + linear_coord * binning.num_lights_32;
+				tile_list[index >> 5] |= 1u << (index & 31);
+			}
+		}
+	}
+}
+
+void bin_bindless_lights(const ClustererBindlessBinning &binning, uint32_t *masks, ThreadGroup *group)
+{
+	const auto bin_lights = [&binning, masks](unsigned first, unsigned last) {
+		Rasterizer::BinnedRasterizer rasterizer;
+		Rasterizer::CoverageMask coverage;
+		for (unsigned i = first; i < last; i++)
+		{
+			if ((binning.transforms->type_mask[i >> 5] & (1u << (i & 31))) != 0)
+				bin_bindless_point_light(binning, masks, i);
+			else
+				bin_bindless_spot_light(binning, masks, i, rasterizer, coverage);
+		}
+	};
+
+	if (!group || binning.count <= 32)
+	{
+		bin_lights(0, binning.count);
+		return;
+	}
+
+	// Each task owns 32 lights, i.e. one mask word in every tile.
+	// Tasks never write to the same word, so the result is bit-identical to the serial path.
+	auto task = group->create_task();
+	for (unsigned first = 0; first < binning.count; first += 32)
+	{
+		unsigned last = std::min(first + 32, binning.count);
+		task->enqueue_task([&bin_lights, first, last]() {
+			bin_lights(first, last);
+		});
+	}
+	task->flush();
+	task->wait();
+}
+}
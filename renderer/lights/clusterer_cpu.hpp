@@ -0,0 +1,88 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "math.hpp"
+#include "render_parameters.hpp"
+#include "cpu_rasterizer.hpp"
+#include <stdint.h>
+
+namespace Granite
+{
+class RenderContext;
+class ThreadGroup;
+
+// Light data for the CPU clustering path in structure-of-arrays form,
+// so the kernels can test a full vector of lights at a time.
+// Arrays are padded to a multiple of 8 lights. Padding lanes are never reported since results are masked by pre_mask.
+struct ClustererCPULights
+{
+	enum { MaxLights = 32 };
+
+	alignas(32) float spot_position_x[MaxLights];
+	alignas(32) float spot_position_y[MaxLights];
+	alignas(32) float spot_position_z[MaxLights];
+	alignas(32) float spot_direction_x[MaxLights];
+	alignas(32) float spot_direction_y[MaxLights];
+	alignas(32) float spot_direction_z[MaxLights];
+	alignas(32) float spot_size[MaxLights];
+	alignas(32) float spot_angle_sin[MaxLights];
+	alignas(32) float spot_angle_cos[MaxLights];
+
+	alignas(32) float point_position_x[MaxLights];
+	alignas(32) float point_position_y[MaxLights];
+	alignas(32) float point_position_z[MaxLights];
+	alignas(32) float point_size[MaxLights];
+
+	void set_spot(unsigned index, const vec3 &position, const vec3 &direction, float size, float xy_range);
+	void set_point(unsigned index, const vec3 &position, float size);
+};
+
+// Tests every light in pre_mask against the sphere at center and returns the mask of lights which touch it.
+uint32_t cluster_spot_lights_cpu(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask);
+uint32_t cluster_point_lights_cpu(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask);
+
+// One light at a time, for reference.
+uint32_t cluster_spot_lights_cpu_scalar(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask);
+uint32_t cluster_point_lights_cpu_scalar(const ClustererCPULights &lights, const vec3 &center, float radius, uint32_t pre_mask);
+
+// Bins bindless lights into screen tiles.
+// masks holds num_lights_32 words per tile with tiles in row-major order, and must be cleared by the caller.
+struct ClustererBindlessBinning
+{
+	const RenderContext *context;
+	const ClustererBindlessTransforms *transforms;
+	unsigned count;
+	unsigned num_lights_32;
+	unsigned resolution_x;
+	unsigned resolution_y;
+};
+
+void bin_bindless_spot_light(const ClustererBindlessBinning &binning, uint32_t *masks, unsigned index,
+                             Rasterizer::BinnedRasterizer &rasterizer, Rasterizer::CoverageMask &coverage);
+void bin_bindless_point_light(const ClustererBindlessBinning &binning, uint32_t *masks, unsigned index);
+
+// Bins every light. If group is non-null, ranges of 32 lights are binned in parallel.
+void bin_bindless_lights(const ClustererBindlessBinning &binning, uint32_t *masks, ThreadGroup *group);
+}
@@ -0,0 +1,258 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "occlusion_culler.hpp"
+#include "simd_headers.hpp"
+#include "timer.hpp"
+#include "muglm/muglm_impl.hpp"
+#include <algorithm>
+#include <float.h>
+
+using namespace std;
+
+namespace Granite
+{
+OcclusionCuller::OcclusionCuller()
+{
+	set_resolution(256, 128);
+}
+
+void OcclusionCuller::set_resolution(unsigned width, unsigned height)
+{
+	hiz_resolution = uvec2((width + BlockSize - 1) / BlockSize, (height + BlockSize - 1) / BlockSize);
+	resolution = hiz_resolution * uvec2(BlockSize);
+	has_depth = false;
+}
+
+void OcclusionCuller::begin(const mat4 &view_projection_)
+{
+	view_projection = view_projection_;
+	rasterizer.begin(resolution);
+	stats = {};
+	has_depth = false;
+}
+
+void OcclusionCuller::add_occluder(const mat4 &model, const vec4 *positions, unsigned num_positions,
+                                   const unsigned *indices, unsigned num_indices)
+{
+	auto start = Util::get_current_time_nsecs();
+	clip.resize(num_positions);
+	Rasterizer::transform_vertices(clip.data(), positions, num_positions, view_projection * model);
+
+	// We cannot know which way the occluder is facing after arbitrary transforms, so keep both sides.
+	rasterizer.add_triangles(clip.data(), indices, num_indices,
+	                         Rasterizer::CullMode::Both, Rasterizer::CoverageMode::Center);
+	stats.occluder_triangles = rasterizer.get_num_triangles();
+	stats.rasterize_nsecs += Util::get_current_time_nsecs() - start;
+}
+
+void OcclusionCuller::end(ThreadGroup *group)
+{
+	auto start = Util::get_current_time_nsecs();
+	depth.clear();
+	depth.resize(resolution.x * resolution.y, 1.0f);
+	rasterizer.rasterize_depth(depth.data(), group);
+	build_hiz();
+	has_depth = true;
+	stats.rasterize_nsecs += Util::get_current_time_nsecs() - start;
+}
+
+void OcclusionCuller::record_tests(unsigned tested, unsigned culled, uint64_t nsecs)
+{
+	stats.tested += tested;
+	stats.culled += culled;
+	stats.test_nsecs += nsecs;
+}
+
+void OcclusionCuller::build_hiz()
+{
+	hiz.resize(hiz_resolution.x * hiz_resolution.y);
+
+	for (unsigned by = 0; by < hiz_resolution.y; by++)
+	{
+		for (unsigned bx = 0; bx < hiz_resolution.x; bx++)
+		{
+			const float *block = depth.data() + by * BlockSize * resolution.x + bx * BlockSize;
+#if defined(__SSE__)
+			__m128 max_depth = _mm_setzero_ps();
+			for (unsigned y = 0; y < BlockSize; y++, block += resolution.x)
+			{
+				max_depth = _mm_max_ps(max_depth, _mm_loadu_ps(block));
+				max_depth = _mm_max_ps(max_depth, _mm_loadu_ps(block + 4));
+			}
+			max_depth = _mm_max_ps(max_depth, _mm_shuffle_ps(max_depth, max_depth, _MM_SHUFFLE(1, 0, 3, 2)));
+			max_depth = _mm_max_ps(max_depth, _mm_shuffle_ps(max_depth, max_depth, _MM_SHUFFLE(2, 3, 0, 1)));
+			hiz[by * hiz_resolution.x + bx] = _mm_cvtss_f32(max_depth);
+#else
+			float max_depth = 0.0f;
+			for (unsigned y = 0; y < BlockSize; y++, block += resolution.x)
+				for (unsigned x = 0; x < BlockSize; x++)
+					max_depth = muglm::max(max_depth, block[x]);
+			hiz[by * hiz_resolution.x + bx] = max_depth;
+#endif
+		}
+	}
+}
+
+// Returns true if any pixel of the block within [x0, x1] x [y0, y1] is not in front of min_z.
+bool OcclusionCuller::test_block(unsigned block_x, unsigned block_y, int x0, int x1, int y0, int y1, float min_z) const
+{
+	int base_x = int(block_x * BlockSize);
+	int base_y = int(block_y * BlockSize);
+	int lo_x = std::max(x0, base_x) - base_x;
+	int hi_x = std::min(x1, base_x + BlockSize - 1) - base_x;
+	int lo_y = std::max(y0, base_y);
+	int hi_y = std::min(y1, base_y + BlockSize - 1);
+	uint32_t column_mask = ((2u << hi_x) - 1u) & ~((1u << lo_x) - 1u);
+
+#if defined(__SSE__)
+	__m128 z = _mm_set1_ps(min_z);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint32_t lane_bits[4] = { 1, 2, 4, 8 };
+	uint32x4_t bits = vld1q_u32(lane_bits);
+	float32x4_t z = vdupq_n_f32(min_z);
+#endif
+
+	for (int y = lo_y; y <= hi_y; y++)
+	{
+		const float *row = depth.data() + y * resolution.x + base_x;
+#if defined(__SSE__)
+		uint32_t mask = uint32_t(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row), z))) |
+		                (uint32_t(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + 4), z))) << 4);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		uint32_t mask = vaddvq_u32(vandq_u32(vcgeq_f32(vld1q_f32(row), z), bits)) |
+		                (vaddvq_u32(vandq_u32(vcgeq_f32(vld1q_f32(row + 4), z), bits)) << 4);
+#else
+		uint32_t mask = 0;
+		for (unsigned x = 0; x < BlockSize; x++)
+			if (row[x] >= min_z)
+				mask |= 1u << x;
+#endif
+		if (mask & column_mask)
+			return true;
+	}
+
+	return false;
+}
+
+bool OcclusionCuller::test_aabb(const AABB &aabb) const
+{
+	if (!has_depth)
+		return true;
+
+	// Project the 8 corners, and find the screen space bounding rect and nearest depth.
+	// Any corner close to or behind the camera makes the projection meaningless, so treat it as visible.
+	constexpr float MinW = 1.0f / 1024.0f;
+	vec4 lo, hi;
+	float min_w;
+
+#if defined(__SSE__)
+	// Since the box is axis aligned, each axis contributes one of two terms per corner.
+	__m128 box_lo = _mm_loadu_ps(aabb.get_minimum4().data);
+	__m128 box_hi = _mm_loadu_ps(aabb.get_maximum4().data);
+	__m128 col0 = _mm_loadu_ps(view_projection[0].data);
+	__m128 col1 = _mm_loadu_ps(view_projection[1].data);
+	__m128 col2 = _mm_loadu_ps(view_projection[2].data);
+	__m128 col3 = _mm_loadu_ps(view_projection[3].data);
+
+	__m128 x_terms[2] = {
+		_mm_mul_ps(col0, _mm_shuffle_ps(box_lo, box_lo, _MM_SHUFFLE(0, 0, 0, 0))),
+		_mm_mul_ps(col0, _mm_shuffle_ps(box_hi, box_hi, _MM_SHUFFLE(0, 0, 0, 0))),
+	};
+	__m128 y_terms[2] = {
+		_mm_mul_ps(col1, _mm_shuffle_ps(box_lo, box_lo, _MM_SHUFFLE(1, 1, 1, 1))),
+		_mm_mul_ps(col1, _mm_shuffle_ps(box_hi, box_hi, _MM_SHUFFLE(1, 1, 1, 1))),
+	};
+	__m128 z_terms[2] = {
+		_mm_add_ps(col3, _mm_mul_ps(col2, _mm_shuffle_ps(box_lo, box_lo, _MM_SHUFFLE(2, 2, 2, 2)))),
+		_mm_add_ps(col3, _mm_mul_ps(col2, _mm_shuffle_ps(box_hi, box_hi, _MM_SHUFFLE(2, 2, 2, 2)))),
+	};
+
+	__m128 min_proj = _mm_set1_ps(FLT_MAX);
+	__m128 max_proj = _mm_set1_ps(-FLT_MAX);
+	__m128 min_ws = _mm_set1_ps(FLT_MAX);
+	for (unsigned i = 0; i < 8; i++)
+	{
+		__m128 corner = _mm_add_ps(_mm_add_ps(x_terms[i & 1], y_terms[(i >> 1) & 1]), z_terms[(i >> 2) & 1]);
+		__m128 w = _mm_shuffle_ps(corner, corner, _MM_SHUFFLE(3, 3, 3, 3));
+		min_ws = _mm_min_ps(min_ws, w);
+		__m128 proj = _mm_div_ps(corner, w);
+		min_proj = _mm_min_ps(min_proj, proj);
+		max_proj = _mm_max_ps(max_proj, proj);
+	}
+
+	min_w = _mm_cvtss_f32(min_ws);
+	_mm_storeu_ps(lo.data, min_proj);
+	_mm_storeu_ps(hi.data, max_proj);
+#else
+	lo = vec4(FLT_MAX);
+	hi = vec4(-FLT_MAX);
+	min_w = FLT_MAX;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		vec4 corner = view_projection * vec4(aabb.get_corner(i), 1.0f);
+		min_w = muglm::min(min_w, corner.w);
+		vec4 proj = corner / vec4(corner.w);
+		lo = min(lo, proj);
+		hi = max(hi, proj);
+	}
+#endif
+
+	if (min_w < MinW)
+		return true;
+
+	vec2 fresolution = vec2(resolution);
+	vec2 screen_lo = (lo.xy() * 0.5f + 0.5f) * fresolution;
+	vec2 screen_hi = (hi.xy() * 0.5f + 0.5f) * fresolution;
+
+	// Entirely outside the screen, which is for the frustum test to decide.
+	if (screen_hi.x < 0.0f || screen_hi.y < 0.0f || screen_lo.x >= fresolution.x || screen_lo.y >= fresolution.y)
+		return true;
+
+	int x0 = std::max(int(screen_lo.x), 0);
+	int y0 = std::max(int(screen_lo.y), 0);
+	int x1 = std::min(int(screen_hi.x), int(resolution.x) - 1);
+	int y1 = std::min(int(screen_hi.y), int(resolution.y) - 1);
+	float min_z = lo.z;
+
+	unsigned block_x0 = unsigned(x0) / BlockSize;
+	unsigned block_y0 = unsigned(y0) / BlockSize;
+	unsigned block_x1 = unsigned(x1) / BlockSize;
+	unsigned block_y1 = unsigned(y1) / BlockSize;
+
+	for (unsigned by = block_y0; by <= block_y1; by++)
+	{
+		for (unsigned bx = block_x0; bx <= block_x1; bx++)
+		{
+			// The whole block is in front of the box.
+			if (hiz[by * hiz_resolution.x + bx] < min_z)
+				continue;
+
+			if (test_block(bx, by, x0, x1, y0, y1, min_z))
+				return true;
+		}
+	}
+
+	return false;
+}
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "cpu_rasterizer.hpp"
+#include "aabb.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace Granite
+{
+class ThreadGroup;
+
+// Software occlusion culling against a small depth buffer.
+// Occluders are rasterized at pixel centers with the farthest depth of each triangle, so depth never lies
+// in front of the real occluders, but silhouettes are only accurate to half a pixel of the depth buffer.
+// Objects are culled only if their bounding box lies entirely behind the occluders.
+// Depth follows the Vulkan convention, 0 is near and 1 is far.
+class OcclusionCuller
+{
+public:
+	enum { BlockSize = 8 };
+
+	OcclusionCuller();
+
+	// Resolution is rounded up to a multiple of BlockSize.
+	void set_resolution(unsigned width, unsigned height);
+
+	uvec2 get_resolution() const
+	{
+		return resolution;
+	}
+
+	// Starts a new frame of occluders. Previous depth is discarded.
+	void begin(const mat4 &view_projection);
+	// Positions are object space, w must be 1.
+	void add_occluder(const mat4 &model, const vec4 *positions, unsigned num_positions,
+	                  const unsigned *indices, unsigned num_indices);
+	// Rasterizes all occluders and builds the hierarchical depth buffer.
+	// If group is non-null, rasterization is spread over the thread group.
+	void end(ThreadGroup *group = nullptr);
+
+	// Returns false if the world space box is certainly hidden behind occluders.
+	// Safe to call concurrently after end().
+	bool test_aabb(const AABB &aabb) const;
+
+	struct Statistics
+	{
+		unsigned occluder_triangles = 0;
+		unsigned tested = 0;
+		unsigned culled = 0;
+		uint64_t rasterize_nsecs = 0;
+		uint64_t test_nsecs = 0;
+	};
+
+	// Counters are reset in begin(). Tests are recorded by the caller, since test_aabb() is const.
+	void record_tests(unsigned tested, unsigned culled, uint64_t nsecs);
+
+	const Statistics &get_statistics() const
+	{
+		return stats;
+	}
+
+	const float *get_depth() const
+	{
+		return depth.data();
+	}
+
+	// Farthest depth within each BlockSize x BlockSize block.
+	const float *get_hiz() const
+	{
+		return hiz.data();
+	}
+
+private:
+	Rasterizer::BinnedRasterizer rasterizer;
+	uvec2 resolution;
+	uvec2 hiz_resolution;
+	mat4 view_projection;
+	std::vector<float> depth;
+	std::vector<float> hiz;
+	std::vector<vec4> clip;
+	Statistics stats;
+	bool has_depth = false;
+
+	void build_hiz();
+	bool test_block(unsigned block_x, unsigned block_y, int x0, int x1, int y0, int y1, float min_z) const;
+};
+}
@@ -37,6 +37,7 @@ void setup_fxaa_postprocess(RenderGraph &graph, const std::string &input, const
 
 	fxaa.add_color_output(output, fxaa_output);
 	auto &fxaa_input = fxaa.add_texture_input(input);
+	fxaa.set_parallel_recording(true);
 	fxaa.set_build_render_pass([&, input](Vulkan::CommandBuffer &cmd) {
 		auto &input_image = graph.get_physical_texture_resource(fxaa_input);
 		cmd.set_unorm_texture(0, 0, input_image);
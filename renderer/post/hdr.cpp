@@ -345,6 +345,8 @@ void setup_hdr_postprocess_compute(RenderGraph &graph, const std::string &input,
 
 	auto &hdr = bloom_pass.add_texture_input(input);
 	bloom_pass.add_history_input("downsample-3");
+	// The HDR passes only read graph resources and frame constants, so they can be recorded on worker threads.
+	bloom_pass.set_parallel_recording(true);
 	bloom_pass.set_build_render_pass([&, ubo = lum](Vulkan::CommandBuffer &cmd) {
 		bloom_threshold_build_compute(cmd, graph, t, hdr, ubo);
 		cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
@@ -385,6 +387,7 @@ void setup_hdr_postprocess_compute(RenderGraph &graph, const std::string &input,
 		if (options.dynamic_exposure)
 			ubo_res = &tonemap.add_uniform_input("average-luminance");
 
+		tonemap.set_parallel_recording(true);
 		tonemap.set_build_render_pass([&, iface = iface, ubo = ubo_res](Vulkan::CommandBuffer &cmd)
 		                              {
 			                              tonemap_build_render_pass(tonemap, cmd, hdr_res, bloom_res, ubo, iface);
@@ -411,6 +414,8 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 			auto &output_res = adapt_pass.add_storage_output("average-luminance-updated", buffer_info,
 			                                                 "average-luminance");
 			auto &input_res = adapt_pass.add_texture_input("bloom-downsample-3");
+			// The HDR passes only read graph resources and frame constants, so they can be recorded on worker threads.
+			adapt_pass.set_parallel_recording(true);
 			adapt_pass.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 			                                 {
 				                                 luminance_build_render_pass(adapt_pass, cmd, input_res, output_res);
@@ -433,6 +438,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		if (options.dynamic_exposure)
 			ubo_res = &threshold.add_uniform_input("average-luminance");
 
+		threshold.set_parallel_recording(true);
 		threshold.set_build_render_pass([&, ubo = ubo_res](Vulkan::CommandBuffer &cmd)
 		                                {
 			                                bloom_threshold_build_render_pass(threshold, cmd, input_res, ubo);
@@ -449,6 +455,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		auto &blur0 = graph.add_pass("bloom-downsample-0", RenderGraph::get_default_post_graphics_queue());
 		blur0.add_color_output("bloom-downsample-0", blur_info);
 		auto &input_res = blur0.add_texture_input("threshold");
+		blur0.set_parallel_recording(true);
 		blur0.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_downsample_build_render_pass(blur0, cmd, input_res, nullptr, false);
@@ -462,6 +469,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		auto &blur1 = graph.add_pass("bloom-downsample-1", RenderGraph::get_default_post_graphics_queue());
 		blur1.add_color_output("bloom-downsample-1", blur_info);
 		auto &input_res = blur1.add_texture_input("bloom-downsample-0");
+		blur1.set_parallel_recording(true);
 		blur1.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_downsample_build_render_pass(blur1, cmd, input_res, nullptr, false);
@@ -475,6 +483,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		auto &blur2 = graph.add_pass("bloom-downsample-2", RenderGraph::get_default_post_graphics_queue());
 		blur2.add_color_output("bloom-downsample-2", blur_info);
 		auto &input_res = blur2.add_texture_input("bloom-downsample-1");
+		blur2.set_parallel_recording(true);
 		blur2.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_downsample_build_render_pass(blur2, cmd, input_res, nullptr, false);
@@ -489,6 +498,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		blur3.add_color_output("bloom-downsample-3", blur_info);
 		auto &input_res = blur3.add_texture_input("bloom-downsample-2");
 		auto &feedback = blur3.add_history_input("bloom-downsample-3");
+		blur3.set_parallel_recording(true);
 		blur3.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_downsample_build_render_pass(blur3, cmd, input_res, &feedback, true);
@@ -502,6 +512,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		auto &blur4 = graph.add_pass("bloom-upsample-0", RenderGraph::get_default_post_graphics_queue());
 		blur4.add_color_output("bloom-upsample-0", blur_info);
 		auto &input_res = blur4.add_texture_input("bloom-downsample-3");
+		blur4.set_parallel_recording(true);
 		blur4.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_upsample_build_render_pass(blur4, cmd, input_res);
@@ -515,6 +526,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		auto &blur5 = graph.add_pass("bloom-upsample-1", RenderGraph::get_default_post_graphics_queue());
 		blur5.add_color_output("bloom-upsample-1", blur_info);
 		auto &input_res = blur5.add_texture_input("bloom-upsample-0");
+		blur5.set_parallel_recording(true);
 		blur5.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_upsample_build_render_pass(blur5, cmd, input_res);
@@ -528,6 +540,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		auto &blur6 = graph.add_pass("bloom-upsample-2", RenderGraph::get_default_post_graphics_queue());
 		blur6.add_color_output("bloom-upsample-2", blur_info);
 		auto &input_res = blur6.add_texture_input("bloom-upsample-1");
+		blur6.set_parallel_recording(true);
 		blur6.set_build_render_pass([&](Vulkan::CommandBuffer &cmd)
 		                            {
 			                            bloom_upsample_build_render_pass(blur6, cmd, input_res);
@@ -546,6 +559,7 @@ void setup_hdr_postprocess(RenderGraph &graph, const std::string &input, const s
 		if (options.dynamic_exposure)
 			ubo_res = &tonemap.add_uniform_input("average-luminance-updated");
 
+		tonemap.set_parallel_recording(true);
 		tonemap.set_build_render_pass([&, iface = iface, ubo = ubo_res](Vulkan::CommandBuffer &cmd)
 		                              {
 			                              tonemap_build_render_pass(tonemap, cmd, hdr_res, bloom_res, ubo, iface);
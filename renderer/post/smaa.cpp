@@ -117,6 +117,9 @@ void setup_smaa_postprocess(RenderGraph &graph, TemporalJitter &jitter,
 	auto &blend_input_res = smaa_blend.add_texture_input(input);
 	auto &blend_weight_res = smaa_blend.add_texture_input("smaa-weights");
 
+	// The weight pass stays serial since it might be the first to load the lookup textures.
+	smaa_edge.set_parallel_recording(true);
+	smaa_blend.set_parallel_recording(true);
 	smaa_edge.set_build_render_pass([&, edge = masked_edge, q = smaa_quality](Vulkan::CommandBuffer &cmd) {
 		auto &input_image = graph.get_physical_texture_resource(edge_input_res);
 		cmd.set_unorm_texture(0, 0, input_image);
@@ -208,6 +211,7 @@ void setup_smaa_postprocess(RenderGraph &graph, TemporalJitter &jitter,
 		smaa_resolve.add_color_output("smaa-variance", variance);
 		smaa_resolve.add_history_input("smaa-variance");
 
+		smaa_resolve.set_parallel_recording(true);
 		smaa_resolve.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
 			auto &current = graph.get_physical_texture_resource(input_res);
 			auto *prev = graph.get_physical_history_texture_resource(history_res);
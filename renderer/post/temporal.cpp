@@ -169,6 +169,7 @@ void setup_taa_resolve(RenderGraph &graph, TemporalJitter &jitter, const std::st
 	mvs.set_depth_stencil_input(input_depth);
 	mvs.add_attachment_input(input_depth);
 
+	mvs.set_parallel_recording(true);
 	mvs.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
 		cmd.set_input_attachments(0, 0);
 
@@ -202,6 +203,7 @@ void setup_taa_resolve(RenderGraph &graph, TemporalJitter &jitter, const std::st
 #endif
 	auto &history = resolve.add_history_input(output);
 
+	resolve.set_parallel_recording(true);
 	resolve.set_build_render_pass([&, q = Util::ecast(quality)](Vulkan::CommandBuffer &cmd) {
 		auto &image = graph.get_physical_texture_resource(input_res);
 		auto &depth = graph.get_physical_texture_resource(input_depth_res);
@@ -271,6 +273,7 @@ void setup_fxaa_2phase_postprocess(RenderGraph &graph, TemporalJitter &jitter, c
 	auto &depth_res = sharpen.add_texture_input(input_depth);
 	auto &history_res = sharpen.add_history_input("fxaa-sharpen");
 
+	sharpen.set_parallel_recording(true);
 	sharpen.set_build_render_pass([&](Vulkan::CommandBuffer &cmd) {
 		auto *history = graph.get_physical_history_texture_resource(history_res);
 		auto &fxaa = graph.get_physical_texture_resource(input_res);
@@ -203,6 +203,23 @@ struct TransparentComponent : ComponentBase
 	GRANITE_COMPONENT_TYPE_DECL(TransparentComponent)
 };
 
+// Low-poly geometry rasterized by OcclusionCuller.
+// The mesh should lie inside the visible geometry of the entity so it never hides more than the real mesh.
+// Positions are object space with w = 1, and are transformed by the RenderInfoComponent transform.
+struct OccluderMesh : Util::IntrusivePtrEnabled<OccluderMesh>
+{
+	std::vector<vec4> positions;
+	std::vector<unsigned> indices;
+};
+using OccluderMeshHandle = Util::IntrusivePtr<OccluderMesh>;
+
+// Instances of the same mesh share one OccluderMesh.
+struct OccluderComponent : ComponentBase
+{
+	GRANITE_COMPONENT_TYPE_DECL(OccluderComponent)
+	OccluderMeshHandle mesh;
+};
+
 struct PositionalLightComponent : ComponentBase
 {
 	GRANITE_COMPONENT_TYPE_DECL(PositionalLightComponent)
@@ -24,6 +24,8 @@
 #include "type_to_string.hpp"
 #include "format.hpp"
 #include "quirks.hpp"
+#include "global_managers.hpp"
+#include "thread_group.hpp"
 #include "muglm/muglm_impl.hpp"
 #include <algorithm>
 
@@ -324,6 +326,8 @@ RenderTextureResource &RenderPass::set_depth_stencil_input(const std::string &na
 
 RenderGraph::RenderGraph()
 {
+	baked_topologies.set_total_cost(BakeCacheSize);
+	baked_graphs.set_total_cost(BakeCacheSize);
 	EVENT_MANAGER_REGISTER_LATCH(RenderGraph, on_swapchain_changed, on_swapchain_destroyed, Vulkan::SwapchainParameterEvent);
 	EVENT_MANAGER_REGISTER_LATCH(RenderGraph, on_device_created, on_device_destroyed, Vulkan::DeviceCreatedEvent);
 }
@@ -961,7 +965,7 @@ void RenderGraph::build_render_pass_info()
 						if (pass.get_clear_color(i))
 						{
 							rp.clear_attachments |= 1u << res.first;
-							physical_pass.color_clear_requests.push_back({ &pass, &rp.clear_color[res.first], i });
+							physical_pass.color_clear_requests.push_back({ pass.get_index(), res.first, i });
 						}
 					}
 					else
@@ -1016,8 +1020,7 @@ void RenderGraph::build_render_pass_info()
 				if (res.second && pass.get_clear_depth_stencil())
 				{
 					rp.op_flags |= Vulkan::RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT;
-					physical_pass.depth_clear_request.pass = &pass;
-					physical_pass.depth_clear_request.target = &rp.clear_depth_stencil;
+					physical_pass.depth_clear_request.pass = pass.get_index();
 				}
 
 				rp.op_flags |= Vulkan::RENDER_PASS_OP_STORE_DEPTH_STENCIL_BIT;
@@ -1633,6 +1636,124 @@ bool RenderGraph::need_invalidate(const Barrier &barrier, const PipelineEvent &e
 	return need_invalidate;
 }
 
+static void get_queue_type(Vulkan::CommandBuffer::Type &queue_type, bool &graphics, RenderGraphQueueFlagBits flag)
+{
+	switch (flag)
+	{
+	default:
+	case RENDER_GRAPH_QUEUE_GRAPHICS_BIT:
+		graphics = true;
+		queue_type = Vulkan::CommandBuffer::Type::Generic;
+		break;
+
+	case RENDER_GRAPH_QUEUE_COMPUTE_BIT:
+		graphics = false;
+		queue_type = Vulkan::CommandBuffer::Type::Generic;
+		break;
+
+	case RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT:
+		graphics = false;
+		queue_type = Vulkan::CommandBuffer::Type::AsyncCompute;
+		break;
+
+	case RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT:
+		graphics = true;
+		queue_type = Vulkan::CommandBuffer::Type::AsyncGraphics;
+		break;
+	}
+}
+
+void RenderGraph::record_physical_pass(Vulkan::CommandBuffer &cmd, PhysicalPass &physical_pass, bool graphics)
+{
+	if (graphics)
+	{
+		auto &rp = physical_pass.render_pass_info;
+		for (auto &clear_req : physical_pass.color_clear_requests)
+			passes[clear_req.pass]->get_clear_color(clear_req.index, &rp.clear_color[clear_req.target]);
+
+		if (physical_pass.depth_clear_request.pass != RenderPass::Unused)
+			passes[physical_pass.depth_clear_request.pass]->get_clear_depth_stencil(&rp.clear_depth_stencil);
+
+		Vulkan::QueryPoolHandle start_vertex, start_fragment, end_vertex, end_fragment;
+		if (enabled_timestamps)
+		{
+			start_vertex = cmd.write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+			start_fragment = cmd.write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+		}
+
+		// TODO: Replace with multiview.
+		VK_ASSERT(physical_pass.layers != ~0u);
+		for (unsigned layer = 0; layer < physical_pass.layers; layer++)
+		{
+			physical_pass.render_pass_info.base_layer = layer;
+			cmd.begin_region("begin-render-pass");
+			cmd.begin_render_pass(physical_pass.render_pass_info);
+			cmd.end_region();
+
+			for (auto &subpass : physical_pass.passes)
+			{
+				auto subpass_index = unsigned(&subpass - physical_pass.passes.data());
+				auto &scaled_requests = physical_pass.scaled_clear_requests[subpass_index];
+				enqueue_scaled_requests(cmd, scaled_requests);
+
+				auto &pass = *passes[subpass];
+
+				// If we have started the render pass, we have to do it, even if a lone subpass might not be required,
+				// due to clearing and so on.
+				// This should be an extremely unlikely scenario.
+				// Either you need all subpasses or none.
+				cmd.begin_region(pass.get_name().c_str());
+				pass.build_render_pass(cmd, layer);
+				cmd.end_region();
+
+				if (&subpass != &physical_pass.passes.back())
+					cmd.next_subpass();
+			}
+
+			cmd.begin_region("end-render-pass");
+			cmd.end_render_pass();
+			cmd.end_region();
+		}
+
+		if (enabled_timestamps)
+		{
+			end_vertex = cmd.write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+			end_fragment = cmd.write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+			string name;
+			if (physical_pass.passes.size() == 1)
+				name = passes[physical_pass.passes.front()]->get_name();
+			else
+			{
+				for (auto &pass : physical_pass.passes)
+				{
+					name += passes[pass]->get_name();
+					if (&pass != &physical_pass.passes.back())
+						name += " + ";
+				}
+			}
+			device->register_time_interval("geometry", std::move(start_vertex), std::move(end_vertex), name.c_str());
+			device->register_time_interval("fragment", std::move(start_fragment), std::move(end_fragment), name.c_str());
+		}
+		enqueue_mipmap_requests(cmd, physical_pass.mipmap_requests);
+	}
+	else
+	{
+		assert(physical_pass.passes.size() == 1);
+		auto &pass = *passes[physical_pass.passes.front()];
+		Vulkan::QueryPoolHandle start_ts, end_ts;
+		if (enabled_timestamps)
+			start_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		cmd.begin_region(pass.get_name().c_str());
+		pass.build_render_pass(cmd, 0);
+		cmd.end_region();
+		if (enabled_timestamps)
+		{
+			end_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			device->register_time_interval("compute", std::move(start_ts), std::move(end_ts), pass.get_name().c_str());
+		}
+	}
+}
+
 void RenderGraph::enqueue_render_passes(Vulkan::Device &device_)
 {
 	vector<VkBufferMemoryBarrier> buffer_barriers;
@@ -1670,6 +1791,7 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device_)
 		}
 	};
 
+	vector<bool> required_passes(physical_passes.size());
 	for (auto &physical_pass : physical_passes)
 	{
 		bool require_pass = false;
@@ -1678,6 +1800,62 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device_)
 			if (passes[pass]->need_render_pass())
 				require_pass = true;
 		}
+		required_passes[&physical_pass - physical_passes.data()] = require_pass;
+	}
+
+	// Kick off recording of passes which opted in to parallel recording.
+	// Barriers and events are still resolved serially below, since they depend on the submission order.
+	vector<Vulkan::CommandBufferHandle> parallel_command_buffers;
+	vector<bool> parallel_passes(physical_passes.size());
+	TaskGroup record_task;
+#ifdef GRANITE_VULKAN_MT
+	if (auto *group = Global::thread_group())
+	{
+		for (auto &physical_pass : physical_passes)
+		{
+			auto physical_pass_index = unsigned(&physical_pass - physical_passes.data());
+			if (!required_passes[physical_pass_index])
+				continue;
+
+			bool parallel = true;
+			for (auto &pass : physical_pass.passes)
+			{
+				if (!passes[pass]->get_parallel_recording())
+					parallel = false;
+			}
+
+			if (!parallel)
+				continue;
+			parallel_passes[physical_pass_index] = true;
+
+			if (!record_task)
+			{
+				record_task = group->create_task();
+				parallel_command_buffers.resize(physical_passes.size());
+			}
+
+			bool graphics;
+			Vulkan::CommandBuffer::Type queue_type;
+			get_queue_type(queue_type, graphics, passes[physical_pass.passes.front()]->get_queue());
+
+			// Each worker only writes to its own slot.
+			auto *target = &parallel_command_buffers[physical_pass_index];
+			auto *pass = &physical_pass;
+			record_task->enqueue_task([this, &device_, target, pass, queue_type, graphics]() {
+				auto cmd = device_.request_command_buffer(queue_type);
+				record_physical_pass(*cmd, *pass, graphics);
+				*target = std::move(cmd);
+			});
+		}
+
+		if (record_task)
+			record_task->flush();
+	}
+#endif
+
+	for (auto &physical_pass : physical_passes)
+	{
+		bool require_pass = required_passes[&physical_pass - physical_passes.data()];
 
 		if (!require_pass)
 		{
@@ -1687,29 +1865,7 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device_)
 
 		bool graphics;
 		Vulkan::CommandBuffer::Type queue_type;
-		switch (passes[physical_pass.passes.front()]->get_queue())
-		{
-		default:
-		case RENDER_GRAPH_QUEUE_GRAPHICS_BIT:
-			graphics = true;
-			queue_type = Vulkan::CommandBuffer::Type::Generic;
-			break;
-
-		case RENDER_GRAPH_QUEUE_COMPUTE_BIT:
-			graphics = false;
-			queue_type = Vulkan::CommandBuffer::Type::Generic;
-			break;
-
-		case RENDER_GRAPH_QUEUE_ASYNC_COMPUTE_BIT:
-			graphics = false;
-			queue_type = Vulkan::CommandBuffer::Type::AsyncCompute;
-			break;
-
-		case RENDER_GRAPH_QUEUE_ASYNC_GRAPHICS_BIT:
-			graphics = true;
-			queue_type = Vulkan::CommandBuffer::Type::AsyncGraphics;
-			break;
-		}
+		get_queue_type(queue_type, graphics, passes[physical_pass.passes.front()]->get_queue());
 
 		auto cmd = device_.request_command_buffer(queue_type);
 		cmd->begin_region("render-graph-sync-pre");
@@ -1916,95 +2072,23 @@ void RenderGraph::enqueue_render_passes(Vulkan::Device &device_)
 
 		cmd->end_region();
 
-		if (graphics)
+		auto physical_pass_index = unsigned(&physical_pass - physical_passes.data());
+		if (parallel_passes[physical_pass_index])
 		{
-			for (auto &clear_req : physical_pass.color_clear_requests)
-				clear_req.pass->get_clear_color(clear_req.index, clear_req.target);
-
-			if (physical_pass.depth_clear_request.pass)
-			{
-				physical_pass.depth_clear_request.pass->get_clear_depth_stencil(
-					physical_pass.depth_clear_request.target);
-			}
-
-			Vulkan::QueryPoolHandle start_vertex, start_fragment, end_vertex, end_fragment;
-			if (enabled_timestamps)
+			// The pass was recorded on a worker thread.
+			// Submit it in graph order between the barriers and the event signal.
+			if (record_task)
 			{
-				start_vertex = cmd->write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
-				start_fragment = cmd->write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
+				record_task->wait();
+				record_task.reset();
 			}
 
-			// TODO: Replace with multiview.
-			VK_ASSERT(physical_pass.layers != ~0u);
-			for (unsigned layer = 0; layer < physical_pass.layers; layer++)
-			{
-				physical_pass.render_pass_info.base_layer = layer;
-				cmd->begin_region("begin-render-pass");
-				cmd->begin_render_pass(physical_pass.render_pass_info);
-				cmd->end_region();
-
-				for (auto &subpass : physical_pass.passes)
-				{
-					auto subpass_index = unsigned(&subpass - physical_pass.passes.data());
-					auto &scaled_requests = physical_pass.scaled_clear_requests[subpass_index];
-					enqueue_scaled_requests(*cmd, scaled_requests);
-
-					auto &pass = *passes[subpass];
-
-					// If we have started the render pass, we have to do it, even if a lone subpass might not be required,
-					// due to clearing and so on.
-					// This should be an extremely unlikely scenario.
-					// Either you need all subpasses or none.
-					cmd->begin_region(pass.get_name().c_str());
-					pass.build_render_pass(*cmd, layer);
-					cmd->end_region();
-
-					if (&subpass != &physical_pass.passes.back())
-						cmd->next_subpass();
-				}
-
-				cmd->begin_region("end-render-pass");
-				cmd->end_render_pass();
-				cmd->end_region();
-			}
-
-			if (enabled_timestamps)
-			{
-				end_vertex = cmd->write_timestamp(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
-				end_fragment = cmd->write_timestamp(VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT);
-				string name;
-				if (physical_pass.passes.size() == 1)
-					name = passes[physical_pass.passes.front()]->get_name();
-				else
-				{
-					for (auto &pass : physical_pass.passes)
-					{
-						name += passes[pass]->get_name();
-						if (&pass != &physical_pass.passes.back())
-							name += " + ";
-					}
-				}
-				device->register_time_interval("geometry", std::move(start_vertex), std::move(end_vertex), name.c_str());
-				device->register_time_interval("fragment", std::move(start_fragment), std::move(end_fragment), name.c_str());
-			}
-			enqueue_mipmap_requests(*cmd, physical_pass.mipmap_requests);
+			device_.submit(cmd);
+			device_.submit(parallel_command_buffers[physical_pass_index]);
+			cmd = device_.request_command_buffer(queue_type);
 		}
 		else
-		{
-			assert(physical_pass.passes.size() == 1);
-			auto &pass = *passes[physical_pass.passes.front()];
-			Vulkan::QueryPoolHandle start_ts, end_ts;
-			if (enabled_timestamps)
-				start_ts = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-			cmd->begin_region(pass.get_name().c_str());
-			pass.build_render_pass(*cmd, 0);
-			cmd->end_region();
-			if (enabled_timestamps)
-			{
-				end_ts = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-				device->register_time_interval("compute", std::move(start_ts), std::move(end_ts), pass.get_name().c_str());
-			}
-		}
+			record_physical_pass(*cmd, physical_pass, graphics);
 
 		cmd->begin_region("render-graph-sync-post");
 
@@ -2586,15 +2670,163 @@ bool RenderGraph::depends_on_pass(unsigned dst_pass, unsigned src_pass)
 	return false;
 }
 
-void RenderGraph::bake()
+static void hash_dimensions(Util::Hasher &h, const ResourceDimensions &dim)
 {
-	// First, validate that the graph is sane.
-	validate_passes();
+	h.u32(dim.format);
+	h.u64(dim.buffer_info.size);
+	h.u32(dim.buffer_info.usage);
+	h.u32(dim.buffer_info.persistent);
+	h.u32(dim.width);
+	h.u32(dim.height);
+	h.u32(dim.depth);
+	h.u32(dim.layers);
+	h.u32(dim.levels);
+	h.u32(dim.samples);
+	h.u32(dim.transient);
+	h.u32(dim.unorm_srgb);
+	h.u32(dim.persistent);
+	h.u32(dim.queues);
+	h.u32(dim.image_usage);
+}
 
-	auto itr = resource_to_index.find(backbuffer_source);
-	if (itr == end(resource_to_index))
-		throw logic_error("Backbuffer source does not exist.");
+void RenderGraph::hash_declarations(Util::Hash &topology_hash, Util::Hash &graph_hash)
+{
+	Util::Hasher h;
+
+	const auto hash_resources = [&](const auto &list) {
+		h.u32(list.size());
+		for (auto *res : list)
+			h.u32(res ? res->get_index() : RenderResource::Unused);
+	};
+
+	const auto hash_resource = [&](const RenderResource *res) {
+		h.u32(res ? res->get_index() : RenderResource::Unused);
+	};
+
+	// Everything which decides the dependencies and order of passes.
+	h.u32(passes.size());
+	for (auto &pass : passes)
+	{
+		h.u32(pass->get_queue());
+		hash_resources(pass->get_color_outputs());
+		hash_resources(pass->get_resolve_outputs());
+		hash_resources(pass->get_color_inputs());
+		hash_resources(pass->get_color_scale_inputs());
+		hash_resources(pass->get_storage_texture_outputs());
+		hash_resources(pass->get_storage_texture_inputs());
+		hash_resources(pass->get_blit_texture_outputs());
+		hash_resources(pass->get_blit_texture_inputs());
+		hash_resources(pass->get_attachment_inputs());
+		hash_resources(pass->get_history_inputs());
+		hash_resources(pass->get_storage_outputs());
+		hash_resources(pass->get_storage_inputs());
+		hash_resources(pass->get_transfer_outputs());
+		hash_resource(pass->get_depth_stencil_input());
+		hash_resource(pass->get_depth_stencil_output());
+
+		h.u32(pass->get_generic_texture_inputs().size());
+		for (auto &input : pass->get_generic_texture_inputs())
+		{
+			hash_resource(input.texture);
+			h.u32(input.stages);
+			h.u32(input.access);
+			h.u32(input.layout);
+		}
+
+		h.u32(pass->get_generic_buffer_inputs().size());
+		for (auto &input : pass->get_generic_buffer_inputs())
+		{
+			hash_resource(input.buffer);
+			h.u32(input.stages);
+			h.u32(input.access);
+			h.u32(input.layout);
+		}
+
+		h.u32(pass->get_fake_resource_aliases().size());
+		for (auto &alias : pass->get_fake_resource_aliases())
+		{
+			hash_resource(alias.first);
+			hash_resource(alias.second);
+		}
+	}
+
+	h.u32(resources.size());
+	for (auto &resource : resources)
+	{
+		h.u32(uint32_t(resource->get_type()));
+		h.u32(resource->get_used_queues());
+	}
 
+	h.u32(resource_to_index[backbuffer_source]);
+	topology_hash = h.get();
+
+	// Everything else which affects physical resources, render passes and barriers.
+	for (auto &pass : passes)
+	{
+		h.u32(pass->may_not_need_render_pass());
+		unsigned num_color_outputs = pass->get_color_outputs().size();
+		for (unsigned i = 0; i < num_color_outputs; i++)
+			h.u32(pass->get_clear_color(i));
+		h.u32(pass->get_clear_depth_stencil());
+	}
+
+	for (auto &resource : resources)
+	{
+		if (resource->get_type() == RenderResource::Type::Buffer)
+			hash_dimensions(h, get_resource_dimensions(static_cast<const RenderBufferResource &>(*resource)));
+		else
+			hash_dimensions(h, get_resource_dimensions(static_cast<const RenderTextureResource &>(*resource)));
+	}
+
+	hash_dimensions(h, swapchain_dimensions);
+	graph_hash = h.get();
+}
+
+void RenderGraph::save_baked_graph(BakedGraph &baked) const
+{
+	baked.pass_stack = pass_stack;
+	baked.pass_dependencies = pass_dependencies;
+	baked.pass_merge_dependencies = pass_merge_dependencies;
+	baked.pass_barriers = pass_barriers;
+	baked.physical_passes = physical_passes;
+	baked.physical_dimensions = physical_dimensions;
+	baked.physical_image_has_history = physical_image_has_history;
+	baked.physical_aliases = physical_aliases;
+	baked.swapchain_physical_index = swapchain_physical_index;
+
+	baked.pass_physical_indices.clear();
+	for (auto &pass : passes)
+		baked.pass_physical_indices.push_back(pass->get_physical_pass_index());
+
+	baked.resource_physical_indices.clear();
+	for (auto &resource : resources)
+		baked.resource_physical_indices.push_back(resource->get_physical_index());
+}
+
+void RenderGraph::restore_baked_graph(const BakedGraph &baked)
+{
+	pass_stack = baked.pass_stack;
+	pass_dependencies = baked.pass_dependencies;
+	pass_merge_dependencies = baked.pass_merge_dependencies;
+	pass_barriers = baked.pass_barriers;
+	physical_passes = baked.physical_passes;
+	physical_dimensions = baked.physical_dimensions;
+	physical_image_has_history = baked.physical_image_has_history;
+	physical_aliases = baked.physical_aliases;
+	swapchain_physical_index = baked.swapchain_physical_index;
+
+	// Copying invalidated the subpass pointers.
+	for (auto &physical_pass : physical_passes)
+		physical_pass.render_pass_info.subpasses = physical_pass.subpasses.data();
+
+	for (auto &pass : passes)
+		pass->set_physical_pass_index(baked.pass_physical_indices[pass->get_index()]);
+	for (auto &resource : resources)
+		resource->set_physical_index(baked.resource_physical_indices[resource->get_index()]);
+}
+
+void RenderGraph::build_topology()
+{
 	pass_stack.clear();
 
 	pass_dependencies.clear();
@@ -2603,7 +2835,7 @@ void RenderGraph::bake()
 	pass_merge_dependencies.resize(passes.size());
 
 	// Work our way back from the backbuffer, and sort out all the dependencies.
-	auto &backbuffer_resource = *resources[itr->second];
+	auto &backbuffer_resource = *resources[resource_to_index[backbuffer_source]];
 
 	if (backbuffer_resource.get_write_passes().empty())
 		throw logic_error("No pass exists which writes to resource.");
@@ -2623,6 +2855,43 @@ void RenderGraph::bake()
 
 	// Now, reorder passes to extract better pipelining.
 	reorder_passes(pass_stack);
+}
+
+void RenderGraph::bake()
+{
+	// First, validate that the graph is sane.
+	validate_passes();
+
+	auto itr = resource_to_index.find(backbuffer_source);
+	if (itr == end(resource_to_index))
+		throw logic_error("Backbuffer source does not exist.");
+
+	Util::Hash topology_hash, graph_hash;
+	hash_declarations(topology_hash, graph_hash);
+
+	auto *cached_graph = baked_graphs.find_and_mark_as_recent(graph_hash);
+	if (cached_graph)
+	{
+		restore_baked_graph(*cached_graph);
+		return;
+	}
+
+	auto *cached_topology = baked_topologies.find_and_mark_as_recent(topology_hash);
+	if (cached_topology)
+	{
+		pass_stack = cached_topology->pass_stack;
+		pass_dependencies = cached_topology->pass_dependencies;
+		pass_merge_dependencies = cached_topology->pass_merge_dependencies;
+	}
+	else
+	{
+		build_topology();
+		auto *topology = baked_topologies.allocate(topology_hash, 1);
+		topology->pass_stack = pass_stack;
+		topology->pass_dependencies = pass_dependencies;
+		topology->pass_merge_dependencies = pass_merge_dependencies;
+		baked_topologies.prune();
+	}
 
 	// Now, we have a linear list of passes to submit in-order which would obey the dependencies.
 
@@ -2674,6 +2943,9 @@ void RenderGraph::bake()
 	// Figure out which images can alias with each other.
 	// Also build virtual "transfer" barriers. These things only copy events over to other physical resources.
 	build_aliases();
+
+	save_baked_graph(*baked_graphs.allocate(graph_hash, 1));
+	baked_graphs.prune();
 }
 
 ResourceDimensions RenderGraph::get_resource_dimensions(const RenderBufferResource &resource) const
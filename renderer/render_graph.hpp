@@ -32,6 +32,8 @@
 #include "vulkan_headers.hpp"
 #include "device.hpp"
 #include "stack_allocator.hpp"
+#include "lru_cache.hpp"
+#include "hash.hpp"
 #include "application_wsi_events.hpp"
 #include "quirks.hpp"
 
@@ -569,6 +571,19 @@ public:
 		get_clear_color_cb = std::move(func);
 	}
 
+	// Lets the pass be recorded on a worker thread, concurrently with other passes.
+	// The build callbacks must then not touch state which other passes might also touch.
+	// Only takes effect if every pass in the physical pass opts in.
+	void set_parallel_recording(bool enable)
+	{
+		parallel_recording = enable;
+	}
+
+	bool get_parallel_recording() const
+	{
+		return parallel_recording;
+	}
+
 	void set_name(const std::string &name)
 	{
 		pass_name = name;
@@ -584,6 +599,7 @@ private:
 	unsigned index;
 	unsigned physical_pass = Unused;
 	RenderGraphQueueFlagBits queue;
+	bool parallel_recording = false;
 
 	std::function<void (Vulkan::CommandBuffer &)> build_render_pass_cb;
 	std::function<void (unsigned, Vulkan::CommandBuffer &)> build_render_pass_layered_cb;
@@ -776,17 +792,17 @@ private:
 	ResourceDimensions get_resource_dimensions(const RenderTextureResource &resource) const;
 	ResourceDimensions swapchain_dimensions;
 
+	// Passes and clear targets are referred to by index, so baked physical passes can be reused after a reset().
 	struct ColorClearRequest
 	{
-		RenderPass *pass;
-		VkClearColorValue *target;
+		unsigned pass;
+		unsigned target;
 		unsigned index;
 	};
 
 	struct DepthClearRequest
 	{
-		RenderPass *pass;
-		VkClearDepthStencilValue *target;
+		unsigned pass = RenderPass::Unused;
 	};
 
 	struct ScaledClearRequests
@@ -825,6 +841,39 @@ private:
 		unsigned layers = 1;
 	};
 	std::vector<PhysicalPass> physical_passes;
+
+	// Applications tend to re-declare the same few graphs over and over, e.g. when toggling features or resizing.
+	// Results of bake() are cached, keyed by a hash of the pass and resource declarations.
+	// Pass ordering only depends on the topology of the graph, so it is cached separately,
+	// and a resize only has to rebuild the physical resources and barriers.
+	struct BakedTopology
+	{
+		std::vector<unsigned> pass_stack;
+		std::vector<std::unordered_set<unsigned>> pass_dependencies;
+		std::vector<std::unordered_set<unsigned>> pass_merge_dependencies;
+	};
+
+	struct BakedGraph : BakedTopology
+	{
+		std::vector<Barriers> pass_barriers;
+		std::vector<PhysicalPass> physical_passes;
+		std::vector<ResourceDimensions> physical_dimensions;
+		std::vector<bool> physical_image_has_history;
+		std::vector<unsigned> physical_aliases;
+		std::vector<unsigned> pass_physical_indices;
+		std::vector<unsigned> resource_physical_indices;
+		unsigned swapchain_physical_index = RenderResource::Unused;
+	};
+
+	enum { BakeCacheSize = 8 };
+	Util::LRUCache<BakedTopology> baked_topologies;
+	Util::LRUCache<BakedGraph> baked_graphs;
+
+	void hash_declarations(Util::Hash &topology_hash, Util::Hash &graph_hash);
+	void build_topology();
+	void save_baked_graph(BakedGraph &baked) const;
+	void restore_baked_graph(const BakedGraph &baked);
+
 	void build_physical_passes();
 	void build_transients();
 	void build_physical_resources();
@@ -862,6 +911,7 @@ private:
 	Vulkan::ImageView *swapchain_attachment = nullptr;
 	unsigned swapchain_physical_index = RenderResource::Unused;
 
+	void record_physical_pass(Vulkan::CommandBuffer &cmd, PhysicalPass &physical_pass, bool graphics);
 	void enqueue_scaled_requests(Vulkan::CommandBuffer &cmd, const std::vector<ScaledClearRequests> &requests);
 	void enqueue_mipmap_requests(Vulkan::CommandBuffer &cmd, const std::vector<MipmapRequests> &requests);
 
@@ -22,6 +22,7 @@
 
 #include "render_queue.hpp"
 #include "render_context.hpp"
+#include "cpu_trace.hpp"
 #include <cstring>
 #include <iterator>
 #include <algorithm>
@@ -35,6 +36,7 @@ namespace Granite
 {
 void RenderQueue::sort()
 {
+	GRANITE_CPU_TRACE_ZONE("RenderQueue::sort");
 	for (auto &queue : queues)
 	{
 		stable_sort(begin(queue), end(queue), [](const RenderQueueData &a, const RenderQueueData &b) {
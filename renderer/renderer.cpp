@@ -27,6 +27,7 @@
 #include "lights/clusterer.hpp"
 #include "lights/volumetric_fog.hpp"
 #include "render_parameters.hpp"
+#include "cpu_trace.hpp"
 #include <string.h>
 
 using namespace Vulkan;
@@ -574,12 +575,14 @@ void Renderer::render_debug_aabb(RenderContext &context, const AABB &aabb, const
 
 void Renderer::push_renderables(RenderContext &context, const VisibilityList &visible)
 {
+	GRANITE_CPU_TRACE_ZONE("Renderer::push_renderables");
 	for (auto &vis : visible)
 		vis.renderable->get_render_info(context, vis.transform, queue);
 }
 
 void Renderer::push_depth_renderables(RenderContext &context, const VisibilityList &visible)
 {
+	GRANITE_CPU_TRACE_ZONE("Renderer::push_depth_renderables");
 	for (auto &vis : visible)
 		vis.renderable->get_depth_render_info(context, vis.transform, queue);
 }
@@ -24,6 +24,10 @@
 #include "transforms.hpp"
 #include "lights/lights.hpp"
 #include "simd.hpp"
+#include "cpu_trace.hpp"
+#include "occlusion_culler.hpp"
+#include "render_context.hpp"
+#include "timer.hpp"
 #include <float.h>
 
 using namespace std;
@@ -35,6 +39,7 @@ Scene::Scene()
 	: spatials(pool.get_component_group<BoundedComponent, RenderInfoComponent, CachedSpatialTransformTimestampComponent>()),
 	  opaque(pool.get_component_group<RenderInfoComponent, RenderableComponent, OpaqueComponent>()),
 	  transparent(pool.get_component_group<RenderInfoComponent, RenderableComponent, TransparentComponent>()),
+	  occluders(pool.get_component_group<RenderInfoComponent, OccluderComponent>()),
 	  positional_lights(pool.get_component_group<RenderInfoComponent, RenderableComponent, PositionalLightComponent>()),
 	  static_shadowing(pool.get_component_group<RenderInfoComponent, RenderableComponent, CastsStaticShadowComponent>()),
 	  dynamic_shadowing(pool.get_component_group<RenderInfoComponent, RenderableComponent, CastsDynamicShadowComponent>()),
@@ -64,8 +69,13 @@ Scene::~Scene()
 }
 
 template <typename T>
-static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects)
+static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
+                                       OcclusionCuller *occlusion = nullptr)
 {
+	unsigned tested = 0;
+	unsigned culled = 0;
+	int64_t start = occlusion ? Util::get_current_time_nsecs() : 0;
+
 	for (auto &o : objects)
 	{
 		auto *transform = get_component<RenderInfoComponent>(o);
@@ -73,15 +83,29 @@ static void gather_visible_renderables(const Frustum &frustum, VisibilityList &l
 
 		if (transform->transform)
 		{
-			if ((renderable->renderable->flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0 ||
-			    SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
+			if ((renderable->renderable->flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0)
+				list.push_back({ renderable->renderable.get(), transform });
+			else if (SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
 			{
+				if (occlusion)
+				{
+					tested++;
+					if (!occlusion->test_aabb(transform->world_aabb))
+					{
+						culled++;
+						continue;
+					}
+				}
+
 				list.push_back({ renderable->renderable.get(), transform });
 			}
 		}
 		else
 			list.push_back({ renderable->renderable.get(), nullptr});
 	}
+
+	if (occlusion)
+		occlusion->record_tests(tested, culled, uint64_t(Util::get_current_time_nsecs() - start));
 }
 
 void Scene::add_render_passes(RenderGraph &graph)
@@ -169,14 +193,48 @@ void Scene::gather_visible_render_pass_sinks(const vec3 &camera_pos, VisibilityL
 	}
 }
 
-void Scene::gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list)
+void Scene::gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list,
+                                              OcclusionCuller *occlusion)
 {
-	gather_visible_renderables(frustum, list, opaque);
+	gather_visible_renderables(frustum, list, opaque, occlusion);
 }
 
-void Scene::gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list)
+void Scene::gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list,
+                                                   OcclusionCuller *occlusion)
 {
-	gather_visible_renderables(frustum, list, transparent);
+	gather_visible_renderables(frustum, list, transparent, occlusion);
+}
+
+void Scene::rasterize_occluders(OcclusionCuller &occlusion, const RenderContext &context, ThreadGroup *group)
+{
+	GRANITE_CPU_TRACE_ZONE("Scene::rasterize_occluders");
+	auto &frustum = context.get_visibility_frustum();
+	occlusion.begin(context.get_render_parameters().view_projection);
+
+	for (auto &o : occluders)
+	{
+		auto *transform = get_component<RenderInfoComponent>(o);
+		auto *occluder = get_component<OccluderComponent>(o)->mesh.get();
+		if (!occluder || occluder->indices.empty())
+			continue;
+
+		if (transform->transform)
+		{
+			if (!SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
+				continue;
+			occlusion.add_occluder(transform->transform->world_transform,
+			                       occluder->positions.data(), unsigned(occluder->positions.size()),
+			                       occluder->indices.data(), unsigned(occluder->indices.size()));
+		}
+		else
+		{
+			occlusion.add_occluder(mat4(1.0f),
+			                       occluder->positions.data(), unsigned(occluder->positions.size()),
+			                       occluder->indices.data(), unsigned(occluder->indices.size()));
+		}
+	}
+
+	occlusion.end(group);
 }
 
 void Scene::gather_visible_static_shadow_renderables(const Frustum &frustum, VisibilityList &list)
@@ -300,6 +358,8 @@ void Scene::update_transform_tree(Node &node, const mat4 &transform, bool parent
 
 void Scene::update_cached_transforms()
 {
+	GRANITE_CPU_TRACE_ZONE("Scene::update_cached_transforms");
+
 	if (root_node)
 		update_transform_tree(*root_node, mat4(1.0f), false);
 
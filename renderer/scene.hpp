@@ -37,6 +37,8 @@ struct RenderableInfo
 using VisibilityList = std::vector<RenderableInfo>;
 
 class RenderContext;
+class OcclusionCuller;
+class ThreadGroup;
 struct EnvironmentComponent;
 
 class Scene
@@ -51,8 +53,11 @@ public:
 
 	void refresh_per_frame(RenderContext &context);
 	void update_cached_transforms();
-	void gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list);
-	void gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list);
+	// If occlusion is non-null, renderables which are hidden behind its occluders are skipped as well.
+	void gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list,
+	                                       OcclusionCuller *occlusion = nullptr);
+	void gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list,
+	                                            OcclusionCuller *occlusion = nullptr);
 	void gather_visible_static_shadow_renderables(const Frustum &frustum, VisibilityList &list);
 	void gather_visible_dynamic_shadow_renderables(const Frustum &frustum, VisibilityList &list);
 	void gather_visible_positional_lights(const Frustum &frustum, VisibilityList &list,
@@ -60,6 +65,9 @@ public:
 	                                      unsigned max_point_lights = std::numeric_limits<unsigned>::max());
 	void gather_visible_render_pass_sinks(const vec3 &camera_pos, VisibilityList &list);
 	void gather_unbounded_renderables(VisibilityList &list);
+
+	// Rasterizes every visible entity with an OccluderComponent from the point of view of context.
+	void rasterize_occluders(OcclusionCuller &occlusion, const RenderContext &context, ThreadGroup *group = nullptr);
 	EnvironmentComponent *get_environment() const;
 	EntityPool &get_entity_pool();
 
@@ -206,6 +214,7 @@ private:
 	const ComponentGroupVector<BoundedComponent, RenderInfoComponent, CachedSpatialTransformTimestampComponent> &spatials;
 	const ComponentGroupVector<RenderInfoComponent, RenderableComponent, OpaqueComponent> &opaque;
 	const ComponentGroupVector<RenderInfoComponent, RenderableComponent, TransparentComponent> &transparent;
+	const ComponentGroupVector<RenderInfoComponent, OccluderComponent> &occluders;
 	const ComponentGroupVector<RenderInfoComponent, RenderableComponent, PositionalLightComponent> &positional_lights;
 	const ComponentGroupVector<RenderInfoComponent, RenderableComponent, CastsStaticShadowComponent> &static_shadowing;
 	const ComponentGroupVector<RenderInfoComponent, RenderableComponent, CastsDynamicShadowComponent> &dynamic_shadowing;
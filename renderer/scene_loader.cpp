@@ -73,7 +73,31 @@ void SceneLoader::load_scene(const std::string &path)
 	scene->set_root_node(node);
 }
 
-Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subscene)
+OccluderMeshHandle SceneLoader::get_occluder_mesh(SubsceneData &subscene, unsigned mesh)
+{
+	if (subscene.occluders.empty())
+		subscene.occluders.resize(subscene.meshes.size());
+
+	auto &occluder = subscene.occluders[mesh];
+	if (!occluder)
+	{
+		// A failed extraction is cached as an empty mesh so we only warn once.
+		occluder = Util::make_handle<OccluderMesh>();
+
+		SceneFormats::CollisionMesh collision;
+		if (SceneFormats::extract_collision_mesh(collision, subscene.parser->get_meshes()[mesh]))
+		{
+			occluder->positions = move(collision.positions);
+			occluder->indices.assign(begin(collision.indices), end(collision.indices));
+		}
+		else
+			LOGW("Mesh %u cannot be used as an occluder.\n", mesh);
+	}
+
+	return occluder;
+}
+
+Scene::NodeHandle SceneLoader::build_tree_for_subscene(SubsceneData &subscene, bool force_occluders)
 {
 	auto &parser = *subscene.parser;
 	std::vector<Scene::NodeHandle> nodes;
@@ -139,7 +163,20 @@ Scene::NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subsc
 					nodes[i]->add_child(nodes[child]);
 
 			for (auto &mesh : node.meshes)
-				scene->create_renderable(subscene.meshes[mesh], nodes[i].get());
+			{
+				auto *entity = scene->create_renderable(subscene.meshes[mesh], nodes[i].get());
+
+				// Only opaque, rigid geometry is guaranteed to hide what is behind it.
+				// Alpha tested meshes are also OpaqueComponents, but can be seen through.
+				if ((node.occluder || force_occluders) && !node.has_skin &&
+				    subscene.meshes[mesh]->get_mesh_draw_pipeline() == DrawPipeline::Opaque &&
+				    entity->has_component<OpaqueComponent>() && entity->has_component<RenderInfoComponent>())
+				{
+					auto occluder = get_occluder_mesh(subscene, mesh);
+					if (!occluder->indices.empty())
+						entity->allocate_component<OccluderComponent>()->mesh = occluder;
+				}
+			}
 		}
 		i++;
 	}
@@ -401,10 +438,12 @@ Scene::NodeHandle SceneLoader::parse_scene_format(const std::string &path, const
 			transform.scale = vec3(s[0].GetFloat(), s[1].GetFloat(), s[2].GetFloat());
 		}
 
+		bool force_occluders = elem.HasMember("occluder") && elem["occluder"].GetBool();
+
 		if (has_scene)
 		{
 			if (all(equal(instance_size, uvec3(1))))
-				hierarchy.push_back(build_tree_for_subscene(scene_itr->second));
+				hierarchy.push_back(build_tree_for_subscene(scene_itr->second, force_occluders));
 			else
 			{
 				auto subroot = scene->create_node();
@@ -414,7 +453,7 @@ Scene::NodeHandle SceneLoader::parse_scene_format(const std::string &path, const
 					{
 						for (unsigned x = 0; x < instance_size.x; x++)
 						{
-							auto child = build_tree_for_subscene(scene_itr->second);
+							auto child = build_tree_for_subscene(scene_itr->second, force_occluders);
 							child->transform.translation = vec3(x, y, z) * stride;
 							subroot->add_child(child);
 						}
@@ -55,6 +55,8 @@ private:
 	{
 		std::unique_ptr<GLTF::Parser> parser;
 		std::vector<AbstractRenderableHandle> meshes;
+		// Filled lazily, shared by every instance of the subscene.
+		std::vector<OccluderMeshHandle> occluders;
 	};
 	std::unordered_map<std::string, SubsceneData> subscenes;
 
@@ -63,7 +65,10 @@ private:
 	Scene::NodeHandle parse_scene_format(const std::string &path, const std::string &json);
 	Scene::NodeHandle parse_gltf(const std::string &path);
 
-	Scene::NodeHandle build_tree_for_subscene(const SubsceneData &subscene);
+	// If force_occluders is set, every opaque static mesh in the subscene becomes an occluder,
+	// otherwise only nodes flagged with "occluder" in their glTF extras do.
+	Scene::NodeHandle build_tree_for_subscene(SubsceneData &subscene, bool force_occluders = false);
+	OccluderMeshHandle get_occluder_mesh(SubsceneData &subscene, unsigned mesh);
 	void load_animation(const std::string &path, SceneFormats::Animation &animation);
 };
 }
\ No newline at end of file
@@ -1058,6 +1058,13 @@ void Parser::parse(const string &original_path, const string &json)
 			}
 		}
 
+		if (value.HasMember("extras"))
+		{
+			auto &extras = value["extras"];
+			if (extras.HasMember("occluder"))
+				node.occluder = extras["occluder"].GetBool();
+		}
+
 		if (value.HasMember("skin"))
 		{
 			auto &s = value["skin"];
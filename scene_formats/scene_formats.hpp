@@ -135,6 +135,7 @@ struct Node
 	Util::Hash skin = 0;
 	bool has_skin = false;
 	bool joint = false;
+	bool occluder = false;
 };
 
 struct CameraInfo
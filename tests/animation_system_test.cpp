@@ -0,0 +1,243 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "animation_system.hpp"
+#include "scene.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+static SceneFormats::Animation make_joint_animation(unsigned num_nodes, float length, std::mt19937 &rnd)
+{
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	SceneFormats::Animation animation;
+	const unsigned num_keys = 8;
+
+	for (unsigned node = 0; node < num_nodes; node++)
+	{
+		SceneFormats::AnimationChannel rotation;
+		rotation.node_index = node;
+		rotation.type = SceneFormats::AnimationChannel::Type::Rotation;
+		SceneFormats::AnimationChannel translation;
+		translation.node_index = node;
+		translation.type = SceneFormats::AnimationChannel::Type::Translation;
+		SceneFormats::AnimationChannel scale;
+		scale.node_index = node;
+		scale.type = SceneFormats::AnimationChannel::Type::Scale;
+
+		for (unsigned key = 0; key < num_keys; key++)
+		{
+			float t = length * float(key) / float(num_keys - 1);
+			rotation.timestamps.push_back(t);
+			translation.timestamps.push_back(t);
+			scale.timestamps.push_back(t);
+			rotation.spherical.values.push_back(normalize(quat(dist(rnd), dist(rnd), dist(rnd), dist(rnd))));
+			translation.linear.values.push_back(vec3(dist(rnd), dist(rnd), dist(rnd)));
+			scale.linear.values.push_back(vec3(1.5f) + 0.5f * vec3(dist(rnd), dist(rnd), dist(rnd)));
+		}
+
+		animation.channels.push_back(std::move(rotation));
+		animation.channels.push_back(std::move(translation));
+		animation.channels.push_back(std::move(scale));
+	}
+
+	animation.update_length();
+	return animation;
+}
+
+static SceneFormats::Animation make_translation_animation(float length, float x)
+{
+	SceneFormats::Animation animation;
+	SceneFormats::AnimationChannel channel;
+	channel.type = SceneFormats::AnimationChannel::Type::Translation;
+	channel.timestamps = { 0.0f, length };
+	channel.linear.values = { vec3(0.0f), vec3(x, 0.0f, 0.0f) };
+	animation.channels.push_back(std::move(channel));
+	animation.update_length();
+	return animation;
+}
+
+static bool transforms_match(const Transform &a, const Transform &b)
+{
+	// q and -q are the same rotation.
+	float rot_dot = muglm::abs(dot(a.rotation.as_vec4(), b.rotation.as_vec4()));
+	return rot_dot > 0.9999f &&
+	       all(lessThan(abs(a.translation - b.translation), vec3(1e-4f))) &&
+	       all(lessThan(abs(a.scale - b.scale), vec3(1e-4f)));
+}
+
+// The SoA pose path (sample() into an AnimationPose, then store()) must produce the same transforms
+// as the per-transform animate() path it replaced for plain clips.
+static bool test_soa_pose_matches_reference()
+{
+	std::mt19937 rnd(7);
+	const unsigned num_joints = 64;
+	AnimationUnrolled animation(make_joint_animation(num_joints, 2.0f, rnd), 30.0f);
+
+	std::vector<Transform> reference(num_joints);
+	std::vector<Transform> soa(num_joints);
+	std::vector<Transform *> reference_ptrs;
+	std::vector<Transform *> soa_ptrs;
+	for (unsigned i = 0; i < num_joints; i++)
+	{
+		reference_ptrs.push_back(&reference[i]);
+		soa_ptrs.push_back(&soa[i]);
+	}
+
+	AnimationPose pose;
+	pose.resize(num_joints);
+
+	std::uniform_real_distribution<float> time(0.0f, animation.get_length());
+	for (unsigned iteration = 0; iteration < 1000; iteration++)
+	{
+		float t = time(rnd);
+		animation.animate(reference_ptrs.data(), num_joints, t);
+		pose.set_identity();
+		animation.sample(pose, t);
+		pose.store(soa_ptrs.data(), num_joints);
+
+		for (unsigned i = 0; i < num_joints; i++)
+		{
+			if (!transforms_match(reference[i], soa[i]))
+			{
+				LOGE("SoA pose differs from reference for joint %u at t = %.3f.\n", i, t);
+				return false;
+			}
+		}
+	}
+
+	// Rough cost of both paths, for reference.
+	const unsigned iterations = 20000;
+	float sink = 0.0f;
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		animation.animate(reference_ptrs.data(), num_joints, time(rnd));
+		sink += reference[i % num_joints].translation.x;
+	}
+	auto aos_time = Util::get_current_time_nsecs() - start;
+
+	start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		animation.sample(pose, time(rnd));
+		pose.store(soa_ptrs.data(), num_joints);
+		sink += soa[i % num_joints].translation.x;
+	}
+	auto soa_time = Util::get_current_time_nsecs() - start;
+
+	LOGI("%u joints: animate() %.2f ns/joint, sample() + store() %.2f ns/joint (checksum %f).\n",
+	     num_joints,
+	     double(aos_time) / (double(iterations) * num_joints),
+	     double(soa_time) / (double(iterations) * num_joints), sink);
+	return true;
+}
+
+static bool test_cross_fade_to_one_shot(bool repeating)
+{
+	Scene scene;
+	AnimationSystem system;
+	auto loop_id = system.register_animation("loop", make_translation_animation(1.0f, 1.0f));
+	auto one_shot_id = system.register_animation("one-shot", make_translation_animation(0.5f, -1.0f));
+
+	auto node = scene.create_node();
+	auto state = system.start_animation(*node, loop_id, 0.0);
+	system.set_repeating(state, repeating);
+
+	double completed_at = -1.0;
+	double elapsed = 0.0;
+	system.set_completion_callback(state, [&]() {
+		completed_at = elapsed;
+	});
+
+	const double frame_time = 1.0 / 60.0;
+	const double fade_start = 0.25;
+	bool faded = false;
+	for (unsigned frame = 0; frame < 600 && completed_at < 0.0; frame++)
+	{
+		elapsed += frame_time;
+		if (!faded && elapsed >= fade_start)
+		{
+			if (!system.cross_fade(state, one_shot_id, 0.1f))
+			{
+				LOGE("Cross-fade failed.\n");
+				return false;
+			}
+			faded = true;
+		}
+		system.animate(frame_time, elapsed);
+	}
+
+	if (repeating)
+	{
+		if (completed_at >= 0.0 || !system.animation_is_running(state))
+		{
+			LOGE("Repeating cross-faded state completed.\n");
+			return false;
+		}
+		return true;
+	}
+
+	if (completed_at < 0.0)
+	{
+		LOGE("Cross-fade to a one-shot animation never completed.\n");
+		return false;
+	}
+
+	// The one-shot clip starts at the fade and lasts 0.5 seconds.
+	// The fade is timed from the last animated frame, so allow a couple of frames either way.
+	if (muglm::abs(completed_at - (fade_start + 0.5)) > 2.0 * frame_time)
+	{
+		LOGE("Cross-faded state completed at %.3f s, expected %.3f s.\n", completed_at, fade_start + 0.5);
+		return false;
+	}
+
+	// Key frames are resampled at 60 Hz, so the last frame is within one key of the end value.
+	if (muglm::abs(node->transform.translation.x + 1.0f) > 2.0f / (0.5f * 60.0f))
+	{
+		LOGE("Final pose is not the last frame of the one-shot animation (x = %f).\n", node->transform.translation.x);
+		return false;
+	}
+
+	if (system.animation_is_running(state))
+	{
+		LOGE("Completed state is still running.\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	if (!test_soa_pose_matches_reference())
+		return 1;
+	if (!test_cross_fade_to_one_shot(false))
+		return 1;
+	if (!test_cross_fade_to_one_shot(true))
+		return 1;
+	LOGI("Animation system tests passed.\n");
+	return 0;
+}
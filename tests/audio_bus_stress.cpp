@@ -0,0 +1,175 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_mixer.hpp"
+#include "audio_events.hpp"
+#include "dsp/lowpass_effect.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <cmath>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+// Plays a constant tone for a fixed number of frames,
+// and posts an event every time it is mixed like a stream which underruns would.
+struct EventStream : MixerStream
+{
+	explicit EventStream(size_t length_)
+		: length(length_)
+	{
+	}
+
+	size_t accumulate_samples(float *const *channels, const float *gain, size_t num_frames) noexcept override
+	{
+		size_t to_mix = std::min(num_frames, length - offset);
+		for (unsigned c = 0; c < 2; c++)
+			for (size_t i = 0; i < to_mix; i++)
+				channels[c][i] += 0.01f * gain[c];
+		offset += to_mix;
+
+		emplace_audio_event_on_queue<StreamUnderrunEvent>(get_message_queue(), get_stream_id(), 1);
+		return to_mix;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return 2;
+	}
+
+	float get_sample_rate() const override
+	{
+		return 44100.0f;
+	}
+
+	size_t length;
+	size_t offset = 0;
+};
+
+int main()
+{
+	constexpr unsigned NumBuses = 4;
+	constexpr unsigned NumStreams = 256;
+	constexpr unsigned FramesPerTick = 256;
+	constexpr unsigned NumTicks = 2000;
+	constexpr float SampleRate = 44100.0f;
+
+	Mixer mixer;
+	BackendCallback &callback = mixer;
+	callback.set_backend_parameters(SampleRate, 2, FramesPerTick);
+	callback.set_latency_usec(0);
+	callback.on_backend_start();
+
+	// Every bus, including the master bus, gets streams, so all of them can be in flight on different threads.
+	BusID buses[NumBuses] = { Mixer::MasterBus };
+	for (unsigned i = 1; i < NumBuses; i++)
+	{
+		auto *effect = DSP::create_lowpass_effect(500.0f * float(i));
+		buses[i] = mixer.create_bus(-3.0f, &effect, 1);
+		if (buses[i] == BusID(-1))
+			return EXIT_FAILURE;
+	}
+
+	mixer.set_num_mix_threads(NumBuses - 1);
+
+	std::vector<StreamID> ids(NumStreams);
+	std::vector<unsigned> expected_events(NumStreams);
+	for (unsigned i = 0; i < NumStreams; i++)
+	{
+		// Stagger stream lengths so streams stop throughout the run.
+		// A stream is mixed until it returns less than a full tick, which might be an empty one.
+		size_t length = 1 + (i * 7919u) % ((NumTicks - 1) * FramesPerTick);
+		expected_events[i] = unsigned(length / FramesPerTick + 1);
+		ids[i] = mixer.add_mixer_stream(new EventStream(length), true, 0.0f, 0.0f, buses[i % NumBuses]);
+		if (ids[i] == StreamID(-1))
+		{
+			LOGE("Failed to add stream.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<float> buffers[2];
+	float *channels[2];
+	for (unsigned c = 0; c < 2; c++)
+	{
+		buffers[c].resize(FramesPerTick);
+		channels[c] = buffers[c].data();
+	}
+
+	std::vector<unsigned> events(NumStreams);
+	unsigned stopped = 0;
+	unsigned unknown = 0;
+	bool finite = true;
+	auto &queue = mixer.get_message_queue();
+	auto start_time = Util::get_current_time_nsecs();
+
+	// No pacing here. Mixing back to back maximizes overlap between the backend thread and the workers.
+	for (unsigned tick = 0; tick < NumTicks + 64 && stopped < NumStreams; tick++)
+	{
+		mixer.mix_samples(channels, FramesPerTick);
+		for (unsigned c = 0; c < 2; c++)
+			for (auto v : buffers[c])
+				finite = finite && std::isfinite(v);
+
+		Util::MessageQueuePayload payload;
+		while ((payload = queue.read_message()))
+		{
+			auto &event = payload.as<Event>();
+			if (event.get_type_id() == StreamUnderrunEvent::get_type_id())
+			{
+				auto id = static_cast<StreamUnderrunEvent &>(event).get_stream_id();
+				unsigned index = 0;
+				while (index < NumStreams && ids[index] != id)
+					index++;
+				if (index < NumStreams)
+					events[index]++;
+				else
+					unknown++;
+			}
+			else if (event.get_type_id() == StreamStoppedEvent::get_type_id())
+				stopped++;
+			queue.recycle_payload(std::move(payload));
+		}
+	}
+
+	auto end_time = Util::get_current_time_nsecs();
+	mixer.set_num_mix_threads(0);
+	callback.on_backend_stop();
+
+	unsigned mismatches = 0;
+	for (unsigned i = 0; i < NumStreams; i++)
+		if (events[i] != expected_events[i])
+			mismatches++;
+
+	LOGI("%u streams over %u buses, %.3f us per tick, %llu missed bus deadlines.\n",
+	     NumStreams, NumBuses, 1e-3 * double(end_time - start_time) / NumTicks,
+	     static_cast<unsigned long long>(mixer.get_num_missed_bus_deadlines()));
+	LOGI("Stopped streams: %u, streams with wrong event count: %u, unknown events: %u.\n",
+	     stopped, mismatches, unknown);
+
+	if (!finite)
+		LOGE("Mixed output is not finite.\n");
+
+	return stopped == NumStreams && mismatches == 0 && unknown == 0 && finite ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "clusterer_cpu.hpp"
+#include "render_context.hpp"
+#include "global_managers.hpp"
+#include "transforms.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <memory>
+#include <string.h>
+
+using namespace Granite;
+
+// Compares serial and parallel binning of bindless lights, which must be bit-identical.
+static bool run_test(const RenderContext &context, unsigned count, unsigned res_x, unsigned res_y, std::mt19937 &rnd)
+{
+	std::unique_ptr<ClustererBindlessTransforms> transforms(new ClustererBindlessTransforms());
+
+	std::uniform_real_distribution<float> pos(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> radius(1.0f, 20.0f);
+	std::uniform_real_distribution<float> spread(0.1f, 1.5f);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		vec3 position = vec3(pos(rnd), pos(rnd), pos(rnd));
+		float r = radius(rnd);
+
+		if (rnd() & 1)
+		{
+			transforms->type_mask[i >> 5] |= 1u << (i & 31);
+			transforms->lights[i].position = position;
+			transforms->lights[i].inv_radius = 1.0f / r;
+		}
+		else
+		{
+			vec3 direction = vec3(dir(rnd), dir(rnd), dir(rnd));
+			if (dot(direction, direction) < 1e-4f)
+				direction = vec3(0.0f, 0.0f, -1.0f);
+			direction = normalize(direction);
+
+			float xy = r * spread(rnd);
+			transforms->model[i] = translate(position) *
+			                       mat4_cast(look_at_arbitrary_up(direction)) *
+			                       scale(vec3(xy, xy, r));
+			transforms->lights[i].position = position;
+			transforms->lights[i].direction = direction;
+			transforms->lights[i].inv_radius = 1.0f / r;
+		}
+	}
+
+	ClustererBindlessBinning binning = {};
+	binning.context = &context;
+	binning.transforms = transforms.get();
+	binning.count = count;
+	binning.num_lights_32 = (count + 31) / 32;
+	binning.resolution_x = res_x;
+	binning.resolution_y = res_y;
+
+	size_t words = size_t(binning.num_lights_32) * res_x * res_y;
+	std::vector<uint32_t> serial(words);
+	std::vector<uint32_t> parallel(words);
+
+	auto start = Util::get_current_time_nsecs();
+	bin_bindless_lights(binning, serial.data(), nullptr);
+	auto serial_time = Util::get_current_time_nsecs() - start;
+
+	start = Util::get_current_time_nsecs();
+	bin_bindless_lights(binning, parallel.data(), Global::thread_group());
+	auto parallel_time = Util::get_current_time_nsecs() - start;
+
+	LOGI("%4u lights, %u x %u tiles: serial %.3f ms, parallel %.3f ms.\n",
+	     count, res_x, res_y, 1e-6 * double(serial_time), 1e-6 * double(parallel_time));
+
+	if (memcmp(serial.data(), parallel.data(), words * sizeof(uint32_t)) != 0)
+	{
+		LOGE("Parallel binning does not match serial binning for %u lights.\n", count);
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_EVENT_BIT | Global::MANAGER_FEATURE_THREAD_GROUP_BIT);
+
+	RenderContext context;
+	mat4 view = mat4_cast(look_at(vec3(0.0f, -0.2f, -1.0f), vec3(0.0f, 1.0f, 0.0f))) *
+	            translate(-vec3(0.0f, 5.0f, 40.0f));
+	context.set_camera(projection(0.5f * pi<float>(), 16.0f / 9.0f, 0.1f, 200.0f), view);
+
+	std::mt19937 rnd(1234);
+	static const unsigned counts[] = { 1, 31, 32, 33, 100, 1000, CLUSTERER_MAX_LIGHTS_BINDLESS };
+
+	bool success = true;
+	for (auto count : counts)
+		if (!run_test(context, count, 64, 32, rnd))
+			success = false;
+
+	Global::deinit();
+	return success ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "intrusive_hash_map.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace Util;
+
+struct Node : IntrusiveHashMapEnabled<Node>
+{
+	explicit Node(Hash key_)
+		: key(key_)
+	{
+	}
+	Hash key;
+};
+
+struct Result
+{
+	double nsecs_per_lookup;
+	bool valid;
+};
+
+// Models the pipeline cache in the steady state: every thread looks up objects which were created earlier,
+// while a writer keeps inserting new keys like a recording thread hitting an uncached pipeline would.
+template <typename Map>
+static Result run_lookups(const std::vector<Hash> &keys, unsigned num_threads, unsigned lookups_per_thread)
+{
+	Map map;
+	size_t size = keys.size() / 2;
+	for (size_t i = 0; i < size; i++)
+		map.emplace_yield(keys[i], keys[i]);
+
+	std::atomic<bool> done;
+	std::atomic<bool> valid;
+	done = false;
+	valid = true;
+
+	std::thread writer([&]() {
+		for (size_t i = size; i < keys.size() && !done.load(std::memory_order_relaxed); i++)
+		{
+			map.emplace_yield(keys[i], keys[i]);
+			std::this_thread::yield();
+		}
+	});
+
+	std::vector<std::thread> readers;
+	auto start = get_current_time_nsecs();
+	for (unsigned t = 0; t < num_threads; t++)
+	{
+		readers.emplace_back([&, t]() {
+			std::mt19937 rnd(t);
+			for (unsigned i = 0; i < lookups_per_thread; i++)
+			{
+				auto key = keys[rnd() % size];
+				auto *node = map.find(key);
+				if (!node || node->key != key)
+					valid = false;
+			}
+		});
+	}
+
+	for (auto &reader : readers)
+		reader.join();
+	auto end = get_current_time_nsecs();
+
+	done = true;
+	writer.join();
+
+	// Everything the writer managed to insert must be visible afterwards.
+	for (auto &node : map)
+		if (map.find(node.key) != &node)
+			valid = false;
+
+	return { double(end - start) / (double(num_threads) * lookups_per_thread), valid };
+}
+
+int main()
+{
+	std::mt19937_64 rnd(1234);
+	static const size_t sizes[] = { 256, 16 * 1024 };
+	static const unsigned thread_counts[] = { 1, 2, 4, 8 };
+	const unsigned lookups_per_thread = 1000000;
+	bool success = true;
+
+	LOGI("%u hardware threads.\n", std::thread::hardware_concurrency());
+
+	for (auto size : sizes)
+	{
+		std::vector<Hash> keys(2 * size);
+		for (auto &key : keys)
+		{
+			Hasher h;
+			h.u64(rnd());
+			key = h.get();
+		}
+
+		LOGI("%zu elements:\n", size);
+		for (auto threads : thread_counts)
+		{
+			auto locked = run_lookups<ThreadSafeIntrusiveHashMap<Node, IntrusiveHashMapGroupedHolder<Node>>>(
+					keys, threads, lookups_per_thread);
+			auto concurrent = run_lookups<ConcurrentIntrusiveHashMap<Node>>(keys, threads, lookups_per_thread);
+
+			LOGI("  %u threads: locked %7.2f ns/lookup, concurrent %7.2f ns/lookup (%.2fx)\n",
+			     threads, locked.nsecs_per_lookup, concurrent.nsecs_per_lookup,
+			     locked.nsecs_per_lookup / concurrent.nsecs_per_lookup);
+
+			if (!locked.valid || !concurrent.valid)
+			{
+				LOGE("Lookup returned the wrong element with %u threads.\n", threads);
+				success = false;
+			}
+		}
+	}
+
+	return success ? 0 : 1;
+}
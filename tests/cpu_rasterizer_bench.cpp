@@ -0,0 +1,157 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpu_rasterizer.hpp"
+#include "thread_group.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// Compares the per-triangle coordinate rasterizer against the binned rasterizer,
+// both serial and spread over a thread group.
+static bool run_bench(ThreadGroup &group, uvec2 resolution, unsigned num_triangles, float max_size, std::mt19937 &rnd)
+{
+	std::uniform_real_distribution<float> pos(-1.2f, 1.2f);
+	std::uniform_real_distribution<float> offset(-max_size, max_size);
+	std::uniform_real_distribution<float> w(0.5f, 2.0f);
+
+	std::vector<vec4> clip(3 * num_triangles);
+	std::vector<unsigned> indices(3 * num_triangles);
+	for (unsigned i = 0; i < num_triangles; i++)
+	{
+		vec2 center = vec2(pos(rnd), pos(rnd));
+		for (unsigned j = 0; j < 3; j++)
+		{
+			float vw = w(rnd);
+			clip[3 * i + j] = vec4((center + vec2(offset(rnd), offset(rnd))) * vw, 0.5f * vw, vw);
+			indices[3 * i + j] = 3 * i + j;
+		}
+	}
+
+	const unsigned iterations = 20;
+	std::vector<uvec2> coverage;
+	Rasterizer::CoverageMask reference, serial, parallel;
+	Rasterizer::BinnedRasterizer rasterizer;
+
+	int64_t legacy_time = 0;
+	int64_t serial_time = 0;
+	int64_t parallel_time = 0;
+
+	for (unsigned iter = 0; iter < iterations; iter++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		coverage.clear();
+		Rasterizer::rasterize_conservative_triangles(coverage, clip.data(), indices.data(), unsigned(indices.size()),
+		                                             resolution, Rasterizer::CullMode::Both);
+		legacy_time += Util::get_current_time_nsecs() - start;
+
+		start = Util::get_current_time_nsecs();
+		serial.reset(resolution);
+		rasterizer.begin(resolution);
+		rasterizer.add_triangles(clip.data(), indices.data(), unsigned(indices.size()), Rasterizer::CullMode::Both);
+		rasterizer.rasterize(serial);
+		serial_time += Util::get_current_time_nsecs() - start;
+
+		start = Util::get_current_time_nsecs();
+		parallel.reset(resolution);
+		rasterizer.begin(resolution);
+		rasterizer.add_triangles(clip.data(), indices.data(), unsigned(indices.size()), Rasterizer::CullMode::Both);
+		rasterizer.rasterize(parallel, &group);
+		parallel_time += Util::get_current_time_nsecs() - start;
+	}
+
+	reference.reset(resolution);
+	for (auto &c : coverage)
+		reference.get_row(c.y)[c.x >> 5] |= 1u << (c.x & 31);
+
+	// Edge functions are evaluated directly rather than accumulated, and conservative edges are biased outwards
+	// to absorb the rounding difference, so the binned path may cover a few extra pixels right on an edge,
+	// but must never miss a pixel the reference covers.
+	unsigned covered = 0;
+	unsigned missed = 0;
+	unsigned extra = 0;
+	for (unsigned y = 0; y < resolution.y; y++)
+	{
+		for (unsigned x = 0; x < resolution.x; x++)
+		{
+			bool ref = reference.test(x, y);
+			bool binned = serial.test(x, y);
+			covered += unsigned(ref);
+			missed += unsigned(ref && !binned);
+			extra += unsigned(!ref && binned);
+		}
+	}
+
+	LOGI("%u x %u, %5u triangles: legacy %8.3f ms, binned %8.3f ms, binned parallel %8.3f ms, "
+	     "%u missed, %u extra / %u covered.\n",
+	     resolution.x, resolution.y, num_triangles,
+	     1e-6 * double(legacy_time) / iterations,
+	     1e-6 * double(serial_time) / iterations,
+	     1e-6 * double(parallel_time) / iterations,
+	     missed, extra, covered);
+
+	if (serial.bits != parallel.bits)
+	{
+		LOGE("Parallel rasterization does not match serial rasterization.\n");
+		return false;
+	}
+
+	if (missed)
+	{
+		LOGE("Binned rasterization misses pixels covered by the reference.\n");
+		return false;
+	}
+
+	if (extra > covered / 200 + 8)
+	{
+		LOGE("Binned rasterization covers too many pixels outside the reference.\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(4);
+
+	std::mt19937 rnd(42);
+	bool success = true;
+
+	static const uvec2 resolutions[] = { uvec2(64, 32), uvec2(256, 128), uvec2(1000, 500) };
+	for (auto &res : resolutions)
+	{
+		if (!run_bench(group, res, 16, 1.0f, rnd))
+			success = false;
+		if (!run_bench(group, res, 1024, 0.1f, rnd))
+			success = false;
+		if (!run_bench(group, res, 8192, 0.02f, rnd))
+			success = false;
+	}
+
+	return success ? 0 : 1;
+}
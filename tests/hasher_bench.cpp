@@ -0,0 +1,102 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hash.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Util;
+
+// What Hasher::data() did for every input size before the bulk path.
+static Hash hash_fnv(const uint32_t *data, size_t size)
+{
+	Hash h = 0xcbf29ce484222325ull;
+	size /= sizeof(uint32_t);
+	for (size_t i = 0; i < size; i++)
+		h = (h * 0x100000001b3ull) ^ data[i];
+	return h;
+}
+
+// Hasher only takes the bulk path from Hasher::BulkThreshold bytes and up, where it starts to win.
+int main()
+{
+	std::mt19937 rnd(42);
+	std::vector<uint32_t> buffer(4 * 1024 * 1024);
+	for (auto &v : buffer)
+		v = rnd();
+
+	static const size_t sizes[] = { 64, 128, 256, 1024, 16 * 1024, 256 * 1024, 16 * 1024 * 1024 };
+	for (auto size : sizes)
+	{
+		unsigned iterations = unsigned(std::max<size_t>(1, (256 * 1024 * 1024) / size));
+		Hash fnv = 0, bulk = 0;
+
+		auto start = get_current_time_nsecs();
+		for (unsigned i = 0; i < iterations; i++)
+		{
+			buffer[0] = i;
+			fnv += hash_fnv(buffer.data(), size);
+		}
+		auto fnv_time = get_current_time_nsecs() - start;
+
+		start = get_current_time_nsecs();
+		for (unsigned i = 0; i < iterations; i++)
+		{
+			buffer[0] = i;
+			bulk += hash_bulk(buffer.data(), size);
+		}
+		auto bulk_time = get_current_time_nsecs() - start;
+
+		double bytes = double(size) * iterations;
+		LOGI("%9zu bytes: FNV-1 %6.2f GB/s, bulk %6.2f GB/s [%016llx]\n", size,
+		     bytes / double(fnv_time), bytes / double(bulk_time),
+		     static_cast<unsigned long long>(fnv ^ bulk));
+	}
+
+	// Every bit of the input must affect the hash, including across stripe and block boundaries.
+	bool success = true;
+	for (size_t size : { size_t(64), size_t(100), size_t(1024), size_t(1088), size_t(5000) })
+	{
+		Hash reference = hash_bulk(buffer.data(), size);
+		auto *bytes = reinterpret_cast<uint8_t *>(buffer.data());
+		for (size_t i = 0; i < size; i++)
+		{
+			bytes[i] ^= 1;
+			if (hash_bulk(buffer.data(), size) == reference)
+			{
+				LOGE("Flipping byte %zu of %zu did not change the hash.\n", i, size);
+				success = false;
+			}
+			bytes[i] ^= 1;
+		}
+
+		if (hash_bulk(buffer.data(), size + 1) == reference)
+		{
+			LOGE("Extending the input did not change the hash.\n");
+			success = false;
+		}
+	}
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "intrusive_hash_map.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Util;
+
+struct Node : IntrusiveHashMapEnabled<Node>
+{
+	explicit Node(uint64_t payload_)
+		: payload(payload_)
+	{
+	}
+	uint64_t payload;
+};
+
+struct Result
+{
+	double nsecs_per_op;
+	uint64_t checksum;
+};
+
+// Runs a mix of lookups which hit, lookups which miss and erase + insert pairs
+// against a map which is kept at a constant size.
+template <typename Holder>
+static Result run_mix(const std::vector<Hash> &keys, const std::vector<Hash> &missing_keys,
+                      const std::vector<uint32_t> &ops, unsigned hit_percent, unsigned miss_percent)
+{
+	IntrusiveHashMap<Node, Holder> map;
+	size_t size = keys.size() / 2;
+	for (size_t i = 0; i < size; i++)
+		map.emplace_yield(keys[i], keys[i]);
+
+	// Keys [live_begin, live_begin + size) are in the map, erase from the front and insert at the back.
+	size_t live_begin = 0;
+	uint64_t checksum = 0;
+
+	auto start = get_current_time_nsecs();
+	for (auto op : ops)
+	{
+		unsigned kind = op % 100;
+		if (kind < hit_percent)
+		{
+			auto *node = map.find(keys[(live_begin + op % size) % keys.size()]);
+			checksum += node ? node->payload : 1;
+		}
+		else if (kind < hit_percent + miss_percent)
+		{
+			auto *node = map.find(missing_keys[op % missing_keys.size()]);
+			checksum += node ? node->payload : 1;
+		}
+		else
+		{
+			map.erase(keys[live_begin]);
+			auto *node = map.emplace_yield(keys[(live_begin + size) % keys.size()], op);
+			checksum += node->payload;
+			live_begin = (live_begin + 1) % keys.size();
+		}
+	}
+	auto end = get_current_time_nsecs();
+
+	return { double(end - start) / double(ops.size()), checksum };
+}
+
+template <typename Holder>
+static Result run_build(const std::vector<Hash> &keys, unsigned iterations)
+{
+	uint64_t checksum = 0;
+	auto start = get_current_time_nsecs();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		IntrusiveHashMap<Node, Holder> map;
+		for (auto key : keys)
+			checksum += map.emplace_yield(key, key)->payload;
+	}
+	auto end = get_current_time_nsecs();
+	return { double(end - start) / (double(keys.size()) * iterations), checksum };
+}
+
+static bool check(const char *desc, const Result &linear, const Result &grouped)
+{
+	LOGI("  %-28s linear %7.2f ns/op, grouped %7.2f ns/op (%.2fx)\n",
+	     desc, linear.nsecs_per_op, grouped.nsecs_per_op, linear.nsecs_per_op / grouped.nsecs_per_op);
+
+	if (linear.checksum != grouped.checksum)
+	{
+		LOGE("Checksum mismatch for %s.\n", desc);
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	std::mt19937_64 rnd(1234);
+	static const size_t sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+	bool success = true;
+
+	for (auto size : sizes)
+	{
+		// Hashed keys like the Vulkan cache and render queue, and small sequential IDs like the ECS.
+		std::vector<Hash> hashed_keys(2 * size);
+		std::vector<Hash> sequential_keys(2 * size);
+		std::vector<Hash> missing_keys(size);
+		for (size_t i = 0; i < 2 * size; i++)
+		{
+			Hasher h;
+			h.u64(rnd());
+			hashed_keys[i] = h.get();
+			sequential_keys[i] = i + 1;
+		}
+		for (auto &key : missing_keys)
+			key = rnd() | (1ull << 63);
+
+		std::vector<uint32_t> ops(4 * 1024 * 1024);
+		for (auto &op : ops)
+			op = uint32_t(rnd());
+
+		LOGI("%zu elements:\n", size);
+		unsigned build_iterations = unsigned(std::max<size_t>(1, (1024 * 1024) / size));
+
+		success &= check("build, hashed keys",
+		                 run_build<IntrusiveHashMapHolder<Node>>(hashed_keys, build_iterations),
+		                 run_build<IntrusiveHashMapGroupedHolder<Node>>(hashed_keys, build_iterations));
+		success &= check("90/5/5, hashed keys",
+		                 run_mix<IntrusiveHashMapHolder<Node>>(hashed_keys, missing_keys, ops, 90, 5),
+		                 run_mix<IntrusiveHashMapGroupedHolder<Node>>(hashed_keys, missing_keys, ops, 90, 5));
+		success &= check("50/40/10, hashed keys",
+		                 run_mix<IntrusiveHashMapHolder<Node>>(hashed_keys, missing_keys, ops, 50, 40),
+		                 run_mix<IntrusiveHashMapGroupedHolder<Node>>(hashed_keys, missing_keys, ops, 50, 40));
+		success &= check("90/5/5, sequential keys",
+		                 run_mix<IntrusiveHashMapHolder<Node>>(sequential_keys, missing_keys, ops, 90, 5),
+		                 run_mix<IntrusiveHashMapGroupedHolder<Node>>(sequential_keys, missing_keys, ops, 90, 5));
+	}
+
+	return success ? 0 : 1;
+}
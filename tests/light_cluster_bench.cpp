@@ -0,0 +1,173 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "clusterer_cpu.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// Mirrors the CPU path in LightClusterer::build_cluster_cpu without needing a device:
+// test coarse blocks first, then refine every cluster in the block against the surviving lights.
+static constexpr int Downsample = 4;
+
+struct Grid
+{
+	int res_x, res_y, res_z;
+	float world_size;
+};
+
+template <typename SpotFunc, typename PointFunc>
+static uint64_t build_grid(const Grid &grid, const ClustererCPULights &lights,
+                           unsigned spot_count, unsigned point_count,
+                           std::vector<uint32_t> &out,
+                           const SpotFunc &spot_func, const PointFunc &point_func)
+{
+	uint64_t hash = 0;
+	vec3 inv_res = vec3(1.0f / grid.res_x, 1.0f / grid.res_y, 1.0f / grid.res_z);
+	vec3 cluster_size = grid.world_size * inv_res;
+	float radius = 0.5f * length(cluster_size);
+
+	uint32_t spot_mask = uint32_t((1ull << spot_count) - 1);
+	uint32_t point_mask = uint32_t((1ull << point_count) - 1);
+
+	auto center = [&](int x, int y, int z, float scale) {
+		return ((vec3(x, y, z) + vec3(0.5f * scale)) * inv_res - vec3(0.5f)) * grid.world_size;
+	};
+
+	for (int cz = 0; cz < grid.res_z; cz += Downsample)
+	{
+		for (int cy = 0; cy < grid.res_y; cy += Downsample)
+		{
+			for (int cx = 0; cx < grid.res_x; cx += Downsample)
+			{
+				vec3 coarse_center = center(cx, cy, cz, float(Downsample));
+				float coarse_radius = radius * float(Downsample);
+				uint32_t coarse_spot = spot_func(lights, coarse_center, coarse_radius, spot_mask);
+				uint32_t coarse_point = point_func(lights, coarse_center, coarse_radius, point_mask);
+
+				for (int sz = cz; sz < cz + Downsample; sz++)
+				{
+					for (int sy = cy; sy < cy + Downsample; sy++)
+					{
+						for (int sx = cx; sx < cx + Downsample; sx++)
+						{
+							uint32_t spot = 0;
+							uint32_t point = 0;
+							if (coarse_spot || coarse_point)
+							{
+								vec3 c = center(sx, sy, sz, 1.0f);
+								spot = spot_func(lights, c, radius, coarse_spot);
+								point = point_func(lights, c, radius, coarse_point);
+							}
+
+							size_t index = 2 * ((sz * grid.res_y + sy) * grid.res_x + sx);
+							out[index + 0] = spot;
+							out[index + 1] = point;
+							hash += spot + point;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return hash;
+}
+
+static void randomize_lights(ClustererCPULights &lights, unsigned count, float world_size, std::mt19937 &rnd)
+{
+	std::uniform_real_distribution<float> pos(-0.5f * world_size, 0.5f * world_size);
+	std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> size(0.02f * world_size, 0.2f * world_size);
+	std::uniform_real_distribution<float> angle(0.1f, 1.2f);
+
+	lights = {};
+	for (unsigned i = 0; i < count; i++)
+	{
+		vec3 d = vec3(dir(rnd), dir(rnd), dir(rnd));
+		if (dot(d, d) < 1e-4f)
+			d = vec3(0.0f, 0.0f, 1.0f);
+		lights.set_spot(i, vec3(pos(rnd), pos(rnd), pos(rnd)), normalize(d), size(rnd), angle(rnd));
+		lights.set_point(i, vec3(pos(rnd), pos(rnd), pos(rnd)), size(rnd));
+	}
+}
+
+int main()
+{
+	std::mt19937 rnd(1337);
+	static const Grid grids[] = {
+		{ 32, 16, 16, 100.0f },
+		{ 64, 32, 16, 100.0f },
+	};
+	static const unsigned light_counts[] = { 8, 16, 32 };
+	const unsigned iterations = 20;
+
+	bool success = true;
+
+	for (auto &grid : grids)
+	{
+		std::vector<uint32_t> reference(2 * grid.res_x * grid.res_y * grid.res_z);
+		std::vector<uint32_t> vectorized(reference.size());
+
+		for (auto count : light_counts)
+		{
+			ClustererCPULights lights;
+			randomize_lights(lights, count, grid.world_size, rnd);
+
+			int64_t scalar_time = 0;
+			int64_t simd_time = 0;
+			uint64_t hash = 0;
+
+			for (unsigned i = 0; i < iterations; i++)
+			{
+				auto start = Util::get_current_time_nsecs();
+				hash += build_grid(grid, lights, count, count, reference,
+				                   cluster_spot_lights_cpu_scalar, cluster_point_lights_cpu_scalar);
+				scalar_time += Util::get_current_time_nsecs() - start;
+
+				start = Util::get_current_time_nsecs();
+				hash += build_grid(grid, lights, count, count, vectorized,
+				                   cluster_spot_lights_cpu, cluster_point_lights_cpu);
+				simd_time += Util::get_current_time_nsecs() - start;
+			}
+
+			if (reference != vectorized)
+			{
+				LOGE("Mismatch between scalar and SIMD results for %u lights in %d x %d x %d grid.\n",
+				     count, grid.res_x, grid.res_y, grid.res_z);
+				success = false;
+			}
+
+			double scalar_ms = 1e-6 * double(scalar_time) / iterations;
+			double simd_ms = 1e-6 * double(simd_time) / iterations;
+			LOGI("%2d x %2d x %2d grid, %2u spot + %2u point lights: scalar %8.3f ms, SIMD %8.3f ms (%.2fx) [%llu]\n",
+			     grid.res_x, grid.res_y, grid.res_z, count, count,
+			     scalar_ms, simd_ms, scalar_ms / simd_ms, static_cast<unsigned long long>(hash));
+		}
+	}
+
+	return success ? 0 : 1;
+}
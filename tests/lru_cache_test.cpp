@@ -1,5 +1,11 @@
 #include "lru_cache.hpp"
 #include "logging.hpp"
+#include "timer.hpp"
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
 using namespace Util;
 
@@ -21,7 +27,7 @@ struct Foo
 	unsigned value = 0;
 };
 
-int main()
+static void test_lru_cache()
 {
 	LRUCache<Foo> cache;
 	cache.set_total_cost(20);
@@ -43,4 +49,204 @@ int main()
 	LOGI("=== Pruned ===\n");
 	for (auto &entry : cache)
 		LOGI("Value: %u\n", entry.t.value);
-}
\ No newline at end of file
+}
+
+struct Payload
+{
+	uint64_t cookie = 0;
+};
+
+// Skewed key distribution: most requests go to a small hot set.
+static uint64_t sample_key(std::mt19937_64 &rnd, uint64_t num_keys)
+{
+	uint64_t r = rnd();
+	if ((r & 7) != 0)
+		return (r >> 8) % (num_keys / 16);
+	else
+		return (r >> 8) % num_keys;
+}
+
+static bool test_admission()
+{
+	ShardedLRUCache<Payload, 1> cache;
+	cache.set_total_cost(64);
+	cache.set_admission_filter(true);
+
+	// Build up a hot set which is requested over and over.
+	for (unsigned iter = 0; iter < 8; iter++)
+	{
+		for (uint64_t i = 0; i < 64; i++)
+		{
+			Payload p;
+			if (!cache.find_and_mark_as_recent(i, p))
+				cache.insert(i, Payload{ i }, 1);
+		}
+	}
+
+	// A scan over one-off assets should bounce off, and a large asset should not flush everything.
+	for (uint64_t i = 1000; i < 2000; i++)
+		cache.insert(i, Payload{ i }, 1);
+	cache.insert(5000, Payload{ 5000 }, 32);
+
+	unsigned hot = 0;
+	for (uint64_t i = 0; i < 64; i++)
+	{
+		Payload p;
+		if (cache.find_and_mark_as_recent(i, p))
+		{
+			if (p.cookie != i)
+			{
+				LOGE("Cookie mismatch.\n");
+				return false;
+			}
+			hot++;
+		}
+	}
+
+	auto stats = cache.get_statistics();
+	LOGI("Admission: %u / 64 hot entries survived, %llu rejections.\n",
+	     hot, static_cast<unsigned long long>(stats.rejections));
+
+	if (hot != 64 || cache.get_current_cost() > cache.get_total_cost_limit())
+	{
+		LOGE("Admission filter did not protect the hot set.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Loader threads requesting assets and inserting them on a miss.
+template <typename Cache>
+static double run_requests(Cache &cache, unsigned num_threads, unsigned requests_per_thread,
+                           uint64_t num_keys, std::atomic<bool> &valid)
+{
+	std::vector<std::thread> threads;
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned t = 0; t < num_threads; t++)
+	{
+		threads.emplace_back([&, t]() {
+			std::mt19937_64 rnd(t);
+			for (unsigned i = 0; i < requests_per_thread; i++)
+			{
+				uint64_t key = sample_key(rnd, num_keys);
+				Payload p;
+				if (cache.find_and_mark_as_recent(key, p))
+				{
+					if (p.cookie != key)
+						valid = false;
+				}
+				else
+					cache.insert(key, Payload{ key }, 1 + (key & 3));
+
+				if ((i & 255) == 0)
+					cache.erase(sample_key(rnd, num_keys));
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	auto end = Util::get_current_time_nsecs();
+	return double(end - start) / (double(num_threads) * requests_per_thread);
+}
+
+// Baseline: the single-threaded LRUCache behind a global lock, with the same interface.
+struct LockedLRUCache
+{
+	LRUCache<Payload> cache;
+	std::mutex lock;
+
+	bool find_and_mark_as_recent(uint64_t cookie, Payload &p)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		auto *t = cache.find_and_mark_as_recent(cookie);
+		if (t)
+			p = *t;
+		return t != nullptr;
+	}
+
+	bool insert(uint64_t cookie, Payload p, uint64_t cost)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		*cache.allocate(cookie, cost) = p;
+		cache.prune();
+		return true;
+	}
+
+	bool erase(uint64_t cookie)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		return cache.erase(cookie);
+	}
+};
+
+static bool test_concurrent()
+{
+	const uint64_t num_keys = 64 * 1024;
+	const unsigned requests_per_thread = 500000;
+	static const unsigned thread_counts[] = { 1, 2, 4, 8 };
+	bool success = true;
+
+	for (auto threads : thread_counts)
+	{
+		std::atomic<bool> valid;
+		valid = true;
+
+		LockedLRUCache locked;
+		locked.cache.set_total_cost(num_keys / 2);
+		double locked_time = run_requests(locked, threads, requests_per_thread, num_keys, valid);
+
+		for (int filter = 0; filter < 2; filter++)
+		{
+			ShardedLRUCache<Payload> sharded;
+			sharded.set_total_cost(num_keys / 2);
+			sharded.set_admission_filter(filter != 0);
+			double sharded_time = run_requests(sharded, threads, requests_per_thread, num_keys, valid);
+
+			auto stats = sharded.get_statistics();
+			LOGI("%u threads, admission %s: locked %6.1f ns/request, sharded %6.1f ns/request, "
+			     "hit rate %.1f %%, %llu evictions, %llu rejections.\n",
+			     threads, filter ? "on " : "off", locked_time, sharded_time,
+			     100.0 * double(stats.hits) / double(stats.hits + stats.misses),
+			     static_cast<unsigned long long>(stats.evictions),
+			     static_cast<unsigned long long>(stats.rejections));
+
+			if (sharded.get_current_cost() > sharded.get_total_cost_limit())
+			{
+				LOGE("Cost budget exceeded after all threads completed.\n");
+				success = false;
+			}
+
+			// Erasing everything must bring the accounted cost back to zero.
+			for (uint64_t key = 0; key < num_keys; key++)
+				sharded.erase(key);
+			if (sharded.get_current_cost() != 0)
+			{
+				LOGE("Cost accounting is off by %llu.\n",
+				     static_cast<unsigned long long>(sharded.get_current_cost()));
+				success = false;
+			}
+		}
+
+		if (!valid)
+		{
+			LOGE("Lookup returned a value for the wrong key.\n");
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+int main()
+{
+	test_lru_cache();
+
+	bool success = true;
+	if (!test_admission())
+		success = false;
+	if (!test_concurrent())
+		success = false;
+	return success ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "occlusion_culler.hpp"
+#include "thread_group.hpp"
+#include "transforms.hpp"
+#include "frustum.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// A street-level view of a city block grid, which is the case occlusion culling is meant for.
+// Buildings are boxes which are their own occluders, and share one occluder mesh through their model transform
+// like glTF instances flagged with "occluder" do in SceneLoader. Props are small boxes in the streets and on roofs.
+static constexpr unsigned Blocks = 24;
+static constexpr float BlockSize = 40.0f;
+static constexpr float StreetWidth = 12.0f;
+static constexpr float EyeHeight = 1.8f;
+
+struct Building
+{
+	AABB aabb;
+	mat4 model;
+};
+
+static bool ray_hits_box(vec3 origin, vec3 dir, float max_t, const AABB &aabb)
+{
+	vec3 inv_dir = 1.0f / dir;
+	vec3 t0 = (aabb.get_minimum() - origin) * inv_dir;
+	vec3 t1 = (aabb.get_maximum() - origin) * inv_dir;
+	vec3 t_near = min(t0, t1);
+	vec3 t_far = max(t0, t1);
+	float enter = max(max(t_near.x, t_near.y), max(t_near.z, 0.0f));
+	float leave = min(min(t_far.x, t_far.y), min(t_far.z, max_t));
+	return enter <= leave;
+}
+
+// A culled prop is wrong if some point of it can be seen on screen past every building.
+// Buildings are grown by a couple of occlusion buffer pixels at the distance of the point,
+// since the rasterizer samples pixel centers.
+static bool has_visible_point(const AABB &prop, vec3 eye, const mat4 &view_projection,
+                              const std::vector<Building> &buildings, float pixel_angle)
+{
+	vec3 points[9];
+	for (unsigned i = 0; i < 8; i++)
+		points[i] = prop.get_corner(i);
+	points[8] = prop.get_center();
+
+	for (auto &p : points)
+	{
+		vec4 clip = view_projection * vec4(p, 1.0f);
+		if (clip.w <= 0.0f || any(greaterThan(abs(clip.xyz()), vec3(clip.w))))
+			continue;
+
+		vec3 dir = p - eye;
+		float dist = length(dir);
+		float slack = 2.0f * pixel_angle * dist;
+		dir /= dist;
+
+		bool blocked = false;
+		for (auto &b : buildings)
+		{
+			AABB grown(b.aabb.get_minimum() - vec3(slack), b.aabb.get_maximum() + vec3(slack));
+			if (ray_hits_box(eye, dir, dist, grown))
+			{
+				blocked = true;
+				break;
+			}
+		}
+
+		if (!blocked)
+			return true;
+	}
+
+	return false;
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(4);
+
+	// Unit cube shared by every building.
+	std::vector<vec4> positions;
+	for (unsigned i = 0; i < 8; i++)
+		positions.emplace_back(float(i & 1), float((i >> 1) & 1), float((i >> 2) & 1), 1.0f);
+	std::vector<unsigned> indices = {
+		0, 2, 1, 1, 2, 3, // -Z
+		4, 5, 6, 5, 7, 6, // +Z
+		0, 1, 4, 1, 5, 4, // -Y
+		2, 6, 3, 3, 6, 7, // +Y
+		0, 4, 2, 2, 4, 6, // -X
+		1, 3, 5, 3, 7, 5, // +X
+	};
+
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> height(8.0f, 80.0f);
+	std::vector<Building> buildings;
+	const float city_size = Blocks * (BlockSize + StreetWidth);
+	for (unsigned z = 0; z < Blocks; z++)
+	{
+		for (unsigned x = 0; x < Blocks; x++)
+		{
+			vec3 lo = vec3(x * (BlockSize + StreetWidth), 0.0f, z * (BlockSize + StreetWidth)) -
+			          vec3(0.5f * city_size, 0.0f, 0.5f * city_size);
+			vec3 size = vec3(BlockSize, height(rnd), BlockSize);
+			buildings.push_back({ AABB(lo, lo + size), translate(lo) * scale(size) });
+		}
+	}
+
+	std::uniform_real_distribution<float> coord(-0.5f * city_size, 0.5f * city_size);
+	std::uniform_real_distribution<float> extent(0.25f, 2.0f);
+	const unsigned num_props = 100000;
+	std::vector<AABB> props;
+	props.reserve(num_props);
+	for (unsigned i = 0; i < num_props; i++)
+	{
+		vec3 e = vec3(extent(rnd), extent(rnd), extent(rnd));
+		vec3 c = vec3(coord(rnd), e.y, coord(rnd));
+
+		// Props which land inside a building go on its roof instead.
+		for (auto &b : buildings)
+		{
+			if (c.x >= b.aabb.get_minimum().x && c.x <= b.aabb.get_maximum().x &&
+			    c.z >= b.aabb.get_minimum().z && c.z <= b.aabb.get_maximum().z)
+			{
+				c.y += b.aabb.get_maximum().y;
+				break;
+			}
+		}
+		props.emplace_back(c - e, c + e);
+	}
+
+	const float fovy = 0.5f * pi<float>();
+	mat4 proj = projection(fovy, 2.0f, 0.5f, 2000.0f);
+	OcclusionCuller culler;
+	float pixel_angle = fovy / float(culler.get_resolution().y);
+
+	// Stand in the middle of a street and look in all four directions.
+	const float street = 0.5f * (BlockSize + StreetWidth) - 0.5f * StreetWidth;
+	vec3 eye = vec3(street - (BlockSize + StreetWidth) * 0.5f, EyeHeight, 3.0f);
+	static const vec3 directions[] = {
+		vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 0.0f, 1.0f),
+		vec3(1.0f, 0.0f, 0.2f), vec3(-1.0f, 0.1f, -0.3f),
+	};
+
+	bool success = true;
+	for (auto &direction : directions)
+	{
+		mat4 view = mat4_cast(look_at(direction, vec3(0.0f, 1.0f, 0.0f))) * translate(-eye);
+		mat4 view_proj = proj * view;
+		Frustum frustum;
+		frustum.build_planes(inverse(view_proj));
+
+		culler.begin(view_proj);
+		for (auto &b : buildings)
+			if (frustum.intersects(b.aabb))
+				culler.add_occluder(b.model, positions.data(), unsigned(positions.size()),
+				                    indices.data(), unsigned(indices.size()));
+		culler.end(&group);
+
+		unsigned in_frustum = 0;
+		unsigned culled = 0;
+		unsigned errors = 0;
+		uint64_t test_nsecs = 0;
+		for (auto &prop : props)
+		{
+			if (!frustum.intersects(prop))
+				continue;
+			in_frustum++;
+
+			auto start = Util::get_current_time_nsecs();
+			bool visible = culler.test_aabb(prop);
+			test_nsecs += Util::get_current_time_nsecs() - start;
+
+			if (!visible)
+			{
+				culled++;
+				if (has_visible_point(prop, eye, view_proj, buildings, pixel_angle))
+					errors++;
+			}
+		}
+
+		auto &stats = culler.get_statistics();
+		LOGI("Direction (%.1f, %.1f, %.1f): %u / %u props in frustum culled (%.1f %%), %u wrongly culled.\n",
+		     direction.x, direction.y, direction.z, culled, in_frustum,
+		     in_frustum ? 100.0 * culled / in_frustum : 0.0, errors);
+		LOGI("  %u occluder triangles rasterized in %.3f ms, %.1f ns per prop test.\n",
+		     stats.occluder_triangles, 1e-6 * double(stats.rasterize_nsecs),
+		     in_frustum ? double(test_nsecs) / in_frustum : 0.0);
+
+		if (errors)
+		{
+			LOGE("Occlusion culling is not conservative.\n");
+			success = false;
+		}
+
+		// At street level almost everything is behind the first row of buildings.
+		if (culled < in_frustum / 2)
+		{
+			LOGE("Too few props were culled.\n");
+			success = false;
+		}
+	}
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "occlusion_culler.hpp"
+#include "thread_group.hpp"
+#include "transforms.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "muglm/matrix_helper.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+
+using namespace Granite;
+
+// A camera at the origin looks down -Z at a wall spanning [-WallSize, WallSize] in X and Y at z = -WallDistance.
+// Boxes are only allowed to be culled if they are entirely behind the wall and inside its silhouette,
+// which can be checked analytically. Occluders are sampled at pixel centers, so allow half a pixel of slack,
+// which is 20 / 128 / 2 world units at the wall for a 90 degree vertical FOV at 256 x 128.
+static constexpr float WallDistance = 10.0f;
+static constexpr float WallSize = 5.0f;
+static constexpr float WallSlack = 0.08f;
+
+static bool is_certainly_hidden(const AABB &aabb)
+{
+	if (aabb.get_maximum().z >= -WallDistance)
+		return false;
+
+	// Every corner must project onto the wall.
+	for (unsigned i = 0; i < 8; i++)
+	{
+		vec3 c = aabb.get_corner(i);
+		vec2 on_wall = c.xy() * (WallDistance / -c.z);
+		if (any(greaterThan(abs(on_wall), vec2(WallSize + WallSlack))))
+			return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	ThreadGroup group;
+	group.start(4);
+
+	mat4 proj = projection(0.5f * pi<float>(), 2.0f, 0.1f, 100.0f);
+	mat4 view = mat4(1.0f);
+
+	std::vector<vec4> positions = {
+		vec4(-WallSize, -WallSize, -WallDistance, 1.0f),
+		vec4(+WallSize, -WallSize, -WallDistance, 1.0f),
+		vec4(-WallSize, +WallSize, -WallDistance, 1.0f),
+		vec4(+WallSize, +WallSize, -WallDistance, 1.0f),
+	};
+	std::vector<unsigned> indices = { 0, 1, 2, 3, 2, 1 };
+
+	OcclusionCuller culler;
+	culler.begin(proj * view);
+	culler.add_occluder(mat4(1.0f), positions.data(), unsigned(positions.size()), indices.data(), unsigned(indices.size()));
+	culler.end(&group);
+
+	std::mt19937 rnd(99);
+	std::uniform_real_distribution<float> xy(-20.0f, 20.0f);
+	std::uniform_real_distribution<float> z(-60.0f, -1.0f);
+	std::uniform_real_distribution<float> extent(0.05f, 3.0f);
+
+	const unsigned count = 100000;
+	std::vector<AABB> boxes;
+	boxes.reserve(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		vec3 center = vec3(xy(rnd), xy(rnd), z(rnd));
+		vec3 e = vec3(extent(rnd), extent(rnd), extent(rnd));
+		boxes.emplace_back(center - e, center + e);
+	}
+
+	unsigned culled = 0;
+	unsigned expected = 0;
+	unsigned errors = 0;
+	auto start = Util::get_current_time_nsecs();
+	for (auto &box : boxes)
+	{
+		bool visible = culler.test_aabb(box);
+		bool hidden = is_certainly_hidden(box);
+		culled += unsigned(!visible);
+		expected += unsigned(hidden);
+		if (!visible && !hidden)
+			errors++;
+	}
+	auto test_time = Util::get_current_time_nsecs() - start;
+
+	// Boxes in front of the occluder and behind the camera must always pass.
+	if (!culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -5.0f), vec3(1.0f, 1.0f, -4.0f))) ||
+	    !culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -20.0f), vec3(1.0f, 1.0f, 5.0f))))
+	{
+		LOGE("Visible box was culled.\n");
+		return 1;
+	}
+
+	if (culler.test_aabb(AABB(vec3(-1.0f, -1.0f, -30.0f), vec3(1.0f, 1.0f, -20.0f))))
+	{
+		LOGE("Box right behind the occluder was not culled.\n");
+		return 1;
+	}
+
+	LOGI("%u boxes: %u culled out of %u hidden, %u wrongly culled, %.3f ns per box.\n",
+	     count, culled, expected, errors, double(test_time) / count);
+	LOGI("Rasterized %u occluder triangles in %.3f ms.\n",
+	     culler.get_statistics().occluder_triangles, 1e-6 * double(culler.get_statistics().rasterize_nsecs));
+
+	if (errors)
+	{
+		LOGE("Occlusion culling is not conservative.\n");
+		return 1;
+	}
+
+	// Boxes close to the silhouette can go either way, but the bulk of the hidden boxes should go.
+	if (culled < expected / 2)
+	{
+		LOGE("Too few boxes were culled.\n");
+		return 1;
+	}
+
+	return 0;
+}
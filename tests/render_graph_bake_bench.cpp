@@ -0,0 +1,104 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "render_graph.hpp"
+#include "global_managers.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <string>
+
+using namespace Granite;
+
+// Builds a synthetic graph of num_passes passes.
+// Every pass reads the previous pass, and every fourth pass also reads a pass further back,
+// so dependency traversal and reordering have some real work to do.
+static void build_graph(RenderGraph &graph, unsigned num_passes, unsigned width, unsigned height)
+{
+	graph.reset();
+
+	ResourceDimensions dim;
+	dim.width = width;
+	dim.height = height;
+	dim.format = VK_FORMAT_R8G8B8A8_UNORM;
+	graph.set_backbuffer_dimensions(dim);
+
+	AttachmentInfo info;
+	info.format = VK_FORMAT_R8G8B8A8_UNORM;
+
+	for (unsigned i = 0; i < num_passes; i++)
+	{
+		auto &pass = graph.add_pass("pass" + std::to_string(i), RENDER_GRAPH_QUEUE_GRAPHICS_BIT);
+		if (i >= 1)
+			pass.add_texture_input("rt" + std::to_string(i - 1));
+		if (i >= 8 && (i & 3) == 0)
+			pass.add_texture_input("rt" + std::to_string(i - 8));
+		pass.add_color_output("rt" + std::to_string(i), info);
+	}
+
+	graph.set_backbuffer_source("rt" + std::to_string(num_passes - 1));
+}
+
+static double bench(unsigned num_passes, unsigned iterations, bool fresh_graph, bool vary_size)
+{
+	RenderGraph graph;
+	int64_t total = 0;
+
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		unsigned width = vary_size ? 1280 + i : 1280;
+		if (fresh_graph)
+		{
+			RenderGraph cold_graph;
+			build_graph(cold_graph, num_passes, width, 720);
+			auto start = Util::get_current_time_nsecs();
+			cold_graph.bake();
+			total += Util::get_current_time_nsecs() - start;
+		}
+		else
+		{
+			build_graph(graph, num_passes, width, 720);
+			auto start = Util::get_current_time_nsecs();
+			graph.bake();
+			total += Util::get_current_time_nsecs() - start;
+		}
+	}
+
+	return 1e-3 * double(total) / iterations;
+}
+
+int main()
+{
+	Global::init(Global::MANAGER_FEATURE_EVENT_BIT);
+
+	static const unsigned pass_counts[] = { 8, 32, 128, 512 };
+	for (auto count : pass_counts)
+	{
+		unsigned iterations = count >= 512 ? 20 : 200;
+		double cold = bench(count, iterations, true, false);
+		double resized = bench(count, iterations, false, true);
+		double cached = bench(count, iterations, false, false);
+		LOGI("%4u passes: cold %10.3f us, resized %10.3f us, cached %10.3f us\n",
+		     count, cold, resized, cached);
+	}
+
+	Global::deinit();
+}
@@ -0,0 +1,113 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dsp/sinc_resampler.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+#include <memory>
+
+using namespace Granite::Audio;
+
+static const char *quality_to_string(DSP::SincResampler::Quality quality)
+{
+	switch (quality)
+	{
+	case DSP::SincResampler::Quality::Low:
+		return "Low";
+	case DSP::SincResampler::Quality::Medium:
+		return "Medium";
+	case DSP::SincResampler::Quality::High:
+		return "High";
+	default:
+		return "?";
+	}
+}
+
+// Resamples a stereo voice in mixer sized chunks, and reports how many such voices one core can keep up with.
+static void run_bench(float out_rate, float in_rate, DSP::SincResampler::Quality quality, bool interleaved)
+{
+	constexpr unsigned num_channels = 2;
+	constexpr size_t chunk_frames = 256;
+	constexpr unsigned iterations = 4000;
+
+	std::unique_ptr<DSP::SincResampler> resamplers[num_channels];
+	if (interleaved)
+		resamplers[0].reset(new DSP::SincResampler(out_rate, in_rate, quality, num_channels));
+	else
+		for (auto &r : resamplers)
+			r.reset(new DSP::SincResampler(out_rate, in_rate, quality));
+
+	size_t max_input = resamplers[0]->get_maximum_input_for_output_frames(chunk_frames);
+	std::vector<float> inputs[num_channels];
+	std::vector<float> outputs[num_channels];
+
+	std::mt19937 rnd;
+	std::uniform_real_distribution<float> range(-1.0f, 1.0f);
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		inputs[c].resize(max_input);
+		outputs[c].resize(chunk_frames);
+		for (auto &i : inputs[c])
+			i = range(rnd);
+	}
+
+	const float *input_ptrs[num_channels] = { inputs[0].data(), inputs[1].data() };
+	float *output_ptrs[num_channels] = { outputs[0].data(), outputs[1].data() };
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		if (interleaved)
+			resamplers[0]->process_and_accumulate(output_ptrs, input_ptrs, chunk_frames);
+		else
+			for (unsigned c = 0; c < num_channels; c++)
+				resamplers[c]->process_and_accumulate(output_ptrs[c], input_ptrs[c], chunk_frames);
+	}
+	auto end = Util::get_current_time_nsecs();
+
+	double elapsed = 1e-9 * double(end - start);
+	double audio_time = double(iterations * chunk_frames) / out_rate;
+	LOGI("%6s quality, %.0f -> %.0f Hz, %s: %.1f stereo voices / core.\n",
+	     quality_to_string(quality), in_rate, out_rate,
+	     interleaved ? "all channels in one pass" : "one resampler per channel",
+	     audio_time / elapsed);
+}
+
+int main()
+{
+	static const DSP::SincResampler::Quality qualities[] = {
+		DSP::SincResampler::Quality::Low,
+		DSP::SincResampler::Quality::Medium,
+		DSP::SincResampler::Quality::High,
+	};
+
+	for (auto quality : qualities)
+	{
+		for (bool interleaved : { false, true })
+		{
+			run_bench(48000.0f, 44100.0f, quality, interleaved);
+			run_bench(44100.0f, 48000.0f, quality, interleaved);
+		}
+	}
+}
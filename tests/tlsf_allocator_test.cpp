@@ -0,0 +1,243 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "tlsf_allocator.hpp"
+#include "logging.hpp"
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Util;
+
+// Stands in for device memory, and tracks which granules are handed out so overlaps are caught.
+enum { Granularity = 256 };
+
+struct MockBackend : TLSFBackend
+{
+	struct Region
+	{
+		std::vector<uint8_t> owned;
+		bool live = false;
+	};
+	std::vector<Region> regions;
+	uint32_t live_regions = 0;
+	uint32_t budget = ~0u;
+
+	bool allocate_region(uint32_t region, uint32_t size) override
+	{
+		if (live_regions >= budget)
+			return false;
+		if (region >= regions.size())
+			regions.resize(region + 1);
+		if (regions[region].live)
+		{
+			LOGE("Region %u allocated twice.\n", region);
+			exit(1);
+		}
+		regions[region].owned.clear();
+		regions[region].owned.resize(size / Granularity);
+		regions[region].live = true;
+		live_regions++;
+		return true;
+	}
+
+	void free_region(uint32_t region, uint32_t size) override
+	{
+		if (region >= regions.size() || !regions[region].live || regions[region].owned.size() != size / Granularity)
+		{
+			LOGE("Invalid region free.\n");
+			exit(1);
+		}
+
+		for (auto v : regions[region].owned)
+		{
+			if (v)
+			{
+				LOGE("Region freed while still in use.\n");
+				exit(1);
+			}
+		}
+
+		regions[region].live = false;
+		live_regions--;
+	}
+
+	void mark(const TLSFAllocation &alloc, bool used)
+	{
+		auto &region = regions[alloc.region];
+		if (!region.live || (alloc.offset + alloc.size) / Granularity > region.owned.size())
+		{
+			LOGE("Allocation outside region.\n");
+			exit(1);
+		}
+
+		for (uint32_t i = alloc.offset / Granularity; i < (alloc.offset + alloc.size) / Granularity; i++)
+		{
+			if (bool(region.owned[i]) == used)
+			{
+				LOGE("Overlapping allocation at offset %u.\n", i * Granularity);
+				exit(1);
+			}
+			region.owned[i] = used;
+		}
+	}
+};
+
+static void test_coalesce()
+{
+	MockBackend backend;
+	{
+		TLSFAllocator allocator(backend, 64 * 1024);
+		TLSFAllocation a, b, c;
+		if (!allocator.allocate(1000, 0, &a) || !allocator.allocate(20000, 4096, &b) || !allocator.allocate(3000, 0, &c))
+		{
+			LOGE("Allocation failed.\n");
+			exit(1);
+		}
+
+		if (a.size != 1024 || (b.offset & 4095) != 0 || a.region != b.region || b.region != c.region)
+		{
+			LOGE("Unexpected allocation layout.\n");
+			exit(1);
+		}
+
+		auto stats = allocator.get_statistics();
+		if (stats.num_regions != 1 || stats.requested_bytes != 24000 || stats.num_allocations != 3)
+		{
+			LOGE("Unexpected statistics.\n");
+			exit(1);
+		}
+
+		allocator.free(b);
+		allocator.free(a);
+		stats = allocator.get_statistics();
+		if (stats.get_fragmentation() <= 0.0f)
+		{
+			LOGE("Expected fragmentation with a hole in the middle.\n");
+			exit(1);
+		}
+
+		// Everything is coalesced back into one region, which is handed back.
+		allocator.free(c);
+		stats = allocator.get_statistics();
+		if (stats.num_regions != 0 || stats.num_free_blocks != 0 || backend.live_regions != 0)
+		{
+			LOGE("Region was not released.\n");
+			exit(1);
+		}
+	}
+}
+
+static void test_oversized()
+{
+	MockBackend backend;
+	TLSFAllocator allocator(backend, 64 * 1024);
+	TLSFAllocation a;
+	if (!allocator.allocate(1024 * 1024, 256, &a) || a.offset != 0 || a.size != 1024 * 1024)
+	{
+		LOGE("Oversized allocation failed.\n");
+		exit(1);
+	}
+	allocator.free(a);
+
+	backend.budget = 0;
+	if (allocator.allocate(16, 0, &a))
+	{
+		LOGE("Allocation should fail when the backend is out of memory.\n");
+		exit(1);
+	}
+}
+
+static void test_random()
+{
+	MockBackend backend;
+	TLSFAllocator allocator(backend, 8 * 1024 * 1024);
+	std::mt19937 rnd(1234);
+	std::vector<TLSFAllocation> live;
+
+	for (unsigned iteration = 0; iteration < 100000; iteration++)
+	{
+		if (live.empty() || (live.size() < 1000 && (rnd() & 1)))
+		{
+			// Mix of small and large allocations, like streaming textures.
+			uint32_t size = (rnd() % 8) == 0 ? 1 + rnd() % (4 * 1024 * 1024) : 1 + rnd() % (64 * 1024);
+			uint32_t alignment = 1u << (rnd() % 17);
+
+			TLSFAllocation alloc;
+			if (!allocator.allocate(size, alignment, &alloc))
+			{
+				LOGE("Allocation failed.\n");
+				exit(1);
+			}
+
+			if ((alloc.offset & (alignment - 1)) != 0 || alloc.size < size)
+			{
+				LOGE("Allocation does not satisfy the request.\n");
+				exit(1);
+			}
+
+			backend.mark(alloc, true);
+			live.push_back(alloc);
+		}
+		else
+		{
+			size_t index = rnd() % live.size();
+			backend.mark(live[index], false);
+			allocator.free(live[index]);
+			live[index] = live.back();
+			live.pop_back();
+		}
+
+		if ((iteration % 10000) == 0)
+		{
+			auto stats = allocator.get_statistics();
+			LOGI("%6u allocations, %7.2f MiB in %u regions, waste %.3f, fragmentation %.3f.\n",
+			     stats.num_allocations, stats.region_bytes / (1024.0 * 1024.0), stats.num_regions,
+			     stats.get_waste(), stats.get_fragmentation());
+		}
+	}
+
+	for (auto &alloc : live)
+	{
+		backend.mark(alloc, false);
+		allocator.free(alloc);
+	}
+
+	auto stats = allocator.get_statistics();
+	if (stats.num_regions != 0 || stats.allocated_bytes != 0 || stats.requested_bytes != 0 || backend.live_regions != 0)
+	{
+		LOGE("Memory was not returned to the backend.\n");
+		exit(1);
+	}
+
+	LOGI("Peak %.2f MiB, %llu region allocations.\n", stats.peak_region_bytes / (1024.0 * 1024.0),
+	     static_cast<unsigned long long>(stats.total_region_allocations));
+}
+
+int main()
+{
+	test_coalesce();
+	test_oversized();
+	test_random();
+	LOGI(":D\n");
+}
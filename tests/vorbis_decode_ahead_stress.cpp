@@ -0,0 +1,120 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio_mixer.hpp"
+#include "audio_interface.hpp"
+#include "audio_events.hpp"
+#include "vorbis_stream.hpp"
+#include "global_managers.hpp"
+#include "filesystem.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <thread>
+#include <chrono>
+#include <stdlib.h>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		LOGE("Usage: vorbis-decode-ahead-stress <file.ogg>\n");
+		return EXIT_FAILURE;
+	}
+
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+
+	constexpr unsigned NumStreams = 64;
+	constexpr unsigned FramesPerTick = 256;
+	constexpr float SampleRate = 44100.0f;
+	constexpr unsigned NumTicks = unsigned(10.0f * SampleRate / float(FramesPerTick));
+
+	Mixer mixer;
+	DumpBackend backend(mixer, "memory://vorbis-decode-ahead-stress.raw", SampleRate, 2, FramesPerTick, NumTicks);
+	if (!backend.start())
+		return EXIT_FAILURE;
+
+	for (unsigned i = 0; i < NumStreams; i++)
+	{
+		auto *stream = create_decode_ahead_vorbis_stream(argv[1], true);
+		if (!stream)
+		{
+			LOGE("Failed to create stream.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (mixer.add_mixer_stream(stream, true, -20.0f) == StreamID(-1))
+		{
+			LOGE("Failed to add stream.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	unsigned underruns = 0;
+	unsigned missing_frames = 0;
+	unsigned stopped = 0;
+	uint64_t total_mix_time = 0;
+	uint64_t worst_mix_time = 0;
+
+	// Drive the backend in real-time, so the decoder thread has to keep up.
+	auto tick_duration = std::chrono::nanoseconds(uint64_t(1e9 * FramesPerTick / SampleRate));
+	auto next_tick = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < NumTicks; i++)
+	{
+		auto start_time = Util::get_current_time_nsecs();
+		backend.frame();
+		auto mix_time = Util::get_current_time_nsecs() - start_time;
+		total_mix_time += mix_time;
+		worst_mix_time = std::max<uint64_t>(worst_mix_time, mix_time);
+
+		auto &queue = mixer.get_message_queue();
+		Util::MessageQueuePayload payload;
+		while ((payload = queue.read_message()))
+		{
+			auto &event = payload.as<Event>();
+			if (event.get_type_id() == StreamUnderrunEvent::get_type_id())
+			{
+				underruns++;
+				missing_frames += static_cast<StreamUnderrunEvent &>(event).get_missing_frames();
+			}
+			else if (event.get_type_id() == StreamStoppedEvent::get_type_id())
+				stopped++;
+			queue.recycle_payload(std::move(payload));
+		}
+
+		next_tick += tick_duration;
+		std::this_thread::sleep_until(next_tick);
+	}
+
+	backend.stop();
+
+	LOGI("%u streams, %u ticks of %u frames.\n", NumStreams, NumTicks, FramesPerTick);
+	LOGI("Mix time: average %.3f us, worst %.3f us, budget %.3f us.\n",
+	     1e-3 * double(total_mix_time) / NumTicks, 1e-3 * double(worst_mix_time),
+	     1e6 * FramesPerTick / SampleRate);
+	LOGI("Underruns: %u (%u frames), stopped streams: %u.\n", underruns, missing_frames, stopped);
+
+	return underruns == 0 && stopped == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
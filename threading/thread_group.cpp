@@ -22,10 +22,12 @@
 
 #include "thread_group.hpp"
 #include <assert.h>
+#include <stdio.h>
 #include <stdexcept>
 #include "logging.hpp"
 #include "global_managers.hpp"
 #include "thread_id.hpp"
+#include "cpu_trace.hpp"
 
 using namespace std;
 
@@ -44,6 +46,10 @@ void TaskDeps::notify_dependees()
 	if (signal)
 		signal->signal_increment();
 
+	for (auto &flow : trace_flows_out)
+		Util::CPUTrace::flow_start(flow);
+	trace_flows_out.clear();
+
 	for (auto &dep : pending)
 		dep->dependency_satisfied();
 	pending.clear();
@@ -156,6 +162,13 @@ void ThreadGroup::add_dependency(TaskGroup &dependee, TaskGroup &dependency)
 
 	dependency->deps->pending.push_back(dependee->deps);
 	dependee->deps->dependency_count.fetch_add(1, memory_order_relaxed);
+
+	if (Util::CPUTrace::is_enabled())
+	{
+		uint64_t flow = Util::CPUTrace::allocate_flow_id();
+		dependency->deps->trace_flows_out.push_back(flow);
+		dependee->deps->trace_flows_in.push_back(flow);
+	}
 }
 
 void ThreadGroup::move_to_ready_tasks(const std::vector<Internal::Task *> &list)
@@ -272,6 +285,10 @@ void ThreadGroup::thread_looper(unsigned index)
 	(void)index;
 #endif
 
+	char thread_name[32];
+	snprintf(thread_name, sizeof(thread_name), "Worker %u", index);
+	Util::CPUTrace::set_thread_name(thread_name);
+
 	for (;;)
 	{
 		Internal::Task *task = nullptr;
@@ -289,10 +306,21 @@ void ThreadGroup::thread_looper(unsigned index)
 			ready_tasks.pop();
 		}
 
-		if (task->func)
-			task->func();
+		{
+			GRANITE_CPU_TRACE_ZONE("Task");
 
-		task->deps->task_completed();
+			if (!task->deps->trace_flows_in.empty() &&
+			    !task->deps->trace_flows_in_consumed.exchange(true, memory_order_relaxed))
+			{
+				for (auto &flow : task->deps->trace_flows_in)
+					Util::CPUTrace::flow_end(flow);
+			}
+
+			if (task->func)
+				task->func();
+
+			task->deps->task_completed();
+		}
 		task_pool.free(task);
 
 		{
@@ -70,6 +70,7 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 	{
 		count.store(0, std::memory_order_relaxed);
 		dependency_count.store(0, std::memory_order_relaxed);
+		trace_flows_in_consumed.store(false, std::memory_order_relaxed);
 	}
 
 	ThreadGroup *group;
@@ -87,6 +88,11 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 	std::condition_variable cond;
 	std::mutex cond_lock;
 	bool done = false;
+
+	// Trace flows from the tasks of this group to the first task of each dependee.
+	std::vector<uint64_t> trace_flows_out;
+	std::vector<uint64_t> trace_flows_in;
+	std::atomic_bool trace_flows_in_consumed;
 };
 using TaskDepsHandle = Util::IntrusivePtr<TaskDeps>;
 
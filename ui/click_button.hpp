@@ -43,11 +43,13 @@ public:
 	void set_label_alignment(Font::Alignment alignment_)
 	{
 		alignment = alignment_;
+		needs_redraw = true;
 	}
 
 	void set_font_color(vec4 color_)
 	{
 		color = color_;
+		needs_redraw = true;
 	}
 
 	void on_click(std::function<void ()> cb)
@@ -25,6 +25,7 @@
 #include "event.hpp"
 #include "sprite.hpp"
 #include <float.h>
+#include <string.h>
 
 using namespace Vulkan;
 using namespace std;
@@ -39,6 +40,62 @@ FlatRenderer::FlatRenderer(const ShaderSuiteResolver *resolver_)
 	reset_scissor();
 }
 
+void FlatDisplayList::clear()
+{
+	commands.clear();
+	text.clear();
+	points.clear();
+	images.clear();
+}
+
+void FlatRenderer::begin_recording(FlatDisplayList &list)
+{
+	assert(!recording);
+	list.clear();
+	recording = &list;
+}
+
+void FlatRenderer::end_recording()
+{
+	assert(recording);
+	recording = nullptr;
+}
+
+void FlatRenderer::replay(const FlatDisplayList &list, float layer_offset)
+{
+	assert(!recording);
+	for (auto &command : list.commands)
+	{
+		switch (command.type)
+		{
+		case FlatDisplayList::CommandType::Quad:
+			render_quad(command.view, command.array_layer, command.sampler,
+			            command.offset + vec3(0.0f, 0.0f, layer_offset), command.size,
+			            command.tex_offset, command.tex_size, command.color, command.pipeline);
+			break;
+
+		case FlatDisplayList::CommandType::Text:
+			render_text(*command.font, list.text.data() + command.data_offset,
+			            command.offset + vec3(0.0f, 0.0f, layer_offset), command.size,
+			            command.color, command.alignment, command.scale);
+			break;
+
+		case FlatDisplayList::CommandType::LineStrip:
+			render_line_strip(list.points.data() + command.data_offset, command.offset.z + layer_offset,
+			                  command.count, command.color);
+			break;
+
+		case FlatDisplayList::CommandType::PushScissor:
+			push_scissor(command.offset.xy(), command.size);
+			break;
+
+		case FlatDisplayList::CommandType::PopScissor:
+			pop_scissor();
+			break;
+		}
+	}
+}
+
 void FlatRenderer::reset_scissor()
 {
 	scissor_stack.clear();
@@ -47,6 +104,14 @@ void FlatRenderer::reset_scissor()
 
 void FlatRenderer::push_scissor(const vec2 &offset, const vec2 &size)
 {
+	if (recording)
+	{
+		FlatDisplayList::Command command = {};
+		command.type = FlatDisplayList::CommandType::PushScissor;
+		command.offset = vec3(offset, 0.0f);
+		command.size = size;
+		recording->commands.push_back(command);
+	}
 	scissor_stack.push_back({ offset, size });
 }
 
@@ -54,6 +119,13 @@ void FlatRenderer::pop_scissor()
 {
 	assert(!scissor_stack.empty());
 	scissor_stack.pop_back();
+
+	if (recording)
+	{
+		FlatDisplayList::Command command = {};
+		command.type = FlatDisplayList::CommandType::PopScissor;
+		recording->commands.push_back(command);
+	}
 }
 
 void FlatRenderer::on_device_created(const DeviceCreatedEvent &created)
@@ -119,6 +191,26 @@ void FlatRenderer::render_quad(const ImageView *view, unsigned layer, Vulkan::St
 {
 	if (color.w <= 0.0f)
 		return;
+
+	if (recording)
+	{
+		FlatDisplayList::Command command = {};
+		command.type = FlatDisplayList::CommandType::Quad;
+		command.view = view;
+		command.array_layer = layer;
+		command.sampler = sampler;
+		command.pipeline = pipeline;
+		command.offset = offset;
+		command.size = size;
+		command.tex_offset = tex_offset;
+		command.tex_size = tex_size;
+		command.color = color;
+		recording->commands.push_back(command);
+
+		if (view)
+			recording->images.push_back(const_cast<Image &>(view->get_image()).reference_from_this());
+	}
+
 	auto type = pipeline == DrawPipeline::AlphaBlend ? Queue::Transparent : Queue::Opaque;
 	bool layered = view && view->get_create_info().view_type == VK_IMAGE_VIEW_TYPE_2D_ARRAY;
 
@@ -228,6 +320,19 @@ void FlatRenderer::render_line_strip(const vec2 *offset, float layer, unsigned c
 {
 	if (color.w <= 0.0f)
 		return;
+
+	if (recording)
+	{
+		FlatDisplayList::Command command = {};
+		command.type = FlatDisplayList::CommandType::LineStrip;
+		command.offset = vec3(0.0f, 0.0f, layer);
+		command.color = color;
+		command.data_offset = unsigned(recording->points.size());
+		command.count = count;
+		recording->commands.push_back(command);
+		recording->points.insert(end(recording->points), offset, offset + count);
+	}
+
 	auto transparent = color.w < 1.0f;
 	LineStripInfo strip;
 
@@ -280,6 +385,22 @@ void FlatRenderer::render_text(const Font &font, const char *text, const vec3 &o
 {
 	if (color.w <= 0.0f)
 		return;
+
+	if (recording)
+	{
+		FlatDisplayList::Command command = {};
+		command.type = FlatDisplayList::CommandType::Text;
+		command.font = &font;
+		command.alignment = alignment;
+		command.offset = offset;
+		command.size = size;
+		command.color = color;
+		command.scale = scale;
+		command.data_offset = unsigned(recording->text.size());
+		recording->commands.push_back(command);
+		recording->text.insert(end(recording->text), text, text + strlen(text) + 1);
+	}
+
 	font.render_text(queue, text, offset, size,
 	                 scissor_stack.back().offset, scissor_stack.back().size,
 	                 color, alignment, scale);
@@ -25,6 +25,7 @@
 #include "renderer.hpp"
 #include "font.hpp"
 #include "sprite.hpp"
+#include "image.hpp"
 #include <vector>
 
 namespace Granite
@@ -69,6 +70,52 @@ struct LineStripInfo
 	ivec4 clip = ivec4(0, 0, 0x4000, 0x4000);
 };
 
+// Quads, text, line strips and scissor changes recorded by FlatRenderer,
+// which can be replayed in later frames without walking the widgets which emitted them.
+// Images referenced by textured quads are kept alive by the list, fonts must outlive it.
+// Sprites pushed with push_sprite() are not recorded.
+class FlatDisplayList
+{
+public:
+	void clear();
+
+private:
+	friend class FlatRenderer;
+
+	enum class CommandType
+	{
+		Quad,
+		Text,
+		LineStrip,
+		PushScissor,
+		PopScissor
+	};
+
+	struct Command
+	{
+		CommandType type;
+		const Vulkan::ImageView *view;
+		unsigned array_layer;
+		Vulkan::StockSampler sampler;
+		DrawPipeline pipeline;
+		const Font *font;
+		Font::Alignment alignment;
+		vec3 offset;
+		vec2 size;
+		vec2 tex_offset;
+		vec2 tex_size;
+		vec4 color;
+		float scale;
+		unsigned data_offset;
+		unsigned count;
+	};
+
+	std::vector<Command> commands;
+	std::vector<char> text;
+	std::vector<vec2> points;
+	std::vector<Vulkan::ImageHandle> images;
+};
+
 class FlatRenderer : public EventHandler
 {
 public:
@@ -99,6 +146,12 @@ public:
 	void push_scissor(const vec2 &offset, const vec2 &size);
 	void pop_scissor();
 
+	// Everything rendered between begin_recording() and end_recording() is also recorded into list.
+	// replay() re-issues a recorded list, shifting every layer by layer_offset.
+	void begin_recording(FlatDisplayList &list);
+	void end_recording();
+	void replay(const FlatDisplayList &list, float layer_offset);
+
 private:
 	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
 	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
@@ -113,6 +166,7 @@ private:
 		vec2 size;
 	};
 	std::vector<Scissor> scissor_stack;
+	FlatDisplayList *recording = nullptr;
 
 	void render_quad(const Vulkan::ImageView *view, unsigned layer, Vulkan::StockSampler sampler,
 	                 const vec3 &offset, const vec2 &size, const vec2 &tex_offset, const vec2 &tex_size, const vec4 &color,
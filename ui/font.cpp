@@ -25,6 +25,7 @@
 #include "filesystem.hpp"
 #include "device.hpp"
 #include "sprite.hpp"
+#include "application_events.hpp"
 #include <string.h>
 #include <float.h>
 
@@ -34,78 +35,307 @@ using namespace Util;
 
 namespace Granite
 {
-Font::Font(const std::string &path, unsigned size)
+// Default bound for the layout cache, in glyph quads.
+static constexpr unsigned DefaultLayoutCacheGlyphs = 64 * 1024;
+
+Font::Font(const std::string &path, unsigned size, GlyphType type)
+	: glyph_type(type)
 {
 	auto file = Global::filesystem()->open(path, FileMode::ReadOnly);
 	if (!file)
 		throw runtime_error("Failed to open font.");
 
-	auto *mapped = file->map();
+	auto *mapped = static_cast<const uint8_t *>(file->map());
 	if (!mapped)
 		throw runtime_error("Failed to map font.");
 
-	unsigned multiplier = 4;
-	bool success = false;
+	// Glyphs are rasterized on demand, so the font must outlive the mapping.
+	font_data.assign(mapped, mapped + file->get_size());
+	if (!stbtt_InitFont(&font_info, font_data.data(), stbtt_GetFontOffsetForIndex(font_data.data(), 0)))
+		throw runtime_error("Failed to parse font.");
+
+	font_scale = stbtt_ScaleForPixelHeight(&font_info, float(size));
+	if (glyph_type == GlyphType::DistanceField)
+		sdf_padding = int(std::max(size / 8u, 2u));
+
+	// Every slot fits the bounding box of any glyph in the font, plus a pixel since glyph boxes are snapped outwards.
+	// One pixel of border around each slot keeps linear filtering from bleeding between glyphs.
+	int x0, y0, x1, y1;
+	stbtt_GetFontBoundingBox(&font_info, &x0, &y0, &x1, &y1);
+	cell_width = unsigned(muglm::ceil(float(x1 - x0) * font_scale)) + 1 + 2 * unsigned(sdf_padding) + 2;
+	cell_height = unsigned(muglm::ceil(float(y1 - y0) * font_scale)) + 1 + 2 * unsigned(sdf_padding) + 2;
+	width = cell_width * AtlasColumns;
+	height = cell_height * AtlasRows;
+	bitmap.resize(width * height);
+
+	glyphs.resize(AtlasColumns * AtlasRows);
+	for (unsigned i = 0; i < glyphs.size(); i++)
+	{
+		glyphs[i].tex_offset = uvec2((i % AtlasColumns) * cell_width + 1, (i / AtlasColumns) * cell_height + 1);
+		glyph_lru.insert_back(&glyphs[i]);
+	}
+
+	layout_cache.set_total_cost(DefaultLayoutCacheGlyphs);
+
+	font_height = size;
+	EVENT_MANAGER_REGISTER_LATCH(Font, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+	EVENT_MANAGER_REGISTER(Font, on_frame_tick, FrameTickEvent);
+}
+
+void Font::set_layout_cache_size(unsigned num_glyphs)
+{
+	lock_guard<mutex> holder{lock};
+	layout_cache.set_total_cost(num_glyphs);
+}
+
+bool Font::on_frame_tick(const FrameTickEvent &)
+{
+	lock_guard<mutex> holder{lock};
+	frame++;
+	return true;
+}
+
+static uint32_t decode_utf8(const char *&text)
+{
+	auto c = uint8_t(*text++);
+	if (c < 0x80)
+		return c;
+
+	unsigned extra;
+	uint32_t codepoint;
+	if ((c & 0xe0) == 0xc0)
+	{
+		extra = 1;
+		codepoint = c & 0x1f;
+	}
+	else if ((c & 0xf0) == 0xe0)
+	{
+		extra = 2;
+		codepoint = c & 0x0f;
+	}
+	else if ((c & 0xf8) == 0xf0)
+	{
+		extra = 3;
+		codepoint = c & 0x07;
+	}
+	else
+		return 0xfffd;
 
-	do
+	for (unsigned i = 0; i < extra; i++)
 	{
-		width = size * multiplier;
-		height = size * multiplier;
-		bitmap.resize(width * height);
-		int res = stbtt_BakeFontBitmap(static_cast<const unsigned char *>(mapped),
-		                               0, size,
-		                               bitmap.data(), width, height,
-		                               32, 96,
-		                               baked_chars);
-
-		if (res <= 0)
-			multiplier++;
+		// Do not consume a byte which does not continue the sequence, it might be the terminator.
+		auto next = uint8_t(*text);
+		if ((next & 0xc0) != 0x80)
+			return 0xfffd;
+		codepoint = (codepoint << 6) | (next & 0x3f);
+		text++;
+	}
+
+	return codepoint;
+}
+
+void Font::touch_glyph(unsigned slot) const
+{
+	auto &glyph = glyphs[slot];
+	if (glyph.last_frame != frame)
+	{
+		glyph.last_frame = frame;
+		glyph_lru.move_to_front(glyph_lru, &glyph);
+	}
+}
+
+void Font::rasterize_glyph(Glyph &glyph) const
+{
+	int index = stbtt_FindGlyphIndex(&font_info, int(glyph.codepoint));
+	int advance, left_side_bearing;
+	stbtt_GetGlyphHMetrics(&font_info, index, &advance, &left_side_bearing);
+	glyph.advance = float(advance) * font_scale;
+
+	int max_width = int(cell_width) - 2;
+	int max_height = int(cell_height) - 2;
+	uint8_t *dst = bitmap.data() + glyph.tex_offset.y * width + glyph.tex_offset.x;
+	for (int y = 0; y < max_height; y++)
+		memset(dst + y * width, 0, max_width);
+
+	int glyph_width = 0, glyph_height = 0;
+	int x_offset = 0, y_offset = 0;
+
+	if (glyph_type == GlyphType::DistanceField)
+	{
+		auto *sdf = stbtt_GetGlyphSDF(&font_info, font_scale, index, sdf_padding, 128, 128.0f / float(sdf_padding),
+		                              &glyph_width, &glyph_height, &x_offset, &y_offset);
+		if (sdf)
+		{
+			int copy_width = std::min(glyph_width, max_width);
+			int copy_height = std::min(glyph_height, max_height);
+			for (int y = 0; y < copy_height; y++)
+				memcpy(dst + y * width, sdf + y * glyph_width, copy_width);
+			stbtt_FreeSDF(sdf, nullptr);
+			glyph_width = copy_width;
+			glyph_height = copy_height;
+		}
 		else
 		{
-			height = unsigned(res);
-			success = true;
+			// Empty glyphs such as space have no distance field.
+			glyph_width = 0;
+			glyph_height = 0;
 		}
-	} while (!success && multiplier <= 32);
-
-	if (!success)
-		throw runtime_error("Failed to bake bitmap.");
+	}
+	else
+	{
+		int x0, y0, x1, y1;
+		stbtt_GetGlyphBitmapBox(&font_info, index, font_scale, font_scale, &x0, &y0, &x1, &y1);
+		glyph_width = std::max(std::min(x1 - x0, max_width), 0);
+		glyph_height = std::max(std::min(y1 - y0, max_height), 0);
+		x_offset = x0;
+		y_offset = y0;
+		if (glyph_width && glyph_height)
+			stbtt_MakeGlyphBitmap(&font_info, dst, glyph_width, glyph_height, int(width), font_scale, font_scale, index);
+	}
 
-	font_height = size;
-	EVENT_MANAGER_REGISTER_LATCH(Font, on_device_created, on_device_destroyed, DeviceCreatedEvent);
+	glyph.offset = ivec2(x_offset, y_offset);
+	glyph.size = ivec2(glyph_width, glyph_height);
 }
 
-vec2 Font::get_text_geometry(const char *text, float) const
+const Font::Glyph *Font::request_glyph(uint32_t codepoint) const
 {
-	if (!*text)
-		return vec2(0);
+	auto itr = glyph_slots.find(codepoint);
+	if (itr != end(glyph_slots))
+	{
+		touch_glyph(itr->second);
+		return &glyphs[itr->second];
+	}
+
+	// Glyphs used this frame might already be queued up for rendering with their current slot.
+	auto &glyph = *glyph_lru.rbegin();
+	if (glyph.resident && glyph.last_frame == frame)
+	{
+		if (!warned_atlas_full)
+		{
+			LOGW("Font: Glyph atlas is full with glyphs used this frame, dropping glyphs.\n");
+			warned_atlas_full = true;
+		}
+		return nullptr;
+	}
 
-	vec2 off = vec2(0.0f);
-	off.y += font_height;
+	if (glyph.resident)
+		glyph_slots.erase(glyph.codepoint);
+
+	auto slot = unsigned(&glyph - glyphs.data());
+	glyph.codepoint = codepoint;
+	glyph.generation++;
+	glyph.resident = true;
+	rasterize_glyph(glyph);
+	glyph_slots[codepoint] = slot;
+	dirty_slots.push_back(slot);
+	touch_glyph(slot);
+	return &glyph;
+}
 
-	vec2 cached = off;
-	vec2 minimum = vec2(FLT_MAX);
-	vec2 maximum = vec2(-FLT_MAX);
+void Font::build_layout(TextLayout &layout, const char *text, float scale) const
+{
+	layout.quads.clear();
+	layout.complete = true;
+
+	float line_y = float(font_height);
+	vec2 pen = vec2(0.0f, line_y);
+	float max_x = 0.0f;
+	vec2 min_rect = vec2(FLT_MAX);
+	vec2 max_rect = vec2(-FLT_MAX);
 
 	while (*text)
 	{
-		stbtt_aligned_quad q;
-		if (*text == '\n')
+		uint32_t codepoint = decode_utf8(text);
+		if (codepoint == '\n')
 		{
-			cached.y += font_height;
-			off = cached;
+			line_y += float(font_height);
+			pen = vec2(0.0f, line_y);
+			continue;
 		}
-		else if (*text >= 32)
+		else if (codepoint < 32)
+			continue;
+
+		auto *glyph = request_glyph(codepoint);
+		if (!glyph)
 		{
-			stbtt_GetBakedQuad(baked_chars, width, height, *text - 32, &off.x, &off.y, &q, 1);
-			minimum = min(minimum, vec2(q.x0, q.y0));
-			minimum = min(minimum, vec2(q.x1, q.y1));
-			maximum = max(maximum, vec2(q.x0, q.y0));
-			maximum = max(maximum, vec2(q.x1, q.y1));
+			layout.complete = false;
+			continue;
 		}
-		text++;
+
+		// Snap to pixels like stbtt_GetBakedQuad.
+		vec2 pos = floor(pen + vec2(glyph->offset) + 0.5f);
+		max_x = muglm::max(max_x, pos.x + float(glyph->size.x));
+
+		if (glyph->size.x > 0 && glyph->size.y > 0)
+		{
+			LayoutQuad quad;
+			quad.pos_offset = pos * scale;
+			quad.pos_scale = vec2(glyph->size) * scale;
+			quad.tex_offset = vec2(glyph->tex_offset);
+			quad.tex_scale = vec2(glyph->size);
+			quad.slot = unsigned(glyph - glyphs.data());
+			quad.generation = glyph->generation;
+			layout.quads.push_back(quad);
+
+			min_rect = min(min_rect, quad.pos_offset);
+			max_rect = max(max_rect, quad.pos_offset + quad.pos_scale);
+		}
+
+		pen.x += glyph->advance;
+	}
+
+	if (layout.quads.empty())
+	{
+		min_rect = vec2(0.0f);
+		max_rect = vec2(0.0f);
+	}
+
+	layout.geometry = ceil(vec2(max_x, line_y) * scale);
+	layout.min_rect = min_rect;
+	layout.max_rect = max_rect;
+}
+
+bool Font::layout_is_resident(const TextLayout &layout) const
+{
+	// Only glyphs which are drawn matter. Glyph metrics do not depend on the slot,
+	// so evicting e.g. a space does not change the layout.
+	for (auto &quad : layout.quads)
+		if (glyphs[quad.slot].generation != quad.generation)
+			return false;
+	return true;
+}
+
+const Font::TextLayout &Font::request_layout(const char *text, float scale) const
+{
+	// Prune before looking up, so the returned layout stays alive until the next request.
+	layout_cache.prune();
+
+	Hasher hasher;
+	hasher.string(text);
+	hasher.f32(scale);
+	auto key = hasher.get();
+
+	auto *layout = layout_cache.find_and_mark_as_recent(key);
+	if (layout && layout->complete && layout_is_resident(*layout))
+	{
+		for (auto &quad : layout->quads)
+			touch_glyph(quad.slot);
+		return *layout;
 	}
 
-	return ceil(vec2(maximum.x, cached.y));
+	// The byte count is an upper bound for the number of quads.
+	layout = layout_cache.allocate(key, strlen(text));
+	build_layout(*layout, text, scale);
+	return *layout;
+}
+
+vec2 Font::get_text_geometry(const char *text, float scale) const
+{
+	if (!*text)
+		return vec2(0);
+
+	lock_guard<mutex> holder{lock};
+	return request_layout(text, scale).geometry;
 }
 
 vec2 Font::get_aligned_offset(Alignment alignment, vec2 text_geometry, vec2 target_geometry) const
@@ -161,65 +391,53 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 	if (!*text)
 		return;
 
-	vec2 geometry = get_text_geometry(text, scale);
-	vec2 alignment_offset = get_aligned_offset(alignment, geometry, size);
+	lock_guard<mutex> holder{lock};
+	auto &layout = request_layout(text, scale);
+	flush_glyph_uploads();
+
+	if (layout.quads.empty())
+		return;
+
+	vec2 alignment_offset = get_aligned_offset(alignment, layout.geometry, size);
+	vec2 base = offset.xy() + alignment_offset;
 
-	size_t len = strlen(text);
 	SpriteRenderInfo sprite;
 	sprite.textures[0] = &texture->get_view();
-	sprite.sampler = StockSampler::LinearWrap;
+	sprite.sampler = StockSampler::LinearClamp;
 
+	auto count = unsigned(layout.quads.size());
 	auto *instance_data = queue.allocate_one<SpriteInstanceInfo>();
-	auto *quads = queue.allocate_many<QuadData>(len);
+	auto *quads = queue.allocate_many<QuadData>(count);
 	instance_data->quads = quads;
-	instance_data->count = 0; // Will be accumulated in the loop.
-
-	vec2 off = offset.xy();
-	off.y += font_height;
-	vec2 cached = off;
+	instance_data->count = count;
 
-	vec2 min_rect = vec2(FLT_MAX);
-	vec2 max_rect = vec2(-FLT_MAX);
+	uint8_t quantized_color[4];
+	quantize_color(quantized_color, color);
 
-	while (*text)
+	for (unsigned i = 0; i < count; i++)
 	{
-		stbtt_aligned_quad q;
-		if (*text == '\n')
-		{
-			cached.y += font_height;
-			off = cached;
-		}
-		else if (*text >= 32)
-		{
-			stbtt_GetBakedQuad(baked_chars, width, height, *text - 32, &off.x, &off.y, &q, 1);
-
-			q.x0 += alignment_offset.x;
-			q.x1 += alignment_offset.x;
-			q.y0 += alignment_offset.y;
-			q.y1 += alignment_offset.y;
-
-			auto &quad = quads[instance_data->count++];
-			quantize_color(quad.color, color);
-			quad.rotation[0] = 1.0f;
-			quad.rotation[1] = 0.0f;
-			quad.rotation[2] = 0.0f;
-			quad.rotation[3] = 1.0f;
-			quad.layer = offset.z;
-			quad.pos_off_x = q.x0;
-			quad.pos_off_y = q.y0;
-			quad.pos_scale_x = q.x1 - q.x0;
-			quad.pos_scale_y = q.y1 - q.y0;
-			quad.tex_off_x = muglm::round(q.s0 * width);
-			quad.tex_off_y = muglm::round(q.t0 * height);
-			quad.tex_scale_x = muglm::round(q.s1 * width) - quad.tex_off_x;
-			quad.tex_scale_y = muglm::round(q.t1 * height) - quad.tex_off_y;
-
-			max_rect = max(max_rect, vec2(q.x1, q.y1));
-			min_rect = min(min_rect, vec2(q.x0, q.y0));
-		}
-		text++;
+		auto &glyph = layout.quads[i];
+		auto &quad = quads[i];
+		memcpy(quad.color, quantized_color, sizeof(quantized_color));
+		quad.rotation[0] = 1.0f;
+		quad.rotation[1] = 0.0f;
+		quad.rotation[2] = 0.0f;
+		quad.rotation[3] = 1.0f;
+		quad.layer = offset.z;
+		quad.array_layer = 0.0f;
+		quad.blend_factor = 0.0f;
+		quad.pos_off_x = base.x + glyph.pos_offset.x;
+		quad.pos_off_y = base.y + glyph.pos_offset.y;
+		quad.pos_scale_x = glyph.pos_scale.x;
+		quad.pos_scale_y = glyph.pos_scale.y;
+		quad.tex_off_x = glyph.tex_offset.x;
+		quad.tex_off_y = glyph.tex_offset.y;
+		quad.tex_scale_x = glyph.tex_scale.x;
+		quad.tex_scale_y = glyph.tex_scale.y;
 	}
 
+	vec2 min_rect = base + layout.min_rect;
+	vec2 max_rect = base + layout.max_rect;
 	if (any(lessThan(min_rect, clip_offset)) || any(greaterThan(max_rect, clip_offset + clip_size)))
 		sprite.clip_quad = ivec4(ivec2(clip_offset), ivec2(clip_size));
 
@@ -241,31 +459,71 @@ void Font::render_text(RenderQueue &queue, const char *text, const vec3 &offset,
 
 	if (sprite_data)
 	{
+		Sprite::ShaderVariantFlags variant = glyph_type == GlyphType::DistanceField ?
+		                                     Sprite::DISTANCE_FIELD_TEXTURE_BIT : Sprite::ALPHA_TEXTURE_BIT;
 		sprite.program = queue.get_shader_suites()[ecast(RenderableType::Sprite)].get_program(DrawPipeline::AlphaBlend,
 		                                                                                      MESH_ATTRIBUTE_UV_BIT |
 		                                                                                      MESH_ATTRIBUTE_POSITION_BIT |
 		                                                                                      MESH_ATTRIBUTE_VERTEX_COLOR_BIT,
 		                                                                                      MATERIAL_TEXTURE_BASE_COLOR_BIT,
-		                                                                                      Sprite::ALPHA_TEXTURE_BIT);
+		                                                                                      variant);
 
 		*sprite_data = sprite;
 	}
 }
 
+void Font::flush_glyph_uploads() const
+{
+	if (dirty_slots.empty() || !device || !texture)
+		return;
+
+	auto cmd = device->request_command_buffer();
+	cmd->image_barrier(*texture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	// Upload entire slots, so nothing of an evicted glyph remains.
+	const VkImageSubresourceLayers subresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	const VkExtent3D extent = { cell_width - 2, cell_height - 2, 1 };
+	for (auto slot : dirty_slots)
+	{
+		auto &glyph = glyphs[slot];
+		const VkOffset3D image_offset = { int32_t(glyph.tex_offset.x), int32_t(glyph.tex_offset.y), 0 };
+		auto *dst = static_cast<uint8_t *>(cmd->update_image(*texture, image_offset, extent,
+		                                                     extent.width, extent.height, subresource));
+		const uint8_t *src = bitmap.data() + glyph.tex_offset.y * width + glyph.tex_offset.x;
+		for (unsigned y = 0; y < extent.height; y++)
+			memcpy(dst + y * extent.width, src + y * width, extent.width);
+	}
+
+	cmd->image_barrier(*texture, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	device->submit(cmd);
+	dirty_slots.clear();
+}
+
 void Font::on_device_created(const DeviceCreatedEvent &created)
 {
-	auto &device = created.get_device();
+	lock_guard<mutex> holder{lock};
+	device = &created.get_device();
 
 	ImageCreateInfo info = ImageCreateInfo::immutable_2d_image(width, height, VK_FORMAT_R8_UNORM, false);
+	info.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	ImageInitialData initial = {};
 	initial.data = bitmap.data();
-	texture = device.create_image(info, &initial);
-	device.set_name(*texture, "font");
+	texture = device->create_image(info, &initial);
+	device->set_name(*texture, "font");
+
+	// The whole atlas was just uploaded.
+	dirty_slots.clear();
 }
 
 void Font::on_device_destroyed(const DeviceCreatedEvent &)
 {
+	lock_guard<mutex> holder{lock};
 	texture.reset();
+	device = nullptr;
 }
 
 }
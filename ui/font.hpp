@@ -26,13 +26,30 @@
 #include "renderer.hpp"
 #include "render_queue.hpp"
 #include "event.hpp"
+#include "intrusive_list.hpp"
+#include "lru_cache.hpp"
+#include <mutex>
+#include <unordered_map>
 
 namespace Granite
 {
+class FrameTickEvent;
+
+// Glyphs are rasterized on demand into a fixed grid of atlas slots, so any codepoint in the font can be rendered.
+// Text is UTF-8. When the atlas is full, the least recently used glyph which has not been used this frame is evicted.
+// Laid out strings are cached, so rendering static text does not need to look up glyphs again.
 class Font : public EventHandler
 {
 public:
-	Font(const std::string &path, unsigned size);
+	enum class GlyphType
+	{
+		// Plain coverage, best quality at the native size.
+		Bitmap,
+		// Signed distance field, which stays sharp when text is scaled up.
+		DistanceField
+	};
+
+	Font(const std::string &path, unsigned size, GlyphType type = GlyphType::Bitmap);
 
 	enum class Alignment
 	{
@@ -58,14 +75,79 @@ public:
 
 	vec2 get_aligned_offset(Alignment alignment, vec2 text_geometry, vec2 target_geometry) const;
 
+	// Upper bound for the number of glyph quads kept in the text layout cache.
+	void set_layout_cache_size(unsigned num_glyphs);
+
 private:
+	enum { AtlasColumns = 32, AtlasRows = 16 };
+
+	struct Glyph : Util::IntrusiveListEnabled<Glyph>
+	{
+		uint32_t codepoint = 0;
+		uint64_t last_frame = 0;
+		// Position of the bitmap relative to the pen, and its size in pixels.
+		ivec2 offset = ivec2(0);
+		ivec2 size = ivec2(0);
+		uvec2 tex_offset = uvec2(0);
+		float advance = 0.0f;
+		// Bumped every time the slot is given to another codepoint.
+		uint32_t generation = 0;
+		bool resident = false;
+	};
+
+	struct LayoutQuad
+	{
+		vec2 pos_offset;
+		vec2 pos_scale;
+		vec2 tex_offset;
+		vec2 tex_scale;
+		unsigned slot;
+		// Generation of the slot when the quad was built. The quad is stale if the slot has moved on since.
+		uint32_t generation;
+	};
+
+	// Quads are relative to the top-left of the text, before alignment.
+	struct TextLayout
+	{
+		std::vector<LayoutQuad> quads;
+		vec2 geometry = vec2(0.0f);
+		vec2 min_rect = vec2(0.0f);
+		vec2 max_rect = vec2(0.0f);
+		bool complete = false;
+	};
+
+	Vulkan::Device *device = nullptr;
 	Vulkan::ImageHandle texture;
-	stbtt_bakedchar baked_chars[128 - 32];
 	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
 	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+	bool on_frame_tick(const FrameTickEvent &e);
+
+	std::vector<uint8_t> font_data;
+	stbtt_fontinfo font_info = {};
+	float font_scale = 0.0f;
+	GlyphType glyph_type;
+	int sdf_padding = 0;
 
-	std::vector<uint8_t> bitmap;
+	mutable std::vector<uint8_t> bitmap;
 	unsigned width = 0, height = 0;
+	unsigned cell_width = 0, cell_height = 0;
 	unsigned font_height = 0;
+
+	mutable std::mutex lock;
+	mutable std::vector<Glyph> glyphs;
+	mutable Util::IntrusiveList<Glyph> glyph_lru;
+	mutable std::unordered_map<uint32_t, unsigned> glyph_slots;
+	mutable std::vector<unsigned> dirty_slots;
+	mutable Util::LRUCache<TextLayout> layout_cache;
+	uint64_t frame = 1;
+	mutable bool warned_atlas_full = false;
+
+	const Glyph *request_glyph(uint32_t codepoint) const;
+	void rasterize_glyph(Glyph &glyph) const;
+	void touch_glyph(unsigned slot) const;
+	bool layout_is_resident(const TextLayout &layout) const;
+	const TextLayout &request_layout(const char *text, float scale) const;
+	void build_layout(TextLayout &layout, const char *text, float scale) const;
+	void flush_glyph_uploads() const;
 };
-}
\ No newline at end of file
+}
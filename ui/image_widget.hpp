@@ -39,6 +39,7 @@ public:
 	void set_keep_aspect_ratio(bool enable)
 	{
 		keep_aspect = enable;
+		geometry_changed();
 	}
 
 	bool get_keep_aspect_ratio() const
@@ -49,6 +50,7 @@ public:
 	void set_filter(Vulkan::StockSampler sampler_)
 	{
 		sampler = sampler_;
+		needs_redraw = true;
 	}
 
 	void reconfigure() override;
@@ -57,6 +57,7 @@ public:
 	void set_color(vec4 color_)
 	{
 		color = color_;
+		needs_redraw = true;
 	}
 
 	vec4 get_color() const
@@ -33,6 +33,7 @@ namespace UI
 void Slider::set_text(string text_)
 {
 	text = move(text_);
+	geometry_changed();
 }
 
 void Slider::reconfigure()
@@ -79,6 +80,7 @@ void Slider::set_range(float minimum, float maximum)
 	value_minimum = minimum;
 	value_maximum = maximum;
 	value = mix(value_minimum, value_maximum, normalized_value);
+	geometry_changed();
 	if (value_cb)
 		value_cb(value);
 }
@@ -195,6 +197,7 @@ void Slider::on_mouse_button_move(vec2 offset)
 void Slider::on_mouse_button_released(vec2)
 {
 	displaying_tooltip = false;
+	needs_redraw = true;
 }
 
 float Slider::render(FlatRenderer &renderer, float layer, vec2 offset, vec2)
@@ -73,7 +73,8 @@ struct Sprite : AbstractRenderable
 		LUMA_TO_ALPHA_BIT = 1 << 2,
 		CLEAR_ALPHA_TO_ZERO_BIT = 1 << 3,
 		ALPHA_TEXTURE_BIT = 1 << 4,
-		ARRAY_TEXTURE_BIT = 1 << 5
+		ARRAY_TEXTURE_BIT = 1 << 5,
+		DISTANCE_FIELD_TEXTURE_BIT = 1 << 6
 	};
 	using ShaderVariantFlags = uint32_t;
 
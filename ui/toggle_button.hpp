@@ -43,16 +43,19 @@ public:
 	void set_label_alignment(Font::Alignment alignment_)
 	{
 		alignment = alignment_;
+		needs_redraw = true;
 	}
 
 	void set_untoggled_font_color(vec4 color)
 	{
 		this->untoggled_color = color;
+		needs_redraw = true;
 	}
 
 	void set_toggled_font_color(vec4 color)
 	{
 		this->toggled_color = color;
+		needs_redraw = true;
 	}
 
 	void on_toggle(std::function<void (bool)> cb)
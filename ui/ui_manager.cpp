@@ -31,6 +31,17 @@ namespace UI
 {
 UIManager::UIManager()
 {
+	EVENT_MANAGER_REGISTER_LATCH(UIManager, on_device_created, on_device_destroyed, Vulkan::DeviceCreatedEvent);
+}
+
+void UIManager::on_device_created(const Vulkan::DeviceCreatedEvent &)
+{
+}
+
+// Recorded windows hold on to images and views, which must not outlive the device.
+void UIManager::on_device_destroyed(const Vulkan::DeviceCreatedEvent &)
+{
+	retained_windows.clear();
 }
 
 void UIManager::add_child(WidgetHandle handle)
@@ -41,6 +52,14 @@ void UIManager::add_child(WidgetHandle handle)
 void UIManager::reset_children()
 {
 	widgets.clear();
+	retained_windows.clear();
+}
+
+void UIManager::set_retained_mode(bool enable)
+{
+	retained_mode = enable;
+	if (!retained_mode)
+		retained_windows.clear();
 }
 
 void UIManager::remove_child(Widget *widget)
@@ -49,6 +68,7 @@ void UIManager::remove_child(Widget *widget)
 		return handle.get() == widget;
 	});
 	widgets.erase(itr, end(widgets));
+	retained_windows.erase(widget);
 }
 
 void UIManager::render(Vulkan::CommandBuffer &cmd)
@@ -64,7 +84,7 @@ void UIManager::render(Vulkan::CommandBuffer &cmd)
 		if (!window->get_visible())
 			continue;
 
-		widget->reconfigure_geometry();
+		widget->reconfigure_geometry(retained_mode);
 
 		vec2 window_size;
 		vec2 window_pos;
@@ -74,21 +94,50 @@ void UIManager::render(Vulkan::CommandBuffer &cmd)
 			window_size.x = cmd.get_viewport().width;
 			window_size.y = cmd.get_viewport().height;
 			widget->reconfigure_geometry_to_canvas(vec2(0.0f),
-			                                       vec2(cmd.get_viewport().width, cmd.get_viewport().height));
+			                                       vec2(cmd.get_viewport().width, cmd.get_viewport().height),
+			                                       retained_mode);
 			window_pos = vec2(0.0f);
 		}
 		else
 		{
-			widget->reconfigure_geometry_to_canvas(window->get_floating_position(), window->get_minimum_geometry());
+			widget->reconfigure_geometry_to_canvas(window->get_floating_position(), window->get_minimum_geometry(), retained_mode);
 			window_size = max(widget->get_target_geometry(), widget->get_minimum_geometry());
 			window_pos = window->get_floating_position();
 		}
 
-		renderer.push_scissor(window->get_floating_position(), window_size);
-		float min_layer = widget->render(renderer, minimum_layer, window_pos, window_size);
-		renderer.pop_scissor();
+		if (!retained_mode)
+		{
+			renderer.push_scissor(window->get_floating_position(), window_size);
+			float min_layer = widget->render(renderer, minimum_layer, window_pos, window_size);
+			renderer.pop_scissor();
+			minimum_layer = min(min_layer, minimum_layer);
+			continue;
+		}
+
+		auto &retained = retained_windows[widget.get()];
+		bool dirty = widget->get_needs_redraw() ||
+		             !retained.valid ||
+		             any(notEqual(retained.position, window_pos)) ||
+		             any(notEqual(retained.size, window_size));
+
+		if (dirty)
+		{
+			renderer.begin_recording(retained.list);
+			renderer.push_scissor(window->get_floating_position(), window_size);
+			retained.minimum_layer = widget->render(renderer, minimum_layer, window_pos, window_size);
+			renderer.pop_scissor();
+			renderer.end_recording();
+
+			retained.position = window_pos;
+			retained.size = window_size;
+			retained.layer = minimum_layer;
+			retained.valid = true;
+			widget->clear_needs_redraw();
+		}
+		else
+			renderer.replay(retained.list, minimum_layer - retained.layer);
 
-		minimum_layer = min(min_layer, minimum_layer);
+		minimum_layer = min(retained.minimum_layer + (minimum_layer - retained.layer), minimum_layer);
 	}
 
 	renderer.flush(cmd, vec3(0.0f, 0.0f, minimum_layer),
@@ -216,8 +265,8 @@ bool UIManager::filter_input_event(const MouseButtonEvent &e)
 		auto *window = static_cast<Window *>(widget.get());
 		if (!window->get_visible())
 			continue;
-		widget->reconfigure_geometry();
-		widget->reconfigure_geometry_to_canvas(window->get_floating_position(), window->get_minimum_geometry());
+		widget->reconfigure_geometry(retained_mode);
+		widget->reconfigure_geometry_to_canvas(window->get_floating_position(), window->get_minimum_geometry(), retained_mode);
 
 		vec2 pos(e.get_abs_x(), e.get_abs_y());
 		vec2 window_pos = pos - window->get_floating_position();
@@ -26,6 +26,7 @@
 #include "widget.hpp"
 #include "flat_renderer.hpp"
 #include "input.hpp"
+#include <unordered_map>
 
 namespace Granite
 {
@@ -70,7 +71,15 @@ public:
 	void reset_children();
 	void remove_child(Widget *widget);
 
+	// In retained mode, windows which have not changed since they were last rendered
+	// replay their recorded draw calls instead of being laid out and rendered again.
+	// Widgets must mark themselves with needs_redraw or geometry_changed() on any visual change.
+	void set_retained_mode(bool enable);
+
 private:
+	void on_device_created(const Vulkan::DeviceCreatedEvent &e);
+	void on_device_destroyed(const Vulkan::DeviceCreatedEvent &e);
+
 	FlatRenderer renderer;
 	std::vector<WidgetHandle> widgets;
 	std::unique_ptr<Font> fonts[Util::ecast(FontSize::Count)];
@@ -80,6 +89,18 @@ private:
 	vec2 drag_receiver_base = vec2(0.0f);
 
 	unsigned touch_emulation_id = ~0u;
+
+	struct RetainedWindow
+	{
+		FlatDisplayList list;
+		vec2 position;
+		vec2 size;
+		float layer;
+		float minimum_layer;
+		bool valid = false;
+	};
+	std::unordered_map<const Widget *, RetainedWindow> retained_windows;
+	bool retained_mode = false;
 };
 }
 }
@@ -99,6 +99,7 @@ Util::IntrusivePtr<Widget> Widget::remove_child(const Widget &widget)
 	auto res = itr->widget;
 	children.erase(itr);
 	res->parent = nullptr;
+	geometry_changed();
 	return res;
 }
 
@@ -109,34 +110,52 @@ bool Widget::get_needs_redraw() const
 
 	for (auto &child : children)
 	{
-		if (child.widget->needs_redraw)
+		if (child.widget->get_needs_redraw())
 			return true;
 	}
 
 	return false;
 }
 
+void Widget::clear_needs_redraw()
+{
+	needs_redraw = false;
+	for (auto &child : children)
+		child.widget->clear_needs_redraw();
+}
+
 void Widget::geometry_changed()
 {
 	needs_redraw = true;
 	needs_reconfigure = true;
+	needs_canvas_reconfigure = true;
 	if (parent)
 		parent->geometry_changed();
 }
 
-void Widget::reconfigure_geometry()
+void Widget::reconfigure_geometry(bool incremental)
 {
+	// Anything which changes geometry below us also marks us through geometry_changed().
+	if (incremental && !needs_reconfigure)
+		return;
+
 	for (auto &child : children)
-		child.widget->reconfigure_geometry();
+		child.widget->reconfigure_geometry(incremental);
 	reconfigure();
 	needs_reconfigure = false;
 }
 
-void Widget::reconfigure_geometry_to_canvas(vec2 offset, vec2 size)
+void Widget::reconfigure_geometry_to_canvas(vec2 offset, vec2 size, bool incremental)
 {
+	if (incremental && !needs_canvas_reconfigure && all(equal(offset, canvas_offset)) && all(equal(size, canvas_size)))
+		return;
+
+	canvas_offset = offset;
+	canvas_size = size;
+	needs_canvas_reconfigure = false;
 	reconfigure_to_canvas(offset, size);
 	for (auto &child : children)
-		child.widget->reconfigure_geometry_to_canvas(child.offset + offset, child.size);
+		child.widget->reconfigure_geometry_to_canvas(child.offset + offset, child.size, incremental);
 }
 }
 }
\ No newline at end of file
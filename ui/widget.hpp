@@ -135,9 +135,14 @@ public:
 		needs_redraw = true;
 	}
 
+	// Checks this widget and every widget below it.
 	bool get_needs_redraw() const;
-	void reconfigure_geometry();
-	void reconfigure_geometry_to_canvas(vec2 offset, vec2 size);
+	void clear_needs_redraw();
+
+	// If incremental, only subtrees which changed since the last call are reconfigured.
+	// This relies on every widget calling geometry_changed() when its layout changes.
+	void reconfigure_geometry(bool incremental = false);
+	void reconfigure_geometry_to_canvas(vec2 offset, vec2 size, bool incremental = false);
 
 	virtual float render(FlatRenderer & /* renderer */, float layer, vec2 /* offset */, vec2 /* size */)
 	{
@@ -205,7 +210,10 @@ protected:
 		Util::IntrusivePtr<Widget> widget;
 	};
 	std::vector<Child> children;
-	bool needs_reconfigure = false;
+	bool needs_reconfigure = true;
+	bool needs_canvas_reconfigure = true;
+	vec2 canvas_offset = vec2(0.0f);
+	vec2 canvas_size = vec2(0.0f);
 
 	virtual void reconfigure() = 0;
 	virtual void reconfigure_to_canvas(vec2 offset, vec2 size) = 0;
@@ -0,0 +1,256 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpu_trace.hpp"
+#include "message_queue.hpp"
+#include "timer.hpp"
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string.h>
+
+using namespace std;
+
+namespace Util
+{
+std::atomic<bool> CPUTrace::enabled;
+
+namespace
+{
+struct ThreadTraceBuffer
+{
+	enum { RingSize = 16 * 1024 };
+
+	explicit ThreadTraceBuffer(unsigned index_)
+		: index(index_)
+	{
+		ring.reset(RingSize);
+		owned.store(true, memory_order_relaxed);
+	}
+
+	LockFreeRingBuffer<TraceEvent> ring;
+	unsigned index;
+	char name[32] = {};
+	atomic<bool> owned;
+};
+
+struct TraceRegistry
+{
+	TraceRegistry()
+	{
+		flow_counter.store(0, memory_order_relaxed);
+		dropped_events.store(0, memory_order_relaxed);
+	}
+
+	mutex lock;
+	vector<unique_ptr<ThreadTraceBuffer>> buffers;
+	vector<TraceEvent> drain_events;
+
+	// Begin events of zones which have not ended yet, per buffer. Zones can span several drains.
+	vector<vector<TraceEvent>> open_zones;
+	atomic<uint64_t> flow_counter;
+	atomic<uint64_t> dropped_events;
+};
+
+TraceRegistry &get_registry()
+{
+	static TraceRegistry registry;
+	return registry;
+}
+
+// Buffers of threads which have exited are handed to the next thread which starts tracing.
+struct ThreadTraceBufferHolder
+{
+	~ThreadTraceBufferHolder()
+	{
+		if (buffer)
+			buffer->owned.store(false, memory_order_release);
+	}
+
+	ThreadTraceBuffer *buffer = nullptr;
+	char name[32] = {};
+};
+thread_local ThreadTraceBufferHolder thread_buffer;
+
+ThreadTraceBuffer *get_thread_buffer()
+{
+	if (thread_buffer.buffer)
+		return thread_buffer.buffer;
+
+	auto &registry = get_registry();
+	lock_guard<mutex> holder{registry.lock};
+
+	// Only take over drained buffers, so events are not attributed to the wrong thread.
+	for (auto &buffer : registry.buffers)
+	{
+		if (!buffer->owned.load(memory_order_acquire) && buffer->ring.read_avail() == 0)
+		{
+			buffer->owned.store(true, memory_order_relaxed);
+			memcpy(buffer->name, thread_buffer.name, sizeof(buffer->name));
+			if (buffer->index < registry.open_zones.size())
+				registry.open_zones[buffer->index].clear();
+			thread_buffer.buffer = buffer.get();
+			return thread_buffer.buffer;
+		}
+	}
+
+	registry.buffers.emplace_back(new ThreadTraceBuffer(unsigned(registry.buffers.size())));
+	thread_buffer.buffer = registry.buffers.back().get();
+	memcpy(thread_buffer.buffer->name, thread_buffer.name, sizeof(thread_buffer.buffer->name));
+	return thread_buffer.buffer;
+}
+}
+
+void CPUTrace::set_enabled(bool enable)
+{
+	enabled.store(enable, memory_order_relaxed);
+}
+
+void CPUTrace::record(const char *name, uint64_t flow_id, TraceEventType type)
+{
+	auto *buffer = get_thread_buffer();
+	TraceEvent event = { get_current_time_nsecs(), name, flow_id, type };
+	if (!buffer->ring.write_and_move(event))
+		get_registry().dropped_events.fetch_add(1, memory_order_relaxed);
+}
+
+void CPUTrace::begin_zone(const char *name)
+{
+	record(name, 0, TraceEventType::Begin);
+}
+
+void CPUTrace::end_zone()
+{
+	record(nullptr, 0, TraceEventType::End);
+}
+
+uint64_t CPUTrace::allocate_flow_id()
+{
+	if (!is_enabled())
+		return 0;
+	return get_registry().flow_counter.fetch_add(1, memory_order_relaxed) + 1;
+}
+
+void CPUTrace::flow_start(uint64_t id)
+{
+	if (id && is_enabled())
+		record(nullptr, id, TraceEventType::FlowStart);
+}
+
+void CPUTrace::flow_end(uint64_t id)
+{
+	if (id && is_enabled())
+		record(nullptr, id, TraceEventType::FlowEnd);
+}
+
+void CPUTrace::set_thread_name(const char *name)
+{
+	// The ring buffer is only allocated once the thread records something.
+	strncpy(thread_buffer.name, name, sizeof(thread_buffer.name) - 1);
+	thread_buffer.name[sizeof(thread_buffer.name) - 1] = '\0';
+
+	if (thread_buffer.buffer)
+	{
+		lock_guard<mutex> holder{get_registry().lock};
+		memcpy(thread_buffer.buffer->name, thread_buffer.name, sizeof(thread_buffer.buffer->name));
+	}
+}
+
+uint64_t CPUTrace::get_num_dropped_events()
+{
+	return get_registry().dropped_events.load(memory_order_relaxed);
+}
+
+void CPUTrace::drain(const DrainCallback &func)
+{
+	auto &registry = get_registry();
+	lock_guard<mutex> holder{registry.lock};
+
+	for (auto &buffer : registry.buffers)
+	{
+		size_t count = buffer->ring.read_avail();
+		if (!count)
+			continue;
+
+		registry.drain_events.resize(count);
+		buffer->ring.read_and_move(registry.drain_events.data(), count);
+		func(buffer->index, buffer->name, registry.drain_events.data(), count);
+	}
+}
+
+void CPUTrace::write_json_events(FILE *file, int64_t origin_ns, unsigned pid)
+{
+	auto &registry = get_registry();
+
+	// Zones are written as complete events once they end, so a zone which is open across drains
+	// is still written as one event, and an End whose Begin was dropped cannot unbalance the trace.
+	drain([&](unsigned thread_index, const char *thread_name, const TraceEvent *events, size_t count) {
+		if (thread_index >= registry.open_zones.size())
+			registry.open_zones.resize(thread_index + 1);
+		auto &open_zones = registry.open_zones[thread_index];
+
+		char tid[64];
+		if (*thread_name != '\0')
+			snprintf(tid, sizeof(tid), "CPU %s", thread_name);
+		else
+			snprintf(tid, sizeof(tid), "CPU thread %u", thread_index);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			auto &e = events[i];
+			double ts = 1e-3 * double(e.timestamp_ns - origin_ns);
+
+			switch (e.type)
+			{
+			case TraceEventType::Begin:
+				open_zones.push_back(e);
+				break;
+
+			case TraceEventType::End:
+			{
+				if (open_zones.empty())
+					break;
+
+				auto &begin = open_zones.back();
+				double begin_ts = 1e-3 * double(begin.timestamp_ns - origin_ns);
+				fprintf(file, "\t{ \"name\": \"%s\", \"ph\": \"X\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %.3f, \"dur\": %.3f },\n",
+				        begin.name, tid, pid, begin_ts, ts - begin_ts);
+				open_zones.pop_back();
+				break;
+			}
+
+			case TraceEventType::FlowStart:
+				fprintf(file, "\t{ \"name\": \"dependency\", \"cat\": \"flow\", \"ph\": \"s\", \"id\": %llu, "
+				              "\"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %.3f },\n",
+				        static_cast<unsigned long long>(e.flow_id), tid, pid, ts);
+				break;
+
+			case TraceEventType::FlowEnd:
+				fprintf(file, "\t{ \"name\": \"dependency\", \"cat\": \"flow\", \"ph\": \"f\", \"bp\": \"e\", \"id\": %llu, "
+				              "\"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %.3f },\n",
+				        static_cast<unsigned long long>(e.flow_id), tid, pid, ts);
+				break;
+			}
+		}
+	});
+}
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <functional>
+
+namespace Util
+{
+enum class TraceEventType : uint8_t
+{
+	Begin,
+	End,
+	FlowStart,
+	FlowEnd
+};
+
+struct TraceEvent
+{
+	// Nanoseconds in the same timebase as get_current_time_nsecs().
+	int64_t timestamp_ns;
+	// Must be a string literal, or otherwise outlive the trace.
+	const char *name;
+	uint64_t flow_id;
+	TraceEventType type;
+};
+
+// Scoped CPU trace zones which are recorded into per-thread lock-free ring buffers.
+// Recording can be toggled at runtime, and costs a single relaxed load when disabled.
+// Only one thread can drain events at a time, typically the thread which owns the trace output.
+class CPUTrace
+{
+public:
+	static void set_enabled(bool enable);
+
+	static bool is_enabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	static void begin_zone(const char *name);
+	static void end_zone();
+
+	// Flows link a zone on one thread to a zone on another thread, e.g. a task and its dependee.
+	// The flow binds to the zone which encloses the flow event.
+	static uint64_t allocate_flow_id();
+	static void flow_start(uint64_t id);
+	static void flow_end(uint64_t id);
+
+	// Name shows up as the thread name in the trace viewer. The name is copied.
+	static void set_thread_name(const char *name);
+
+	using DrainCallback = std::function<void (unsigned thread_index, const char *thread_name,
+	                                          const TraceEvent *events, size_t count)>;
+	static void drain(const DrainCallback &func);
+
+	// Drains all pending events and appends them to a Chrome trace JSON array.
+	// Timestamps are reported relative to origin_ns.
+	// Zones are written once they end, so a zone which is still open is written by a later call.
+	static void write_json_events(FILE *file, int64_t origin_ns, unsigned pid);
+
+	// Events which could not be recorded because a thread's ring buffer was full.
+	static uint64_t get_num_dropped_events();
+
+private:
+	static std::atomic<bool> enabled;
+	static void record(const char *name, uint64_t flow_id, TraceEventType type);
+};
+
+class CPUTraceZone
+{
+public:
+	explicit CPUTraceZone(const char *name)
+	{
+		if (CPUTrace::is_enabled())
+		{
+			CPUTrace::begin_zone(name);
+			active = true;
+		}
+	}
+
+	~CPUTraceZone()
+	{
+		if (active)
+			CPUTrace::end_zone();
+	}
+
+	CPUTraceZone(const CPUTraceZone &) = delete;
+	void operator=(const CPUTraceZone &) = delete;
+
+private:
+	bool active = false;
+};
+}
+
+#define GRANITE_CPU_TRACE_CONCAT_INNER(a, b) a##b
+#define GRANITE_CPU_TRACE_CONCAT(a, b) GRANITE_CPU_TRACE_CONCAT_INNER(a, b)
+#define GRANITE_CPU_TRACE_ZONE(name) ::Util::CPUTraceZone GRANITE_CPU_TRACE_CONCAT(cpu_trace_zone_, __LINE__)(name)
@@ -0,0 +1,192 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hash.hpp"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Util
+{
+// Modelled after the XXH3 long input loop: 64-byte stripes are accumulated into 8 lanes,
+// each lane adding a 32x32 -> 64-bit product of the data keyed with a secret.
+// The secret offset rotates per stripe so stripes are not interchangeable,
+// and the lanes are scrambled after every block of stripes.
+// The SSE2 and scalar paths compute identical results, so hashes can be persisted.
+static constexpr unsigned StripeSize = 64;
+static constexpr unsigned StripeLanes = StripeSize / sizeof(uint64_t);
+static constexpr unsigned StripesPerBlock = 16;
+
+static constexpr uint64_t Prime32_1 = 0x9e3779b1ull;
+static constexpr uint64_t Prime32_2 = 0x85ebca77ull;
+static constexpr uint64_t Prime32_3 = 0xc2b2ae3dull;
+static constexpr uint64_t Prime64_1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t Prime64_2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t Prime64_3 = 0x165667b19e3779f9ull;
+static constexpr uint64_t Prime64_4 = 0x85ebca77c2b2ae63ull;
+static constexpr uint64_t Prime64_5 = 0x27d4eb2f165667c5ull;
+
+// Stripe s uses secret[s % StripesPerBlock], the scramble uses the last StripeLanes entries.
+static const uint64_t secret[StripesPerBlock + StripeLanes] = {
+	0xa1efb4d6c54961faull, 0xb822bb847edd21a3ull, 0xd63774cc58175393ull, 0x2c6c4ff863b0df10ull,
+	0xc1a4a4bcf12f7a3full, 0x26612e96eb6a8240ull, 0x36ae077245920f97ull, 0xee03a5919f8a5486ull,
+	0x313955f4b89f82fbull, 0xeac0c3d0089cab66ull, 0x106aea73f99aa903ull, 0xba4579b286fad979ull,
+	0x23dbe040b7f9dc16ull, 0x44e3f71c96a99dd9ull, 0x5f1fff8e710a5703ull, 0xc559436dcf765920ull,
+	0x9143aefe5f4179ffull, 0x85433187752c47f4ull, 0xc92e8c3be1923707ull, 0x623dfd84dcc05d2cull,
+	0x7d971e65650bb518ull, 0x4b4d7a19ac4ec0b3ull, 0x810b442061e18c37ull, 0xb14f3a3b086c0f5cull,
+};
+
+#if defined(__SSE2__)
+static inline void accumulate_stripe(__m128i *acc, const uint8_t *data, const uint64_t *key)
+{
+	for (unsigned i = 0; i < StripeLanes / 2; i++)
+	{
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data) + i);
+		__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key) + i);
+		__m128i dk = _mm_xor_si128(d, k);
+		__m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+		acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, swapped));
+	}
+}
+
+static inline void scramble(__m128i *acc, const uint64_t *key)
+{
+	const __m128i prime = _mm_set1_epi32(int(Prime32_1));
+	for (unsigned i = 0; i < StripeLanes / 2; i++)
+	{
+		__m128i a = acc[i];
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i *>(key) + i));
+
+		// 64-bit multiply by a 32-bit constant.
+		__m128i lo = _mm_mul_epu32(a, prime);
+		__m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+		acc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+	}
+}
+#else
+static inline uint64_t read_u64(const uint8_t *data)
+{
+	uint64_t v;
+	memcpy(&v, data, sizeof(v));
+	return v;
+}
+
+static inline void accumulate_stripe(uint64_t *acc, const uint8_t *data, const uint64_t *key)
+{
+	for (unsigned i = 0; i < StripeLanes; i++)
+	{
+		uint64_t d = read_u64(data + i * sizeof(uint64_t));
+		uint64_t dk = d ^ key[i];
+		acc[i ^ 1] += d;
+		acc[i] += (dk & 0xffffffffu) * (dk >> 32);
+	}
+}
+
+static inline void scramble(uint64_t *acc, const uint64_t *key)
+{
+	for (unsigned i = 0; i < StripeLanes; i++)
+	{
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= key[i];
+		acc[i] = a * Prime32_1;
+	}
+}
+#endif
+
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t product = __uint128_t(a) * b;
+	return uint64_t(product) ^ uint64_t(product >> 64);
+#else
+	uint64_t a_lo = a & 0xffffffffu, a_hi = a >> 32;
+	uint64_t b_lo = b & 0xffffffffu, b_hi = b >> 32;
+	uint64_t lo_lo = a_lo * b_lo;
+	uint64_t hi_lo = a_hi * b_lo;
+	uint64_t lo_hi = a_lo * b_hi;
+	uint64_t hi_hi = a_hi * b_hi;
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffffu) + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (lo_lo & 0xffffffffu);
+	return lower ^ upper;
+#endif
+}
+
+Hash hash_bulk(const void *data_, size_t size)
+{
+	auto *data = static_cast<const uint8_t *>(data_);
+
+	// Short inputs are zero padded to a single stripe. The length is part of the final mix.
+	uint8_t padded[StripeSize];
+	if (size < StripeSize)
+	{
+		memset(padded, 0, sizeof(padded));
+		if (size)
+			memcpy(padded, data, size);
+		data = padded;
+	}
+	size_t padded_size = size < StripeSize ? StripeSize : size;
+
+	alignas(16) uint64_t lanes[StripeLanes] = {
+		Prime32_3, Prime64_1, Prime64_2, Prime64_3,
+		Prime64_4, Prime32_2, Prime64_5, Prime32_1,
+	};
+
+#if defined(__SSE2__)
+	__m128i acc[StripeLanes / 2];
+	for (unsigned i = 0; i < StripeLanes / 2; i++)
+		acc[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes) + i);
+#else
+	uint64_t *acc = lanes;
+#endif
+
+	// The last stripe is always handled separately, overlapping the previous one if need be.
+	size_t num_stripes = (padded_size - 1) / StripeSize;
+	for (size_t stripe = 0; stripe < num_stripes; stripe++)
+	{
+		unsigned index = unsigned(stripe % StripesPerBlock);
+		accumulate_stripe(acc, data + stripe * StripeSize, secret + index);
+		if (index == StripesPerBlock - 1)
+			scramble(acc, secret + StripesPerBlock);
+	}
+	accumulate_stripe(acc, data + padded_size - StripeSize, secret + 7);
+
+#if defined(__SSE2__)
+	for (unsigned i = 0; i < StripeLanes / 2; i++)
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes) + i, acc[i]);
+#endif
+
+	uint64_t h = uint64_t(size) * Prime64_1;
+	for (unsigned i = 0; i < StripeLanes; i += 2)
+		h += mul128_fold64(lanes[i] ^ secret[i + 3], lanes[i + 1] ^ secret[i + 4]);
+
+	h ^= h >> 37;
+	h *= 0x165667919e3779f9ull;
+	h ^= h >> 32;
+	return h;
+}
+}
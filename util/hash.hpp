@@ -22,12 +22,17 @@
 
 #pragma once
 #include <stdint.h>
+#include <string.h>
 #include <string>
 
 namespace Util
 {
 using Hash = uint64_t;
 
+// Vectorized hash of a block of memory, much faster than FNV-1 for large inputs.
+// Results are stable across platforms and can be persisted.
+Hash hash_bulk(const void *data, size_t size);
+
 class Hasher
 {
 public:
@@ -38,9 +43,19 @@ public:
 
 	Hasher() = default;
 
+	// data() and string() fold inputs of at least this many bytes in with hash_bulk().
+	// Changing how this is done changes persisted hashes, so caches on disk must be versioned.
+	enum { BulkThreshold = 128 };
+
 	template <typename T>
 	inline void data(const T *data_, size_t size)
 	{
+		if (size >= BulkThreshold)
+		{
+			u64(hash_bulk(data_, size));
+			return;
+		}
+
 		size /= sizeof(*data_);
 		for (size_t i = 0; i < size; i++)
 			h = (h * 0x100000001b3ull) ^ data_[i];
@@ -79,19 +94,24 @@ public:
 		u64(reinterpret_cast<uintptr_t>(ptr));
 	}
 
-	inline void string(const char *str)
+	inline void string(const char *str, size_t size)
 	{
-		char c;
 		u32(0xff);
-		while ((c = *str++) != '\0')
-			u32(uint8_t(c));
+		if (size >= BulkThreshold)
+			u64(hash_bulk(str, size));
+		else
+			for (size_t i = 0; i < size; i++)
+				u32(uint8_t(str[i]));
+	}
+
+	inline void string(const char *str)
+	{
+		string(str, strlen(str));
 	}
 
 	inline void string(const std::string &str)
 	{
-		u32(0xff);
-		for (auto &c : str)
-			u32(uint8_t(c));
+		string(str.data(), str.size());
 	}
 
 	inline Hash get() const
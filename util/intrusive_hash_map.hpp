@@ -26,9 +26,27 @@
 #include "intrusive_list.hpp"
 #include "object_pool.hpp"
 #include "read_write_lock.hpp"
+#include "bitops.hpp"
 #include <assert.h>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
 #include <vector>
 
+#if defined(__SANITIZE_THREAD__)
+#define GRANITE_HASH_MAP_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define GRANITE_HASH_MAP_TSAN 1
+#endif
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace Util
 {
 template <typename T>
@@ -307,7 +325,364 @@ private:
 	unsigned load_count = 0;
 };
 
+namespace Internal
+{
+// Probing helpers for tables with a control byte per slot, shared by
+// IntrusiveHashMapGroupedHolder and ConcurrentIntrusiveHashMap.
+// Full slots hold a 7-bit tag of the mixed hash, so Empty and Deleted are the only negative values.
+struct HashMapGroup
+{
+	enum { Size = 16 };
+	enum : int8_t { Empty = -128, Deleted = -2 };
+
+	// Keys are not necessarily well distributed (e.g. small integer IDs), so spread them out first.
+	static inline Hash mix_hash(Hash hash)
+	{
+		return hash * 0x9e3779b97f4a7c15ull;
+	}
+
+	static inline int8_t get_tag(Hash mixed)
+	{
+		return int8_t(mixed >> 57);
+	}
+
+#if !defined(__SSE2__) && defined(__ARM_NEON) && defined(__aarch64__)
+	static inline uint32_t movemask(uint8x16_t v)
+	{
+		static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+		uint8x16_t masked = vandq_u8(v, vld1q_u8(bits));
+		return uint32_t(vaddv_u8(vget_low_u8(masked))) | (uint32_t(vaddv_u8(vget_high_u8(masked))) << 8);
+	}
+#elif !defined(__SSE2__)
+	// Portable fallback works on 8 control bytes at a time (assumes little-endian).
+	static constexpr uint64_t LSBs = 0x0101010101010101ull;
+	static constexpr uint64_t MSBs = 0x8080808080808080ull;
+
+	// Gathers the MSB of every byte into an 8-bit mask.
+	static inline uint32_t pack_msbs(uint64_t v)
+	{
+		return uint32_t((((v >> 7) & LSBs) * 0x0102040810204080ull) >> 56);
+	}
+
+	template <typename Op>
+	static inline uint32_t swar_match(const int8_t *ctrl, const Op &op)
+	{
+		uint64_t lo, hi;
+		memcpy(&lo, ctrl, sizeof(lo));
+		memcpy(&hi, ctrl + 8, sizeof(hi));
+		return pack_msbs(op(lo)) | (pack_msbs(op(hi)) << 8);
+	}
+#endif
+
+	static inline uint32_t match_tag(const int8_t *ctrl, int8_t tag)
+	{
+#if defined(__SSE2__)
+		__m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+		return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		return movemask(vceqq_s8(vld1q_s8(ctrl), vdupq_n_s8(tag)));
+#else
+		// Classic zero byte test. It can report false positives, which are rejected by comparing the full hash.
+		uint64_t pattern = LSBs * uint8_t(tag);
+		return swar_match(ctrl, [pattern](uint64_t v) {
+			v ^= pattern;
+			return (v - LSBs) & ~v & MSBs;
+		});
+#endif
+	}
+
+	static inline uint32_t match_empty(const int8_t *ctrl)
+	{
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+		return match_tag(ctrl, Empty);
+#else
+		// Empty is the only control byte with the MSB set and bit 1 clear. Exact, unlike match_tag().
+		return swar_match(ctrl, [](uint64_t v) {
+			return v & ~(v << 6) & MSBs;
+		});
+#endif
+	}
+
+	// Empty and Deleted are the only negative control bytes.
+	static inline uint32_t match_free(const int8_t *ctrl)
+	{
+#if defined(__SSE2__)
+		return uint32_t(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		return movemask(vcltzq_s8(vld1q_s8(ctrl)));
+#else
+		return swar_match(ctrl, [](uint64_t v) {
+			return v & MSBs;
+		});
+#endif
+	}
+};
+}
+
+// Same interface as IntrusiveHashMapHolder, but probing does not touch the elements themselves.
+// Every slot has a control byte, either Empty, Deleted or 7 bits of the mixed hash.
+// Slots are probed 16 at a time by comparing control bytes, and an element is only dereferenced
+// when its tag matches, which is almost always the element we are looking for.
 template <typename T>
+class IntrusiveHashMapGroupedHolder
+{
+public:
+	enum { GroupSize = Internal::HashMapGroup::Size, InitialGroups = 1 };
+
+	T *find(Hash hash) const
+	{
+		size_t index;
+		if (controls.empty() || !find_slot_inner(hash, index))
+			return nullptr;
+		return values[index];
+	}
+
+	template <typename P>
+	bool find_and_consume_pod(Hash hash, P &p) const
+	{
+		T *t = find(hash);
+		if (t)
+		{
+			p = t->get();
+			return true;
+		}
+		else
+			return false;
+	}
+
+	// Same semantics as IntrusiveHashMapHolder::insert_yield.
+	T *insert_yield(T *&value)
+	{
+		size_t index;
+		if (find_slot(get_hash(value), index))
+		{
+			T *ret = value;
+			value = values[index];
+			return ret;
+		}
+
+		insert_at(index, value);
+		return nullptr;
+	}
+
+	T *insert_replace(T *value)
+	{
+		size_t index;
+		if (find_slot(get_hash(value), index))
+		{
+			std::swap(values[index], value);
+			list.erase(value);
+			list.insert_front(values[index]);
+			return value;
+		}
+
+		insert_at(index, value);
+		return nullptr;
+	}
+
+	T *erase(Hash hash)
+	{
+		size_t index;
+		if (controls.empty() || !find_slot_inner(hash, index))
+			return nullptr;
+
+		auto *value = values[index];
+		list.erase(value);
+		values[index] = nullptr;
+		count--;
+
+		// If the group still has an empty slot, no probe sequence can have continued past it,
+		// so the slot can become empty again rather than a tombstone.
+		if (Group::match_empty(controls.data() + (index & ~size_t(GroupSize - 1))))
+		{
+			controls[index] = Empty;
+			growth_left++;
+		}
+		else
+			controls[index] = Deleted;
+
+		return value;
+	}
+
+	void erase(T *value)
+	{
+		erase(get_hash(value));
+	}
+
+	void clear()
+	{
+		list.clear();
+		controls.clear();
+		values.clear();
+		group_mask = 0;
+		count = 0;
+		growth_left = 0;
+	}
+
+	typename IntrusiveList<T>::Iterator begin()
+	{
+		return list.begin();
+	}
+
+	typename IntrusiveList<T>::Iterator end()
+	{
+		return list.end();
+	}
+
+	IntrusiveList<T> &inner_list()
+	{
+		return list;
+	}
+
+private:
+	using Group = Internal::HashMapGroup;
+	enum : int8_t { Empty = Group::Empty, Deleted = Group::Deleted };
+
+	std::vector<int8_t> controls;
+	std::vector<T *> values;
+	IntrusiveList<T> list;
+	size_t group_mask = 0;
+	size_t count = 0;
+	size_t growth_left = 0;
+
+	inline Hash get_hash(const T *value) const
+	{
+		return static_cast<const IntrusiveHashMapEnabled<T> *>(value)->get_hash();
+	}
+
+	inline size_t get_group(Hash mixed) const
+	{
+		return size_t(mixed >> 32) & group_mask;
+	}
+
+	// Looks for an existing element, returning its index.
+	bool find_slot_inner(Hash hash, size_t &index) const
+	{
+		Hash mixed = Group::mix_hash(hash);
+		int8_t tag = Group::get_tag(mixed);
+		size_t group = get_group(mixed);
+
+		for (size_t step = 1; ; step++)
+		{
+			const int8_t *ctrl = controls.data() + group * GroupSize;
+			uint32_t mask = Group::match_tag(ctrl, tag);
+			while (mask)
+			{
+				size_t i = group * GroupSize + trailing_zeroes(mask);
+				if (get_hash(values[i]) == hash)
+				{
+					index = i;
+					return true;
+				}
+				mask &= mask - 1;
+			}
+
+			if (Group::match_empty(ctrl))
+				return false;
+			group = (group + step) & group_mask;
+		}
+	}
+
+	// Finds either the existing element, or the first free slot where it can be inserted.
+	bool find_slot(Hash hash, size_t &index)
+	{
+		if (controls.empty())
+		{
+			grow();
+			index = find_free_slot(hash);
+			return false;
+		}
+
+		Hash mixed = Group::mix_hash(hash);
+		int8_t tag = Group::get_tag(mixed);
+		size_t group = get_group(mixed);
+		size_t free_index = SIZE_MAX;
+
+		for (size_t step = 1; ; step++)
+		{
+			const int8_t *ctrl = controls.data() + group * GroupSize;
+			uint32_t mask = Group::match_tag(ctrl, tag);
+			while (mask)
+			{
+				size_t i = group * GroupSize + trailing_zeroes(mask);
+				if (get_hash(values[i]) == hash)
+				{
+					index = i;
+					return true;
+				}
+				mask &= mask - 1;
+			}
+
+			uint32_t free_mask = Group::match_free(ctrl);
+			if (free_index == SIZE_MAX && free_mask)
+				free_index = group * GroupSize + trailing_zeroes(free_mask);
+
+			if (Group::match_empty(ctrl))
+				break;
+			group = (group + step) & group_mask;
+		}
+
+		// Reusing a tombstone does not consume any of the growth budget.
+		if (growth_left == 0 && controls[free_index] == Empty)
+		{
+			grow();
+			free_index = find_free_slot(hash);
+		}
+
+		index = free_index;
+		return false;
+	}
+
+	size_t find_free_slot(Hash hash) const
+	{
+		Hash mixed = Group::mix_hash(hash);
+		size_t group = get_group(mixed);
+		for (size_t step = 1; ; step++)
+		{
+			uint32_t mask = Group::match_free(controls.data() + group * GroupSize);
+			if (mask)
+				return group * GroupSize + trailing_zeroes(mask);
+			group = (group + step) & group_mask;
+		}
+	}
+
+	void insert_at(size_t index, T *value)
+	{
+		if (controls[index] == Empty)
+			growth_left--;
+		controls[index] = Group::get_tag(Group::mix_hash(get_hash(value)));
+		values[index] = value;
+		list.insert_front(value);
+		count++;
+	}
+
+	void grow()
+	{
+		size_t num_groups = group_mask + 1;
+		if (controls.empty())
+			num_groups = InitialGroups;
+		else if (count >= num_groups * GroupSize / 2)
+			num_groups *= 2;
+		// Otherwise, the table is mostly tombstones, so just rehash in place.
+
+		size_t capacity = num_groups * GroupSize;
+		controls.assign(capacity, Empty);
+		values.assign(capacity, nullptr);
+		group_mask = num_groups - 1;
+
+		// Keep at least 1/8th of the slots empty so probe sequences terminate quickly.
+		growth_left = capacity - capacity / 8 - count;
+
+		for (auto &t : list)
+		{
+			size_t index = find_free_slot(get_hash(&t));
+			controls[index] = Group::get_tag(Group::mix_hash(get_hash(&t)));
+			values[index] = &t;
+		}
+	}
+};
+
+template <typename T, typename Holder = IntrusiveHashMapHolder<T>>
 class IntrusiveHashMap
 {
 public:
@@ -425,14 +800,14 @@ public:
 	}
 
 private:
-	IntrusiveHashMapHolder<T> hashmap;
+	Holder hashmap;
 	ObjectPool<T> pool;
 };
 
 template <typename T>
 using IntrusiveHashMapWrapper = IntrusiveHashMap<IntrusivePODWrapper<T>>;
 
-template <typename T>
+template <typename T, typename Holder = IntrusiveHashMapHolder<T>>
 class ThreadSafeIntrusiveHashMap
 {
 public:
@@ -541,13 +916,368 @@ public:
 		return hashmap.end();
 	}
 
-	IntrusiveHashMap<T> &get_thread_unsafe()
+	IntrusiveHashMap<T, Holder> &get_thread_unsafe()
 	{
 		return hashmap;
 	}
 
 private:
-	IntrusiveHashMap<T> hashmap;
+	IntrusiveHashMap<T, Holder> hashmap;
 	mutable RWSpinLock lock;
 };
+
+// Read-mostly variant of ThreadSafeIntrusiveHashMap where find() never takes a lock or writes to shared memory.
+// Writers are serialized by a lock and publish into the same kind of table as IntrusiveHashMapGroupedHolder:
+// the element pointer is stored first, then its control byte, both with release semantics. Readers load the pointer
+// with acquire semantics, so an element is fully visible once find() returns it.
+// When the table fills up, a larger copy is built and published atomically, RCU style.
+// Readers still probing a retired table just see a consistent, older view of the map,
+// so retired tables are only freed in clear(). This makes the map a poor fit for erase-heavy workloads,
+// since every rebuild to get rid of tombstones retires a full table.
+// As with ThreadSafeIntrusiveHashMap, elements must not be erased or replaced while other threads may be using them.
+template <typename T>
+class ConcurrentIntrusiveHashMap
+{
+public:
+	enum { GroupSize = Internal::HashMapGroup::Size, InitialGroups = 1 };
+
+	ConcurrentIntrusiveHashMap() = default;
+	ConcurrentIntrusiveHashMap(const ConcurrentIntrusiveHashMap &) = delete;
+	void operator=(const ConcurrentIntrusiveHashMap &) = delete;
+
+	~ConcurrentIntrusiveHashMap()
+	{
+		clear();
+	}
+
+	T *find(Hash hash) const
+	{
+		const Table *table = current.load(std::memory_order_acquire);
+		if (!table)
+			return nullptr;
+
+		Hash mixed = Group::mix_hash(hash);
+		int8_t tag = Group::get_tag(mixed);
+		size_t group = table->get_group(mixed);
+
+		int8_t scratch[GroupSize];
+		for (size_t step = 1; ; step++)
+		{
+			const int8_t *ctrl = table->probe_group(group, scratch);
+			uint32_t mask = Group::match_tag(ctrl, tag);
+			while (mask)
+			{
+				// Pairs with the release store of the value, which makes the element itself visible.
+				T *value = table->values[group * GroupSize + trailing_zeroes(mask)].load(std::memory_order_acquire);
+				if (value && get_hash(value) == hash)
+					return value;
+				mask &= mask - 1;
+			}
+
+			if (Group::match_empty(ctrl))
+				return nullptr;
+			group = (group + step) & table->group_mask;
+		}
+	}
+
+	// Copies under the lock, so this is safe against concurrent replacement of the element.
+	template <typename P>
+	bool find_and_consume_pod(Hash hash, P &p) const
+	{
+		lock.lock_read();
+		T *t = find(hash);
+		if (t)
+			p = t->get();
+		lock.unlock_read();
+		return t != nullptr;
+	}
+
+	void clear()
+	{
+		lock.lock_write();
+		auto itr = list.begin();
+		while (itr != list.end())
+		{
+			auto *to_free = itr.get();
+			itr = list.erase(itr);
+			pool.free(to_free);
+		}
+		delete current.load(std::memory_order_relaxed);
+		current.store(nullptr, std::memory_order_relaxed);
+		for (auto *table : retired)
+			delete table;
+		retired.clear();
+		count = 0;
+		growth_left = 0;
+		lock.unlock_write();
+	}
+
+	void erase(T *value)
+	{
+		lock.lock_write();
+		erase_locked(get_hash(value));
+		pool.free(value);
+		lock.unlock_write();
+	}
+
+	void erase(Hash hash)
+	{
+		lock.lock_write();
+		T *value = erase_locked(hash);
+		if (value)
+			pool.free(value);
+		lock.unlock_write();
+	}
+
+	template <typename... P>
+	T *allocate(P&&... p)
+	{
+		lock.lock_write();
+		T *t = pool.allocate(std::forward<P>(p)...);
+		lock.unlock_write();
+		return t;
+	}
+
+	void free(T *value)
+	{
+		lock.lock_write();
+		pool.free(value);
+		lock.unlock_write();
+	}
+
+	T *insert_replace(Hash hash, T *value)
+	{
+		static_cast<IntrusiveHashMapEnabled<T> *>(value)->set_hash(hash);
+		lock.lock_write();
+		T *to_delete = insert_locked(value, true);
+		if (to_delete)
+			pool.free(to_delete);
+		lock.unlock_write();
+		return value;
+	}
+
+	T *insert_yield(Hash hash, T *value)
+	{
+		static_cast<IntrusiveHashMapEnabled<T> *>(value)->set_hash(hash);
+		lock.lock_write();
+		T *existing = insert_locked(value, false);
+		if (existing)
+		{
+			pool.free(value);
+			value = existing;
+		}
+		lock.unlock_write();
+		return value;
+	}
+
+	template <typename... P>
+	T *emplace_replace(Hash hash, P&&... p)
+	{
+		T *t = allocate(std::forward<P>(p)...);
+		return insert_replace(hash, t);
+	}
+
+	template <typename... P>
+	T *emplace_yield(Hash hash, P&&... p)
+	{
+		T *t = allocate(std::forward<P>(p)...);
+		return insert_yield(hash, t);
+	}
+
+	// Not supposed to be called in racy conditions.
+	typename IntrusiveList<T>::Iterator begin()
+	{
+		return list.begin();
+	}
+
+	typename IntrusiveList<T>::Iterator end()
+	{
+		return list.end();
+	}
+
+	ConcurrentIntrusiveHashMap &get_thread_unsafe()
+	{
+		return *this;
+	}
+
+private:
+	using Group = Internal::HashMapGroup;
+
+	struct Table
+	{
+		explicit Table(size_t num_groups)
+			: controls(num_groups * GroupSize), values(num_groups * GroupSize), group_mask(num_groups - 1)
+		{
+			for (auto &c : controls)
+				c.store(Group::Empty, std::memory_order_relaxed);
+			for (auto &v : values)
+				v.store(nullptr, std::memory_order_relaxed);
+		}
+
+		// Control bytes are read as plain memory when probing a whole group at once.
+		const int8_t *get_controls() const
+		{
+			return reinterpret_cast<const int8_t *>(controls.data());
+		}
+
+		// Lock-free readers probe a group with a plain vector load, which races with publish_slot() on purpose.
+		// A stale or torn group can only hide an element which is being inserted concurrently,
+		// or point at a slot whose value is null or another element, which find() checks for.
+		// ThreadSanitizer cannot tell the difference, so it gets byte-wise atomic loads instead.
+		const int8_t *probe_group(size_t group, int8_t *scratch) const
+		{
+#ifdef GRANITE_HASH_MAP_TSAN
+			for (size_t i = 0; i < GroupSize; i++)
+				scratch[i] = controls[group * GroupSize + i].load(std::memory_order_relaxed);
+			return scratch;
+#else
+			(void)scratch;
+			return get_controls() + group * GroupSize;
+#endif
+		}
+
+		size_t get_group(Hash mixed) const
+		{
+			return size_t(mixed >> 32) & group_mask;
+		}
+
+		size_t capacity() const
+		{
+			return controls.size();
+		}
+
+		std::vector<std::atomic<int8_t>> controls;
+		std::vector<std::atomic<T *>> values;
+		size_t group_mask;
+	};
+	static_assert(sizeof(std::atomic<int8_t>) == sizeof(int8_t), "Control bytes must be probed as plain bytes.");
+
+	std::atomic<Table *> current = { nullptr };
+	std::vector<Table *> retired;
+	IntrusiveList<T> list;
+	ObjectPool<T> pool;
+	size_t count = 0;
+	size_t growth_left = 0;
+	mutable RWSpinLock lock;
+
+	static inline Hash get_hash(const T *value)
+	{
+		return static_cast<const IntrusiveHashMapEnabled<T> *>(value)->get_hash();
+	}
+
+	// Writers hold the lock, so the table can be read directly.
+	bool find_index_locked(const Table &table, Hash hash, size_t &index) const
+	{
+		Hash mixed = Group::mix_hash(hash);
+		int8_t tag = Group::get_tag(mixed);
+		size_t group = table.get_group(mixed);
+
+		for (size_t step = 1; ; step++)
+		{
+			const int8_t *ctrl = table.get_controls() + group * GroupSize;
+			uint32_t mask = Group::match_tag(ctrl, tag);
+			while (mask)
+			{
+				size_t i = group * GroupSize + trailing_zeroes(mask);
+				if (get_hash(table.values[i].load(std::memory_order_relaxed)) == hash)
+				{
+					index = i;
+					return true;
+				}
+				mask &= mask - 1;
+			}
+
+			if (Group::match_empty(ctrl))
+				return false;
+			group = (group + step) & table.group_mask;
+		}
+	}
+
+	static size_t find_free_slot(const Table &table, Hash hash)
+	{
+		size_t group = table.get_group(Group::mix_hash(hash));
+		for (size_t step = 1; ; step++)
+		{
+			uint32_t mask = Group::match_free(table.get_controls() + group * GroupSize);
+			if (mask)
+				return group * GroupSize + trailing_zeroes(mask);
+			group = (group + step) & table.group_mask;
+		}
+	}
+
+	static void publish_slot(Table &table, size_t index, T *value)
+	{
+		table.values[index].store(value, std::memory_order_release);
+		table.controls[index].store(Group::get_tag(Group::mix_hash(get_hash(value))), std::memory_order_release);
+	}
+
+	// Returns the element which is not part of the map afterwards, if any.
+	T *insert_locked(T *value, bool replace)
+	{
+		Table *table = current.load(std::memory_order_relaxed);
+		Hash hash = get_hash(value);
+		size_t index;
+
+		if (table && find_index_locked(*table, hash, index))
+		{
+			T *existing = table->values[index].load(std::memory_order_relaxed);
+			if (!replace)
+				return existing;
+
+			table->values[index].store(value, std::memory_order_release);
+			list.erase(existing);
+			list.insert_front(value);
+			return existing;
+		}
+
+		if (!table || growth_left == 0)
+			table = grow();
+
+		index = find_free_slot(*table, hash);
+		if (table->controls[index].load(std::memory_order_relaxed) == Group::Empty)
+			growth_left--;
+		publish_slot(*table, index, value);
+		list.insert_front(value);
+		count++;
+		return nullptr;
+	}
+
+	T *erase_locked(Hash hash)
+	{
+		Table *table = current.load(std::memory_order_relaxed);
+		size_t index;
+		if (!table || !find_index_locked(*table, hash, index))
+			return nullptr;
+
+		// Readers may be in the middle of a probe sequence passing through here, so always leave a tombstone.
+		T *value = table->values[index].load(std::memory_order_relaxed);
+		table->controls[index].store(Group::Deleted, std::memory_order_release);
+		list.erase(value);
+		count--;
+		return value;
+	}
+
+	Table *grow()
+	{
+		Table *old_table = current.load(std::memory_order_relaxed);
+		size_t num_groups = InitialGroups;
+		if (old_table)
+		{
+			num_groups = old_table->group_mask + 1;
+			// Otherwise, the table is mostly tombstones, so just rebuild at the same size.
+			if (count >= num_groups * GroupSize / 2)
+				num_groups *= 2;
+		}
+
+		auto *table = new Table(num_groups);
+		for (auto &t : list)
+			publish_slot(*table, find_free_slot(*table, get_hash(&t)), &t);
+		growth_left = table->capacity() - table->capacity() / 8 - count;
+
+		current.store(table, std::memory_order_release);
+		if (old_table)
+			retired.push_back(old_table);
+		return table;
+	}
+};
 }
@@ -25,6 +25,9 @@
 #include "object_pool.hpp"
 #include "intrusive_list.hpp"
 #include "intrusive_hash_map.hpp"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
 
 namespace Util
 {
@@ -42,6 +45,11 @@ public:
 		return total_cost;
 	}
 
+	uint64_t get_total_cost_limit() const
+	{
+		return total_cost_limit;
+	}
+
 	T *find_and_mark_as_recent(uint64_t cookie)
 	{
 		auto *entry = hashmap.find(get_hash(cookie));
@@ -109,9 +117,11 @@ public:
 		auto *entry = hashmap.find(get_hash(cookie));
 		if (entry)
 		{
+			auto itr = entry->get();
+			total_cost -= itr->cost;
 			hashmap.erase(entry);
-			lru.erase(entry->get());
-			pool.free(entry->get().get());
+			lru.erase(itr);
+			pool.free(itr.get());
 			return true;
 		}
 		else
@@ -160,4 +170,314 @@ private:
 		return h.get();
 	}
 };
+
+// Approximates how often a key has been seen recently with a count-min sketch of saturating 4-bit counters.
+// All counters are halved periodically so that old popularity fades out, as in TinyLFU.
+class FrequencySketch
+{
+public:
+	enum { Rows = 4, Width = 512, MaxCount = 15, ResetInterval = 8 * Width };
+
+	void increment(Hash hash)
+	{
+		for (unsigned row = 0; row < Rows; row++)
+		{
+			auto &counter = counters[row][get_index(hash, row)];
+			if (counter < MaxCount)
+				counter++;
+		}
+
+		if (++additions >= ResetInterval)
+		{
+			for (auto &row : counters)
+				for (auto &counter : row)
+					counter >>= 1;
+			additions = 0;
+		}
+	}
+
+	unsigned estimate(Hash hash) const
+	{
+		unsigned count = MaxCount;
+		for (unsigned row = 0; row < Rows; row++)
+		{
+			unsigned c = counters[row][get_index(hash, row)];
+			if (c < count)
+				count = c;
+		}
+		return count;
+	}
+
+private:
+	uint8_t counters[Rows][Width] = {};
+	unsigned additions = 0;
+
+	static unsigned get_index(Hash hash, unsigned row)
+	{
+		static const uint64_t seeds[Rows] = {
+			0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0x27d4eb2f165667c5ull,
+		};
+		return unsigned(((hash ^ (hash >> 31)) * seeds[row]) >> 55) & (Width - 1);
+	}
+};
+
+// Thread-safe variant of LRUCache meant to be shared between loader threads.
+// Keys are spread over NumShards independent LRU lists, each with its own lock, while the cost budget is global.
+// Since entries may be evicted by another thread at any time, values are copied in and out
+// rather than handing out pointers, so T should be cheap to copy, e.g. a handle.
+// With the admission filter enabled, a new entry which would cause evictions is only admitted
+// if it has been requested more often than the entries it would displace.
+// This keeps a scan through one-off assets from flushing the hot set.
+template <typename T, unsigned NumShards = 16>
+class ShardedLRUCache
+{
+public:
+	static_assert((NumShards & (NumShards - 1)) == 0, "NumShards must be a power of two.");
+
+	struct Statistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t insertions = 0;
+		uint64_t rejections = 0;
+		uint64_t evictions = 0;
+		uint64_t evicted_cost = 0;
+	};
+
+	void set_total_cost(uint64_t cost)
+	{
+		total_cost_limit.store(cost, std::memory_order_relaxed);
+	}
+
+	uint64_t get_current_cost() const
+	{
+		return total_cost.load(std::memory_order_relaxed);
+	}
+
+	uint64_t get_total_cost_limit() const
+	{
+		return total_cost_limit.load(std::memory_order_relaxed);
+	}
+
+	void set_admission_filter(bool enable)
+	{
+		admission_filter.store(enable, std::memory_order_relaxed);
+	}
+
+	bool find_and_mark_as_recent(uint64_t cookie, T &t)
+	{
+		Hash hash = get_hash(cookie);
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+
+		if (admission_filter.load(std::memory_order_relaxed))
+			shard.sketch.increment(hash);
+		auto *entry = shard.hashmap.find(hash);
+		if (entry)
+		{
+			shard.lru.move_to_front(shard.lru, entry->get());
+			t = entry->get()->t;
+			shard.stats.hits++;
+			return true;
+		}
+		else
+		{
+			shard.stats.misses++;
+			return false;
+		}
+	}
+
+	// Returns false if the admission filter rejected the entry.
+	bool insert(uint64_t cookie, T t, uint64_t cost)
+	{
+		Hash hash = get_hash(cookie);
+		auto &shard = get_shard(hash);
+		uint64_t limit = get_total_cost_limit();
+
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			bool filter = admission_filter.load(std::memory_order_relaxed);
+			if (filter)
+				shard.sketch.increment(hash);
+
+			auto *hash_entry = shard.hashmap.find(hash);
+			if (hash_entry)
+			{
+				auto itr = hash_entry->get();
+				total_cost.fetch_add(cost - itr->cost, std::memory_order_relaxed);
+				itr->cost = cost;
+				itr->t = std::move(t);
+				shard.lru.move_to_front(shard.lru, itr);
+			}
+			else
+			{
+				if (filter && !should_admit(shard, hash, cost, limit))
+				{
+					shard.stats.rejections++;
+					return false;
+				}
+
+				auto *entry = shard.pool.allocate();
+				entry->cost = cost;
+				entry->hash = hash;
+				entry->t = std::move(t);
+				shard.lru.insert_front(entry);
+				shard.hashmap.emplace_replace(hash, shard.lru.begin());
+				total_cost.fetch_add(cost, std::memory_order_relaxed);
+				shard.stats.insertions++;
+			}
+
+			// Prefer evicting from the shard we already hold, but never the entry we just inserted.
+			while (get_current_cost() > limit && shard.lru.rbegin() != shard.lru.begin())
+				evict_tail(shard);
+		}
+
+		if (get_current_cost() > limit)
+			prune();
+		return true;
+	}
+
+	bool erase(uint64_t cookie)
+	{
+		Hash hash = get_hash(cookie);
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+
+		auto *entry = shard.hashmap.find(hash);
+		if (entry)
+		{
+			auto itr = entry->get();
+			total_cost.fetch_sub(itr->cost, std::memory_order_relaxed);
+			shard.hashmap.erase(entry);
+			shard.lru.erase(itr);
+			shard.pool.free(itr.get());
+			return true;
+		}
+		else
+			return false;
+	}
+
+	// Evicts least recently used entries until the budget is met.
+	// Only one shard is locked at a time, starting where the last prune left off.
+	uint64_t prune()
+	{
+		uint64_t total_pruned = 0;
+		unsigned first = prune_shard.fetch_add(1, std::memory_order_relaxed);
+		for (unsigned i = 0; i < NumShards && get_current_cost() > get_total_cost_limit(); i++)
+		{
+			auto &shard = shards[(first + i) & (NumShards - 1)];
+			std::lock_guard<std::mutex> holder{shard.lock};
+			while (get_current_cost() > get_total_cost_limit() && !shard.lru.empty())
+				total_pruned += evict_tail(shard);
+		}
+		return total_pruned;
+	}
+
+	Statistics get_statistics() const
+	{
+		Statistics stats;
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			stats.hits += shard.stats.hits;
+			stats.misses += shard.stats.misses;
+			stats.insertions += shard.stats.insertions;
+			stats.rejections += shard.stats.rejections;
+			stats.evictions += shard.stats.evictions;
+			stats.evicted_cost += shard.stats.evicted_cost;
+		}
+		return stats;
+	}
+
+	~ShardedLRUCache()
+	{
+		for (auto &shard : shards)
+		{
+			while (!shard.lru.empty())
+			{
+				auto itr = shard.lru.begin();
+				shard.lru.erase(itr);
+				shard.pool.free(itr.get());
+			}
+		}
+	}
+
+private:
+	struct CacheEntry : IntrusiveListEnabled<CacheEntry>
+	{
+		uint64_t cost;
+		Hash hash;
+		T t;
+	};
+
+	// The sketch is large enough to keep the locks of neighbouring shards on separate cache lines.
+	struct Shard
+	{
+		mutable std::mutex lock;
+		ObjectPool<CacheEntry> pool;
+		IntrusiveList<CacheEntry> lru;
+		IntrusiveHashMap<IntrusivePODWrapper<typename IntrusiveList<CacheEntry>::Iterator>> hashmap;
+		FrequencySketch sketch;
+		Statistics stats;
+	};
+
+	enum { MaxVictimSamples = 8 };
+
+	Shard shards[NumShards];
+	std::atomic<uint64_t> total_cost = { 0 };
+	std::atomic<uint64_t> total_cost_limit = { 0 };
+	std::atomic<unsigned> prune_shard = { 0 };
+	std::atomic<bool> admission_filter = { false };
+
+	Shard &get_shard(Hash hash)
+	{
+		return shards[(hash >> 32) & (NumShards - 1)];
+	}
+
+	// Compares against the least recently used entries of this shard which would have to make room.
+	// Cost matters, since one large entry can displace several small ones.
+	bool should_admit(Shard &shard, Hash hash, uint64_t cost, uint64_t limit) const
+	{
+		uint64_t current = get_current_cost();
+		if (current + cost <= limit)
+			return true;
+		if (cost > limit)
+			return false;
+
+		uint64_t needed = current + cost - limit;
+		uint64_t freed = 0;
+		unsigned victim_frequency = 0;
+		unsigned samples = 0;
+
+		for (auto itr = shard.lru.rbegin(); itr != shard.lru.end() && freed < needed && samples < MaxVictimSamples; --itr, samples++)
+		{
+			unsigned frequency = shard.sketch.estimate(itr->hash);
+			if (frequency > victim_frequency)
+				victim_frequency = frequency;
+			freed += itr->cost;
+		}
+
+		return samples == 0 || shard.sketch.estimate(hash) > victim_frequency;
+	}
+
+	uint64_t evict_tail(Shard &shard)
+	{
+		auto itr = shard.lru.rbegin();
+		uint64_t cost = itr->cost;
+		total_cost.fetch_sub(cost, std::memory_order_relaxed);
+		shard.lru.erase(itr);
+		shard.hashmap.erase(itr->hash);
+		shard.pool.free(itr.get());
+		shard.stats.evictions++;
+		shard.stats.evicted_cost += cost;
+		return cost;
+	}
+
+	static Hash get_hash(uint64_t cookie)
+	{
+		Hasher h;
+		h.u64(cookie);
+		return h.get();
+	}
+};
 }
@@ -0,0 +1,366 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "tlsf_allocator.hpp"
+#include "bitops.hpp"
+#include "logging.hpp"
+#include <assert.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace Util
+{
+static inline uint32_t floor_log2(uint32_t v)
+{
+	return 31 - leading_zeroes(v);
+}
+
+TLSFAllocator::TLSFAllocator(TLSFBackend &backend_, uint32_t region_size_, uint32_t granularity_)
+	: backend(backend_), region_size(region_size_), granularity(granularity_)
+{
+	assert(granularity && (granularity & (granularity - 1)) == 0);
+	granularity_log2 = floor_log2(granularity);
+	region_size = (region_size + granularity - 1) & ~(granularity - 1);
+
+	for (auto &fl : free_heads)
+		for (auto &head : fl)
+			head = Invalid;
+}
+
+TLSFAllocator::~TLSFAllocator()
+{
+	if (stats.num_allocations != 0)
+		LOGE("Memory leak in TLSF allocator detected, %u allocations still live.\n", stats.num_allocations);
+}
+
+void TLSFAllocator::mapping_insert(uint32_t size, uint32_t &fl, uint32_t &sl) const
+{
+	// Sizes below SLCount granules are binned linearly in the first level.
+	if (size < (1u << (granularity_log2 + SLCountLog2)))
+	{
+		fl = 0;
+		sl = size >> granularity_log2;
+	}
+	else
+	{
+		uint32_t msb = floor_log2(size);
+		sl = (size >> (msb - SLCountLog2)) & (SLCount - 1);
+		fl = msb - (granularity_log2 + SLCountLog2) + 1;
+	}
+}
+
+bool TLSFAllocator::mapping_search(uint32_t size, uint32_t &fl, uint32_t &sl) const
+{
+	// Round up to the next bin, so any block in the bin we land in is large enough.
+	if (size >= (1u << (granularity_log2 + SLCountLog2)))
+	{
+		uint32_t round = (1u << (floor_log2(size) - SLCountLog2)) - 1;
+		if (size > ~0u - round)
+			return false;
+		size += round;
+	}
+
+	mapping_insert(size, fl, sl);
+	return fl < FLCount;
+}
+
+uint32_t TLSFAllocator::find_free_block(uint32_t size) const
+{
+	uint32_t fl, sl;
+	if (!mapping_search(size, fl, sl))
+		return Invalid;
+
+	uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+	if (!sl_map)
+	{
+		uint32_t fl_map = fl + 1 < FLCount ? (fl_bitmap & (~0u << (fl + 1))) : 0;
+		if (!fl_map)
+			return Invalid;
+
+		fl = trailing_zeroes(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+
+	sl = trailing_zeroes(sl_map);
+	return free_heads[fl][sl];
+}
+
+void TLSFAllocator::insert_free_block(uint32_t index)
+{
+	uint32_t fl, sl;
+	auto &block = blocks[index];
+	mapping_insert(block.size, fl, sl);
+
+	block.free = true;
+	block.prev_free = Invalid;
+	block.next_free = free_heads[fl][sl];
+	if (block.next_free != Invalid)
+		blocks[block.next_free].prev_free = index;
+	free_heads[fl][sl] = index;
+
+	fl_bitmap |= 1u << fl;
+	sl_bitmap[fl] |= 1u << sl;
+	stats.num_free_blocks++;
+}
+
+void TLSFAllocator::remove_free_block(uint32_t index)
+{
+	uint32_t fl, sl;
+	auto &block = blocks[index];
+	mapping_insert(block.size, fl, sl);
+
+	if (block.prev_free != Invalid)
+		blocks[block.prev_free].next_free = block.next_free;
+	else
+		free_heads[fl][sl] = block.next_free;
+
+	if (block.next_free != Invalid)
+		blocks[block.next_free].prev_free = block.prev_free;
+
+	if (free_heads[fl][sl] == Invalid)
+	{
+		sl_bitmap[fl] &= ~(1u << sl);
+		if (!sl_bitmap[fl])
+			fl_bitmap &= ~(1u << fl);
+	}
+
+	block.free = false;
+	block.prev_free = Invalid;
+	block.next_free = Invalid;
+	stats.num_free_blocks--;
+}
+
+uint32_t TLSFAllocator::allocate_block()
+{
+	if (!vacant_blocks.empty())
+	{
+		uint32_t index = vacant_blocks.back();
+		vacant_blocks.pop_back();
+		return index;
+	}
+
+	blocks.emplace_back();
+	return uint32_t(blocks.size() - 1);
+}
+
+void TLSFAllocator::release_block(uint32_t index)
+{
+	vacant_blocks.push_back(index);
+}
+
+uint32_t TLSFAllocator::split_block(uint32_t index, uint32_t size)
+{
+	// Careful, allocate_block() can reallocate the block array.
+	uint32_t tail = allocate_block();
+	auto &block = blocks[index];
+	auto &tail_block = blocks[tail];
+
+	tail_block.offset = block.offset + size;
+	tail_block.size = block.size - size;
+	tail_block.requested = 0;
+	tail_block.region = block.region;
+	tail_block.prev_phys = index;
+	tail_block.next_phys = block.next_phys;
+	tail_block.prev_free = Invalid;
+	tail_block.next_free = Invalid;
+	tail_block.free = false;
+
+	if (block.next_phys != Invalid)
+		blocks[block.next_phys].prev_phys = tail;
+	block.next_phys = tail;
+	block.size = size;
+	return tail;
+}
+
+void TLSFAllocator::merge_with_next(uint32_t index)
+{
+	auto &block = blocks[index];
+	uint32_t next = block.next_phys;
+	auto &next_block = blocks[next];
+	assert(block.offset + block.size == next_block.offset);
+
+	block.size += next_block.size;
+	block.next_phys = next_block.next_phys;
+	if (block.next_phys != Invalid)
+		blocks[block.next_phys].prev_phys = index;
+	release_block(next);
+}
+
+uint32_t TLSFAllocator::create_region(uint32_t size)
+{
+	uint32_t region;
+	if (!vacant_regions.empty())
+	{
+		region = vacant_regions.back();
+		vacant_regions.pop_back();
+	}
+	else
+	{
+		region = uint32_t(region_sizes.size());
+		region_sizes.push_back(0);
+	}
+
+	if (!backend.allocate_region(region, size))
+	{
+		vacant_regions.push_back(region);
+		return Invalid;
+	}
+
+	region_sizes[region] = size;
+	stats.num_regions++;
+	stats.region_bytes += size;
+	stats.peak_region_bytes = max(stats.peak_region_bytes, stats.region_bytes);
+	stats.total_region_allocations++;
+
+	uint32_t index = allocate_block();
+	auto &block = blocks[index];
+	block.offset = 0;
+	block.size = size;
+	block.requested = 0;
+	block.region = region;
+	block.prev_phys = Invalid;
+	block.next_phys = Invalid;
+	block.prev_free = Invalid;
+	block.next_free = Invalid;
+	block.free = false;
+	return index;
+}
+
+bool TLSFAllocator::allocate(uint32_t size, uint32_t alignment, TLSFAllocation *alloc)
+{
+	assert(alignment == 0 || (alignment & (alignment - 1)) == 0);
+	alignment = max(alignment, granularity);
+
+	if (size == 0)
+		size = 1;
+	if (size > 0x80000000u || alignment > 0x80000000u)
+		return false;
+
+	uint32_t aligned_size = (size + granularity - 1) & ~(granularity - 1);
+	// Over-allocate so that we can always align within the block we find.
+	uint32_t search_size = aligned_size + (alignment - granularity);
+	if (search_size < aligned_size)
+		return false;
+
+	uint32_t index = find_free_block(search_size);
+	if (index != Invalid)
+		remove_free_block(index);
+	else
+	{
+		index = create_region(max(region_size, search_size));
+		if (index == Invalid)
+			return false;
+	}
+
+	// Give the padding in front back to the free list.
+	uint32_t offset = blocks[index].offset;
+	uint32_t aligned_offset = (offset + alignment - 1) & ~(alignment - 1);
+	if (aligned_offset != offset)
+	{
+		uint32_t head = index;
+		index = split_block(head, aligned_offset - offset);
+		insert_free_block(head);
+	}
+
+	// Give the remainder back as well. The next physical block cannot be free, since free blocks are always coalesced.
+	if (blocks[index].size > aligned_size)
+	{
+		uint32_t tail = split_block(index, aligned_size);
+		insert_free_block(tail);
+	}
+
+	auto &block = blocks[index];
+	block.requested = size;
+
+	stats.num_allocations++;
+	stats.allocated_bytes += block.size;
+	stats.requested_bytes += size;
+
+	alloc->region = block.region;
+	alloc->offset = block.offset;
+	alloc->size = block.size;
+	alloc->block = index;
+	return true;
+}
+
+void TLSFAllocator::free(const TLSFAllocation &alloc)
+{
+	uint32_t index = alloc.block;
+	assert(index < blocks.size());
+	assert(!blocks[index].free);
+
+	stats.num_allocations--;
+	stats.allocated_bytes -= blocks[index].size;
+	stats.requested_bytes -= blocks[index].requested;
+	blocks[index].requested = 0;
+
+	uint32_t next = blocks[index].next_phys;
+	if (next != Invalid && blocks[next].free)
+	{
+		remove_free_block(next);
+		merge_with_next(index);
+	}
+
+	uint32_t prev = blocks[index].prev_phys;
+	if (prev != Invalid && blocks[prev].free)
+	{
+		remove_free_block(prev);
+		merge_with_next(prev);
+		index = prev;
+	}
+
+	auto &block = blocks[index];
+	if (block.prev_phys == Invalid && block.next_phys == Invalid)
+	{
+		// The entire region is free, hand it back.
+		uint32_t region = block.region;
+		assert(block.size == region_sizes[region]);
+		backend.free_region(region, block.size);
+		stats.num_regions--;
+		stats.region_bytes -= block.size;
+		region_sizes[region] = 0;
+		vacant_regions.push_back(region);
+		release_block(index);
+	}
+	else
+		insert_free_block(index);
+}
+
+TLSFStatistics TLSFAllocator::get_statistics() const
+{
+	TLSFStatistics ret = stats;
+	ret.free_bytes = ret.region_bytes - ret.allocated_bytes;
+
+	// The largest block lives in the highest non-empty bin, but blocks within a bin are unordered.
+	if (fl_bitmap)
+	{
+		uint32_t fl = floor_log2(fl_bitmap);
+		uint32_t sl = floor_log2(sl_bitmap[fl]);
+		for (uint32_t index = free_heads[fl][sl]; index != Invalid; index = blocks[index].next_free)
+			ret.largest_free_block = max<uint64_t>(ret.largest_free_block, blocks[index].size);
+	}
+
+	return ret;
+}
+}
@@ -0,0 +1,150 @@
+/* Copyright (c) 2017-2020 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace Util
+{
+// Provides the backing memory for a TLSFAllocator.
+// Regions are identified by a small index which the allocator recycles once a region has been freed.
+class TLSFBackend
+{
+public:
+	virtual ~TLSFBackend() = default;
+	virtual bool allocate_region(uint32_t region, uint32_t size) = 0;
+	virtual void free_region(uint32_t region, uint32_t size) = 0;
+};
+
+struct TLSFAllocation
+{
+	uint32_t region = 0;
+	uint32_t offset = 0;
+	uint32_t size = 0;
+	uint32_t block = ~0u;
+};
+
+struct TLSFStatistics
+{
+	// Memory currently requested from the backend.
+	uint64_t region_bytes = 0;
+	// Sum of the blocks handed out, including rounding up to the granularity.
+	uint64_t allocated_bytes = 0;
+	// Sum of the sizes which were actually asked for.
+	uint64_t requested_bytes = 0;
+	uint64_t free_bytes = 0;
+	uint64_t largest_free_block = 0;
+	uint64_t peak_region_bytes = 0;
+	uint64_t total_region_allocations = 0;
+	uint32_t num_regions = 0;
+	uint32_t num_allocations = 0;
+	uint32_t num_free_blocks = 0;
+
+	// Internal fragmentation, the fraction of allocated memory which was not asked for.
+	float get_waste() const
+	{
+		return allocated_bytes ? float(allocated_bytes - requested_bytes) / float(allocated_bytes) : 0.0f;
+	}
+
+	// External fragmentation, 0 if all free memory is one contiguous block.
+	float get_fragmentation() const
+	{
+		return free_bytes ? 1.0f - float(largest_free_block) / float(free_bytes) : 0.0f;
+	}
+};
+
+// Two-level segregated fit allocator. Allocation and free are O(1).
+// Free blocks are binned by the position of their most significant bit, then linearly subdivided,
+// and two levels of bitmasks find a large enough bin without searching.
+// Adjacent free blocks are coalesced on free, and a region is returned to the backend once it is completely free.
+// The allocator only deals in offsets, so it can be driven by any backend. It is not thread-safe.
+class TLSFAllocator
+{
+public:
+	// Requests larger than region_size get a region of their own.
+	// Granularity must be a power of two. All offsets and sizes are multiples of it.
+	TLSFAllocator(TLSFBackend &backend, uint32_t region_size, uint32_t granularity = 256);
+	~TLSFAllocator();
+
+	TLSFAllocator(const TLSFAllocator &) = delete;
+	void operator=(const TLSFAllocator &) = delete;
+
+	// Alignment must be a power of two.
+	bool allocate(uint32_t size, uint32_t alignment, TLSFAllocation *alloc);
+	void free(const TLSFAllocation &alloc);
+
+	TLSFStatistics get_statistics() const;
+
+private:
+	enum
+	{
+		SLCountLog2 = 4,
+		SLCount = 1 << SLCountLog2,
+		FLCount = 32,
+		Invalid = ~0u
+	};
+
+	struct Block
+	{
+		uint32_t offset;
+		uint32_t size;
+		uint32_t requested;
+		uint32_t region;
+		uint32_t prev_phys;
+		uint32_t next_phys;
+		uint32_t prev_free;
+		uint32_t next_free;
+		bool free;
+	};
+
+	TLSFBackend &backend;
+	uint32_t region_size;
+	uint32_t granularity;
+	uint32_t granularity_log2;
+
+	std::vector<Block> blocks;
+	std::vector<uint32_t> vacant_blocks;
+	std::vector<uint32_t> region_sizes;
+	std::vector<uint32_t> vacant_regions;
+
+	uint32_t fl_bitmap = 0;
+	uint32_t sl_bitmap[FLCount] = {};
+	uint32_t free_heads[FLCount][SLCount];
+
+	TLSFStatistics stats;
+
+	void mapping_insert(uint32_t size, uint32_t &fl, uint32_t &sl) const;
+	bool mapping_search(uint32_t size, uint32_t &fl, uint32_t &sl) const;
+	uint32_t find_free_block(uint32_t size) const;
+	void insert_free_block(uint32_t index);
+	void remove_free_block(uint32_t index);
+	uint32_t split_block(uint32_t index, uint32_t size);
+	void merge_with_next(uint32_t index);
+	uint32_t allocate_block();
+	void release_block(uint32_t index);
+	uint32_t create_region(uint32_t size);
+};
+}
@@ -120,6 +120,16 @@ void BufferPool::recycle_block(BufferBlock &&block)
 	blocks.push_back(move(block));
 }
 
+void BufferPool::take_blocks(std::vector<BufferBlock> &out, size_t count)
+{
+	count = min(count, blocks.size());
+	for (size_t i = 0; i < count; i++)
+	{
+		out.push_back(move(blocks.back()));
+		blocks.pop_back();
+	}
+}
+
 BufferPool::~BufferPool()
 {
 	VK_ASSERT(blocks.empty());
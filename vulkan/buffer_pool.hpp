@@ -87,6 +87,13 @@ public:
 	BufferBlock request_block(VkDeviceSize minimum_size);
 	void recycle_block(BufferBlock &&block);
 
+	// Moves up to count recycled blocks to out. The blocks are not mapped.
+	// Used to refill per-thread block caches in batches.
+	void take_blocks(std::vector<BufferBlock> &out, size_t count);
+
+	// Allocates a new, mapped block. Does not touch the pool itself, so it does not need to be synchronized.
+	BufferBlock allocate_block(VkDeviceSize size);
+
 private:
 	Device *device = nullptr;
 	VkDeviceSize block_size = 0;
@@ -94,7 +101,6 @@ private:
 	VkDeviceSize spill_size = 0;
 	VkBufferUsageFlags usage = 0;
 	std::vector<BufferBlock> blocks;
-	BufferBlock allocate_block(VkDeviceSize size);
 	bool need_device_local = false;
 };
 }
\ No newline at end of file
@@ -1084,7 +1084,13 @@ bool CommandBuffer::flush_graphics_pipeline(bool synchronous)
 	current_pipeline = pipeline_state.program->get_pipeline(pipeline_state.hash);
 
 	if (current_pipeline == VK_NULL_HANDLE && synchronous)
+	{
+#ifdef GRANITE_VULKAN_MT
+		current_pipeline = device->request_deferred_graphics_pipeline(pipeline_state, pipeline_compile_deferred);
+#else
 		current_pipeline = build_graphics_pipeline(device, pipeline_state);
+#endif
+	}
 
 	return current_pipeline != VK_NULL_HANDLE;
 }
@@ -1130,6 +1136,7 @@ bool CommandBuffer::flush_compute_state(bool synchronous)
 
 bool CommandBuffer::flush_render_state(bool synchronous)
 {
+	pipeline_compile_deferred = false;
 	if (!pipeline_state.program)
 		return false;
 	VK_ASSERT(current_layout);
@@ -1405,7 +1412,7 @@ void *CommandBuffer::allocate_constant_data(unsigned set, unsigned binding, VkDe
 	auto data = ubo_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_uniform_block(ubo_block, size);
+		device->request_uniform_block(ubo_block, size, thread_index);
 		data = ubo_block.allocate(size);
 	}
 	set_uniform_buffer(set, binding, *ubo_block.gpu, data.offset, data.padded_size);
@@ -1417,7 +1424,7 @@ void *CommandBuffer::allocate_index_data(VkDeviceSize size, VkIndexType index_ty
 	auto data = ibo_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_index_block(ibo_block, size);
+		device->request_index_block(ibo_block, size, thread_index);
 		data = ibo_block.allocate(size);
 	}
 	set_index_buffer(*ibo_block.gpu, data.offset, index_type);
@@ -1432,7 +1439,7 @@ void *CommandBuffer::update_buffer(const Buffer &buffer, VkDeviceSize offset, Vk
 	auto data = staging_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_staging_block(staging_block, size);
+		device->request_staging_block(staging_block, size, thread_index);
 		data = staging_block.allocate(size);
 	}
 	copy_buffer(buffer, offset, *staging_block.cpu, data.offset, size);
@@ -1471,7 +1478,7 @@ void *CommandBuffer::update_image(const Image &image, const VkOffset3D &offset,
 	auto data = staging_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_staging_block(staging_block, size);
+		device->request_staging_block(staging_block, size, thread_index);
 		data = staging_block.allocate(size);
 	}
 
@@ -1494,7 +1501,7 @@ void *CommandBuffer::allocate_vertex_data(unsigned binding, VkDeviceSize size, V
 	auto data = vbo_block.allocate(size);
 	if (!data.host)
 	{
-		device->request_vertex_block(vbo_block, size);
+		device->request_vertex_block(vbo_block, size, thread_index);
 		data = vbo_block.allocate(size);
 	}
 
@@ -1642,6 +1649,15 @@ void CommandBuffer::set_bindless(unsigned set, VkDescriptorSet desc_set)
 	dirty_sets |= 1u << set;
 }
 
+void CommandBuffer::set_descriptor_set_linear(unsigned set, bool linear)
+{
+	VK_ASSERT(set < VULKAN_NUM_DESCRIPTOR_SETS);
+	if (linear)
+		linear_sets |= 1u << set;
+	else
+		linear_sets &= ~(1u << set);
+}
+
 void CommandBuffer::set_texture(unsigned set, unsigned binding, const ImageView &view)
 {
 	VK_ASSERT(view.get_image().get_create_info().usage & VK_IMAGE_USAGE_SAMPLED_BIT);
@@ -1891,6 +1907,44 @@ void CommandBuffer::rebind_descriptor_set(uint32_t set)
 	                              current_pipeline_layout, set, 1, &allocated_sets[set], num_dynamic_offsets, dynamic_offsets);
 }
 
+void CommandBuffer::write_descriptor_set(uint32_t set, VkDescriptorSet desc_set)
+{
+	auto update_template = current_layout->get_update_template(set);
+
+	if (update_template != VK_NULL_HANDLE)
+	{
+		table.vkUpdateDescriptorSetWithTemplateKHR(device->get_device(), desc_set,
+		                                           update_template, bindings.bindings[set]);
+	}
+	else
+		update_descriptor_set_legacy(*device, desc_set, current_layout->get_resource_layout().sets[set], bindings.bindings[set]);
+}
+
+void CommandBuffer::flush_linear_descriptor_set(uint32_t set)
+{
+	auto &set_layout = current_layout->get_resource_layout().sets[set];
+	uint32_t num_dynamic_offsets = 0;
+	uint32_t dynamic_offsets[VULKAN_NUM_BINDINGS];
+
+	for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.array_size[binding];
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			VK_ASSERT(bindings.bindings[set][binding + i].buffer.buffer != VK_NULL_HANDLE);
+			VK_ASSERT(num_dynamic_offsets < VULKAN_NUM_BINDINGS);
+			dynamic_offsets[num_dynamic_offsets++] = bindings.bindings[set][binding + i].dynamic_offset;
+		}
+	});
+
+	// The frame context cannot change while this command buffer is being recorded.
+	auto desc_set = current_layout->get_allocator(set)->allocate_linear(thread_index, device->frame_context_index);
+	write_descriptor_set(set, desc_set);
+
+	table.vkCmdBindDescriptorSets(cmd, actual_render_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE,
+	                              current_pipeline_layout, set, 1, &desc_set, num_dynamic_offsets, dynamic_offsets);
+	allocated_sets[set] = desc_set;
+}
+
 void CommandBuffer::flush_descriptor_set(uint32_t set)
 {
 	auto &layout = current_layout->get_resource_layout();
@@ -1902,6 +1956,12 @@ void CommandBuffer::flush_descriptor_set(uint32_t set)
 		return;
 	}
 
+	if (linear_sets & (1u << set))
+	{
+		flush_linear_descriptor_set(set);
+		return;
+	}
+
 	auto &set_layout = layout.sets[set];
 	uint32_t num_dynamic_offsets = 0;
 	uint32_t dynamic_offsets[VULKAN_NUM_BINDINGS];
@@ -2009,17 +2069,7 @@ void CommandBuffer::flush_descriptor_set(uint32_t set)
 
 	// The descriptor set was not successfully cached, rebuild.
 	if (!allocated.second)
-	{
-		auto update_template = current_layout->get_update_template(set);
-
-		if (update_template != VK_NULL_HANDLE)
-		{
-			table.vkUpdateDescriptorSetWithTemplateKHR(device->get_device(), allocated.first,
-			                                           update_template, bindings.bindings[set]);
-		}
-		else
-			update_descriptor_set_legacy(*device, allocated.first, layout.sets[set], bindings.bindings[set]);
-	}
+		write_descriptor_set(set, allocated.first);
 
 	table.vkCmdBindDescriptorSets(cmd, actual_render_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE,
 	                              current_pipeline_layout, set, 1, &allocated.first, num_dynamic_offsets, dynamic_offsets);
@@ -2051,7 +2101,7 @@ void CommandBuffer::draw(uint32_t vertex_count, uint32_t instance_count, uint32_
 		set_backtrace_checkpoint();
 		table.vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
 	}
-	else
+	else if (!pipeline_compile_deferred)
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
@@ -2065,7 +2115,7 @@ void CommandBuffer::draw_indexed(uint32_t index_count, uint32_t instance_count,
 		set_backtrace_checkpoint();
 		table.vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
 	}
-	else
+	else if (!pipeline_compile_deferred)
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
@@ -2078,7 +2128,7 @@ void CommandBuffer::draw_indirect(const Vulkan::Buffer &buffer,
 		set_backtrace_checkpoint();
 		table.vkCmdDrawIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
 	}
-	else
+	else if (!pipeline_compile_deferred)
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
@@ -2099,7 +2149,7 @@ void CommandBuffer::draw_multi_indirect(const Buffer &buffer, uint32_t offset, u
 		                                count.get_buffer(), count_offset,
 		                                draw_count, stride);
 	}
-	else
+	else if (!pipeline_compile_deferred)
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
@@ -2120,7 +2170,7 @@ void CommandBuffer::draw_indexed_multi_indirect(const Buffer &buffer, uint32_t o
 		                                       count.get_buffer(), count_offset,
 		                                       draw_count, stride);
 	}
-	else
+	else if (!pipeline_compile_deferred)
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
@@ -2133,7 +2183,7 @@ void CommandBuffer::draw_indexed_indirect(const Vulkan::Buffer &buffer,
 		table.vkCmdDrawIndexedIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
 		set_backtrace_checkpoint();
 	}
-	else
+	else if (!pipeline_compile_deferred)
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
@@ -2363,6 +2413,8 @@ void CommandBuffer::end()
 	if (table.vkEndCommandBuffer(cmd) != VK_SUCCESS)
 		LOGE("Failed to end command buffer.\n");
 
+	// end() runs on the submitting thread, which need not be the recording thread,
+	// so the blocks go back through the locked path rather than the thread cache.
 	if (vbo_block.mapped)
 		device->request_vertex_block_nolock(vbo_block, 0);
 	if (ibo_block.mapped)
@@ -365,6 +365,11 @@ public:
 
 	void set_bindless(unsigned set, VkDescriptorSet desc_set);
 
+	// Descriptor sets are normally hashed and looked up in a cache, which avoids rewriting sets whose bindings are stable.
+	// For sets which change on every draw, the hash and lookup is wasted work.
+	// Linear sets are instead allocated from per-thread, per-frame pools and written on every flush.
+	void set_descriptor_set_linear(unsigned set, bool linear);
+
 	void push_constants(const void *data, VkDeviceSize offset, VkDeviceSize range);
 
 	void *allocate_constant_data(unsigned set, unsigned binding, VkDeviceSize size);
@@ -687,11 +692,14 @@ private:
 	CommandBufferDirtyFlags dirty = ~0u;
 	uint32_t dirty_sets = 0;
 	uint32_t dirty_sets_dynamic = 0;
+	uint32_t linear_sets = 0;
 	uint32_t dirty_vbos = 0;
 	uint32_t active_vbos = 0;
 	bool uses_swapchain = false;
 	bool is_compute = true;
 	bool is_secondary = false;
+	// Set when a draw is skipped because its pipeline is still being compiled in the background.
+	bool pipeline_compile_deferred = false;
 
 	void set_dirty(CommandBufferDirtyFlags flags)
 	{
@@ -721,6 +729,8 @@ private:
 	void flush_descriptor_sets();
 	void begin_graphics();
 	void flush_descriptor_set(uint32_t set);
+	void flush_linear_descriptor_set(uint32_t set);
+	void write_descriptor_set(uint32_t set, VkDescriptorSet desc_set);
 	void rebind_descriptor_set(uint32_t set);
 	void begin_compute();
 	void begin_context();
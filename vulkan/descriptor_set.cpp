@@ -241,34 +241,27 @@ VkDescriptorPool DescriptorSetAllocator::allocate_bindless_pool(unsigned num_set
 	return pool;
 }
 
+DescriptorSetAllocator::PerThread::PerThread()
+{
+	hashed_hits.store(0, memory_order_relaxed);
+	hashed_misses.store(0, memory_order_relaxed);
+	linear_allocations.store(0, memory_order_relaxed);
+}
+
 void DescriptorSetAllocator::begin_frame()
 {
 	if (!bindless)
 	{
 		for (auto &thr : per_thread)
+		{
 			thr->should_begin = true;
+			thr->linear_should_begin = true;
+		}
 	}
 }
 
-pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index, Hash hash)
+bool DescriptorSetAllocator::allocate_pool(PerThread &state, VkDescriptorSet *sets)
 {
-	VK_ASSERT(!bindless);
-
-	auto &state = *per_thread[thread_index];
-	if (state.should_begin)
-	{
-		state.set_nodes.begin_frame();
-		state.should_begin = false;
-	}
-
-	auto *node = state.set_nodes.request(hash);
-	if (node)
-		return { node->set, true };
-
-	node = state.set_nodes.request_vacant(hash);
-	if (node)
-		return { node->set, false };
-
 	VkDescriptorPool pool;
 	VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
 	info.maxSets = VULKAN_NUM_SETS_PER_POOL;
@@ -281,10 +274,9 @@ pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index,
 	if (table.vkCreateDescriptorPool(device->get_device(), &info, nullptr, &pool) != VK_SUCCESS)
 	{
 		LOGE("Failed to create descriptor pool.\n");
-		return { VK_NULL_HANDLE, false };
+		return false;
 	}
 
-	VkDescriptorSet sets[VULKAN_NUM_SETS_PER_POOL];
 	VkDescriptorSetLayout layouts[VULKAN_NUM_SETS_PER_POOL];
 	fill(begin(layouts), end(layouts), set_layout);
 
@@ -296,6 +288,75 @@ pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index,
 	if (table.vkAllocateDescriptorSets(device->get_device(), &alloc, sets) != VK_SUCCESS)
 		LOGE("Failed to allocate descriptor sets.\n");
 	state.pools.push_back(pool);
+	return true;
+}
+
+VkDescriptorSet DescriptorSetAllocator::allocate_linear(unsigned thread_index, unsigned frame_index)
+{
+	VK_ASSERT(!bindless);
+
+	auto &state = *per_thread[thread_index];
+	if (frame_index >= state.linear_frames.size())
+		state.linear_frames.resize(frame_index + 1);
+	auto &frame = state.linear_frames[frame_index];
+
+	// The first allocation in a new frame context rewinds the sets of that context.
+	// Those were last used at least one full frame ring ago, which the device has already waited for.
+	if (state.linear_should_begin)
+	{
+		frame.offset = 0;
+		state.linear_should_begin = false;
+	}
+
+	if (frame.offset == frame.sets.size())
+	{
+		VkDescriptorSet sets[VULKAN_NUM_SETS_PER_POOL];
+		if (!allocate_pool(state, sets))
+			return VK_NULL_HANDLE;
+		frame.sets.insert(frame.sets.end(), begin(sets), end(sets));
+	}
+
+	state.linear_allocations.fetch_add(1, memory_order_relaxed);
+	return frame.sets[frame.offset++];
+}
+
+void DescriptorSetAllocator::get_statistics(DescriptorSetStatistics &stats) const
+{
+	for (auto &thr : per_thread)
+	{
+		stats.hashed_hits += thr->hashed_hits.load(memory_order_relaxed);
+		stats.hashed_misses += thr->hashed_misses.load(memory_order_relaxed);
+		stats.linear_allocations += thr->linear_allocations.load(memory_order_relaxed);
+	}
+}
+
+pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index, Hash hash)
+{
+	VK_ASSERT(!bindless);
+
+	auto &state = *per_thread[thread_index];
+	if (state.should_begin)
+	{
+		state.set_nodes.begin_frame();
+		state.should_begin = false;
+	}
+
+	auto *node = state.set_nodes.request(hash);
+	if (node)
+	{
+		state.hashed_hits.fetch_add(1, memory_order_relaxed);
+		return { node->set, true };
+	}
+
+	state.hashed_misses.fetch_add(1, memory_order_relaxed);
+
+	node = state.set_nodes.request_vacant(hash);
+	if (node)
+		return { node->set, false };
+
+	VkDescriptorSet sets[VULKAN_NUM_SETS_PER_POOL];
+	if (!allocate_pool(state, sets))
+		return { VK_NULL_HANDLE, false };
 
 	for (auto set : sets)
 		state.set_nodes.make_vacant(set);
@@ -308,6 +369,7 @@ void DescriptorSetAllocator::clear()
 	for (auto &thr : per_thread)
 	{
 		thr->set_nodes.clear();
+		thr->linear_frames.clear();
 		for (auto &pool : thr->pools)
 		{
 			table.vkResetDescriptorPool(device->get_device(), pool, 0);
@@ -30,6 +30,7 @@
 #include "limits.hpp"
 #include <utility>
 #include <vector>
+#include <atomic>
 #include "cookie.hpp"
 
 namespace Vulkan
@@ -116,6 +117,13 @@ enum class BindlessResourceType
 	ImageInt
 };
 
+struct DescriptorSetStatistics
+{
+	uint64_t hashed_hits = 0;
+	uint64_t hashed_misses = 0;
+	uint64_t linear_allocations = 0;
+};
+
 class DescriptorSetAllocator : public HashedObject<DescriptorSetAllocator>
 {
 public:
@@ -127,6 +135,13 @@ public:
 	void begin_frame();
 	std::pair<VkDescriptorSet, bool> find(unsigned thread_index, Util::Hash hash);
 
+	// Returns a set which is not in use by the GPU, and must be fully written before use.
+	// Sets are handed out linearly and are recycled once frame_index comes around again.
+	VkDescriptorSet allocate_linear(unsigned thread_index, unsigned frame_index);
+
+	// Accumulates into stats.
+	void get_statistics(DescriptorSetStatistics &stats) const;
+
 	VkDescriptorSetLayout get_layout() const
 	{
 		return set_layout;
@@ -157,14 +172,31 @@ private:
 	const VolkDeviceTable &table;
 	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
 
+	struct LinearFrame
+	{
+		std::vector<VkDescriptorSet> sets;
+		size_t offset = 0;
+	};
+
 	struct PerThread
 	{
+		PerThread();
+
 		Util::TemporaryHashmap<DescriptorSetNode, VULKAN_DESCRIPTOR_RING_SIZE, true> set_nodes;
 		std::vector<VkDescriptorPool> pools;
+		std::vector<LinearFrame> linear_frames;
 		bool should_begin = true;
+		bool linear_should_begin = true;
+
+		// Only written by the owning thread, but can be read from anywhere.
+		std::atomic<uint64_t> hashed_hits;
+		std::atomic<uint64_t> hashed_misses;
+		std::atomic<uint64_t> linear_allocations;
 	};
 	std::vector<std::unique_ptr<PerThread>> per_thread;
 	std::vector<VkDescriptorPoolSize> pool_size;
 	bool bindless = false;
+
+	bool allocate_pool(PerThread &state, VkDescriptorSet *sets);
 };
 }
@@ -25,6 +25,7 @@
 #include "type_to_string.hpp"
 #include "quirks.hpp"
 #include "timer.hpp"
+#include "cpu_trace.hpp"
 #include <algorithm>
 #include <string.h>
 #include <stdlib.h>
@@ -40,6 +41,7 @@
 
 #ifdef GRANITE_VULKAN_MT
 #include "thread_id.hpp"
+#include "global_managers.hpp"
 static unsigned get_thread_index()
 {
 	return Vulkan::get_current_thread_index();
@@ -74,6 +76,9 @@ Device::Device()
 {
 #ifdef GRANITE_VULKAN_MT
 	cookie.store(0);
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	replayer_state.prewarm_complete.store(true, std::memory_order_relaxed);
+#endif
 #endif
 
 	if (const char *env = getenv("GRANITE_TIMESTAMP_TRACE"))
@@ -725,6 +730,15 @@ void Device::set_context(const Context &context)
 
 	managers.memory.init(this);
 	managers.memory.set_supports_dedicated_allocation(ext.supports_dedicated);
+	if (const char *env = getenv("GRANITE_TLSF_HEAPS"))
+	{
+		// Region size in MiB.
+		uint32_t region_size_mib = strtoul(env, nullptr, 0);
+		if (region_size_mib == 0)
+			region_size_mib = 64;
+		LOGI("Using TLSF heaps with %u MiB regions.\n", region_size_mib);
+		managers.memory.enable_tlsf_heaps(region_size_mib * 1024 * 1024);
+	}
 	managers.semaphore.init(this);
 	managers.fence.init(this);
 	managers.event.init(this);
@@ -740,6 +754,10 @@ void Device::set_context(const Context &context)
 	                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	                      false);
 
+	thread_buffer_blocks.clear();
+	for (unsigned i = 0; i < num_thread_indices; i++)
+		thread_buffer_blocks.emplace_back(new ThreadBufferBlocks);
+
 	graphics.performance_query_pool.init_device(this, graphics_queue_family_index);
 	if (graphics_queue_family_index != compute_queue_family_index)
 		compute.performance_query_pool.init_device(this, compute_queue_family_index);
@@ -988,6 +1006,194 @@ void Device::request_staging_block_nolock(BufferBlock &block, VkDeviceSize size)
 	request_block(*this, block, size, managers.staging, nullptr, frame().staging_blocks);
 }
 
+Device::ThreadBufferBlocks::ThreadBufferBlocks()
+{
+	requests.store(0, memory_order_relaxed);
+	cache_hits.store(0, memory_order_relaxed);
+	refills.store(0, memory_order_relaxed);
+	returns.store(0, memory_order_relaxed);
+}
+
+BufferPool &Device::get_buffer_pool(BufferBlockType type)
+{
+	switch (type)
+	{
+	case BUFFER_BLOCK_TYPE_VERTEX:
+		return managers.vbo;
+	case BUFFER_BLOCK_TYPE_INDEX:
+		return managers.ibo;
+	case BUFFER_BLOCK_TYPE_UNIFORM:
+		return managers.ubo;
+	default:
+		return managers.staging;
+	}
+}
+
+void Device::request_vertex_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index)
+{
+	request_thread_block(BUFFER_BLOCK_TYPE_VERTEX, block, size, thread_index);
+}
+
+void Device::request_index_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index)
+{
+	request_thread_block(BUFFER_BLOCK_TYPE_INDEX, block, size, thread_index);
+}
+
+void Device::request_uniform_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index)
+{
+	request_thread_block(BUFFER_BLOCK_TYPE_UNIFORM, block, size, thread_index);
+}
+
+void Device::request_staging_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index)
+{
+	request_thread_block(BUFFER_BLOCK_TYPE_STAGING, block, size, thread_index);
+}
+
+// Blocks are taken from the pool in batches, and excess blocks are handed back in batches,
+// so the device lock is taken once every few blocks rather than for every block.
+static constexpr size_t ThreadBufferBlockBatch = 4;
+static constexpr size_t ThreadBufferBlockMaxCached = 2 * ThreadBufferBlockBatch;
+
+void Device::request_thread_block(BufferBlockType type, BufferBlock &block, VkDeviceSize size,
+                                  unsigned thread_index)
+{
+	VK_ASSERT(thread_index < thread_buffer_blocks.size());
+	auto &pool = get_buffer_pool(type);
+	auto &cache = *thread_buffer_blocks[thread_index];
+	auto &ready = cache.ready[type];
+
+#ifdef GRANITE_VULKAN_MT
+	std::unique_lock<std::mutex> holder{lock.lock, std::defer_lock};
+	const auto take_lock = [&]() {
+		if (!holder.owns_lock())
+			holder.lock();
+	};
+#else
+	const auto take_lock = []() {};
+#endif
+
+	if (block.mapped)
+		unmap_host_buffer(*block.cpu, MEMORY_ACCESS_WRITE_BIT);
+
+	if (block.offset == 0)
+	{
+		// Never written to, so it can be reused right away.
+		if (block.size == pool.get_block_size())
+			ready.push_back(move(block));
+	}
+	else if (block.cpu != block.gpu)
+	{
+		// DMA copies are flushed on submission, which is shared state.
+		VK_ASSERT(type != BUFFER_BLOCK_TYPE_STAGING);
+		take_lock();
+		if (type == BUFFER_BLOCK_TYPE_VERTEX)
+			dma.vbo.push_back(block);
+		else if (type == BUFFER_BLOCK_TYPE_INDEX)
+			dma.ibo.push_back(block);
+		else
+			dma.ubo.push_back(block);
+
+		if (block.size == pool.get_block_size())
+		{
+			auto &frame_blocks = type == BUFFER_BLOCK_TYPE_VERTEX ? frame().vbo_blocks :
+			                     (type == BUFFER_BLOCK_TYPE_INDEX ? frame().ibo_blocks : frame().ubo_blocks);
+			frame_blocks.push_back(move(block));
+		}
+	}
+	else if (block.size == pool.get_block_size())
+	{
+		// The frame context cannot change while a command buffer is pending, and only the
+		// thread recording on this thread index touches its retired list. CommandBuffer::end()
+		// may run on another thread, so it never comes through here.
+		frame().thread_retired_blocks[thread_index].blocks[type].push_back(move(block));
+	}
+
+	if (ready.size() > ThreadBufferBlockMaxCached)
+	{
+		take_lock();
+		while (ready.size() > ThreadBufferBlockBatch)
+		{
+			pool.recycle_block(move(ready.back()));
+			ready.pop_back();
+		}
+		cache.returns.fetch_add(1, memory_order_relaxed);
+	}
+
+	if (size == 0)
+	{
+		block = {};
+		return;
+	}
+
+	cache.requests.fetch_add(1, memory_order_relaxed);
+
+	if (size > pool.get_block_size())
+	{
+		block = pool.allocate_block(size);
+		return;
+	}
+
+	if (ready.empty())
+	{
+		take_lock();
+		pool.take_blocks(ready, ThreadBufferBlockBatch);
+		cache.refills.fetch_add(1, memory_order_relaxed);
+	}
+	else
+		cache.cache_hits.fetch_add(1, memory_order_relaxed);
+
+#ifdef GRANITE_VULKAN_MT
+	if (holder.owns_lock())
+		holder.unlock();
+#endif
+
+	if (ready.empty())
+	{
+		block = pool.allocate_block(pool.get_block_size());
+	}
+	else
+	{
+		block = move(ready.back());
+		ready.pop_back();
+		block.mapped = static_cast<uint8_t *>(map_host_buffer(*block.cpu, MEMORY_ACCESS_WRITE_BIT));
+		block.offset = 0;
+	}
+}
+
+void Device::clear_thread_buffer_blocks()
+{
+	for (auto &cache : thread_buffer_blocks)
+		for (auto &ready : cache->ready)
+			ready.clear();
+
+	for (auto &frame : per_frame)
+		for (auto &retired : frame->thread_retired_blocks)
+			for (auto &blocks : retired.blocks)
+				blocks.clear();
+}
+
+Device::BufferBlockStatistics Device::get_buffer_block_statistics(unsigned thread_index) const
+{
+	BufferBlockStatistics stats = {};
+	if (thread_index < thread_buffer_blocks.size())
+	{
+		auto &cache = *thread_buffer_blocks[thread_index];
+		stats.requests = cache.requests.load(memory_order_relaxed);
+		stats.cache_hits = cache.cache_hits.load(memory_order_relaxed);
+		stats.refills = cache.refills.load(memory_order_relaxed);
+		stats.returns = cache.returns.load(memory_order_relaxed);
+	}
+	return stats;
+}
+
+DescriptorSetStatistics Device::get_descriptor_set_statistics()
+{
+	DescriptorSetStatistics stats;
+	for (auto &allocator : descriptor_set_allocators)
+		allocator.get_statistics(stats);
+	return stats;
+}
+
 void Device::submit(CommandBufferHandle &cmd, Fence *fence, unsigned semaphore_count, Semaphore *semaphores)
 {
 	cmd->end_debug_channel();
@@ -2020,9 +2226,13 @@ bool Device::swapchain_touched() const
 
 Device::~Device()
 {
+#ifdef GRANITE_VULKAN_MT
+	wait_pipeline_compiles();
+#endif
 	wait_idle();
 
 	managers.timestamps.log_simple();
+	managers.memory.log_tlsf_statistics();
 
 	wsi.acquire.reset();
 	wsi.release.reset();
@@ -2178,6 +2388,8 @@ Device::PerFrame::PerFrame(Device *device_, unsigned frame_index_)
 		compute_cmd_pool.emplace_back(device_, device_->compute_queue_family_index);
 		transfer_cmd_pool.emplace_back(device_, device_->transfer_queue_family_index);
 	}
+
+	thread_retired_blocks.resize(count);
 }
 
 void Device::keep_handle_alive(ImageHandle handle)
@@ -2405,6 +2617,7 @@ void Device::wait_idle_nolock()
 	clear_wait_semaphores();
 
 	// Free memory for buffer pools.
+	clear_thread_buffer_blocks();
 	managers.vbo.reset();
 	managers.ubo.reset();
 	managers.ibo.reset();
@@ -2457,7 +2670,132 @@ void Device::next_frame_context()
 	frame().begin();
 	recalibrate_timestamps();
 	frame_context_begin_ts = write_calibrated_timestamp_nolock();
+#ifdef GRANITE_VULKAN_MT
+	begin_frame_async_pipelines();
+#endif
+}
+
+#ifdef GRANITE_VULKAN_MT
+void Device::set_pipeline_compile_deferral(unsigned max_deferred_frames)
+{
+	std::lock_guard<std::mutex> holder{async_pipelines.lock};
+	async_pipelines.max_deferred_frames = max_deferred_frames;
+}
+
+void Device::begin_frame_async_pipelines()
+{
+	std::lock_guard<std::mutex> holder{async_pipelines.lock};
+	async_pipelines.frame_count++;
+
+	// Compiles which have completed are visible in the program's pipeline table, no need to track them anymore.
+	auto itr = async_pipelines.pending.begin();
+	while (itr != async_pipelines.pending.end())
+	{
+		auto &job = *itr->second;
+		bool done;
+		{
+			std::lock_guard<std::mutex> job_holder{job.lock};
+			done = job.done;
+		}
+
+		if (done)
+			itr = async_pipelines.pending.erase(itr);
+		else
+			++itr;
+	}
+}
+
+void Device::run_async_pipeline_compile(AsyncPipelineCompile &job)
+{
+	if (job.claimed.exchange(true, std::memory_order_acq_rel))
+		return;
+
+	CommandBuffer::build_graphics_pipeline(this, job.compile);
+
+	std::lock_guard<std::mutex> holder{job.lock};
+	job.done = true;
+	job.cond.notify_all();
+}
+
+void Device::wait_async_pipeline_compile(AsyncPipelineCompile &job)
+{
+	// If no worker has picked up the compile yet, just do it ourselves.
+	// Blocking on a queued task could deadlock if we are a worker thread ourselves.
+	run_async_pipeline_compile(job);
+
+	std::unique_lock<std::mutex> holder{job.lock};
+	job.cond.wait(holder, [&]() {
+		return job.done;
+	});
+}
+
+VkPipeline Device::request_deferred_graphics_pipeline(const DeferredPipelineCompile &compile, bool &deferred)
+{
+	deferred = false;
+	auto *thread_group = Granite::Global::thread_group();
+
+	AsyncPipelineCompileHandle job;
+	{
+		std::unique_lock<std::mutex> holder{async_pipelines.lock};
+		if (async_pipelines.max_deferred_frames == 0 || !thread_group)
+		{
+			// Recording threads must not serialize on each other's compiles.
+			holder.unlock();
+			return CommandBuffer::build_graphics_pipeline(this, compile);
+		}
+
+		auto itr = async_pipelines.pending.find(compile.hash);
+		if (itr == async_pipelines.pending.end())
+		{
+			job = Util::make_handle<AsyncPipelineCompile>();
+			job->compile = compile;
+			job->frame = async_pipelines.frame_count;
+			async_pipelines.pending[compile.hash] = job;
+
+			auto task = thread_group->create_task([this, job]() {
+				run_async_pipeline_compile(*job);
+			});
+			thread_group->submit(task);
+
+			deferred = true;
+			return VK_NULL_HANDLE;
+		}
+
+		job = itr->second;
+
+		// The compile might have completed after the command buffer looked up the pipeline.
+		VkPipeline pipeline = compile.program->get_pipeline(compile.hash);
+		if (pipeline != VK_NULL_HANDLE)
+			return pipeline;
+
+		if (async_pipelines.frame_count - job->frame < async_pipelines.max_deferred_frames)
+		{
+			deferred = true;
+			return VK_NULL_HANDLE;
+		}
+	}
+
+	// We have been skipping draws for long enough.
+	wait_async_pipeline_compile(*job);
+	return compile.program->get_pipeline(compile.hash);
+}
+
+void Device::wait_pipeline_compiles()
+{
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	wait_pipeline_prewarm();
+#endif
+
+	std::unordered_map<Util::Hash, AsyncPipelineCompileHandle> pending;
+	{
+		std::lock_guard<std::mutex> holder{async_pipelines.lock};
+		std::swap(pending, async_pipelines.pending);
+	}
+
+	for (auto &job : pending)
+		wait_async_pipeline_compile(*job.second);
 }
+#endif
 
 QueryPoolHandle Device::write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
 {
@@ -2773,6 +3111,17 @@ void Device::PerFrame::begin()
 	ubo_blocks.clear();
 	staging_blocks.clear();
 
+	for (auto &retired : thread_retired_blocks)
+	{
+		for (unsigned type = 0; type < BUFFER_BLOCK_TYPE_COUNT; type++)
+		{
+			auto &pool = device.get_buffer_pool(BufferBlockType(type));
+			for (auto &block : retired.blocks[type])
+				pool.recycle_block(move(block));
+			retired.blocks[type].clear();
+		}
+	}
+
 	destroyed_framebuffers.clear();
 	destroyed_samplers.clear();
 	destroyed_pipelines.clear();
@@ -2802,6 +3151,7 @@ void Device::PerFrame::begin()
 		}
 	}
 	device.write_json_timestamp_range_us(frame_index, "CPU + GPU", "full frame lifetime", min_timestamp_us, max_timestamp_us);
+	device.write_json_cpu_trace(frame_index);
 	managers.timestamps.mark_end_of_frame_context();
 	timestamp_intervals.clear();
 }
@@ -4849,6 +5199,10 @@ bool Device::init_timestamp_trace(const char *path)
 	json_trace_file.reset(fopen(path, "w"));
 	if (json_trace_file)
 		fprintf(json_trace_file.get(), "[");
+
+	// CPU trace zones are merged into the same timeline.
+	if (json_trace_file)
+		Util::CPUTrace::set_enabled(true);
 	return bool(json_trace_file);
 }
 
@@ -4901,6 +5255,25 @@ void Device::write_json_timestamp_range_us(unsigned frame_index, const char *tid
 	        name, tid, frame_index, static_cast<long long>(end_us));
 }
 
+void Device::write_json_cpu_trace(unsigned frame_index)
+{
+	if (!json_trace_file)
+		return;
+
+	if (json_timestamp_origin == 0)
+		convert_timestamp_to_absolute_usec(calibrated_timestamp_device);
+
+	// Find the host time which corresponds to the GPU timestamp origin through the calibration point.
+	int64_t calibrated_ticks = json_base_timestamp_value +
+	                           convert_to_signed_delta(json_base_timestamp_value, calibrated_timestamp_device,
+	                                                   timestamp_valid_bits);
+	auto calibrated_ns_from_origin = int64_t(double(calibrated_ticks - json_timestamp_origin) *
+	                                         gpu_props.limits.timestampPeriod);
+	int64_t origin_ns = calibrated_timestamp_host - calibrated_ns_from_origin;
+
+	Util::CPUTrace::write_json_events(json_trace_file.get(), origin_ns, frame_index);
+}
+
 void Device::JSONTraceFileDeleter::operator()(FILE *file)
 {
 	// Intentionally truncate the JSON so that we can emit "," after the last element.
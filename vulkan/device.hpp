@@ -42,6 +42,7 @@
 #include <vector>
 #include <functional>
 #include <unordered_map>
+#include <atomic>
 #include <stdio.h>
 
 #ifdef GRANITE_VULKAN_FILESYSTEM
@@ -50,9 +51,10 @@
 #endif
 
 #ifdef GRANITE_VULKAN_MT
-#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
+#include "thread_group.hpp"
 #endif
 
 #ifdef GRANITE_VULKAN_FOSSILIZE
@@ -191,6 +193,41 @@ public:
 	void wait_idle();
 	void end_frame_context();
 
+#ifdef GRANITE_VULKAN_MT
+	// Asynchronous pipeline compilation.
+	// If a draw misses its pipeline, the pipeline is compiled on the thread group, and draws which need it
+	// are skipped until it is ready. Once a compile has been pending for more than max_deferred_frames
+	// frame contexts, the command buffer waits for it instead, so a draw is never skipped indefinitely.
+	// Compute pipelines are never deferred, as skipping a dispatch is rarely benign.
+	// 0 disables deferral and pipelines are compiled synchronously on a miss, which is the default.
+	void set_pipeline_compile_deferral(unsigned max_deferred_frames);
+	// Waits for all pipeline compiles in flight, including the Fossilize pre-warm.
+	void wait_pipeline_compiles();
+#endif
+
+#ifdef GRANITE_VULKAN_FOSSILIZE
+	// Pipelines recorded by Fossilize in earlier runs are replayed in the background on device creation.
+	// They are published to the same pipeline tables as the pipelines command buffers create.
+	bool is_pipeline_prewarm_complete() const;
+#endif
+
+	// Command buffers allocate vertex, index, uniform and staging blocks from a cache owned by their thread index.
+	// The device lock is only taken to refill or trim the cache, or to queue a DMA copy
+	// when blocks are not host-visible.
+	struct BufferBlockStatistics
+	{
+		uint64_t requests;
+		uint64_t cache_hits;
+		uint64_t refills;
+		uint64_t returns;
+	};
+	BufferBlockStatistics get_buffer_block_statistics(unsigned thread_index) const;
+
+	// Hit rate of the hashed descriptor set cache, and the number of linearly allocated sets,
+	// summed over all descriptor set layouts and threads.
+	// Iterates over the layouts, so it should not race with threads requesting new programs.
+	DescriptorSetStatistics get_descriptor_set_statistics();
+
 	// RenderDoc integration API for app-guided captures.
 	static bool init_renderdoc_capture();
 	// Calls next_frame_context() and begins a renderdoc capture.
@@ -362,6 +399,10 @@ private:
 	void request_index_block(BufferBlock &block, VkDeviceSize size);
 	void request_uniform_block(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block(BufferBlock &block, VkDeviceSize size);
+	void request_vertex_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index);
+	void request_index_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index);
+	void request_uniform_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index);
+	void request_staging_block(BufferBlock &block, VkDeviceSize size, unsigned thread_index);
 
 	QueryPoolHandle write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage);
 
@@ -392,6 +433,7 @@ private:
 	                                uint64_t start_ts, uint64_t end_ts,
 	                                int64_t &min_us, int64_t &max_us);
 	void write_json_timestamp_range_us(unsigned frame_index, const char *tid, const char *name, int64_t start_us, int64_t end_us);
+	void write_json_cpu_trace(unsigned frame_index);
 
 	QueryPoolHandle write_timestamp_nolock(VkCommandBuffer cmd, VkPipelineStageFlagBits stage);
 	QueryPoolHandle write_calibrated_timestamp_nolock();
@@ -433,6 +475,28 @@ private:
 		unsigned counter = 0;
 	} lock;
 
+	enum BufferBlockType
+	{
+		BUFFER_BLOCK_TYPE_VERTEX = 0,
+		BUFFER_BLOCK_TYPE_INDEX,
+		BUFFER_BLOCK_TYPE_UNIFORM,
+		BUFFER_BLOCK_TYPE_STAGING,
+		BUFFER_BLOCK_TYPE_COUNT
+	};
+
+	struct ThreadBufferBlocks
+	{
+		ThreadBufferBlocks();
+
+		// Unused blocks, unmapped, which can be handed out without taking the device lock.
+		std::vector<BufferBlock> ready[BUFFER_BLOCK_TYPE_COUNT];
+		std::atomic<uint64_t> requests;
+		std::atomic<uint64_t> cache_hits;
+		std::atomic<uint64_t> refills;
+		std::atomic<uint64_t> returns;
+	};
+	std::vector<std::unique_ptr<ThreadBufferBlocks>> thread_buffer_blocks;
+
 	struct PerFrame
 	{
 		PerFrame(Device *device, unsigned index);
@@ -456,6 +520,13 @@ private:
 		std::vector<BufferBlock> ubo_blocks;
 		std::vector<BufferBlock> staging_blocks;
 
+		// Blocks retired by a thread index without taking the device lock.
+		struct ThreadRetiredBlocks
+		{
+			std::vector<BufferBlock> blocks[BUFFER_BLOCK_TYPE_COUNT];
+		};
+		std::vector<ThreadRetiredBlocks> thread_retired_blocks;
+
 		VkSemaphore graphics_timeline_semaphore;
 		VkSemaphore compute_timeline_semaphore;
 		VkSemaphore transfer_timeline_semaphore;
@@ -653,6 +724,12 @@ private:
 	void request_uniform_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block_nolock(BufferBlock &block, VkDeviceSize size);
 
+	// Fast path for command buffers, only to be called from the thread recording on thread_index.
+	void request_thread_block(BufferBlockType type, BufferBlock &block, VkDeviceSize size,
+	                          unsigned thread_index);
+	BufferPool &get_buffer_pool(BufferBlockType type);
+	void clear_thread_buffer_blocks();
+
 	CommandBufferHandle request_secondary_command_buffer_for_thread(unsigned thread_index,
 	                                                                const Framebuffer *framebuffer,
 	                                                                unsigned subpass,
@@ -702,13 +779,53 @@ private:
 		std::unordered_map<VkRenderPass, RenderPass *> render_pass_map;
 #ifdef GRANITE_VULKAN_MT
 		Granite::TaskGroup pipeline_group;
+		std::thread prewarm_thread;
+		std::atomic_bool prewarm_complete;
 #endif
 	} replayer_state;
 
 	void init_pipeline_state();
+	void replay_pipeline_state(const void *data, size_t size);
+	void wait_pipeline_prewarm();
 	void flush_pipeline_state();
 #endif
 
+#ifdef GRANITE_VULKAN_MT
+	struct AsyncPipelineCompile : Util::IntrusivePtrEnabled<AsyncPipelineCompile,
+	                                                        std::default_delete<AsyncPipelineCompile>,
+	                                                        Util::MultiThreadCounter>
+	{
+		AsyncPipelineCompile()
+		{
+			claimed.store(false, std::memory_order_relaxed);
+		}
+
+		DeferredPipelineCompile compile;
+		uint64_t frame = 0;
+		// Whoever claims the compile first builds the pipeline, either a worker or a recording thread which
+		// has run out of patience. This way we never block a worker on a task which is still queued.
+		std::atomic_bool claimed;
+		std::mutex lock;
+		std::condition_variable cond;
+		bool done = false;
+	};
+	using AsyncPipelineCompileHandle = Util::IntrusivePtr<AsyncPipelineCompile>;
+
+	struct
+	{
+		std::mutex lock;
+		std::unordered_map<Util::Hash, AsyncPipelineCompileHandle> pending;
+		uint64_t frame_count = 0;
+		unsigned max_deferred_frames = 0;
+	} async_pipelines;
+
+	// Returns VK_NULL_HANDLE and sets deferred if the draw should be skipped while the pipeline compiles.
+	VkPipeline request_deferred_graphics_pipeline(const DeferredPipelineCompile &compile, bool &deferred);
+	void run_async_pipeline_compile(AsyncPipelineCompile &job);
+	void wait_async_pipeline_compile(AsyncPipelineCompile &job);
+	void begin_frame_async_pipelines();
+#endif
+
 	ImplementationWorkarounds workarounds;
 	void init_workarounds();
 	void report_checkpoints();
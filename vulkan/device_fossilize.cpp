@@ -207,13 +207,29 @@ bool Device::enqueue_create_pipeline_layout(Fossilize::Hash, const VkPipelineLay
 	return true;
 }
 
+void Device::replay_pipeline_state(const void *data, size_t size)
+{
+	LOGI("Replaying cached state.\n");
+	Fossilize::StateReplayer replayer;
+	auto start = Util::get_current_time_nsecs();
+	replayer.parse(*this, nullptr, static_cast<const char *>(data), size);
+	auto end = Util::get_current_time_nsecs();
+	LOGI("Completed replaying cached state in %.3f ms.\n", (end - start) * 1e-6);
+	replayer_state.shader_map.clear();
+	replayer_state.render_pass_map.clear();
+}
+
+// The Fossilize hashes recorded here are Util::Hasher hashes,
+// so the cache is versioned along with the hash scheme.
+static const char PipelineStateCachePath[] = "cache://pipelines.v2.json";
+
 void Device::init_pipeline_state()
 {
 	state_recorder.init_recording_thread(nullptr);
 
 	auto file = Granite::Global::filesystem()->open("assets://pipelines.json", Granite::FileMode::ReadOnly);
 	if (!file)
-		file = Granite::Global::filesystem()->open("cache://pipelines.json", Granite::FileMode::ReadOnly);
+		file = Granite::Global::filesystem()->open(PipelineStateCachePath, Granite::FileMode::ReadOnly);
 
 	if (!file)
 		return;
@@ -225,13 +241,37 @@ void Device::init_pipeline_state()
 		return;
 	}
 
-	LOGI("Replaying cached state.\n");
-	Fossilize::StateReplayer replayer;
-	auto start = Util::get_current_time_nsecs();
-	replayer.parse(*this, nullptr, static_cast<const char *>(mapped), file->get_size());
-	auto end = Util::get_current_time_nsecs();
-	LOGI("Completed replaying cached state in %.3f ms.\n", (end - start) * 1e-6);
-	replayer_state = {};
+#ifdef GRANITE_VULKAN_MT
+	// Pre-warm in the background so device creation does not stall on pipeline compilation.
+	// Any pipeline a command buffer needs before the replay gets to it is compiled on demand as usual.
+	replayer_state.prewarm_complete.store(false, std::memory_order_relaxed);
+	auto ctx = std::shared_ptr<Granite::Global::GlobalManagers>(Granite::Global::create_thread_context().release(),
+	                                                            Granite::Global::delete_thread_context);
+	replayer_state.prewarm_thread = std::thread([this, ctx, mapped, f = std::move(file)]() {
+		Granite::Global::set_thread_context(*ctx);
+		replay_pipeline_state(mapped, f->get_size());
+		replayer_state.prewarm_complete.store(true, std::memory_order_release);
+	});
+#else
+	replay_pipeline_state(mapped, file->get_size());
+#endif
+}
+
+void Device::wait_pipeline_prewarm()
+{
+#ifdef GRANITE_VULKAN_MT
+	if (replayer_state.prewarm_thread.joinable())
+		replayer_state.prewarm_thread.join();
+#endif
+}
+
+bool Device::is_pipeline_prewarm_complete() const
+{
+#ifdef GRANITE_VULKAN_MT
+	return replayer_state.prewarm_complete.load(std::memory_order_acquire);
+#else
+	return true;
+#endif
 }
 
 void Device::flush_pipeline_state()
@@ -244,7 +284,7 @@ void Device::flush_pipeline_state()
 		return;
 	}
 
-	auto file = Granite::Global::filesystem()->open("cache://pipelines.json", Granite::FileMode::WriteOnly);
+	auto file = Granite::Global::filesystem()->open(PipelineStateCachePath, Granite::FileMode::WriteOnly);
 	if (file)
 	{
 		auto *data = static_cast<uint8_t *>(file->map_write(serialized_size));
@@ -21,11 +21,15 @@
  */
 
 #include <cstring>
+#include <stdio.h>
 #include <algorithm>
 #include "path.hpp"
 #include "shader_manager.hpp"
 #include "device.hpp"
 #include "rapidjson_wrapper.hpp"
+#ifdef GRANITE_VULKAN_MT
+#include "thread_group.hpp"
+#endif
 
 using namespace std;
 using namespace Util;
@@ -38,15 +42,18 @@ using namespace Util;
 
 namespace Vulkan
 {
-ShaderTemplate::ShaderTemplate(Device *device_, const std::string &shader_path,
+ShaderTemplate::ShaderTemplate(Device *device_, ShaderManager *manager_, const std::string &shader_path,
                                PrecomputedShaderCache &cache_,
                                Util::Hash path_hash_,
                                const std::vector<std::string> &include_directories_)
 	: device(device_), path(shader_path), cache(cache_), path_hash(path_hash_)
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
-	, include_directories(include_directories_)
+	, manager(manager_), include_directories(include_directories_)
 #endif
 {
+#ifndef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	(void)manager_;
+#endif
 }
 
 bool ShaderTemplate::init()
@@ -64,6 +71,7 @@ bool ShaderTemplate::init()
 		compiler.reset();
 		return false;
 	}
+	update_source_hash();
 #else
 	(void)include_directories;
 #endif
@@ -71,6 +79,45 @@ bool ShaderTemplate::init()
 	return true;
 }
 
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+void ShaderTemplate::update_source_hash()
+{
+	Hasher h;
+	// The path ends up in the debug info of unstripped SPIR-V.
+	h.string(compiler->get_source_path());
+	h.u64(Granite::GLSLCompiler::get_compiler_version_hash());
+	h.string(compiler->get_preprocessed_source());
+	h.u32(uint32_t(compiler->get_target()));
+	h.u32(uint32_t(compiler->get_stage()));
+	h.u32(uint32_t(compiler->get_optimization()));
+	h.u32(uint32_t(compiler->get_strip()));
+	source_hash = h.get();
+}
+
+vector<uint32_t> ShaderTemplate::compile_variant(const vector<pair<string, int>> *defines, string &error) const
+{
+	Hasher h(source_hash);
+	if (defines)
+	{
+		for (auto &define : *defines)
+		{
+			h.string(define.first);
+			h.s32(define.second);
+		}
+	}
+	auto key = h.get();
+
+	vector<uint32_t> spirv;
+	if (manager->load_spirv_blob(key, spirv))
+		return spirv;
+
+	spirv = compiler->compile(error, defines);
+	if (!spirv.empty())
+		manager->save_spirv_blob(key, spirv);
+	return spirv;
+}
+#endif
+
 const ShaderTemplate::Variant *ShaderTemplate::register_variant(const std::vector<std::pair<std::string, int>> *defines)
 {
 	Hasher h;
@@ -98,10 +145,11 @@ const ShaderTemplate::Variant *ShaderTemplate::register_variant(const std::vecto
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 			if (compiler)
 			{
-				variant->spirv = compiler->compile(defines);
+				string error;
+				variant->spirv = compile_variant(defines, error);
 				if (variant->spirv.empty())
 				{
-					LOGE("Shader error:\n%s\n", compiler->get_error_message().c_str());
+					LOGE("Shader error:\n%s\n", error.c_str());
 					variants.free(variant);
 					return nullptr;
 				}
@@ -140,13 +188,15 @@ void ShaderTemplate::recompile()
 		return;
 	}
 	compiler = move(newcompiler);
+	update_source_hash();
 
 	for (auto &variant : variants)
 	{
-		auto newspirv = compiler->compile(&variant.defines);
+		string error;
+		auto newspirv = compile_variant(&variant.defines, error);
 		if (newspirv.empty())
 		{
-			LOGE("Failed to compile shader: %s\n%s\n", path.c_str(), compiler->get_error_message().c_str());
+			LOGE("Failed to compile shader: %s\n%s\n", path.c_str(), error.c_str());
 			for (auto &define : variant.defines)
 				LOGE("  Define: %s = %d\n", define.first.c_str(), define.second);
 			continue;
@@ -344,7 +394,7 @@ ShaderTemplate *ShaderManager::get_template(const std::string &path)
 	auto *ret = shaders.find(hash);
 	if (!ret)
 	{
-		auto *shader = shaders.allocate(device, path, shader_cache, hasher.get(), include_directories);
+		auto *shader = shaders.allocate(device, this, path, shader_cache, hasher.get(), include_directories);
 		if (!shader->init())
 		{
 			shaders.free(shader);
@@ -441,6 +491,152 @@ void ShaderManager::add_directory_watch(const std::string &source)
 }
 #endif
 
+void ShaderManager::prewarm(const vector<PrewarmEntry> &entries)
+{
+	// Compiling the SPIR-V is the expensive part, and every template variant is independent.
+	struct Job
+	{
+		ShaderTemplate *shader;
+		const vector<pair<string, int>> *defines;
+	};
+	vector<Job> jobs;
+	unordered_set<Hash> seen_variants;
+
+	for (auto &entry : entries)
+	{
+		for (unsigned i = 0; i < static_cast<unsigned>(ShaderStage::Count); i++)
+		{
+			auto *shader = entry.program->get_stage(static_cast<ShaderStage>(i));
+			if (!shader)
+				continue;
+
+			Hasher h;
+			h.u64(shader->get_path_hash());
+			for (auto &define : entry.defines)
+			{
+				h.string(define.first);
+				h.s32(define.second);
+			}
+
+			if (seen_variants.insert(h.get()).second)
+				jobs.push_back({ shader, &entry.defines });
+		}
+	}
+
+#ifdef GRANITE_VULKAN_MT
+	auto *workers = Granite::Global::thread_group();
+	if (workers && workers->get_num_threads() != 0)
+	{
+		auto group = workers->create_task();
+		for (auto &job : jobs)
+		{
+			group->enqueue_task([job]() {
+				job.shader->register_variant(job.defines);
+			});
+		}
+		group->wait();
+	}
+	else
+#endif
+	{
+		for (auto &job : jobs)
+			job.shader->register_variant(job.defines);
+	}
+
+	// Creating the programs goes through the device, keep that on the calling thread.
+	for (auto &entry : entries)
+		entry.program->register_variant(entry.defines);
+}
+
+void ShaderManager::set_spirv_blob_cache_prefix(const string &prefix)
+{
+	spirv_blob_cache_prefix = prefix;
+}
+
+struct SPIRVBlobHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	Hash key;
+	Hash payload_hash;
+};
+static const uint32_t SPIRVBlobMagic = 0x56505347; // GSPV
+// Version 2: payload hashes and keys use the bulk path in Util::Hasher.
+static const uint32_t SPIRVBlobVersion = 2;
+
+static string spirv_blob_path(const string &prefix, Hash key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key));
+	return prefix + name;
+}
+
+static Hash spirv_payload_hash(const vector<uint32_t> &spirv)
+{
+	Hasher h;
+	h.data(spirv.data(), spirv.size() * sizeof(uint32_t));
+	return h.get();
+}
+
+bool ShaderManager::load_spirv_blob(Hash key, vector<uint32_t> &spirv)
+{
+	if (spirv_blob_cache_prefix.empty())
+		return false;
+
+	auto file = Granite::Global::filesystem()->open(spirv_blob_path(spirv_blob_cache_prefix, key));
+	if (!file)
+		return false;
+
+	size_t size = file->get_size();
+	if (size <= sizeof(SPIRVBlobHeader) || ((size - sizeof(SPIRVBlobHeader)) & 3) != 0)
+		return false;
+
+	auto *mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		return false;
+
+	SPIRVBlobHeader header;
+	memcpy(&header, mapped, sizeof(header));
+	if (header.magic != SPIRVBlobMagic || header.version != SPIRVBlobVersion || header.key != key)
+		return false;
+
+	spirv.resize((size - sizeof(SPIRVBlobHeader)) / sizeof(uint32_t));
+	memcpy(spirv.data(), mapped + sizeof(SPIRVBlobHeader), spirv.size() * sizeof(uint32_t));
+
+	// Guard against truncated or partially written blobs.
+	if (spirv_payload_hash(spirv) != header.payload_hash || spirv.front() != 0x07230203u)
+	{
+		spirv.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void ShaderManager::save_spirv_blob(Hash key, const vector<uint32_t> &spirv)
+{
+	if (spirv_blob_cache_prefix.empty())
+		return;
+
+	auto path = spirv_blob_path(spirv_blob_cache_prefix, key);
+	auto file = Granite::Global::filesystem()->open(path, Granite::FileMode::WriteOnly);
+	if (!file)
+		return;
+
+	SPIRVBlobHeader header = { SPIRVBlobMagic, SPIRVBlobVersion, key, spirv_payload_hash(spirv) };
+	size_t payload_size = spirv.size() * sizeof(uint32_t);
+	auto *mapped = static_cast<uint8_t *>(file->map_write(sizeof(header) + payload_size));
+	if (!mapped)
+	{
+		LOGE("Failed to map SPIR-V blob %s for writing.\n", path.c_str());
+		return;
+	}
+
+	memcpy(mapped, &header, sizeof(header));
+	memcpy(mapped + sizeof(header), spirv.data(), payload_size);
+	file->unmap();
+}
+
 void ShaderManager::register_shader_hash_from_variant_hash(Hash variant_hash, Hash shader_hash)
 {
 	shader_cache.emplace_replace(variant_hash, shader_hash);
@@ -457,6 +653,9 @@ void ShaderManager::add_include_directory(const string &path)
 		include_directories.push_back(path);
 }
 
+// Maps are stored by Util::Hasher hashes, so bump this whenever the hash scheme changes.
+static const unsigned ShaderCacheVersion = 2;
+
 bool ShaderManager::load_shader_cache(const string &path)
 {
 	using namespace rapidjson;
@@ -473,6 +672,12 @@ bool ShaderManager::load_shader_cache(const string &path)
 		return false;
 	}
 
+	if (!doc.HasMember("version") || doc["version"].GetUint() != ShaderCacheVersion)
+	{
+		LOGW("Shader cache %s is from an older version, ignoring.\n", path.c_str());
+		return false;
+	}
+
 	auto &maps = doc["maps"];
 	for (auto itr = maps.Begin(); itr != maps.End(); ++itr)
 	{
@@ -501,6 +706,7 @@ bool ShaderManager::save_shader_cache(const string &path)
 		maps.PushBack(map_entry, allocator);
 	}
 
+	doc.AddMember("version", ShaderCacheVersion, allocator);
 	doc.AddMember("maps", maps, allocator);
 
 	StringBuffer buffer;
@@ -47,7 +47,8 @@ class Device;
 class ShaderTemplate : public Util::IntrusiveHashMapEnabled<ShaderTemplate>
 {
 public:
-	ShaderTemplate(Device *device, const std::string &shader_path, PrecomputedShaderCache &cache, Util::Hash path_hash,
+	ShaderTemplate(Device *device, ShaderManager *manager, const std::string &shader_path,
+	               PrecomputedShaderCache &cache, Util::Hash path_hash,
 	               const std::vector<std::string> &include_directories);
 
 	bool init();
@@ -61,6 +62,7 @@ public:
 		unsigned instance = 0;
 	};
 
+	// Thread-safe with GRANITE_VULKAN_MT, except against recompile().
 	const Variant *register_variant(const std::vector<std::pair<std::string, int>> *defines = nullptr);
 	void recompile();
 	void register_dependencies(ShaderManager &manager);
@@ -76,8 +78,13 @@ private:
 	PrecomputedShaderCache &cache;
 	Util::Hash path_hash = 0;
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+	ShaderManager *manager;
 	std::unique_ptr<Granite::GLSLCompiler> compiler;
 	const std::vector<std::string> &include_directories;
+	Util::Hash source_hash = 0;
+
+	void update_source_hash();
+	std::vector<uint32_t> compile_variant(const std::vector<std::pair<std::string, int>> *defines, std::string &error) const;
 #endif
 	VulkanCache<Variant> variants;
 };
@@ -100,6 +107,12 @@ public:
 
 	Vulkan::Program *get_program(unsigned variant);
 	void set_stage(Vulkan::ShaderStage stage, ShaderTemplate *shader);
+
+	ShaderTemplate *get_stage(Vulkan::ShaderStage stage) const
+	{
+		return stages[static_cast<unsigned>(stage)];
+	}
+
 	unsigned register_variant(const std::vector<std::pair<std::string, int>> &defines);
 
 private:
@@ -135,6 +148,22 @@ public:
 	bool load_shader_cache(const std::string &path);
 	bool save_shader_cache(const std::string &path);
 
+	// Compiled SPIR-V is stored as <prefix><hash>.spv, keyed by the preprocessed source, defines and compiler options,
+	// so unchanged variants are loaded instead of recompiled. An empty prefix disables the blob cache.
+	void set_spirv_blob_cache_prefix(const std::string &prefix);
+	bool load_spirv_blob(Util::Hash key, std::vector<uint32_t> &spirv);
+	void save_spirv_blob(Util::Hash key, const std::vector<uint32_t> &spirv);
+
+	struct PrewarmEntry
+	{
+		ShaderProgram *program;
+		std::vector<std::pair<std::string, int>> defines;
+	};
+
+	// Compiles SPIR-V for all variants up front, in parallel on the thread group with GRANITE_VULKAN_MT,
+	// then registers the program variants. Must not be called from a thread group worker.
+	void prewarm(const std::vector<PrewarmEntry> &entries);
+
 	void add_include_directory(const std::string &path);
 
 	~ShaderManager();
@@ -161,6 +190,7 @@ private:
 	VulkanCache<ShaderTemplate> shaders;
 	VulkanCache<ShaderProgram> programs;
 	std::vector<std::string> include_directories;
+	std::string spirv_blob_cache_prefix = "cache://spirv-";
 
 	ShaderTemplate *get_template(const std::string &source);
 
@@ -25,6 +25,7 @@
 #include "stb_image.h"
 #include "memory_mapped_texture.hpp"
 #include "texture_files.hpp"
+#include "cpu_trace.hpp"
 
 #ifdef GRANITE_VULKAN_MT
 #include "thread_group.hpp"
@@ -62,6 +63,7 @@ void Texture::update(std::unique_ptr<Granite::File> file)
 {
 	auto *f = file.release();
 	auto work = [f, this]() {
+		GRANITE_CPU_TRACE_ZONE("Texture::update");
 #if defined(GRANITE_VULKAN_MT) && defined(VULKAN_DEBUG)
 		LOGI("Loading texture in thread index: %u\n", get_current_thread_index());
 #endif
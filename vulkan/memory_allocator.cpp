@@ -37,6 +37,16 @@ namespace Vulkan
 
 void DeviceAllocation::free_immediate()
 {
+	if (tlsf_heap)
+	{
+		tlsf_heap->free(this);
+		tlsf_heap = nullptr;
+		base = VK_NULL_HANDLE;
+		host_base = nullptr;
+		offset = 0;
+		return;
+	}
+
 	if (!alloc)
 		return;
 
@@ -49,7 +59,7 @@ void DeviceAllocation::free_immediate()
 
 void DeviceAllocation::free_immediate(DeviceAllocator &allocator)
 {
-	if (alloc)
+	if (alloc || tlsf_heap)
 		free_immediate();
 	else if (base)
 	{
@@ -268,6 +278,82 @@ void ClassAllocator::free(DeviceAllocation *alloc)
 	}
 }
 
+TLSFHeap::TLSFHeap(DeviceAllocator *global_allocator_, uint32_t memory_type_, uint32_t region_size)
+	: allocator(*this, region_size), global_allocator(global_allocator_), memory_type(memory_type_)
+{
+}
+
+bool TLSFHeap::allocate_region(uint32_t region, uint32_t size)
+{
+	if (region >= regions.size())
+		regions.resize(region + 1);
+
+	auto &r = regions[region];
+	r.memory = VK_NULL_HANDLE;
+	r.host_memory = nullptr;
+	return global_allocator->allocate(size, memory_type, &r.memory, &r.host_memory, VK_NULL_HANDLE);
+}
+
+void TLSFHeap::free_region(uint32_t region, uint32_t size)
+{
+	auto &r = regions[region];
+	global_allocator->free(size, memory_type, r.memory, r.host_memory);
+	r.memory = VK_NULL_HANDLE;
+	r.host_memory = nullptr;
+}
+
+bool TLSFHeap::allocate(uint32_t size, uint32_t alignment, AllocationTiling tiling, DeviceAllocation *alloc)
+{
+	ALLOCATOR_LOCK();
+	Util::TLSFAllocation tlsf_alloc;
+	if (!allocator.allocate(size, alignment, &tlsf_alloc))
+		return false;
+
+	auto &region = regions[tlsf_alloc.region];
+	alloc->base = region.memory;
+	alloc->host_base = region.host_memory ? region.host_memory + tlsf_alloc.offset : nullptr;
+	alloc->offset = tlsf_alloc.offset;
+	alloc->size = tlsf_alloc.size;
+	alloc->tiling = tiling;
+	alloc->memory_type = memory_type;
+	alloc->alloc = nullptr;
+	alloc->tlsf_heap = this;
+	alloc->tlsf_block = tlsf_alloc.block;
+	alloc->hierarchical = false;
+	return true;
+}
+
+void TLSFHeap::free(DeviceAllocation *alloc)
+{
+	ALLOCATOR_LOCK();
+	Util::TLSFAllocation tlsf_alloc;
+	tlsf_alloc.offset = alloc->offset;
+	tlsf_alloc.size = alloc->size;
+	tlsf_alloc.block = alloc->tlsf_block;
+	allocator.free(tlsf_alloc);
+}
+
+Util::TLSFStatistics TLSFHeap::get_statistics()
+{
+	ALLOCATOR_LOCK();
+	return allocator.get_statistics();
+}
+
+void Allocator::enable_tlsf_heaps(uint32_t region_size)
+{
+	tlsf_region_size = region_size;
+	for (auto &heap : tlsf_heaps)
+		heap.reset(new TLSFHeap(global_allocator, memory_type, region_size));
+}
+
+Util::TLSFStatistics Allocator::get_tlsf_statistics(AllocationTiling tiling)
+{
+	if (tlsf_heaps[tiling])
+		return tlsf_heaps[tiling]->get_statistics();
+	else
+		return {};
+}
+
 bool Allocator::allocate_global(uint32_t size, DeviceAllocation *alloc)
 {
 	// Fall back to global allocation, do not recycle.
@@ -303,6 +389,10 @@ DeviceAllocation DeviceAllocation::make_imported_allocation(VkDeviceMemory memor
 
 bool Allocator::allocate(uint32_t size, uint32_t alignment, AllocationTiling mode, DeviceAllocation *alloc)
 {
+	auto &medium = get_class_allocator(MEMORY_CLASS_MEDIUM);
+	if (tlsf_heaps[mode] && size > medium.sub_block_size * Block::NumSubBlocks && size <= tlsf_region_size)
+		return tlsf_heaps[mode]->allocate(size, alignment, mode, alloc);
+
 	for (auto &c : classes)
 	{
 		// Find a suitable class to allocate from.
@@ -372,6 +462,38 @@ void DeviceAllocator::init(Device *device_)
 	}
 }
 
+void DeviceAllocator::enable_tlsf_heaps(uint32_t region_size)
+{
+	for (auto &allocator : allocators)
+		allocator->enable_tlsf_heaps(region_size);
+}
+
+Util::TLSFStatistics DeviceAllocator::get_tlsf_statistics(uint32_t memory_type, AllocationTiling tiling)
+{
+	return allocators[memory_type]->get_tlsf_statistics(tiling);
+}
+
+void DeviceAllocator::log_tlsf_statistics()
+{
+	for (uint32_t type = 0; type < uint32_t(allocators.size()); type++)
+	{
+		for (unsigned tiling = 0; tiling < ALLOCATION_TILING_COUNT; tiling++)
+		{
+			auto stats = get_tlsf_statistics(type, static_cast<AllocationTiling>(tiling));
+			if (!stats.total_region_allocations)
+				continue;
+
+			LOGI("TLSF heap (type %u, %s): %.3f MiB in %u regions, %u allocations, waste %.3f, fragmentation %.3f, "
+			     "peak %.3f MiB, %llu region allocations.\n",
+			     type, tiling == ALLOCATION_TILING_OPTIMAL ? "optimal" : "linear",
+			     stats.region_bytes / (1024.0 * 1024.0), stats.num_regions, stats.num_allocations,
+			     stats.get_waste(), stats.get_fragmentation(),
+			     stats.peak_region_bytes / (1024.0 * 1024.0),
+			     static_cast<unsigned long long>(stats.total_region_allocations));
+		}
+	}
+}
+
 bool DeviceAllocator::allocate(uint32_t size, uint32_t alignment, uint32_t memory_type, AllocationTiling mode,
                                DeviceAllocation *alloc)
 {
@@ -29,6 +29,7 @@
 #include "vulkan_headers.hpp"
 #include "logging.hpp"
 #include "bitops.hpp"
+#include "tlsf_allocator.hpp"
 #include <assert.h>
 #include <memory>
 #include <stddef.h>
@@ -141,6 +142,7 @@ class ClassAllocator;
 class DeviceAllocator;
 class Allocator;
 class Device;
+class TLSFHeap;
 
 struct DeviceAllocation
 {
@@ -149,6 +151,7 @@ struct DeviceAllocation
 	friend class Block;
 	friend class DeviceAllocator;
 	friend class Device;
+	friend class TLSFHeap;
 
 public:
 	inline VkDeviceMemory get_memory() const
@@ -158,7 +161,7 @@ public:
 
 	inline bool allocation_is_global() const
 	{
-		return !alloc && base;
+		return !alloc && !tlsf_heap && base;
 	}
 
 	inline uint32_t get_offset() const
@@ -190,10 +193,12 @@ private:
 	VkDeviceMemory base = VK_NULL_HANDLE;
 	uint8_t *host_base = nullptr;
 	ClassAllocator *alloc = nullptr;
+	TLSFHeap *tlsf_heap = nullptr;
 	Util::IntrusiveList<MiniHeap>::Iterator heap = {};
 	uint32_t offset = 0;
 	uint32_t mask = 0;
 	uint32_t size = 0;
+	uint32_t tlsf_block = 0;
 
 	uint8_t tiling = 0;
 	uint8_t memory_type = 0;
@@ -275,6 +280,36 @@ private:
 	}
 };
 
+// Serves allocations of varied sizes from large regions with a TLSF allocator.
+// Unlike the class hierarchy, there is no rounding to power-of-two sub-blocks, so streaming resources of mixed sizes
+// waste far less memory and need fewer vkAllocateMemory calls.
+class TLSFHeap : private Util::TLSFBackend
+{
+public:
+	TLSFHeap(DeviceAllocator *global_allocator, uint32_t memory_type, uint32_t region_size);
+
+	bool allocate(uint32_t size, uint32_t alignment, AllocationTiling tiling, DeviceAllocation *alloc);
+	void free(DeviceAllocation *alloc);
+	Util::TLSFStatistics get_statistics();
+
+private:
+	struct Region
+	{
+		VkDeviceMemory memory;
+		uint8_t *host_memory;
+	};
+	std::vector<Region> regions;
+	Util::TLSFAllocator allocator;
+	DeviceAllocator *global_allocator;
+	uint32_t memory_type;
+#ifdef GRANITE_VULKAN_MT
+	std::mutex lock;
+#endif
+
+	bool allocate_region(uint32_t region, uint32_t size) override;
+	void free_region(uint32_t region, uint32_t size) override;
+};
+
 class Allocator
 {
 public:
@@ -309,8 +344,16 @@ public:
 		global_allocator = allocator;
 	}
 
+	// Allocations which are too large for the MEDIUM class, but no larger than region_size
+	// are served from TLSF heaps instead of the LARGE and HUGE classes.
+	void enable_tlsf_heaps(uint32_t region_size);
+	Util::TLSFStatistics get_tlsf_statistics(AllocationTiling tiling);
+
 private:
 	ClassAllocator classes[MEMORY_CLASS_COUNT];
+	// One heap per tiling mode, so we never have to care about bufferImageGranularity.
+	std::unique_ptr<TLSFHeap> tlsf_heaps[ALLOCATION_TILING_COUNT];
+	uint32_t tlsf_region_size = 0;
 	DeviceAllocator *global_allocator = nullptr;
 	uint32_t memory_type = 0;
 };
@@ -324,6 +367,11 @@ public:
 		use_dedicated = enable;
 	}
 
+	// Must be called before any allocations are made.
+	void enable_tlsf_heaps(uint32_t region_size);
+	Util::TLSFStatistics get_tlsf_statistics(uint32_t memory_type, AllocationTiling tiling);
+	void log_tlsf_statistics();
+
 	~DeviceAllocator();
 
 	bool allocate(uint32_t size, uint32_t alignment, uint32_t memory_type, AllocationTiling tiling,
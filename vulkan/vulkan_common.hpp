@@ -38,11 +38,11 @@ using HandleCounter = Util::SingleThreadCounter;
 template <typename T>
 using VulkanObjectPool = Util::ThreadSafeObjectPool<T>;
 template <typename T>
-using VulkanCache = Util::ThreadSafeIntrusiveHashMap<T>;
+using VulkanCache = Util::ConcurrentIntrusiveHashMap<T>;
 #else
 template <typename T>
 using VulkanObjectPool = Util::ObjectPool<T>;
 template <typename T>
-using VulkanCache = Util::IntrusiveHashMap<T>;
+using VulkanCache = Util::IntrusiveHashMap<T, Util::IntrusiveHashMapGroupedHolder<T>>;
 #endif
 }
\ No newline at end of file